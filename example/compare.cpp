@@ -0,0 +1,83 @@
+#include <intel_pmu_comparison.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Purpose: CI perf gate comparing two traces recorded by 'trace.tsk record' or 'TraceWriter', e.g. of the same
+// benchmark built from main and from a branch. Per counter it prints both medians, the candidate's relative change
+// with its bootstrap confidence interval, the Mann-Whitney U test, and a verdict of improved, REGRESSED or noise.
+// Exits 0 if no counter regressed, 1 if one did, and 2 on bad usage or unreadable traces so a script can tell a
+// regression from a broken run.
+//
+// Usage: compare.tsk [--threshold <percent>] [--alpha <p>] [--confidence <percent>] [--resamples <n>]
+//                    [--counters <mnemonic,...>] <baseline trace> <candidate trace>
+
+namespace {
+
+void usage(const char *program) {
+  fprintf(stderr, "usage: %s [--threshold <percent>] [--alpha <p>] [--confidence <percent>] [--resamples <n>]\n",
+    program);
+  fprintf(stderr, "       %*s [--counters <mnemonic,...>] <baseline trace> <candidate trace>\n",
+    (int)strlen(program), "");
+}
+
+std::vector<std::string> split(const char *list) {
+  std::vector<std::string> result;
+  for (const char *comma; (comma = strchr(list, ','))!=0; list = comma+1) {
+    result.push_back(std::string(list, comma));
+  }
+  result.push_back(list);
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Intel::Comparison::Options options;
+  std::vector<const char*> path;
+
+  for (int i=1; i<argc; ++i) {
+    const bool value = i+1<argc;
+    if (value && strcmp(argv[i], "--threshold")==0) {
+      options.d_threshold = atof(argv[++i])/100;
+    } else if (value && strcmp(argv[i], "--alpha")==0) {
+      options.d_alpha = atof(argv[++i]);
+    } else if (value && strcmp(argv[i], "--confidence")==0) {
+      options.d_confidence = atof(argv[++i])/100;
+    } else if (value && strcmp(argv[i], "--resamples")==0) {
+      options.d_resamples = (u_int32_t)strtoul(argv[++i], 0, 10);
+    } else if (value && strcmp(argv[i], "--counters")==0) {
+      options.d_counters = split(argv[++i]);
+    } else if (strncmp(argv[i], "--", 2)==0) {
+      usage(argv[0]);
+      return 2;
+    } else {
+      path.push_back(argv[i]);
+    }
+  }
+
+  if (path.size()!=2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  Intel::TraceReader baseline, candidate;
+  if (baseline.open(path[0])!=0 || candidate.open(path[1])!=0) {
+    return 2;
+  }
+
+  Intel::Comparison comparison(options);
+  if (comparison.compare(baseline, candidate)!=0) {
+    return 2;
+  }
+
+  printf("baseline: %s, candidate: %s\n", path[0], path[1]);
+  std::cout << comparison;
+
+  return comparison.regressions() ? 1 : 0;
+}
@@ -1,10 +1,30 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <assert.h>
 
+#include <intel_xeon_event_catalog.h>
+#include <intel_xeon_pmu.h>
+
+#include <iostream>
+
 // Purpose: make & pretty print Intel PMU programmable counter configuration.
 // Use with 'doc/pmu.md' which has background and references to this structure
 // and lift event/umask/cmask from https://perfmon-events.intel.com/
+//
+// Event catalog usage (see 'src/intel_xeon_event_catalog.h'):
+//   config.tsk compile <catalog> <perfmon.json>...   compile perfmon JSON files into a catalog
+//   config.tsk dump    <catalog> [csv]               pretty print every catalog event
+//   config.tsk search  <catalog> <text> [csv]        pretty print events whose name or description contains text
+//   config.tsk lookup  <catalog> <name> [csv]        pretty print one event by exact perfmon name
+//
+// PMU capability usage (see 'src/intel_xeon_capability.h'):
+//   config.tsk caps                                  print host PMU capabilities from CPUID and which default
+//                                                    configs 'PMU' accepts on it
+//   config.tsk caps <eax> <ebx> <edx> <threads>      same for a host whose CPUID leaf 0xA returns hex 'eax', 'ebx',
+//                                                    'edx' with 'threads' logical processors per core e.g.
+//                                                    'caps 0x08300804 0 0x0603 2' is Skylake with HT ON
 
 int csvFormat = 0;
 int csvHeader = 0;
@@ -63,9 +83,112 @@ void prettyPrint(const char *name, const char *description, const Config& cfg) {
   }
 }
 
-int main(int argc, char **argv __attribute__((unused))) {
+void prettyPrint(const Intel::XEON::EventCatalog& catalog, const Intel::XEON::EventCatalog::Entry& entry) {
+  Config cfg;
+  cfg.value = (u_int32_t)entry.d_eventSelect;
+  prettyPrint(catalog.name(entry), catalog.description(entry), cfg);
+}
+
+int catalogMain(int argc, char **argv) {
+  using namespace Intel::XEON;
+
+  if (strcmp(argv[1], "compile")==0) {
+    std::vector<std::string> json(argv+3, argv+argc);
+    if (argc<4) {
+      fprintf(stderr, "usage: %s compile <catalog> <perfmon.json>...\n", argv[0]);
+      return 1;
+    }
+    return EventCatalog::compile(json, argv[2])==0 ? 0 : 1;
+  }
+
+  const bool dump = strcmp(argv[1], "dump")==0;
+  if ((dump && argc<3) || (!dump && argc<4)) {
+    fprintf(stderr, "usage: %s dump|search|lookup <catalog> [text|name] [csv]\n", argv[0]);
+    return 1;
+  }
+  csvFormat = argc>(dump ? 3 : 4);
+
+  EventCatalog catalog;
+  if (catalog.open(argv[2])!=0) {
+    return 1;
+  }
+
+  if (strcmp(argv[1], "lookup")==0) {
+    const EventCatalog::Entry *entry = catalog.find(argv[3]);
+    if (entry==0) {
+      fprintf(stderr, "Error: event '%s' not in catalog\n", argv[3]);
+      return 1;
+    }
+    prettyPrint(catalog, *entry);
+    return 0;
+  }
+
+  for (u_int32_t i=0; i<catalog.size(); ++i) {
+    const EventCatalog::Entry& entry = catalog.entry(i);
+    if (dump || strcasestr(catalog.name(entry), argv[3]) || strcasestr(catalog.description(entry), argv[3])) {
+      prettyPrint(catalog, entry);
+    }
+  }
+
+  return 0;
+}
+
+// Injected CPUID leaf 0xA and 0xB values for 'caps'
+u_int32_t fakeEax, fakeEbx, fakeEdx, fakeThreads;
+
+void fakeCpuid(u_int32_t leaf, u_int32_t, u_int32_t *eax, u_int32_t *ebx, u_int32_t *ecx, u_int32_t *edx) {
+  *eax = *ebx = *ecx = *edx = 0;
+  if (leaf==0xa) {
+    *eax = fakeEax;
+    *ebx = fakeEbx;
+    *edx = fakeEdx;
+  } else if (leaf==0xb) {
+    *ebx = fakeThreads;
+    *ecx = 1<<8;            // SMT level
+  }
+}
+
+int capsMain(int argc, char **argv) {
+  using namespace Intel::XEON;
+
+  Capability::CpuidFunction cpuid = &Capability::hostCpuid;
+  if (argc==6) {
+    fakeEax = (u_int32_t)strtoul(argv[2], 0, 16);
+    fakeEbx = (u_int32_t)strtoul(argv[3], 0, 16);
+    fakeEdx = (u_int32_t)strtoul(argv[4], 0, 16);
+    fakeThreads = (u_int32_t)strtoul(argv[5], 0, 10);
+    cpuid = &fakeCpuid;
+  } else if (argc!=2) {
+    fprintf(stderr, "usage: %s caps [<eax> <ebx> <edx> <threads>]\n", argv[0]);
+    return 1;
+  }
+
+  const Capability capability(cpuid);
+  std::cout << capability;
+
+  const u_int64_t eventSelect[] = {
+    Events::LLC_REFERENCE::k_VALUE, Events::LLC_MISS::k_VALUE, Events::BRANCHES::k_VALUE,
+    Events::BRANCHES_NOT_TAKEN::k_VALUE, Events::DTLB_LOAD_WALK::k_VALUE, Events::DTLB_STORE_WALK::k_VALUE,
+    Events::LOADS::k_VALUE, Events::STORES::k_VALUE,
+  };
+  printf("k_DEFAULT_XEON_CONFIG_0      : %s\n", PMU::check(capability, 4, eventSelect)==0 ? "accepted" : "rejected");
+  printf("k_DEFAULT_XEON_CONFIG_1      : %s\n", PMU::check(capability, 8, eventSelect)==0 ? "accepted" : "rejected");
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
   assert(sizeof(struct CounterConfig)==sizeof(u_int32_t));
 
+  if (argc>1 && (strcmp(argv[1], "compile")==0 || strcmp(argv[1], "dump")==0 || strcmp(argv[1], "search")==0 ||
+                 strcmp(argv[1], "lookup")==0)) {
+    return catalogMain(argc, argv);
+  }
+
+  if (argc>1 && strcmp(argv[1], "caps")==0) {
+    return capsMain(argc, argv);
+  }
+
   // Super cheap 'usage line'
   if (argc>1) {
     csvFormat = 1;
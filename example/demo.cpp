@@ -0,0 +1,105 @@
+#include <intel_xeon_pmu.h>
+#include <intel_pmu_stats.h>
+#include <intel_xeon_static_pmu.h>
+#include <intel_pmu_multiplexer.h>
+
+#include <stdlib.h>
+
+// Purpose: show PMU APIs the benchmark framework in 'example.cpp' doesn't use: events chosen at compile time with
+// 'StaticPMU', and more events than counters in one run with 'Multiplexer'.
+//
+// Usage: demo.tsk
+
+using namespace Intel::XEON;
+
+const int MAX_INTEGERS = 100000000;
+
+PMU *pmu = 0;
+
+void testStaticStats(int *ptr) {
+  // Events chosen at compile time; loops in 'record' fully unrolled for 4 counters
+  StaticPMU<Events::DTLB_LOAD_WALK, Events::DTLB_STORE_WALK, Events::LOADS, Events::STORES> spmu;
+  Intel::Stats stats(spmu.pmu());
+
+  spmu.reset();
+  spmu.start();
+  stats.reset();
+
+  // Run test three times
+  for (unsigned runs=0; runs<3; ++runs) {
+
+    // Memory heavily accessed randomly
+    for (volatile int i=0; i<MAX_INTEGERS; ++i) {
+      long idx = random() % MAX_INTEGERS;
+      *(ptr+idx) = 0xdeadbeef;
+    }
+
+    spmu.record(&stats);
+  }
+
+  std::cout << stats << std::endl;
+}
+
+void testMultiplex(int *ptr) {
+  // 13 events through 4 programmable counters in one run: rotate groups every ~1ms at 3GHz
+  std::vector<u_int64_t> eventSelect = {
+    Events::LLC_REFERENCE::k_VALUE, Events::LLC_MISS::k_VALUE, Events::BRANCHES::k_VALUE,
+    Events::BRANCHES_NOT_TAKEN::k_VALUE, Events::CYCLES_L1D_MISS::k_VALUE, Events::CYCLES_L2_MISS::k_VALUE,
+    Events::CYCLES_L3_MISS::k_VALUE, Events::CYCLES_MEM_ANY::k_VALUE, Events::DTLB_LOAD_WALK::k_VALUE,
+    Events::DTLB_STORE_WALK::k_VALUE, Events::LOADS::k_VALUE, Events::STORES::k_VALUE,
+    Events::MEMORY_INSTRUCTIONS::k_VALUE,
+  };
+  std::vector<std::string> description = {
+    Events::LLC_REFERENCE::k_DESCRIPTION, Events::LLC_MISS::k_DESCRIPTION, Events::BRANCHES::k_DESCRIPTION,
+    Events::BRANCHES_NOT_TAKEN::k_DESCRIPTION, Events::CYCLES_L1D_MISS::k_DESCRIPTION,
+    Events::CYCLES_L2_MISS::k_DESCRIPTION, Events::CYCLES_L3_MISS::k_DESCRIPTION,
+    Events::CYCLES_MEM_ANY::k_DESCRIPTION, Events::DTLB_LOAD_WALK::k_DESCRIPTION,
+    Events::DTLB_STORE_WALK::k_DESCRIPTION, Events::LOADS::k_DESCRIPTION, Events::STORES::k_DESCRIPTION,
+    Events::MEMORY_INSTRUCTIONS::k_DESCRIPTION,
+  };
+
+  Intel::Multiplexer mux(*pmu, eventSelect, description, 3000000);
+  if (mux.start()!=0) {
+    return;
+  }
+
+  // Same run through the usual reporting path: per iteration estimates instead of rotating programmable counters
+  Intel::Stats stats(*pmu);
+  stats.setMultiplexer(&mux);
+  stats.reset();
+
+  // Memory heavily accessed randomly
+  for (volatile int i=0; i<MAX_INTEGERS; ++i) {
+    long idx = random() % MAX_INTEGERS;
+    *(ptr+idx) = 0xdeadbeef;
+    stats.record();
+    mux.poll();
+  }
+
+  mux.stop();
+  std::cout << mux << std::endl;
+  std::cout << stats << std::endl;
+}
+
+int main() {
+  pmu = new PMU(PMU::k_DEFAULT_XEON_CONFIG_0);
+
+  int *ptr = (int*)malloc(sizeof(int)*MAX_INTEGERS);
+  if (ptr==0) {
+      fprintf(stderr, "Error: memory allocation failed\n");
+      return 1;
+  }
+
+  // Events chosen at compile time
+  testStaticStats(ptr);
+
+  // More events than counters in one run
+  testMultiplex(ptr);
+
+  free(ptr);
+  ptr=0;
+  delete pmu;
+  pmu = 0;
+
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include <intel_xeon_pmu.h>
+#include <intel_xeon_rapl.h>
+#include <intel_pmu_stats.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Purpose: joules and watts per iteration and per operation of two ways to sum an array, next to cycles and
+// instructions, so a faster kernel that draws more power is visible.
+//
+// Without '--real' counters come from software perf events and RAPL from a file-backed fake MSR device under /tmp
+// whose energy counters start just below 2^32 and are advanced after each iteration as if the package drew 20W, so
+// the wraparound path runs anywhere and only the plumbing is meaningful. With '--real' the MSR PMU and the calling
+// cpu's '/dev/cpu/<n>/msr' RAPL counters are used (requires 'setcap', see README).
+//
+// Usage: energy.tsk [--real] [iterations]
+
+namespace {
+
+const u_int32_t k_ELEMENTS = 1u<<20;            // array elements summed per iteration i.e. operations
+
+std::vector<u_int32_t> data(k_ELEMENTS, 1);
+
+void scalar() {
+  u_int64_t sum = 0;
+  for (u_int32_t i=0; i<k_ELEMENTS; ++i) {
+    sum += data[i];
+    Intel::DoNotOptimize(sum);
+  }
+}
+
+void unrolled() {
+  u_int64_t sum[4] = {0, 0, 0, 0};
+  for (u_int32_t i=0; i<k_ELEMENTS; i+=4) {
+    sum[0] += data[i]; sum[1] += data[i+1]; sum[2] += data[i+2]; sum[3] += data[i+3];
+  }
+  u_int64_t total = sum[0]+sum[1]+sum[2]+sum[3];
+  Intel::DoNotOptimize(total);
+}
+
+int poke(const std::string& msr, u_int32_t reg, u_int64_t value, bool add) {
+  // Write, or add to, the 64-bit fake register 'reg' of 'msr' as if hardware counted
+  int fid = ::open(msr.c_str(), O_RDWR);
+  u_int64_t old = 0;
+  if (fid<0 || pread(fid, &old, sizeof(old), reg)!=sizeof(old)) {
+    fprintf(stderr, "Error: cannot read '%s': %s\n", msr.c_str(), strerror(errno));
+    if (fid>=0) {
+      close(fid);
+    }
+    return 1;
+  }
+  // The hardware counter is 32 bits: keep the fake one that wide too
+  value = add ? (old + value) & Intel::XEON::Rapl::ENERGY_STATUS_MASK : value;
+  const int rc = pwrite(fid, &value, sizeof(value), reg)==sizeof(value) ? 0 : 1;
+  close(fid);
+  return rc;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool real = false;
+  u_int32_t iterations = 200;
+
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "--real")==0) {
+      real = true;
+    } else {
+      iterations = (u_int32_t)atoi(argv[i]);
+    }
+  }
+
+  if (iterations==0) {
+    fprintf(stderr, "usage: %s [--real] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  Intel::XEON::Rapl::Options options;
+  char root[64] = "";
+  std::string msr;
+  if (!real) {
+    strcpy(root, "/tmp/pmc-fake-rapl.XXXXXX");
+    if (mkdtemp(root)==0) {
+      fprintf(stderr, "Error: cannot make fake MSR directory: %s\n", strerror(errno));
+      return 1;
+    }
+    options.d_msrRoot = root;
+    options.d_cpu = 0;
+    options.d_dramJoules = 1.0/65536;
+    mkdir((std::string(root) + "/0").c_str(), 0700);
+    msr = std::string(root) + "/0/msr";
+    int fid = ::open(msr.c_str(), O_RDWR|O_CREAT, 0600);
+    if (fid<0 || ftruncate(fid, 4096)!=0) {
+      fprintf(stderr, "Error: cannot make '%s': %s\n", msr.c_str(), strerror(errno));
+      return 1;
+    }
+    close(fid);
+    // Energy status unit 14: 61 uJ per count, the usual Xeon value
+    if (poke(msr, Intel::XEON::Rapl::MSR_RAPL_POWER_UNIT, 0xa0e03, false)!=0 ||
+        poke(msr, Intel::XEON::Rapl::MSR_PKG_ENERGY_STATUS, 0xffffff00, false)!=0 ||
+        poke(msr, Intel::XEON::Rapl::MSR_PP0_ENERGY_STATUS, 0xffffff80, false)!=0 ||
+        poke(msr, Intel::XEON::Rapl::MSR_DRAM_ENERGY_STATUS, 0xfffffff0, false)!=0) {
+      return 1;
+    }
+  }
+
+  int rc = 0;
+  {
+    Intel::XEON::Rapl rapl(options);
+    Intel::XEON::PMU *pmu = real
+      ? new Intel::XEON::PMU(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0)
+      : new Intel::XEON::PMU(std::vector<Intel::XEON::PerfEvent>{
+          Intel::XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock nanoseconds")}, false);
+
+    if (rapl.status()!=0 || pmu->status()!=0 || pmu->reset()!=0 || pmu->start()!=0) {
+      fprintf(stderr, "Error: cannot start PMU or RAPL counters\n");
+      rc = 1;
+    } else {
+      std::cout << rapl << std::endl;
+      pmu->setRapl(&rapl);
+
+      struct Kernel {
+        const char *d_name;
+        void      (*d_function)();
+      } const kernels[] = {
+        {"scalar", &scalar},
+        {"unrolled", &unrolled},
+      };
+
+      for (const Kernel& k: kernels) {
+        Intel::Stats stats(*pmu);
+        stats.setOperations(k_ELEMENTS);
+        stats.reset();
+        for (u_int32_t i=0; i<iterations && rc==0; ++i) {
+          Intel::XEON::Snapshot begin, end;
+          pmu->snapshotBegin(&begin);
+          k.d_function();
+          pmu->snapshot(&end);
+          if (!real) {
+            // 20W package, 12W cores, 3W DRAM for the iteration's task clock nanoseconds
+            const double ns = (double)(end.d_prog[0]-begin.d_prog[0]);
+            rc |= poke(msr, Intel::XEON::Rapl::MSR_PKG_ENERGY_STATUS,
+                       (u_int64_t)(20*ns*1e-9/rapl.joulesPerCount(Intel::XEON::Rapl::k_PACKAGE)), true);
+            rc |= poke(msr, Intel::XEON::Rapl::MSR_PP0_ENERGY_STATUS,
+                       (u_int64_t)(12*ns*1e-9/rapl.joulesPerCount(Intel::XEON::Rapl::k_PP0)), true);
+            rc |= poke(msr, Intel::XEON::Rapl::MSR_DRAM_ENERGY_STATUS,
+                       (u_int64_t)(3*ns*1e-9/rapl.joulesPerCount(Intel::XEON::Rapl::k_DRAM)), true);
+            // Re-read so the fake energy counted in this iteration lands in its delta
+            pmu->snapshot(&end);
+          }
+          stats.record(begin, end);
+        }
+        printf("%s: %u elements per iteration\n", k.d_name, k_ELEMENTS);
+        std::cout << stats << std::endl;
+      }
+
+      pmu->setRapl(0);
+    }
+    delete pmu;
+  }
+
+  if (!real) {
+    unlink(msr.c_str());
+    rmdir((std::string(root) + "/0").c_str());
+    rmdir(root);
+  }
+
+  return rc;
+}
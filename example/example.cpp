@@ -1,131 +1,104 @@
-#include <intel_xeon_pmu.h>
-#include <intel_pmu_stats.h>
+#include <intel_pmu_benchmark.h>
 
-#include <algorithm>
+#include <stdlib.h>
 
-#include <time.h>
-#include <unistd.h>
+#include <vector>
 
-using namespace Intel::XEON;
-
-const int MAX_INTEGERS = 100000000;
-
-PMU *pmu = 0;
+// Purpose: measure simple loops with and without memory access on the benchmark framework. Each benchmark body does
+// its setup then loops 'while (state.next())' over the measured code; loop lengths and array sizes are swept.
+//
+// Usage: example.tsk [--filter=<regex>] [--format=console|json|csv] [--out=<file>] [--list]
 
-void test0() {
-  pmu->reset();
-  pmu->start();
-
-  // No memory accessed. volatile helpe sure compiler does
-  // not optimize out the loop into a no-op
-  volatile int i=0;
-  do {
-    ++i;
-  } while (__builtin_expect((i<MAX_INTEGERS),1));
+using namespace Intel::XEON;
 
-  std::cout << "test loop no memory accesses" << std::endl;
-  std::cout << *pmu << std::endl;
+void noMemoryDoWhile(Intel::BenchmarkState& state) {
+  const int count = (int)state.param();
+  while (state.next()) {
+    // No memory accessed. volatile helpe sure compiler does
+    // not optimize out the loop into a no-op
+    volatile int i=0;
+    do {
+      ++i;
+    } while (__builtin_expect((i<count),1));
+  }
 }
-
-void test1() {
-  pmu->reset();
-  pmu->start();
-
-  // No memory accessed. volatile helpe sure compiler does
-  // not optimize out the loop into a no-op
-  for (volatile int i=0; i<MAX_INTEGERS; i++);
-
-  std::cout << "test loop no memory accesses" << std::endl;
-  std::cout << *pmu << std::endl;
+PMCBENCH(noMemoryDoWhile)->range(1<<16, 1<<24, 16)->repetitions(10);
+
+void noMemoryFor(Intel::BenchmarkState& state) {
+  const int count = (int)state.param();
+  while (state.next()) {
+    // No memory accessed. volatile helpe sure compiler does
+    // not optimize out the loop into a no-op
+    for (volatile int i=0; i<count; i++);
+  }
 }
-
-void test2(int *ptr) {
-  pmu->reset();
-  pmu->start();
-
-  // Memory heavily accessed, however, not randomly
-  for (volatile int i=0; i<MAX_INTEGERS; ++i) {
-    *(ptr+i) = 0xdeadbeef;
+PMCBENCH(noMemoryFor)->range(1<<16, 1<<24, 16)->repetitions(10);
+
+void sequentialWrite(Intel::BenchmarkState& state) {
+  std::vector<int> v(state.param());
+  while (state.next()) {
+    // Memory heavily accessed, however, not randomly
+    for (volatile int i=0; i<(int)v.size(); ++i) {
+      v[i] = 0xdeadbeef;
+    }
   }
-
-  std::cout << "test loop accessing memory non-randomly" << std::endl;
-  std::cout << *pmu << std::endl;
 }
+PMCBENCH(sequentialWrite)->range(1<<16, 1<<24, 16)->warmup(1)->repetitions(10);
 
-void test3(int *ptr) {
-  pmu->reset();
-  pmu->start();
-
-  // Memory heavily accessed randomly
-  for (volatile int i=0; i<MAX_INTEGERS; ++i) {
-    long idx = random() % MAX_INTEGERS;
-    *(ptr+idx) = 0xdeadbeef;
+void randomWrite(Intel::BenchmarkState& state) {
+  std::vector<int> v(state.param());
+  while (state.next()) {
+    // Memory heavily accessed randomly
+    for (volatile int i=0; i<(int)v.size(); ++i) {
+      long idx = random() % v.size();
+      v[idx] = 0xdeadbeef;
+    }
   }
-
-  std::cout << "test loop accessing memory randomly" << std::endl;
-  std::cout << *pmu << std::endl;
 }
-
-void test4() {
-  pmu->reset();
-  pmu->start();
-
-  // No memory accessed
-  unsigned s=0;
-  for (volatile int i=0; i<MAX_INTEGERS; ++i) {
-    s+=1;
+PMCBENCH(randomWrite)->range(1<<16, 1<<24, 16)->warmup(1)->repetitions(10);
+
+void noMemoryAdd(Intel::BenchmarkState& state) {
+  const int count = (int)state.param();
+  while (state.next()) {
+    // No memory accessed
+    unsigned s=0;
+    for (volatile int i=0; i<count; ++i) {
+      s+=1;
+    }
   }
-
-  std::cout << "test loop accessing no memory" << std::endl;
-  std::cout << *pmu << std::endl;
 }
-
-void testStats(int *ptr) {
-  Intel::Stats stats(*pmu);
-
-  pmu->reset();
-  pmu->start();
-  stats.reset();
-
-  // Run test three times
-  for (unsigned runs=0; runs<3; ++runs) {
-
-    // Memory heavily accessed randomly
-    for (volatile int i=0; i<MAX_INTEGERS; ++i) {
-      long idx = random() % MAX_INTEGERS;
-      *(ptr+idx) = 0xdeadbeef;
+PMCBENCH(noMemoryAdd)->range(1<<16, 1<<24, 16)->repetitions(10);
+
+void randomWriteTlb(Intel::BenchmarkState& state) {
+  // Same as 'randomWrite' counting TLB walks, loads, and stores
+  std::vector<int> v(state.param());
+  while (state.next()) {
+    for (volatile int i=0; i<(int)v.size(); ++i) {
+      long idx = random() % v.size();
+      v[idx] = 0xdeadbeef;
     }
-
-    stats.record();
   }
-
-  // Dump PMU data one set per run
-  std::cout << stats << std::endl;
 }
-
-int main() {
-  pmu = new PMU(PMU::k_DEFAULT_XEON_CONFIG_0);
-
-  int *ptr = (int*)malloc(sizeof(int)*MAX_INTEGERS);
-  if (ptr==0) {
-      fprintf(stderr, "Error: memory allocation failed\n");
-      return 1;
+PMCBENCH(randomWriteTlb)
+  ->range(1<<16, 1<<24, 16)
+  ->events({Events::DTLB_LOAD_WALK::k_VALUE, Events::DTLB_STORE_WALK::k_VALUE, Events::LOADS::k_VALUE,
+            Events::STORES::k_VALUE},
+           {Events::DTLB_LOAD_WALK::k_DESCRIPTION, Events::DTLB_STORE_WALK::k_DESCRIPTION,
+            Events::LOADS::k_DESCRIPTION, Events::STORES::k_DESCRIPTION})
+  ->repetitions(3);
+
+void randomWriteTail(Intel::BenchmarkState& state) {
+  // Many short iterations run until the 95% CI of F1 cycles is within 1% of the mean. Percentiles show the few
+  // iterations that missed LLC, the average hides them. Iterations are short enough that the cost of reading the
+  // counters is calibrated and subtracted.
+  std::vector<int> v(state.param());
+  while (state.next()) {
+    for (volatile int i=0; i<64; ++i) {
+      long idx = random() % v.size();
+      v[idx] = 0xdeadbeef;
+    }
   }
-
-  // Different tests snap shotting counters
-  test0();
-  test1();
-  test2(ptr);
-  test3(ptr);
-  test4();
-
-  // Test simple stats:
-  testStats(ptr);
-
-  free(ptr);
-  ptr=0;
-  delete pmu;
-  pmu = 0;
-
-  return 0;
 }
+PMCBENCH(randomWriteTail)->arg(1<<24)->precision(Intel::Runner::k_F1, 0.01)->histogram()->calibrate();
+
+PMCBENCH_MAIN();
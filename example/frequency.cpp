@@ -1,57 +1,54 @@
-#include <intel_skylake_pmu.h>
+#include <intel_tsc_clock.h>
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
-#include <assert.h>
-
-using namespace Intel::SkyLake;
-PMU pmu(false, PMU::ProgCounterSetConfig::k_DEFAULT_SKYLAKE_CONFIG_0);
-
-const u_int64_t secToNs   = 1000000000UL;
-const u_int64_t target    = 1000000000UL;
-const u_int64_t delta     = 75000UL;
-const u_int64_t epsilonNs = 100UL;
-const double    hzToGhz   = 1000000000.0;
-
-int main() {
-  struct timespec startTs, endTs;
-  u_int64_t       startRdtsc, endRdtsc;
-  u_int64_t       iterations = 1000000000;
-  u_int64_t       elapsedNs;
-  u_int64_t       elapsedRdtsc;
-
-  while (1) {
-	  clock_gettime(CLOCK_MONOTONIC, &startTs);
-    startRdtsc = pmu.timeStampCounter();
-    for (volatile u_int64_t i=0; i<iterations; ++i);
-    endRdtsc = pmu.timeStampCounter();
-	  clock_gettime(CLOCK_MONOTONIC, &endTs);
-
-    assert(endTs.tv_sec>=startTs.tv_sec);
-    if (endTs.tv_sec<startTs.tv_sec) {
-      fprintf(stderr, "discarding run (rare)\n");
-      continue;
-    }
-
-    elapsedNs = endTs.tv_sec*secToNs+endTs.tv_nsec - (startTs.tv_sec*secToNs+startTs.tv_nsec);
-    elapsedRdtsc = endRdtsc - startRdtsc;
-    double freqGhz = (double)elapsedRdtsc / hzToGhz;
-    double nsPerRdtscCycle = 1.0 / (double)elapsedRdtsc * (double)secToNs;
-
-    fprintf(stderr, "iterations %lu, elapsedTimeNs %lu, elapsedRdtsc %lu, freqGhz %lf -> 1-rdtsc-cycle = %lf ns\n",
-      iterations, elapsedNs, elapsedRdtsc, freqGhz, nsPerRdtscCycle);
-
-    if (elapsedNs>target) {
-      if ((elapsedNs-target)<=epsilonNs) {
-        break;
-      }
-      iterations -= delta;
-    } else {
-      if ((target-elapsedNs)<=epsilonNs) {
-        break;
-      }
-      iterations += delta;
-    }
+#include <x86intrin.h>
+
+#include <iostream>
+
+// Purpose: report the TSC frequency and how it was found, then cross check it. The library's 'TscClock' takes the
+// frequency from CPUID leaf 0x15/0x16 when reported; here it's also calibrated against CLOCK_MONOTONIC_RAW over a few
+// window lengths so the two can be compared, and a busy loop is timed both by rdtsc converted to ns and by the clock.
+//
+// Usage: frequency.tsk [windowUs]
+
+int main(int argc, char **argv) {
+  const u_int32_t windowUs = argc>1 ? (u_int32_t)strtoul(argv[1], 0, 0) : 2000;
+  if (windowUs==0) {
+    fprintf(stderr, "Error: windowUs must be positive\n");
+    return 1;
+  }
+
+  const Intel::TscClock& clock = Intel::TscClock::instance();
+  std::cout << clock;
+  if (!clock.invariant()) {
+    fprintf(stderr, "Warning: TSC is not invariant; rdtsc cycles don't convert to time across P/C-state changes\n");
   }
 
+  for (u_int32_t us = windowUs/4 ? windowUs/4 : 1; us<=windowUs*4; us *= 2) {
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    const u_int64_t hz = Intel::TscClock::calibrate(us);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+    const double elapsedMs = (double)(end.tv_sec-begin.tv_sec)*1e3 + (double)(end.tv_nsec-begin.tv_nsec)/1e6;
+    printf("calibrated over 5x%uus: %lu Hz, %+.1lf ppm from above, took %.2lf ms\n",
+      us, hz, ((double)hz-(double)clock.hz())*1e6/(double)clock.hz(), elapsedMs);
+  }
+
+  // Time one busy loop both ways
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+  const u_int64_t tsc0 = __rdtsc();
+  for (volatile u_int64_t i=0; i<100000000; ++i);
+  const u_int64_t tsc1 = __rdtsc();
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+  const u_int64_t clockNs = (u_int64_t)(end.tv_sec-begin.tv_sec)*1000000000ull + (u_int64_t)end.tv_nsec
+                          - (u_int64_t)begin.tv_nsec;
+  printf("busy loop: %lu rdtsc cycles = %lu ns by TscClock, %lu ns by CLOCK_MONOTONIC_RAW\n",
+    tsc1-tsc0, clock.toNanoseconds(tsc1-tsc0), clockNs);
+
   return 0;
 }
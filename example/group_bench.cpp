@@ -0,0 +1,144 @@
+#include <intel_xeon_pmu_group.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <thread>
+
+// Purpose: measure how PMUGroup setup ('reset()' then 'start()') scales with the number of cores and worker threads.
+//
+// Without '--real' a tree of file-backed fake MSR devices '<tmp>/<cpu>/msr' is made for 'cores' cpus under /tmp so
+// the program runs anywhere; only costs and plumbing are meaningful then. With '--real' the Linux MSR devices of every
+// cpu in the caller's affinity mask are used and per core counter values are printed after a short busy loop
+// (requires 'setcap', see README).
+//
+// Usage: group_bench.tsk [--real] [cores]
+
+using namespace Intel::XEON;
+
+u_int64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u_int64_t)ts.tv_sec*1000000000ull + (u_int64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  bool real = false;
+  int cores = 64;
+
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "--real")==0) {
+      real = true;
+    } else {
+      cores = atoi(argv[i]);
+    }
+  }
+
+  if (cores<=0) {
+    fprintf(stderr, "usage: %s [--real] [cores]\n", argv[0]);
+    return 1;
+  }
+
+  const u_int64_t eventSelect[] = {
+    Events::LLC_REFERENCE::k_VALUE,
+    Events::LLC_MISS::k_VALUE,
+    Events::BRANCHES::k_VALUE,
+    Events::BRANCHES_NOT_TAKEN::k_VALUE,
+  };
+  const char *description[] = {
+    Events::LLC_REFERENCE::k_DESCRIPTION,
+    Events::LLC_MISS::k_DESCRIPTION,
+    Events::BRANCHES::k_DESCRIPTION,
+    Events::BRANCHES_NOT_TAKEN::k_DESCRIPTION,
+  };
+
+  char root[64] = "/dev/cpu";
+  std::vector<int> cpu;
+  char msr[PATH_MAX];
+
+  if (real) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet)!=0) {
+      fprintf(stderr, "Error: sched_getaffinity failed: %s\n", strerror(errno));
+      return 1;
+    }
+    for (int i=0; i<CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &cpuSet)) {
+        cpu.push_back(i);
+      }
+    }
+  } else {
+    strcpy(root, "/tmp/pmc-fake-msr.XXXXXX");
+    if (mkdtemp(root)==0) {
+      fprintf(stderr, "Error: cannot make fake MSR directory: %s\n", strerror(errno));
+      return 1;
+    }
+    for (int i=0; i<cores; ++i) {
+      cpu.push_back(i);
+      snprintf(msr, sizeof(msr), "%s/%d", root, i);
+      mkdir(msr, 0700);
+      snprintf(msr, sizeof(msr), "%s/%d/msr", root, i);
+      int fid = ::open(msr, O_RDWR|O_CREAT, 0600);
+      // Reads of never written registers e.g. IA32_TIME_STAMP_COUNTER must not hit EOF
+      if (fid<0 || ftruncate(fid, 4096)!=0) {
+        fprintf(stderr, "Error: cannot make '%s': %s\n", msr, strerror(errno));
+        return 1;
+      }
+      close(fid);
+    }
+  }
+
+  printf("MSR root: %s, cores: %lu\n", root, cpu.size());
+
+  // At least 8 so the worker path runs even on small hosts
+  const u_int16_t maxThreads = (u_int16_t)std::max(8u, std::thread::hardware_concurrency());
+  for (u_int16_t threads=1; ; threads = (u_int16_t)std::min<u_int32_t>(threads*2u, maxThreads)) {
+    PMUGroup group(cpu, 4, eventSelect, description, threads, root);
+
+    const u_int64_t start = nowNs();
+    if (group.reset()!=0 || group.start()!=0) {
+      return 1;
+    }
+    const u_int64_t elapsed = nowNs()-start;
+
+    std::vector<Snapshot> snap;
+    const u_int64_t readStart = nowNs();
+    if (group.snapshot(&snap)!=0) {
+      return 1;
+    }
+    const u_int64_t readElapsed = nowNs()-readStart;
+
+    printf("threads %3u: reset+start %8.1lf us (%6.2lf us/core), snapshot %8.1lf us, path: %s\n",
+      threads, elapsed/1000.0, elapsed/1000.0/cpu.size(), readElapsed/1000.0, group.batched() ? "batch" : "pwrite");
+
+    if (real && threads==maxThreads) {
+      volatile u_int64_t sum = 0;
+      for (u_int64_t i=0; i<100000000; ++i) {
+        sum += i;
+      }
+      group.pause();
+      std::cout << group << std::endl;
+    }
+
+    if (threads==maxThreads) {
+      break;
+    }
+  }
+
+  if (!real) {
+    for (int c: cpu) {
+      snprintf(msr, sizeof(msr), "%s/%d/msr", root, c);
+      unlink(msr);
+      snprintf(msr, sizeof(msr), "%s/%d", root, c);
+      rmdir(msr);
+    }
+    rmdir(root);
+  }
+
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <intel_xeon_pmu.h>
+#include <intel_pmu_stats.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+
+// Purpose: measure with the 'perf_event_open' backend, which needs no 'setcap', no MSR device, and no pinning. By
+// default the fixed counters and the default programmable events are opened; with 'sw' only software events
+// (task-clock nanoseconds, page faults, context switches) are, which works on any Linux box including VMs without a
+// PMU. Each iteration touches fresh pages so page faults show up. Also prints, per event, whether reads go through
+// 'rdpmc' or fall back to a system call.
+//
+// Usage: perf.tsk [sw] [iterations]
+
+int main(int argc, char **argv) {
+  const bool software = argc>1 && strcmp(argv[1], "sw")==0;
+  const unsigned iterations = argc>2 ? (unsigned)atoi(argv[2]) : 10;
+
+  Intel::XEON::PMU *pmu = 0;
+  if (software) {
+    std::vector<Intel::XEON::PerfEvent> event = {
+      Intel::XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock nanoseconds"),
+      Intel::XEON::PerfEvent::software(PERF_COUNT_SW_PAGE_FAULTS, "page faults"),
+      Intel::XEON::PerfEvent::software(PERF_COUNT_SW_CONTEXT_SWITCHES, "context switches"),
+    };
+    pmu = new Intel::XEON::PMU(event, false);
+  } else {
+    pmu = new Intel::XEON::PMU(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0, Intel::XEON::PMU::k_BACKEND_PERF);
+  }
+
+  if (pmu->reset()!=0 || pmu->start()!=0) {
+    fprintf(stderr, "Error: cannot start perf events%s\n", software ? "" : "; try 'perf.tsk sw' without a PMU");
+    delete pmu;
+    return 1;
+  }
+
+  const Intel::XEON::PerfEvents *events = pmu->perfEvents();
+  for (u_int16_t i=0; i<events->count(); ++i) {
+    printf("event %u read by %s\n", i, events->userRdpmc(i) ? "rdpmc" : "system call");
+  }
+
+  Intel::Stats stats(*pmu);
+  for (unsigned i=0; i<iterations; ++i) {
+    std::vector<char> page(1<<22);
+    for (size_t p=0; p<page.size(); p+=4096) {
+      page[p] = 1;
+    }
+    Intel::DoNotOptimize(page[0]);
+    stats.record();
+  }
+
+  std::cout << stats;
+
+  delete pmu;
+  return 0;
+}
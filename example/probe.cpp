@@ -0,0 +1,66 @@
+#include <intel_pmu_probe.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <vector>
+
+// Purpose: show 'PMU_SCOPE' probes in code that doesn't otherwise know about the PMU. 'handle' runs nested regions
+// 'handle' > 'lookup' and 'handle' > 'update'; the dump gives each region's counts inclusive of nested regions and
+// exclusive of them, every 'intervalMs' and once more at exit. Build with '-DPMU_PROBES_DISABLED' to compile probes
+// out. Requires 'linux_pmu' and 'setcap', see README.
+//
+// Usage: probe.tsk [requests] [intervalMs]
+
+namespace {
+
+std::vector<int> table(1<<22);
+
+int lookup(int key) {
+  PMU_SCOPE("lookup");
+  int sum = 0;
+  for (int i=0; i<64; ++i) {
+    sum += table[(unsigned)(key*2654435761u + i*40503u) % table.size()];
+  }
+  return sum;
+}
+
+void update(int key, int value) {
+  PMU_SCOPE("update");
+  for (int i=0; i<16; ++i) {
+    table[(unsigned)(key + i*97) % table.size()] = value;
+  }
+}
+
+void handle(int key) {
+  PMU_SCOPE("handle");
+  const int value = lookup(key);
+  for (volatile int i=0; i<256; ++i);
+  update(key, value+1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const unsigned requests = argc>1 ? (unsigned)atoi(argv[1]) : 1000000;
+  const u_int64_t intervalMs = argc>2 ? strtoull(argv[2], 0, 10) : 250;
+
+  Intel::XEON::PMU pmu(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0);
+  if (pmu.reset()!=0 || pmu.start()!=0) {
+    return 1;
+  }
+  if (Intel::Probe::attach(pmu)!=0) {
+    return 1;
+  }
+
+  for (unsigned r=0; r<requests; ++r) {
+    handle((int)random());
+    Intel::Probe::dumpEvery(intervalMs*1000000ull, std::cout);
+  }
+
+  Intel::Probe::dump(std::cout);
+  Intel::Probe::detach();
+
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include <intel_xeon_pmu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Purpose: measure the cost of PMU 'reset()' followed by 'start()' in rdtsc cycles for three ways of writing MSRs:
+//
+//  legacy: one 'pwrite' per MSR in the order PMU used before MSR plans (reset: 15 writes, start: 5 writes)
+//  plan  : PMU's precompiled reset/start plans applied with one 'pwrite' per MSR
+//  pmu   : PMU::reset()/start() which applies the same plans through the msr-safe batch device when present
+//
+// With '--real' the Linux MSR device is used and, since the counters really run, the counts leaked into the fixed
+// and programmable counters between enabling them and the first read are reported too (requires 'linux_pmu' and
+// 'setcap', see README). Without '--real' a file-backed fake MSR device under /tmp is used so the program runs
+// anywhere; only costs are meaningful then.
+//
+// Usage: reset_bench.tsk [--real] [iterations]
+
+using namespace Intel::XEON;
+
+// Legacy sequence register addresses. See 'doc/intel_msr.pdf'
+const u_int32_t IA32_PERF_GLOBAL_CTRL         = 0x38f;
+const u_int32_t IA32_PERFEVTSEL0              = 0x186;
+const u_int32_t IA32_PMC0                     = 0xc1;
+const u_int32_t IA32_PERF_GLOBAL_STATUS_RESET = 0x390;
+const u_int32_t IA32_FIXED_CTR0               = 0x309;
+const u_int32_t IA32_FIXED_CTR_CTRL           = 0x38d;
+
+const u_int64_t k_DEFAULT_PCFG[] = { 0x414f2e, 0x41412e, 0x4104c4, 0x4110c4 };
+
+struct Result {
+  u_int64_t d_min;                      // minimum reset+start cost in rdtsc cycles
+  u_int64_t d_total;                    // sum of reset+start cost in rdtsc cycles
+  u_int64_t d_fixedNoise[PMU::k_FIXED_COUNTERS];             // sum of fixed counter values right after start
+  u_int64_t d_progNoise[PMU::k_MAX_PROG_COUNTERS_HT_OFF];    // sum of prog counter values right after start
+};
+
+void wr(int fid, u_int32_t reg, u_int64_t value) {
+  if (pwrite(fid, &value, sizeof(value), reg) != sizeof(value)) {
+    fprintf(stderr, "Error: MSR write error on register 0x%x value 0x%lx: %s\n", reg, value, strerror(errno));
+    exit(1);
+  }
+}
+
+void legacyResetStart(int fid, u_int16_t cnt) {
+  // reset
+  wr(fid, IA32_PERF_GLOBAL_CTRL, 0);
+  for (u_int16_t i=0; i<cnt; ++i) {
+    wr(fid, IA32_PERFEVTSEL0+i, 0);
+  }
+  wr(fid, IA32_FIXED_CTR_CTRL, 0);
+  for (u_int16_t i=0; i<cnt; ++i) {
+    wr(fid, IA32_PMC0+i, 0);
+  }
+  for (u_int16_t i=0; i<PMU::k_FIXED_COUNTERS; ++i) {
+    wr(fid, IA32_FIXED_CTR0+i, 0);
+  }
+  wr(fid, IA32_PERF_GLOBAL_STATUS_RESET, 0);
+  u_int64_t value = 0x700000000;
+  for (u_int16_t i=0; i<cnt; ++i) {
+    value |= (1<<i);
+  }
+  wr(fid, IA32_PERF_GLOBAL_CTRL, value);
+
+  // start
+  wr(fid, IA32_FIXED_CTR_CTRL, 0x222);
+  for (u_int16_t i=0; i<cnt; ++i) {
+    wr(fid, IA32_PERFEVTSEL0+i, k_DEFAULT_PCFG[i]);
+  }
+}
+
+void planResetStart(int fid, const PMU& pmu) {
+  if (pmu.resetPlan().apply(fid)!=0 || pmu.startPlan().apply(fid)!=0) {
+    exit(1);
+  }
+}
+
+void pmuResetStart(PMU& pmu) {
+  if (pmu.reset()!=0 || pmu.start()!=0) {
+    exit(1);
+  }
+}
+
+template <typename FUNC>
+void measure(const char *name, PMU& pmu, bool real, unsigned iterations, FUNC func) {
+  Result result;
+  memset(&result, 0, sizeof(result));
+  result.d_min = ~0ull;
+
+  for (unsigned i=0; i<iterations; ++i) {
+    const u_int64_t start = pmu.timeStampCounter();
+    func();
+    const u_int64_t end = pmu.timeStampCounter();
+    if (real) {
+      // Counters are now running: anything seen here is setup noise
+      for (u_int16_t c=0; c<pmu.fixedCountersDefined(); ++c) {
+        result.d_fixedNoise[c] += pmu.fixedCounterValue(c);
+      }
+      for (u_int16_t c=0; c<pmu.programmableCountersDefined(); ++c) {
+        result.d_progNoise[c] += pmu.programmableCounterValue(c);
+      }
+    }
+    const u_int64_t delta = end-start;
+    result.d_min = delta<result.d_min ? delta : result.d_min;
+    result.d_total += delta;
+  }
+
+  printf("%-7s: reset+start rdtsc cycles: min: %012lu, avg: %lf\n", name, result.d_min,
+    (double)result.d_total/(double)iterations);
+
+  if (real) {
+    for (u_int16_t c=0; c<pmu.fixedCountersDefined(); ++c) {
+      printf("%-7s  %-3s [%-48s]: avg noise: %lf\n", "", pmu.fixedMnemonic()[c].c_str(),
+        pmu.fixedDescription()[c].c_str(), (double)result.d_fixedNoise[c]/(double)iterations);
+    }
+    for (u_int16_t c=0; c<pmu.programmableCountersDefined(); ++c) {
+      printf("%-7s  %-3s [%-48s]: avg noise: %lf\n", "", pmu.programmableMnemonic()[c].c_str(),
+        pmu.programmableDescription()[c].c_str(), (double)result.d_progNoise[c]/(double)iterations);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  bool real = false;
+  unsigned iterations = 10000;
+
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "--real")==0) {
+      real = true;
+    } else {
+      iterations = (unsigned)atoi(argv[i]);
+    }
+  }
+
+  if (iterations==0) {
+    fprintf(stderr, "usage: %s [--real] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  char root[64] = "/dev/cpu";
+  if (!real) {
+    strcpy(root, "/tmp/pmc-fake-msr.XXXXXX");
+    if (mkdtemp(root)==0) {
+      fprintf(stderr, "Error: cannot make fake MSR directory: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+
+  PMU pmu(PMU::k_DEFAULT_XEON_CONFIG_0, root);
+
+  char msr[PATH_MAX];
+  snprintf(msr, sizeof(msr), "%s/%d", root, pmu.coreId());
+  if (!real) {
+    mkdir(msr, 0700);
+  }
+  snprintf(msr, sizeof(msr), "%s/%d/msr", root, pmu.coreId());
+  if (!real) {
+    close(::open(msr, O_RDWR|O_CREAT, 0600));
+  }
+
+  int fid = ::open(msr, O_RDWR);
+  if (fid<0) {
+    fprintf(stderr, "Error: cannot open '%s': %s\n", msr, strerror(errno));
+    return 1;
+  }
+
+  if (pmu.reset()!=0) {
+    return 1;
+  }
+
+  printf("MSR device: %s, iterations: %u, plan writes: reset %u start %u, pmu path: %s\n",
+    msr, iterations, pmu.resetPlan().writes(), pmu.startPlan().writes(), pmu.batched() ? "batch" : "pwrite");
+
+  measure("legacy", pmu, real, iterations, [&]() { legacyResetStart(fid, pmu.programmableCountersDefined()); });
+  measure("plan",   pmu, real, iterations, [&]() { planResetStart(fid, pmu); });
+  measure("pmu",    pmu, real, iterations, [&]() { pmuResetStart(pmu); });
+
+  close(fid);
+
+  if (!real) {
+    unlink(msr);
+    snprintf(msr, sizeof(msr), "%s/%d", root, pmu.coreId());
+    rmdir(msr);
+    rmdir(root);
+  }
+
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <intel_pmu_sampler.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Purpose: run the background PMU sampler on every cpu in the caller's affinity mask while a consumer drains the
+// per cpu rings, then print per cpu sample and drop counts, per sample overhead, and deltas between samples. Use it to
+// tune the sampling interval and ring capacity: drops mean the consumer drains too rarely or the ring is too small.
+// Requires 'linux_pmu' and 'setcap', see README.
+//
+// Usage: sampler.tsk [intervalUs] [seconds] [capacity]
+
+using namespace Intel;
+using namespace Intel::XEON;
+
+int main(int argc, char **argv) {
+  const u_int64_t intervalUs = argc>1 ? strtoull(argv[1], 0, 10) : 1000;
+  const unsigned seconds = argc>2 ? (unsigned)atoi(argv[2]) : 2;
+  const u_int32_t capacity = argc>3 ? (u_int32_t)atoi(argv[3]) : 4096;
+
+  if (intervalUs==0 || capacity==0 || (capacity & (capacity-1))!=0) {
+    fprintf(stderr, "usage: %s [intervalUs>0] [seconds] [capacity power of 2]\n", argv[0]);
+    return 1;
+  }
+
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet)!=0) {
+    fprintf(stderr, "Error: sched_getaffinity failed: %s\n", strerror(errno));
+    return 1;
+  }
+  std::vector<int> cpu;
+  for (int i=0; i<CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &cpuSet)) {
+      cpu.push_back(i);
+    }
+  }
+
+  const u_int64_t eventSelect[] = {
+    Events::LLC_REFERENCE::k_VALUE,
+    Events::LLC_MISS::k_VALUE,
+    Events::BRANCHES::k_VALUE,
+    Events::BRANCHES_NOT_TAKEN::k_VALUE,
+  };
+  const char *description[] = {
+    Events::LLC_REFERENCE::k_DESCRIPTION,
+    Events::LLC_MISS::k_DESCRIPTION,
+    Events::BRANCHES::k_DESCRIPTION,
+    Events::BRANCHES_NOT_TAKEN::k_DESCRIPTION,
+  };
+
+  Sampler sampler(cpu, 4, eventSelect, description, intervalUs*1000, capacity);
+  if (sampler.start()!=0) {
+    return 1;
+  }
+
+  // Consumer: drain every 10ms handing batches to a trivial sink
+  u_int64_t batches = 0;
+  u_int64_t samples = 0;
+  for (unsigned i=0; i<seconds*100; ++i) {
+    usleep(10000);
+    samples += sampler.drain([&](const Sample *, u_int32_t) { ++batches; });
+  }
+
+  sampler.stop();
+  samples += sampler.drain();
+
+  printf("cpus: %lu, interval: %luus, capacity: %u, samples: %lu, batches: %lu\n",
+    cpu.size(), intervalUs, capacity, samples, batches);
+  std::cout << sampler << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <intel_xeon_pmu.h>
+#include <intel_pmu_calibration.h>
+
+#include <x86intrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Purpose: compare the per-sample cost of reading rdtsc plus all defined counters through the per-counter accessors
+// 'timeStampCounter()', 'fixedCounterValue()', 'programmableCounterValue()' (one 'mfence;lfence' each) against one
+// 'PMU::snapshot()' for each fence policy.
+//
+//  overhead: rdtsc cycles between an 'lfence;rdtsc' before and after one sample
+//  skew    : rdtsc cycles between reading rdtsc in the sample and finishing the last counter read i.e. how far apart
+//            in time the values in one sample were taken
+//
+// Requires 'rdpmc' in user space (see 'scripts/linux_pmu'). Counters need not be programmed. If the MSR device is
+// writable too (see 'setcap' in README) the counters are started and 'Calibration' reports what one empty
+// 'mfence;lfence' measured region adds to each counter, i.e. what 'Stats::setOverhead' would subtract. Usage:
+// snapshot_bench.tsk [samples]
+
+using namespace Intel::XEON;
+
+struct Result {
+  u_int64_t d_overheadMin;              // minimum rdtsc cycles per sample
+  u_int64_t d_overheadTotal;            // sum of rdtsc cycles per sample
+  u_int64_t d_skewMin;                  // minimum rdtsc cycles from first to last read in a sample
+  u_int64_t d_skewTotal;                // sum of rdtsc cycles from first to last read in a sample
+};
+
+inline u_int64_t fencedTsc() {
+  _mm_lfence();
+  return __rdtsc();
+}
+
+void report(const char *name, const Result& result, unsigned samples) {
+  printf("%-14s: overhead min: %06lu avg: %10.2lf, skew min: %06lu avg: %10.2lf\n", name,
+    result.d_overheadMin, (double)result.d_overheadTotal/(double)samples,
+    result.d_skewMin, (double)result.d_skewTotal/(double)samples);
+}
+
+void update(Result *result, u_int64_t overhead, u_int64_t skew) {
+  result->d_overheadMin = overhead<result->d_overheadMin ? overhead : result->d_overheadMin;
+  result->d_overheadTotal += overhead;
+  result->d_skewMin = skew<result->d_skewMin ? skew : result->d_skewMin;
+  result->d_skewTotal += skew;
+}
+
+void perCounter(const PMU& pmu, unsigned samples) {
+  Result result = { ~0ull, 0, ~0ull, 0 };
+  u_int64_t value[1+PMU::k_FIXED_COUNTERS+PMU::k_MAX_PROG_COUNTERS_HT_OFF];
+
+  for (unsigned i=0; i<samples; ++i) {
+    const u_int64_t start = fencedTsc();
+    u_int16_t n = 0;
+    value[n++] = pmu.timeStampCounter();
+    for (u_int16_t c=0; c<pmu.fixedCountersDefined(); ++c) {
+      value[n++] = pmu.fixedCounterValue(c);
+    }
+    for (u_int16_t c=0; c<pmu.programmableCountersDefined(); ++c) {
+      value[n++] = pmu.programmableCounterValue(c);
+    }
+    const u_int64_t last = __rdtsc();
+    const u_int64_t end = fencedTsc();
+    Intel::DoNotOptimize(value);
+    update(&result, end-start, last-value[0]);
+  }
+
+  report("per-counter", result, samples);
+}
+
+template <PMU::FencePolicy FENCE>
+void snapshot(const PMU& pmu, const char *name, unsigned samples) {
+  Result result = { ~0ull, 0, ~0ull, 0 };
+  Snapshot snap;
+
+  for (unsigned i=0; i<samples; ++i) {
+    const u_int64_t start = fencedTsc();
+    pmu.snapshot(&snap, FENCE);
+    const u_int64_t last = __rdtsc();
+    const u_int64_t end = fencedTsc();
+    Intel::DoNotOptimize(snap);
+    update(&result, end-start, last-snap.d_tsc);
+  }
+
+  report(name, result, samples);
+}
+
+int main(int argc, char **argv) {
+  unsigned samples = argc>1 ? (unsigned)atoi(argv[1]) : 100000;
+  if (samples==0) {
+    fprintf(stderr, "usage: %s [samples]\n", argv[0]);
+    return 1;
+  }
+
+  PMU pmu(PMU::k_DEFAULT_XEON_CONFIG_0);
+
+  printf("HW core %d, samples %u, fixed counters %u, programmable counters %u\n", pmu.coreId(), samples,
+    pmu.fixedCountersDefined(), pmu.programmableCountersDefined());
+
+  perCounter(pmu, samples);
+  snapshot<PMU::k_FENCE_NONE>(pmu, "none", samples);
+  snapshot<PMU::k_FENCE_LFENCE>(pmu, "lfence", samples);
+  snapshot<PMU::k_FENCE_MFENCE_LFENCE>(pmu, "mfence+lfence", samples);
+  snapshot<PMU::k_FENCE_RDTSCP>(pmu, "rdtscp", samples);
+
+  if (pmu.reset()==0 && pmu.start()==0) {
+    Intel::Calibration calibration;
+    if (calibration.calibrate(pmu, PMU::k_FENCE_MFENCE_LFENCE, samples)==0) {
+      calibration.print(std::cout, pmu);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include <intel_xeon_pmu.h>
+#include <intel_xeon_frequency.h>
+#include <intel_pmu_runner.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Purpose: effective frequency and throttle detection around every iteration, and 'Runner' retrying unstable runs.
+//
+// Without '--real' counters come from software perf events and APERF/MPERF/IA32_THERM_STATUS from a file-backed fake
+// MSR device under /tmp which the body advances as hardware would: the first run drops from 1.5 to 1.2 times the TSC
+// frequency half way (frequency varied), the second logs a power limit (throttled), and the third is steady, so
+// 'Runner' keeps the third after two retries. With '--real' the MSR PMU and the calling cpu's '/dev/cpu/<n>/msr' are
+// used (requires 'setcap', see README) and the body is a busy loop.
+//
+// Usage: throttle.tsk [--real] [maxVariation]
+
+namespace {
+
+std::string msr;                                // fake MSR device or empty with '--real'
+u_int32_t   run = 0;                            // runs started
+u_int32_t   iteration = 0;                      // iterations of the current run
+
+int poke(u_int32_t reg, u_int64_t value, bool add) {
+  // Write, or add to, the 64-bit fake register 'reg' as if hardware counted
+  int fid = ::open(msr.c_str(), O_RDWR);
+  u_int64_t old = 0;
+  if (fid<0 || pread(fid, &old, sizeof(old), reg)!=sizeof(old)) {
+    fprintf(stderr, "Error: cannot read '%s': %s\n", msr.c_str(), strerror(errno));
+    if (fid>=0) {
+      close(fid);
+    }
+    return 1;
+  }
+  value = add ? old + value : value;
+  const int rc = pwrite(fid, &value, sizeof(value), reg)==sizeof(value) ? 0 : 1;
+  close(fid);
+  return rc;
+}
+
+void body() {
+  u_int64_t sum = 0;
+  for (u_int32_t i=0; i<100000; ++i) {
+    sum += i;
+    Intel::DoNotOptimize(sum);
+  }
+
+  if (msr.empty()) {
+    return;
+  }
+
+  // A file's offsets are bytes not registers, so fake IA32_APERF (0xe8) is fake IA32_MPERF (0xe7) shifted left 8 bits
+  // less its top byte. Adding 2^56+L to APERF adds 256*L to MPERF, making APERF/MPERF 1.5 (1.2 when slow) for the
+  // L below i.e. an effective frequency 1.5 times the TSC's.
+  const u_int64_t ratio10 = run==0 && iteration>=40 ? 12 : 15;
+  const u_int64_t low = (1ull<<56)*10/(256*ratio10-10);
+  poke(Intel::XEON::Frequency::IA32_APERF, (1ull<<56) + low, true);
+  if (run==1 && iteration==20) {
+    poke(Intel::XEON::Frequency::IA32_THERM_STATUS, Intel::XEON::Frequency::k_POWER_LIMIT_LOG, false);
+  }
+  ++iteration;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool real = false;
+  double maxVariation = 0.02;
+
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "--real")==0) {
+      real = true;
+    } else {
+      maxVariation = atof(argv[i]);
+    }
+  }
+
+  if (maxVariation<=0) {
+    fprintf(stderr, "usage: %s [--real] [maxVariation]\n", argv[0]);
+    return 1;
+  }
+
+  Intel::XEON::Frequency::Options options;
+  char root[64] = "";
+  if (!real) {
+    strcpy(root, "/tmp/pmc-fake-freq.XXXXXX");
+    if (mkdtemp(root)==0) {
+      fprintf(stderr, "Error: cannot make fake MSR directory: %s\n", strerror(errno));
+      return 1;
+    }
+    options.d_msrRoot = root;
+    options.d_cpu = 0;
+    mkdir((std::string(root) + "/0").c_str(), 0700);
+    msr = std::string(root) + "/0/msr";
+    int fid = ::open(msr.c_str(), O_RDWR|O_CREAT, 0600);
+    if (fid<0 || ftruncate(fid, 4096)!=0) {
+      fprintf(stderr, "Error: cannot make '%s': %s\n", msr.c_str(), strerror(errno));
+      return 1;
+    }
+    close(fid);
+  }
+
+  int rc = 0;
+  {
+    Intel::XEON::Frequency frequency(options);
+    Intel::XEON::PMU *pmu = real
+      ? new Intel::XEON::PMU(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0)
+      : new Intel::XEON::PMU(std::vector<Intel::XEON::PerfEvent>{
+          Intel::XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock nanoseconds")}, false);
+
+    if (frequency.status()!=0 || pmu->status()!=0 || pmu->reset()!=0 || pmu->start()!=0) {
+      fprintf(stderr, "Error: cannot start PMU or read frequency MSRs\n");
+      rc = 1;
+    } else {
+      std::cout << frequency << std::endl;
+      if (real) {
+        frequency.clear();
+      }
+      pmu->setFrequency(&frequency);
+
+      Intel::Runner::Options runnerOptions;
+      runnerOptions.d_counter = real ? Intel::Runner::k_F1 : Intel::Runner::k_P0;
+      runnerOptions.d_relativeWidth = 0.5;
+      runnerOptions.d_minIterations = 80;
+      runnerOptions.d_maxIterations = 80;
+      runnerOptions.d_maxWarmup = 0;
+      runnerOptions.d_outlierZ = 1e9;
+      runnerOptions.d_maxFrequencyVariation = maxVariation;
+      runnerOptions.d_retries = 2;
+
+      Intel::Runner runner(*pmu, runnerOptions);
+      if ((rc = runner.start())==0) {
+        // What 'Runner::run' does, with runs counted for the fake MSR script
+        Intel::XEON::Snapshot begin, end;
+        do {
+          if (run>0 && (rc = runner.start())!=0) {
+            break;
+          }
+          iteration = 0;
+          do {
+            pmu->snapshotBegin(&begin);
+            body();
+            pmu->snapshot(&end);
+          } while (runner.add(begin, end));
+          printf("run %u: %s\n", run, runner.result().d_stable ? "stable" : "unstable");
+          ++run;
+        } while (runner.retry());
+        std::cout << runner << std::endl;
+      }
+
+      pmu->setFrequency(0);
+    }
+    delete pmu;
+  }
+
+  if (!real) {
+    unlink(msr.c_str());
+    rmdir((std::string(root) + "/0").c_str());
+    rmdir(root);
+  }
+
+  return rc==0 ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#include <intel_xeon_pmu.h>
+#include <intel_pmu_topdown.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+
+// Purpose: top-down (TMA) breakdown of small kernels each dominated by one level 1 or 2 node: a pointer chase
+// through a buffer bigger than the LLC (memory bound), unpredictable branches (bad speculation), and independent
+// integer adds (retiring). The PMU is programmed through the MSR device by default, or with 'perf' through
+// 'perf_event_open'. Level 2 runs each kernel once per event pass; 'level 1' only runs the level 1 pass.
+//
+// Usage: topdown.tsk [msr|perf] [chase|branch|alu|all] [iterations] [1|2]
+
+namespace {
+
+std::vector<u_int32_t> ring;                    // random cyclic permutation for 'chase'
+std::vector<u_int8_t>  coin;                    // random bits for 'branch'
+
+void chase() {
+  u_int32_t at = 0;
+  for (u_int32_t i=0; i<1u<<16; ++i) {
+    at = ring[at];
+  }
+  Intel::DoNotOptimize(at);
+}
+
+void branch() {
+  u_int64_t sum = 0;
+  for (u_int32_t i=0; i<coin.size(); ++i) {
+    if (coin[i]) {
+      sum += i;
+    } else {
+      sum ^= i;
+    }
+    Intel::DoNotOptimize(sum);
+  }
+}
+
+void alu() {
+  u_int64_t a = 1, b = 2, c = 3, d = 4;
+  for (u_int32_t i=0; i<1u<<16; ++i) {
+    a += i; b += a; c += i; d += c;
+    Intel::DoNotOptimize(d);
+  }
+  Intel::DoNotOptimize(b);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const bool perf = argc>1 && strcmp(argv[1], "perf")==0;
+  const char *kernel = argc>2 ? argv[2] : "all";
+  const u_int64_t iterations = argc>3 ? (u_int64_t)atoll(argv[3]) : 100;
+  const Intel::TopDown::Level level = argc>4 && atoi(argv[4])==1 ? Intel::TopDown::k_LEVEL_1
+                                                                  : Intel::TopDown::k_LEVEL_2;
+
+  // 64Mb of indices visited in one random cycle so every load misses
+  ring.resize(1u<<24);
+  for (u_int32_t i=0; i<ring.size(); ++i) {
+    ring[i] = i;
+  }
+  srand(1);
+  for (u_int32_t i=(u_int32_t)ring.size()-1; i>0; --i) {
+    const u_int32_t j = (u_int32_t)rand()%i;
+    const u_int32_t t = ring[i]; ring[i] = ring[j]; ring[j] = t;
+  }
+  coin.resize(1u<<16);
+  for (auto& c: coin) {
+    c = (u_int8_t)(rand() & 1);
+  }
+
+  Intel::XEON::PMU *pmu = perf
+    ? new Intel::XEON::PMU(Intel::XEON::PMU::k_TOPDOWN_XEON_CONFIG, Intel::XEON::PMU::k_BACKEND_PERF)
+    : new Intel::XEON::PMU(Intel::XEON::PMU::k_TOPDOWN_XEON_CONFIG);
+  if (pmu->status()!=0) {
+    delete pmu;
+    return 1;
+  }
+
+  struct Kernel {
+    const char *d_name;
+    void      (*d_function)();
+  } const kernels[] = {
+    {"chase", &chase},
+    {"branch", &branch},
+    {"alu", &alu},
+  };
+
+  int rc = 0;
+  for (const Kernel& k: kernels) {
+    if (strcmp(kernel, "all")!=0 && strcmp(kernel, k.d_name)!=0) {
+      continue;
+    }
+    Intel::TopDown topDown(*pmu, level);
+    if ((rc = topDown.run(k.d_function, iterations))!=0) {
+      fprintf(stderr, "Error: cannot run '%s': %s\n", k.d_name, strerror(rc));
+      break;
+    }
+    printf("%s:\n", k.d_name);
+    std::cout << topDown << std::endl;
+  }
+
+  delete pmu;
+  return rc==0 ? 0 : 1;
+}
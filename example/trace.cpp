@@ -0,0 +1,428 @@
+#include <intel_pmu_trace.h>
+#include <intel_pmu_histogram.h>
+#include <intel_pmu_metric.h>
+#include <intel_pmu_welford.h>
+#include <intel_tsc_clock.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <x86intrin.h>
+
+#include <string>
+#include <vector>
+
+// Purpose: record raw PMU snapshots into a trace file and analyze trace files offline. 'record' snapshots the PMU
+// after each iteration of a toy workload, appends it to '<file>', and reports bytes per sample and append cost; with
+// 'sw' it records software perf events so it runs without a PMU. The other commands stream any trace, however large,
+// in constant memory and work on the deltas between consecutive samples: 'stats' prints per counter count, min, max,
+// mean, stddev and percentiles; 'series' prints per counter totals in buckets of '<bucketMs>' of TSC time; 'csv'
+// prints one row per delta; 'metrics' evaluates derived metrics, by default the 'Metric::library' ones whose every
+// counter the trace recorded counting the event the library metric was written for, else each 'name=expression'
+// given, per delta in batches of stored deltas and over the totals. Deltas whose samples an MSR backend PMU read on
+// different cpus are skipped and counted.
+//
+// Usage: trace.tsk record <file> [samples] [sw]
+//        trace.tsk stats <file>
+//        trace.tsk series <file> <bucketMs>
+//        trace.tsk csv <file>
+//        trace.tsk metrics <file> [name=expression ...]
+
+using namespace Intel;
+using namespace Intel::XEON;
+
+namespace {
+
+struct Counters {
+  // Counters of a trace in the order deltas are reported: R0, A0, fixed, programmable
+  u_int16_t                d_count;
+  std::vector<std::string> d_mnemonic;
+  std::vector<std::string> d_description;
+};
+
+Counters counters(const TraceHeader& header) {
+  Counters result;
+  result.d_mnemonic = {"R0", "A0"};
+  result.d_description = {"rdtsc cycles", "active (not paused) rdtsc cycles"};
+  for (u_int16_t i=0; i<header.d_fixedCnt+header.d_progCnt; ++i) {
+    result.d_mnemonic.push_back(header.d_mnemonic[i]);
+    result.d_description.push_back(header.d_description[i]);
+  }
+  result.d_count = (u_int16_t)result.d_mnemonic.size();
+  return result;
+}
+
+bool delta(const TraceHeader& header, const Snapshot& begin, const Snapshot& end, u_int64_t *value) {
+  // Return false if 'begin' and 'end' were read on different cpus of an MSR backend PMU and the deltas don't subtract
+  if (header.d_backend==PMU::k_BACKEND_MSR && begin.d_aux!=end.d_aux) {
+    return false;
+  }
+  value[0] = end.d_tsc - begin.d_tsc;
+  value[1] = value[0] - (end.d_paused - begin.d_paused);
+  u_int16_t c = 2;
+  for (u_int16_t i=0; i<header.d_fixedCnt; ++i) {
+    value[c++] = (end.d_fixed[i] - begin.d_fixed[i]) & header.d_fixedMask;
+  }
+  for (u_int16_t i=0; i<header.d_progCnt; ++i) {
+    value[c++] = (end.d_prog[i] - begin.d_prog[i]) & header.d_progMask;
+  }
+  return true;
+}
+
+TscClock clock(const TraceHeader& header) {
+  // Cycles convert at the writing host's rate, not this one's
+  return TscClock(header.d_tscHz ? header.d_tscHz : 1000000000ull, (TscClock::Source)header.d_tscSource, true);
+}
+
+int record(const char *path, u_int64_t samples, bool software) {
+  PMU *pmu = 0;
+  if (software) {
+    std::vector<PerfEvent> event = {
+      PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock nanoseconds"),
+      PerfEvent::software(PERF_COUNT_SW_PAGE_FAULTS, "page faults"),
+      PerfEvent::software(PERF_COUNT_SW_CONTEXT_SWITCHES, "context switches"),
+    };
+    pmu = new PMU(event, false);
+  } else {
+    pmu = new PMU(PMU::k_DEFAULT_XEON_CONFIG_0);
+  }
+
+  TraceWriter trace;
+  if (pmu->reset()!=0 || pmu->start()!=0 || trace.open(path, *pmu)!=0) {
+    delete pmu;
+    return 1;
+  }
+
+  std::vector<u_int32_t> table(1<<20);
+  u_int64_t appendCycles = 0;
+  u_int32_t key = 1;
+  Snapshot snap;
+  for (u_int64_t s=0; s<samples; ++s) {
+    // Vary the work so deltas aren't constant
+    const u_int32_t steps = 16 + (key & 255);
+    for (u_int32_t i=0; i<steps; ++i) {
+      key = key*1664525u + 1013904223u;
+      table[key & (table.size()-1)] += i;
+    }
+    pmu->snapshot(&snap, PMU::k_FENCE_LFENCE);
+
+    const u_int64_t start = __rdtsc();
+    if (trace.append(snap)!=0) {
+      break;
+    }
+    appendCycles += __rdtsc() - start;
+  }
+  DoNotOptimize(table[0]);
+
+  const u_int64_t written = trace.samples();
+  if (trace.close()!=0) {
+    delete pmu;
+    return 1;
+  }
+
+  TraceReader reader;
+  if (reader.open(path)!=0) {
+    delete pmu;
+    return 1;
+  }
+  const TraceHeader& header = reader.header();
+  printf("%s: %lu samples of %u counters in %lu blocks, %lu bytes: %.2lf bytes per sample (raw %lu), append %.2lf "
+    "rdtsc cycles per sample including block encoding\n", path, header.d_samples, header.columns(), header.d_blocks,
+    header.d_bytes, written ? (double)(header.d_bytes-TraceHeader::k_HEADER_SIZE)/(double)written : 0.0,
+    (u_int64_t)header.columns()*sizeof(u_int64_t), written ? (double)appendCycles/(double)written : 0.0);
+
+  delete pmu;
+  return 0;
+}
+
+int stats(TraceReader& reader) {
+  const TraceHeader& header = reader.header();
+  const Counters counter = counters(header);
+  std::vector<Welford> welford(counter.d_count);
+  std::vector<Histogram> histogram(counter.d_count);
+  u_int64_t value[TraceHeader::k_MAX_COUNTERS+2];
+  u_int64_t skipped = 0;
+
+  Snapshot first, prev, snap;
+  if (!reader.next(&first)) {
+    printf("empty trace\n");
+    return reader.status();
+  }
+  prev = first;
+  while (reader.next(&snap)) {
+    if (!delta(header, prev, snap, value)) {
+      ++skipped;
+    } else {
+      for (u_int16_t c=0; c<counter.d_count; ++c) {
+        welford[c].add((double)value[c]);
+        histogram[c].record(value[c]);
+      }
+    }
+    prev = snap;
+  }
+
+  const TscClock tsc = clock(header);
+  printf("trace %s: core %d, %s backend, TSC %lu Hz, %lu samples over %.3lf ms, %lu deltas skipped: thread migrated\n",
+    reader.complete() ? "complete" : "not closed by its writer", header.d_coreId,
+    header.d_backend==PMU::k_BACKEND_MSR ? "MSR" : "perf", header.d_tscHz, reader.samples(),
+    tsc.nanoseconds((double)(prev.d_tsc - first.d_tsc))/1e6, skipped);
+
+  for (u_int16_t c=0; c<counter.d_count; ++c) {
+    const Histogram& h = histogram[c];
+    printf("%-3s [%-48s]: min: %lu, max: %lu, mean: %.2lf, stddev: %.2lf, p50: %lu, p90: %lu, p99: %lu, p99.9: %lu, "
+      "total: %lu\n", counter.d_mnemonic[c].c_str(), counter.d_description[c].c_str(), h.count() ? h.min() : 0,
+      h.max(), welford[c].mean(), welford[c].stddev(), h.percentile(50.0), h.percentile(90.0), h.percentile(99.0),
+      h.percentile(99.9), h.total());
+  }
+
+  return reader.status();
+}
+
+int series(TraceReader& reader, u_int64_t bucketMs) {
+  const TraceHeader& header = reader.header();
+  const Counters counter = counters(header);
+  const TscClock tsc = clock(header);
+  std::vector<u_int64_t> total(counter.d_count, 0);
+  u_int64_t value[TraceHeader::k_MAX_COUNTERS+2];
+
+  printf("%12s %10s", "ms", "deltas");
+  for (u_int16_t c=0; c<counter.d_count; ++c) {
+    printf(" %14s", counter.d_mnemonic[c].c_str());
+  }
+  printf("\n");
+
+  Snapshot first, prev, snap;
+  if (!reader.next(&first)) {
+    return reader.status();
+  }
+  prev = first;
+
+  const u_int64_t bucketNs = bucketMs*1000000ull;
+  u_int64_t bucket = 0;
+  u_int64_t deltas = 0;
+  bool more = true;
+  while (more) {
+    more = reader.next(&snap);
+    const u_int64_t index = more ? tsc.toNanoseconds(snap.d_tsc - first.d_tsc)/bucketNs : bucket+1;
+    if (index!=bucket) {
+      // Delta goes to the bucket its end falls in; empty buckets in between print as zeros
+      for (; bucket<index; ++bucket) {
+        printf("%12lu %10lu", bucket*bucketMs, deltas);
+        for (u_int16_t c=0; c<counter.d_count; ++c) {
+          printf(" %14lu", total[c]);
+          total[c] = 0;
+        }
+        printf("\n");
+        deltas = 0;
+      }
+    }
+    if (more && delta(header, prev, snap, value)) {
+      ++deltas;
+      for (u_int16_t c=0; c<counter.d_count; ++c) {
+        total[c] += value[c];
+      }
+    }
+    prev = snap;
+  }
+
+  return reader.status();
+}
+
+bool recorded(const TraceHeader& header, PMU::ProgCounterSetConfig config, const Metric& metric) {
+  // Every counter the metric reads must have counted the event 'config' puts there, not just exist
+  if (!metric.defined(header.d_fixedCnt, header.d_progCnt)) {
+    return false;
+  }
+  const u_int64_t *eventSelect = PMU::configEventSelect(config);
+  for (u_int32_t v=2; v<Metric::k_VARIABLES; ++v) {
+    if (!metric.uses(v)) {
+      continue;
+    }
+    const u_int16_t i = (u_int16_t)(v-2);
+    if (i<PMU::k_FIXED_COUNTERS) {
+      if (!header.counts(i, PMU::fixedEvent(i))) {
+        return false;
+      }
+    } else if (!header.counts(header.d_fixedCnt+i-PMU::k_FIXED_COUNTERS,
+                              PerfEvent::raw(eventSelect[i-PMU::k_FIXED_COUNTERS], ""))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int metrics(TraceReader& reader, int count, char **definition) {
+  const TraceHeader& header = reader.header();
+  std::vector<Metric> metric;
+  if (count==0) {
+    // Fixed counter metrics e.g. IPC are in both libraries; keep the first
+    for (PMU::ProgCounterSetConfig config: {PMU::k_DEFAULT_XEON_CONFIG_1, PMU::k_TOPDOWN_XEON_CONFIG}) {
+      for (const Metric& m: Metric::library(config)) {
+        bool seen = false;
+        for (const Metric& other: metric) {
+          seen = seen || other.name()==m.name();
+        }
+        if (!seen && recorded(header, config, m)) {
+          metric.push_back(m);
+        }
+      }
+    }
+  }
+  for (int i=0; i<count; ++i) {
+    const char *equals = strchr(definition[i], '=');
+    Metric m;
+    if (equals==0) {
+      fprintf(stderr, "Error: expected 'name=expression' not '%s'\n", definition[i]);
+      return EINVAL;
+    }
+    int rc;
+    if ((rc = m.compile(std::string((const char*)definition[i], equals), equals+1))!=0) {
+      return rc;
+    }
+    if (!m.defined(header.d_fixedCnt, header.d_progCnt)) {
+      fprintf(stderr, "Error: metric '%s' reads counters the trace doesn't have\n", m.name().c_str());
+      return EINVAL;
+    }
+    metric.push_back(m);
+  }
+
+  // Deltas are stored column by column in variable order, then every metric runs over the block at once
+  const u_int32_t block = 4096;
+  std::vector<u_int64_t> storage((size_t)Metric::k_VARIABLES*block, 0);
+  const u_int64_t *column[Metric::k_VARIABLES];
+  for (u_int32_t v=0; v<Metric::k_VARIABLES; ++v) {
+    column[v] = storage.data() + (size_t)v*block;
+  }
+  std::vector<double> result(block);
+  std::vector<Welford> welford(metric.size());
+  std::vector<double> min(metric.size(), INFINITY);
+  std::vector<double> max(metric.size(), -INFINITY);
+  std::vector<u_int64_t> undefined(metric.size(), 0);
+  u_int64_t total[Metric::k_VARIABLES] = {0};
+  u_int64_t value[TraceHeader::k_MAX_COUNTERS+2];
+  u_int32_t stored = 0;
+
+  auto evaluate = [&]() {
+    for (size_t m=0; m<metric.size(); ++m) {
+      metric[m].evaluate(column, stored, result.data());
+      for (u_int32_t i=0; i<stored; ++i) {
+        if (!isfinite(result[i])) {
+          // e.g. a ratio over a delta with no cycles
+          ++undefined[m];
+          continue;
+        }
+        welford[m].add(result[i]);
+        min[m] = result[i]<min[m] ? result[i] : min[m];
+        max[m] = result[i]>max[m] ? result[i] : max[m];
+      }
+    }
+    stored = 0;
+  };
+
+  Snapshot prev, snap;
+  if (!reader.next(&prev)) {
+    return reader.status();
+  }
+  while (reader.next(&snap)) {
+    if (delta(header, prev, snap, value)) {
+      // 'value' skips fixed counters the trace lacks; variables don't
+      u_int64_t *row = storage.data() + stored;
+      row[0] = value[0];
+      row[block] = value[1];
+      for (u_int16_t i=0; i<header.d_fixedCnt; ++i) {
+        row[(size_t)(2+i)*block] = value[2+i];
+      }
+      for (u_int16_t i=0; i<header.d_progCnt; ++i) {
+        row[(size_t)(2+PMU::k_FIXED_COUNTERS+i)*block] = value[2+header.d_fixedCnt+i];
+      }
+      for (u_int32_t v=0; v<Metric::k_VARIABLES; ++v) {
+        total[v] += row[(size_t)v*block];
+      }
+      if (++stored==block) {
+        evaluate();
+      }
+    }
+    prev = snap;
+  }
+  evaluate();
+
+  for (size_t m=0; m<metric.size(); ++m) {
+    printf("%-20s: total: %.4lf, per delta mean: %.4lf, stddev: %.4lf, min: %.4lf, max: %.4lf, undefined: %lu = %s\n",
+      metric[m].name().c_str(), metric[m].evaluate(total), welford[m].mean(), welford[m].stddev(),
+      welford[m].count() ? min[m] : 0.0, welford[m].count() ? max[m] : 0.0, undefined[m],
+      metric[m].expression().c_str());
+  }
+
+  return reader.status();
+}
+
+int csv(TraceReader& reader) {
+  const TraceHeader& header = reader.header();
+  const Counters counter = counters(header);
+  const TscClock tsc = clock(header);
+  u_int64_t value[TraceHeader::k_MAX_COUNTERS+2];
+
+  printf("\"sample\",\"tsc\",\"ns\",\"cpu\"");
+  for (u_int16_t c=0; c<counter.d_count; ++c) {
+    printf(",\"%s\"", counter.d_mnemonic[c].c_str());
+  }
+  printf("\n");
+
+  Snapshot first, prev, snap;
+  if (!reader.next(&first)) {
+    return reader.status();
+  }
+  prev = first;
+  for (u_int64_t sample=1; reader.next(&snap); ++sample) {
+    if (delta(header, prev, snap, value)) {
+      printf("%lu,%lu,%lu,%u", sample, snap.d_tsc, tsc.toNanoseconds(snap.d_tsc - first.d_tsc), snap.cpu());
+      for (u_int16_t c=0; c<counter.d_count; ++c) {
+        printf(",%lu", value[c]);
+      }
+      printf("\n");
+    }
+    prev = snap;
+  }
+
+  return reader.status();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc>2 && strcmp(argv[1], "record")==0) {
+    const u_int64_t samples = argc>3 ? strtoull(argv[3], 0, 10) : 1000000;
+    return record(argv[2], samples, argc>4 && strcmp(argv[4], "sw")==0);
+  }
+
+  const bool bucketed = argc>3 && strcmp(argv[1], "series")==0 && strtoull(argv[3], 0, 10)>0;
+  if (argc<3 || (strcmp(argv[1], "stats")!=0 && strcmp(argv[1], "csv")!=0 && strcmp(argv[1], "metrics")!=0
+                 && !bucketed)) {
+    fprintf(stderr, "usage: %s record <file> [samples] [sw]\n", argv[0]);
+    fprintf(stderr, "       %s stats <file>\n", argv[0]);
+    fprintf(stderr, "       %s series <file> <bucketMs>\n", argv[0]);
+    fprintf(stderr, "       %s csv <file>\n", argv[0]);
+    fprintf(stderr, "       %s metrics <file> [name=expression ...]\n", argv[0]);
+    return 2;
+  }
+
+  TraceReader reader;
+  if (reader.open(argv[2])!=0) {
+    return 1;
+  }
+
+  int rc;
+  if (strcmp(argv[1], "stats")==0) {
+    rc = stats(reader);
+  } else if (strcmp(argv[1], "csv")==0) {
+    rc = csv(reader);
+  } else if (strcmp(argv[1], "metrics")==0) {
+    rc = metrics(reader, argc-3, argv+3);
+  } else {
+    rc = series(reader, strtoull(argv[3], 0, 10));
+  }
+
+  return rc==0 ? 0 : 1;
+}
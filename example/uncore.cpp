@@ -0,0 +1,223 @@
+#include <intel_xeon_uncore.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Purpose: per socket DRAM bandwidth, LLC lookup rate, and LLC occupancy from the uncore PMUs.
+//
+// Without '--real' a fake two socket machine is made under /tmp: 'cpu/cpu<n>/topology' files, file-backed MSR
+// devices 'msr/<cpu>/msr', and IMC channel and PCU PCI config files 'pci/<device>/config' carrying Skylake-SP device
+// IDs. Each PCU's CAPID6 flags three CHAs, one more than the package's cores, as on parts with cores fused off.
+// Counter values are then written straight into the fake counter registers between two snapshots, so the printed
+// rates only show the plumbing works. With '--real' the Linux sysfs and MSR devices are used while a loop streams
+// through a buffer 'megabytes' large (requires root for PCI config writes, see README).
+//
+// Usage: uncore.tsk [--real] [megabytes]
+
+using namespace Intel::XEON;
+
+namespace {
+
+std::vector<std::string> made;                  // fake files and directories in creation order
+
+int makeDirectory(const std::string& path) {
+  if (mkdir(path.c_str(), 0700)!=0) {
+    fprintf(stderr, "Error: cannot make '%s': %s\n", path.c_str(), strerror(errno));
+    return errno;
+  }
+  made.push_back(path);
+  return 0;
+}
+
+int makeFile(const std::string& path, const void *data, size_t size, off_t length) {
+  // Write 'data' at offset 0 then extend to 'length' bytes so reads of never written registers don't hit EOF
+  int fid = ::open(path.c_str(), O_RDWR|O_CREAT, 0600);
+  if (fid<0 || pwrite(fid, data, size, 0)!=(ssize_t)size || ftruncate(fid, length)!=0) {
+    fprintf(stderr, "Error: cannot make '%s': %s\n", path.c_str(), strerror(errno));
+    if (fid>=0) {
+      close(fid);
+    }
+    return errno ? errno : EIO;
+  }
+  close(fid);
+  made.push_back(path);
+  return 0;
+}
+
+int poke(const std::string& path, u_int32_t offset, u_int64_t value) {
+  // Add 'value' to the 64-bit fake register at 'offset' of 'path' as if hardware counted
+  int fid = ::open(path.c_str(), O_RDWR);
+  u_int64_t old = 0;
+  if (fid<0 || pread(fid, &old, sizeof(old), offset)!=sizeof(old)) {
+    fprintf(stderr, "Error: cannot read '%s': %s\n", path.c_str(), strerror(errno));
+    if (fid>=0) {
+      close(fid);
+    }
+    return 1;
+  }
+  old += value;
+  const int rc = pwrite(fid, &old, sizeof(old), offset)==sizeof(old) ? 0 : 1;
+  close(fid);
+  return rc;
+}
+
+int makeFakeTree(const std::string& root) {
+  // Two packages of two cores with two threads each; three IMC channels and a PCU flagging three CHAs per package on
+  // buses 0x3a and 0xae
+  const int sockets = 2, cores = 2, threads = 2;
+  const char *bus[] = {"0000:3a", "0000:ae"};
+  const char *device[] = {"0a.2", "0a.6", "0b.2"};
+
+  int rc;
+  if ((rc = makeDirectory(root + "/cpu"))!=0 || (rc = makeDirectory(root + "/msr"))!=0 ||
+      (rc = makeDirectory(root + "/pci"))!=0) {
+    return rc;
+  }
+
+  for (int cpu=0; cpu<sockets*cores*threads; ++cpu) {
+    const std::string dir = root + "/cpu/cpu" + std::to_string(cpu);
+    const std::string package = std::to_string(cpu/(cores*threads)) + "\n";
+    const std::string core = std::to_string(cpu%cores) + "\n";
+    if ((rc = makeDirectory(dir))!=0 || (rc = makeDirectory(dir + "/topology"))!=0 ||
+        (rc = makeFile(dir + "/topology/physical_package_id", package.data(), package.size(), package.size()))!=0 ||
+        (rc = makeFile(dir + "/topology/core_id", core.data(), core.size(), core.size()))!=0 ||
+        (rc = makeDirectory(root + "/msr/" + std::to_string(cpu)))!=0 ||
+        (rc = makeFile(root + "/msr/" + std::to_string(cpu) + "/msr", "", 0, 0x1000))!=0) {
+      return rc;
+    }
+  }
+
+  for (int s=0; s<sockets; ++s) {
+    for (int c=0; c<3; ++c) {
+      const std::string dir = root + "/pci/" + bus[s] + ":" + device[c];
+      const u_int16_t id[2] = {Uncore::PCI_VENDOR_INTEL, Uncore::IMC_DEVICE_ID[c]};
+      if ((rc = makeDirectory(dir))!=0 || (rc = makeFile(dir + "/config", id, sizeof(id), 0x1000))!=0) {
+        return rc;
+      }
+    }
+
+    u_int32_t pcu[Uncore::PCU_CAPID6/4+1] = {Uncore::PCI_VENDOR_INTEL|(u_int32_t)Uncore::PCU_CR3_DEVICE_ID<<16};
+    pcu[Uncore::PCU_CAPID6/4] = 0x7;
+    const std::string dir = root + "/pci/" + bus[s] + ":1e.3";
+    if ((rc = makeDirectory(dir))!=0 || (rc = makeFile(dir + "/config", pcu, sizeof(pcu), 0x1000))!=0) {
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+int count(const std::string& root, const Uncore& uncore, u_int64_t milliseconds) {
+  // Write 'milliseconds' worth of fake traffic into every counter: socket 's' reads '(s+1)*4' and writes '(s+1)*2'
+  // GB/s spread over its channels, and looks up its LLC 100M times per second
+  usleep((useconds_t)milliseconds*1000);
+
+  const char *bus[] = {"0000:3a", "0000:ae"};
+  const char *device[] = {"0a.2", "0a.6", "0b.2"};
+  int rc = 0;
+  for (u_int16_t s=0; s<uncore.sockets(); ++s) {
+    const u_int64_t read = (s+1)*4000000ull*milliseconds/Uncore::k_CAS_BYTES;
+    const u_int64_t write = (s+1)*2000000ull*milliseconds/Uncore::k_CAS_BYTES;
+    for (u_int16_t c=0; c<uncore.channels(s); ++c) {
+      const std::string config = root + "/pci/" + bus[s] + ":" + device[c] + "/config";
+      rc |= poke(config, Uncore::IMC_PMON_CTR0, read/uncore.channels(s));
+      rc |= poke(config, Uncore::IMC_PMON_CTR0+8, write/uncore.channels(s));
+    }
+    const std::string msr = root + "/msr/" + std::to_string(uncore.cpu(s)) + "/msr";
+    for (u_int16_t c=0; c<uncore.chas(s); ++c) {
+      const u_int32_t ctr = Uncore::CHA_MSR_PMON_BOX_CTL+c*Uncore::CHA_MSR_OFFSET+Uncore::CHA_PMON_CTR0;
+      rc |= poke(msr, ctr, 100000ull*milliseconds/uncore.chas(s));
+    }
+    // 'makeFakeTree' runs with a 64Kb occupancy scale: 160 units are 10MiB
+    rc |= poke(msr, Uncore::IA32_QM_CTR, 160*(s+1));
+  }
+  return rc;
+}
+
+void stream(std::vector<u_int64_t> *buffer, u_int32_t passes) {
+  // Read every word of 'buffer' and write its successor so traffic goes both ways
+  u_int64_t *data = buffer->data();
+  const size_t size = buffer->size();
+  for (u_int32_t p=0; p<passes; ++p) {
+    for (size_t i=1; i<size; ++i) {
+      data[i] += data[i-1];
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool real = false;
+  u_int64_t megabytes = 512;
+
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "--real")==0) {
+      real = true;
+    } else {
+      megabytes = (u_int64_t)atoll(argv[i]);
+    }
+  }
+
+  if (megabytes==0) {
+    fprintf(stderr, "usage: %s [--real] [megabytes]\n", argv[0]);
+    return 1;
+  }
+
+  Uncore::Options options;
+  char root[64] = "";
+  if (!real) {
+    strcpy(root, "/tmp/pmc-fake-uncore.XXXXXX");
+    if (mkdtemp(root)==0) {
+      fprintf(stderr, "Error: cannot make fake uncore directory: %s\n", strerror(errno));
+      return 1;
+    }
+    if (makeFakeTree(root)!=0) {
+      return 1;
+    }
+    options.d_cpuRoot = std::string(root) + "/cpu";
+    options.d_msrRoot = std::string(root) + "/msr";
+    options.d_pciRoot = std::string(root) + "/pci";
+    options.d_occupancyScale = 65536;
+  }
+
+  int rc = 0;
+  {
+    Uncore uncore(options);
+    std::vector<UncoreSnapshot> begin, end;
+    if ((rc = uncore.status())!=0 || (rc = uncore.reset())!=0 || (rc = uncore.start())!=0 ||
+        (rc = uncore.snapshot(&begin))!=0) {
+      fprintf(stderr, "Error: cannot start uncore PMU: %s\n", strerror(rc));
+    } else {
+      if (real) {
+        std::vector<u_int64_t> buffer(megabytes*1024*1024/sizeof(u_int64_t), 1);
+        stream(&buffer, 4);
+      } else {
+        rc = count(root, uncore, 100);
+      }
+      if (rc==0 && (rc = uncore.snapshot(&end))==0) {
+        uncore.pause();
+        std::cout << uncore << std::endl;
+        uncore.print(std::cout, begin, end);
+      }
+    }
+  }
+
+  for (auto iter = made.rbegin(); iter!=made.rend(); ++iter) {
+    remove(iter->c_str());
+  }
+  if (!real) {
+    rmdir(root);
+  }
+
+  return rc==0 ? 0 : 1;
+}
@@ -0,0 +1,408 @@
+#include <intel_pmu_benchmark.h>
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <regex>
+
+namespace {
+
+std::vector<Intel::Benchmark*>& benchmarks() {
+  // Function local so registration from other translation units' static initializers finds it constructed
+  static std::vector<Intel::Benchmark*> registry;
+  return registry;
+}
+
+std::string quote(const std::string& text) {
+  // JSON string with quote, backslash, and control characters escaped
+  std::string result("\"");
+  for (char c: text) {
+    if (c=='"' || c=='\\') {
+      result += '\\';
+      result += c;
+    } else if ((unsigned char)c<0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+      result += buf;
+    } else {
+      result += c;
+    }
+  }
+  return result += '"';
+}
+
+std::string csvQuote(const std::string& text) {
+  // CSV field with embedded quotes doubled
+  std::string result("\"");
+  for (char c: text) {
+    result += c;
+    if (c=='"') {
+      result += c;
+    }
+  }
+  return result += '"';
+}
+
+double ratio(const Intel::Runner::Result& result, Intel::Runner::Counter numerator,
+             Intel::Runner::Counter denominator) {
+  const double d = result.d_counter[denominator].mean();
+  return d!=0.0 ? result.d_counter[numerator].mean()/d : 0.0;
+}
+
+struct Derived {
+  const char            *d_mnemonic;    // name in output
+  const char            *d_description; // what it is
+  Intel::Runner::Counter d_numerator;   // mean of this counter
+  Intel::Runner::Counter d_denominator; // over mean of this counter
+};
+
+const Derived k_DERIVED[] = {
+  { "IPC",      "retired instructions per cycle",           Intel::Runner::k_F0, Intel::Runner::k_F1 },
+  { "CPI",      "cycles per retired instruction",           Intel::Runner::k_F1, Intel::Runner::k_F0 },
+  { "CORE/REF", "core over reference cycles i.e. frequency", Intel::Runner::k_F1, Intel::Runner::k_F2 },
+};
+
+} // anon namespace
+
+Intel::Benchmark::Benchmark(const char *name, Function function)
+: d_name(name)
+, d_function(function)
+, d_config(XEON::PMU::k_DEFAULT_XEON_CONFIG_0)
+, d_warmup(0)
+, d_repetitions(0)
+, d_mode(Stats::k_MIN_MAX)
+, d_calibrate(false)
+, d_frequency(false)
+{
+  assert(name);
+  assert(function);
+}
+
+Intel::Benchmark *Intel::Benchmark::define(const char *name, Function function) {
+  Benchmark *benchmark = new Benchmark(name, function);
+  benchmarks().push_back(benchmark);
+  return benchmark;
+}
+
+const std::vector<Intel::Benchmark*>& Intel::Benchmark::registry() {
+  return benchmarks();
+}
+
+int Intel::Benchmark::main(int argc, char **argv) {
+  std::string filter(".*");
+  std::string out;
+  Format format = k_CONSOLE;
+  bool list = false;
+
+  for (int i=1; i<argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg.compare(0, 9, "--filter=")==0) {
+      filter = arg.substr(9);
+    } else if (arg.compare(0, 9, "--format=")==0) {
+      const std::string value = arg.substr(9);
+      if (value=="console") {
+        format = k_CONSOLE;
+      } else if (value=="json") {
+        format = k_JSON;
+      } else if (value=="csv") {
+        format = k_CSV;
+      } else {
+        fprintf(stderr, "Error: unknown format '%s'; expected console, json, or csv\n", value.c_str());
+        return EINVAL;
+      }
+    } else if (arg.compare(0, 6, "--out=")==0) {
+      out = arg.substr(6);
+    } else if (arg=="--list") {
+      list = true;
+    } else {
+      fprintf(stderr, "usage: %s [--filter=<regex>] [--format=console|json|csv] [--out=<file>] [--list]\n", argv[0]);
+      return EINVAL;
+    }
+  }
+
+  std::regex pattern;
+  try {
+    pattern = std::regex(filter, std::regex::ECMAScript);
+  } catch (const std::regex_error& e) {
+    fprintf(stderr, "Error: invalid filter '%s': %s\n", filter.c_str(), e.what());
+    return EINVAL;
+  }
+
+  std::ofstream file;
+  if (!out.empty()) {
+    file.open(out);
+    if (!file) {
+      fprintf(stderr, "Error: cannot open '%s' for writing: %s\n", out.c_str(), strerror(errno));
+      return errno ? errno : EIO;
+    }
+  }
+  std::ostream& stream = out.empty() ? std::cout : file;
+
+  std::vector<BenchmarkResult> result;
+  for (Benchmark *benchmark: benchmarks()) {
+    const std::vector<std::string> name = benchmark->runNames();
+    for (u_int32_t i=0; i<name.size(); ++i) {
+      if (!std::regex_search(name[i], pattern)) {
+        continue;
+      }
+      if (list) {
+        stream << name[i] << std::endl;
+        continue;
+      }
+      result.emplace_back();
+      const u_int64_t param = benchmark->d_param.empty() ? 0 : benchmark->d_param[i];
+      int rc = benchmark->run(param, &result.back(), format==k_CONSOLE ? &stream : 0);
+      if (rc!=0) {
+        fprintf(stderr, "Error: benchmark '%s' failed: %s\n", name[i].c_str(), strerror(rc));
+        return rc;
+      }
+    }
+  }
+
+  if (format==k_JSON && !list) {
+    writeJson(stream, result);
+  } else if (format==k_CSV && !list) {
+    writeCsv(stream, result);
+  }
+
+  stream.flush();
+  if (!stream) {
+    fprintf(stderr, "Error: cannot write output\n");
+    return EIO;
+  }
+
+  return 0;
+}
+
+void Intel::Benchmark::writeJson(std::ostream& stream, const std::vector<BenchmarkResult>& result) {
+  char buf[128];
+
+  stream << "{\n  \"benchmarks\": [";
+  for (u_int32_t r=0; r<result.size(); ++r) {
+    const BenchmarkResult& res = result[r];
+    stream << (r ? ",\n" : "\n")
+           << "    {\n"
+           << "      \"name\": " << quote(res.d_name) << ",\n"
+           << "      \"benchmark\": " << quote(res.d_benchmark) << ",\n"
+           << "      \"param\": " << res.d_param << ",\n"
+           << "      \"iterations\": " << res.d_result.d_iterations << ",\n"
+           << "      \"warmup\": " << res.d_result.d_warmup << ",\n"
+           << "      \"outliers\": " << res.d_result.d_outliers << ",\n"
+           << "      \"migrations\": " << res.d_result.d_migrations << ",\n"
+           << "      \"converged\": " << (res.d_result.d_converged ? "true" : "false") << ",\n"
+           << "      \"stable\": " << (res.d_result.d_stable ? "true" : "false") << ",\n"
+           << "      \"retries\": " << res.d_result.d_retries << ",\n"
+           << "      \"ghz\": " << res.d_ghz << ",\n"
+           << "      \"counters\": [";
+
+    for (u_int32_t c=0; c<res.d_mnemonic.size(); ++c) {
+      const Welford& w = res.d_result.d_counter[c];
+      snprintf(buf, sizeof(buf), "\"count\": %lu, \"mean\": %.17g, \"stddev\": %.17g, \"ci\": %.17g",
+        w.count(), w.mean(), w.stddev(), w.halfWidth(res.d_z));
+      stream << (c ? ",\n" : "\n")
+             << "        { \"mnemonic\": " << quote(res.d_mnemonic[c])
+             << ", \"description\": " << quote(res.d_description[c])
+             << ", " << buf << " }";
+    }
+
+    stream << "\n      ],\n      \"derived\": {";
+    for (u_int32_t d=0; d<sizeof(k_DERIVED)/sizeof(k_DERIVED[0]); ++d) {
+      snprintf(buf, sizeof(buf), "%.17g", ratio(res.d_result, k_DERIVED[d].d_numerator, k_DERIVED[d].d_denominator));
+      stream << (d ? ", " : " ") << quote(k_DERIVED[d].d_mnemonic) << ": " << buf;
+    }
+    stream << " }\n    }";
+  }
+  stream << "\n  ]\n}\n";
+}
+
+void Intel::Benchmark::writeCsv(std::ostream& stream, const std::vector<BenchmarkResult>& result) {
+  char buf[160];
+
+  stream << "\"name\",\"benchmark\",\"param\",\"iterations\",\"warmup\",\"outliers\",\"migrations\",\"converged\","
+         << "\"mnemonic\",\"description\",\"count\",\"mean\",\"stddev\",\"ci\"\n";
+
+  for (const BenchmarkResult& res: result) {
+    snprintf(buf, sizeof(buf), ",%lu,%lu,%lu,%lu,%lu,%d,", res.d_param, res.d_result.d_iterations,
+      res.d_result.d_warmup, res.d_result.d_outliers, res.d_result.d_migrations, res.d_result.d_converged ? 1 : 0);
+    const std::string prefix = csvQuote(res.d_name) + "," + csvQuote(res.d_benchmark) + buf;
+
+    for (u_int32_t c=0; c<res.d_mnemonic.size(); ++c) {
+      const Welford& w = res.d_result.d_counter[c];
+      snprintf(buf, sizeof(buf), ",%lu,%.17g,%.17g,%.17g", w.count(), w.mean(), w.stddev(), w.halfWidth(res.d_z));
+      stream << prefix << csvQuote(res.d_mnemonic[c]) << "," << csvQuote(res.d_description[c]) << buf << "\n";
+    }
+
+    for (const Derived& d: k_DERIVED) {
+      snprintf(buf, sizeof(buf), ",%lu,%.17g,,", res.d_result.d_counter[d.d_denominator].count(),
+        ratio(res.d_result, d.d_numerator, d.d_denominator));
+      stream << prefix << csvQuote(d.d_mnemonic) << "," << csvQuote(d.d_description) << buf << "\n";
+    }
+  }
+}
+
+std::vector<std::string> Intel::Benchmark::runNames() const {
+  std::vector<std::string> name;
+  if (d_param.empty()) {
+    name.push_back(d_name);
+  }
+  for (u_int64_t param: d_param) {
+    name.push_back(d_name + "/" + std::to_string(param));
+  }
+  return name;
+}
+
+Intel::Benchmark *Intel::Benchmark::arg(u_int64_t value) {
+  d_param.push_back(value);
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::range(u_int64_t first, u_int64_t last, u_int64_t multiplier) {
+  assert(first>0);
+  assert(multiplier>1);
+  for (u_int64_t value=first; value<=last; value*=multiplier) {
+    d_param.push_back(value);
+    if (value>last/multiplier) {
+      break;
+    }
+  }
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::config(XEON::PMU::ProgCounterSetConfig config) {
+  d_config = config;
+  d_eventSelect.clear();
+  d_eventName.clear();
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::events(const std::vector<u_int64_t>& eventSelect,
+                                           const std::vector<std::string>& description) {
+  assert(eventSelect.size()==description.size());
+  assert(eventSelect.size()<=XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF);
+  d_eventSelect = eventSelect;
+  d_eventName = description;
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::warmup(u_int32_t iterations) {
+  d_warmup = iterations;
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::repetitions(u_int32_t iterations) {
+  assert(iterations==0 || iterations>=2);
+  d_repetitions = iterations;
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::precision(Runner::Counter counter, double relativeWidth, u_int32_t maxIterations) {
+  d_repetitions = 0;
+  d_options.d_counter = counter;
+  d_options.d_relativeWidth = relativeWidth;
+  d_options.d_maxIterations = maxIterations;
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::calibrate() {
+  d_calibrate = true;
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::histogram() {
+  d_mode = Stats::k_HISTOGRAM;
+  return this;
+}
+
+Intel::Benchmark *Intel::Benchmark::frequency(double maxVariation, u_int32_t retries) {
+  d_frequency = true;
+  d_options.d_maxFrequencyVariation = maxVariation;
+  d_options.d_retries = retries;
+  return this;
+}
+
+int Intel::Benchmark::run(u_int64_t param, BenchmarkResult *result, std::ostream *console) {
+  assert(result);
+
+  std::unique_ptr<XEON::PMU> pmu;
+  if (d_eventSelect.empty()) {
+    pmu.reset(new XEON::PMU(d_config));
+  } else {
+    const char *description[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];
+    for (u_int32_t i=0; i<d_eventName.size(); ++i) {
+      description[i] = d_eventName[i].c_str();
+    }
+    pmu.reset(new XEON::PMU((u_int16_t)d_eventSelect.size(), d_eventSelect.data(), description));
+  }
+
+  int rc;
+  if ((rc = pmu->status())!=0 || (rc = pmu->reset())!=0 || (rc = pmu->start())!=0) {
+    return rc;
+  }
+
+  // Fixed repetitions: every iteration kept, no changepoint search, no outliers, no early stop
+  Runner::Options options = d_options;
+  if (d_repetitions>0) {
+    options.d_minIterations = d_repetitions;
+    options.d_maxIterations = d_repetitions;
+    options.d_maxWarmup = 0;
+    options.d_outlierZ = std::numeric_limits<double>::infinity();
+  }
+
+  // Empty iterations measured the way 'BenchmarkState::next' measures the body
+  Calibration calibration;
+  if (d_calibrate) {
+    if ((rc = calibration.calibrate(*pmu, options.d_fence))!=0) {
+      return rc;
+    }
+    options.d_overhead = calibration.overhead();
+  }
+
+  // APERF/MPERF are per cpu: read the one the PMU counts on
+  std::unique_ptr<XEON::Frequency> frequency;
+  if (d_frequency) {
+    XEON::Frequency::Options frequencyOptions;
+    frequencyOptions.d_cpu = pmu->coreId();
+    frequency.reset(new XEON::Frequency(frequencyOptions));
+    if (frequency->status()==0) {
+      pmu->setFrequency(frequency.get());
+    } else {
+      fprintf(stderr, "Warning: '%s' measured without frequency and throttle checks\n", d_name.c_str());
+    }
+  }
+
+  Runner runner(*pmu, options, d_mode);
+  do {
+    BenchmarkState state(*pmu, runner, param, d_warmup);
+    if (!state.valid()) {
+      pmu->setFrequency(0);
+      return EINVAL;
+    }
+    d_function(state);
+  } while (runner.retry());
+  pmu->pause();
+  pmu->setFrequency(0);
+
+  result->d_name = d_param.empty() ? d_name : d_name + "/" + std::to_string(param);
+  result->d_benchmark = d_name;
+  result->d_param = param;
+  result->d_result = runner.result();
+  result->d_z = options.d_z;
+  result->d_ghz = runner.stats().effectiveGhz();
+  result->d_mnemonic = { "R0", "A0" };
+  result->d_description = { "rdtsc cycles", "active (not paused) rdtsc cycles" };
+  for (u_int16_t i=0; i<pmu->fixedCountersDefined(); ++i) {
+    result->d_mnemonic.push_back(pmu->fixedMnemonic()[i]);
+    result->d_description.push_back(pmu->fixedDescription()[i]);
+  }
+  for (u_int16_t i=0; i<pmu->programmableCountersDefined(); ++i) {
+    result->d_mnemonic.push_back(pmu->programmableMnemonic()[i]);
+    result->d_description.push_back(pmu->programmableDescription()[i]);
+  }
+
+  if (console) {
+    *console << result->d_name << std::endl << runner << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+// PURPOSE: Register, select, run, and report PMU measured benchmarks without per benchmark boilerplate
+//
+// CLASSES:
+//  Intel::BenchmarkState:  Handed to a benchmark body. The body does its setup, then loops 'while (state.next())'
+//                          over the measured code. Each 'next()' snapshots the PMU so only the loop body is measured;
+//                          explicit warmup iterations are run then dropped, and the rest go through a 'Runner' which
+//                          stops after a fixed repetition count or once the CI of the chosen counter is tight enough.
+//  Intel::BenchmarkResult: Name, parameter, iteration counts, and per counter mean/stddev/CI of one benchmark run.
+//  Intel::Benchmark:       One registered benchmark: body, event set, parameter sweep, and warmup/repetition control.
+//                          'PMCBENCH(function)' registers one at static initialization returning a 'Benchmark*' for
+//                          chained configuration. 'Benchmark::main' runs those whose 'name/param' matches a command
+//                          line filter and writes results to the console, JSON, or CSV.
+//
+// Usage:
+//   void randomWrite(Intel::BenchmarkState& state) {
+//     std::vector<int> v(state.param());                 // not measured
+//     while (state.next()) {
+//       v[random() % v.size()] = 1;                      // measured once per iteration
+//     }
+//   }
+//   PMCBENCH(randomWrite)->range(1<<10, 1<<20, 32)->config(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0);
+//   PMCBENCH_MAIN();
+//
+// Command line of 'PMCBENCH_MAIN' programs:
+//   --filter=<regex>          run benchmarks whose 'name/param' matches ECMAScript 'regex'; default all
+//   --format=console|json|csv output format; default console
+//   --out=<file>              write output to 'file' instead of stdout
+//   --list                    print matching 'name/param' and exit
+
+#include <intel_pmu_calibration.h>
+#include <intel_pmu_runner.h>
+#include <intel_xeon_pmu.h>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Intel {
+
+class BenchmarkState {
+  // DATA
+  XEON::PMU&             d_pmu;         // PMU measuring the body
+  Runner&                d_runner;      // stop rule and statistics of measured iterations
+  u_int64_t              d_param;       // sweep value of this run
+  u_int32_t              d_warmup;      // explicit warmup iterations left
+  bool                   d_measuring;   // true if 'd_begin' was taken and the iteration's end is due
+  bool                   d_done;        // true once the runner's stop rule was met or it rejected its options
+  bool                   d_valid;       // false if the runner rejected its options
+  XEON::PMU::FencePolicy d_fence;       // serialization of snapshots
+  XEON::Snapshot         d_begin;       // snapshot before the current iteration
+  XEON::Snapshot         d_end;         // snapshot after the last iteration
+
+public:
+  // CREATORS
+  BenchmarkState(XEON::PMU& pmu, Runner& runner, u_int64_t param, u_int32_t warmup);
+    // Create a state measuring with specified 'pmu' whose iterations are fed to specified 'runner' after specified
+    // 'warmup' iterations are dropped. Specified 'param' is the sweep value. 'runner.start()' is called here.
+
+  BenchmarkState(const BenchmarkState& other) = delete;
+    // Copy constructor not supported
+
+  ~BenchmarkState() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  u_int64_t param() const;
+    // Return the parameter of this run e.g. an array size, or 0 if the benchmark has no sweep
+
+  bool valid() const;
+    // Return false if the runner rejected its options in which case 'next()' always returns false
+
+  // MANIPULATORS
+  bool next();
+    // Return true if the body should run its measured code once more, and false once the runner's stop rule is met.
+    // Ends the measurement of the previous iteration, if any, and starts that of the next.
+
+  int pause();
+    // Return 0 if PMU counting stopped e.g. to keep per iteration setup out of the measurement, and non-zero
+    // otherwise. See 'PMU::pause'.
+
+  int resume();
+    // Return 0 if PMU counting resumed after 'pause()' and non-zero otherwise. See 'PMU::resume'.
+
+  XEON::PMU& pmu();
+    // Return a modifiable reference to the PMU measuring the body
+
+  BenchmarkState& operator=(const BenchmarkState& rhs) = delete;
+    // Assignment operator not supported
+};
+
+struct BenchmarkResult {
+  std::string              d_name;        // '<benchmark>/<param>' or '<benchmark>' without a sweep
+  std::string              d_benchmark;   // registered name
+  u_int64_t                d_param;       // sweep value or 0
+  Runner::Result           d_result;      // iteration counts and statistics by counter
+  double                   d_z;           // normal quantile of the reported CI e.g. 1.96 for 95%
+  double                   d_ghz;         // average effective GHz per APERF/MPERF or 0 if not read
+  std::vector<std::string> d_mnemonic;    // mnemonic by counter e.g. "R0", "F1", "P0"
+  std::vector<std::string> d_description; // description by counter
+};
+
+class Benchmark {
+public:
+  // TYPES
+  typedef void (*Function)(BenchmarkState& state);
+    // Benchmark body
+
+  enum Format {
+    k_CONSOLE = 0,                      // 'Runner' pretty print per run
+    k_JSON    = 1,                      // one JSON document
+    k_CSV     = 2,                      // one row per run and counter
+  };
+
+private:
+  // DATA
+  std::string                     d_name;        // registered name
+  Function                        d_function;    // body
+  std::vector<u_int64_t>          d_param;       // sweep values; empty for one run with param 0
+  XEON::PMU::ProgCounterSetConfig d_config;      // event set if 'd_eventSelect' is empty
+  std::vector<u_int64_t>          d_eventSelect; // explicit event set
+  std::vector<std::string>        d_eventName;   // description by 'd_eventSelect' entry
+  u_int32_t                       d_warmup;      // explicit warmup iterations dropped before measuring
+  u_int32_t                       d_repetitions; // fixed number of measured iterations or 0 for adaptive
+  Runner::Options                 d_options;     // adaptive stop rule
+  Stats::Mode                     d_mode;        // 'Stats' mode of each run
+  bool                            d_calibrate;   // true to subtract measurement overhead calibrated per run
+  bool                            d_frequency;   // true to read APERF/MPERF and throttle bits around iterations
+
+  // PRIVATE CREATORS
+  Benchmark(const char *name, Function function);
+    // Create a benchmark of specified 'name' running specified 'function' with default settings: event set
+    // 'k_DEFAULT_XEON_CONFIG_0', no sweep, no explicit warmup, adaptive repetitions with default 'Runner::Options'
+
+public:
+  // CLASS METHODS
+  static Benchmark *define(const char *name, Function function);
+    // Return a pointer to a new benchmark of specified 'name' running specified 'function', added to the registry.
+    // The benchmark lives until exit.
+
+  static const std::vector<Benchmark*>& registry();
+    // Return the registered benchmarks in registration order
+
+  static int main(int argc, char **argv);
+    // Return 0 after running the registered benchmarks selected per the command line given by specified 'argc' and
+    // 'argv' and writing their results, and non-zero if the command line is invalid, output cannot be written, or a
+    // PMU cannot be set up. See file header for options.
+
+  static void writeJson(std::ostream& stream, const std::vector<BenchmarkResult>& result);
+    // Write specified 'result' to specified 'stream' as one JSON document
+
+  static void writeCsv(std::ostream& stream, const std::vector<BenchmarkResult>& result);
+    // Write specified 'result' to specified 'stream' as CSV: a header row, then one row per run and counter followed
+    // by derived values 'IPC' (F0/F1), 'CPI' (F1/F0), and 'CORE/REF' (F1/F2 i.e. effective over nominal frequency)
+
+  // CREATORS
+  Benchmark(const Benchmark& other) = delete;
+    // Copy constructor not supported
+
+  ~Benchmark() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  const std::string& name() const;
+    // Return the registered name
+
+  std::vector<std::string> runNames() const;
+    // Return '<name>/<param>' by sweep value, or just '<name>' without a sweep
+
+  // MANIPULATORS
+  Benchmark *arg(u_int64_t value);
+    // Add specified 'value' to the sweep returning this object
+
+  Benchmark *range(u_int64_t first, u_int64_t last, u_int64_t multiplier = 2);
+    // Add 'first', 'first*multiplier', ... through at most specified 'last' to the sweep returning this object. The
+    // behavior is defined if 'first>0' and 'multiplier>1'.
+
+  Benchmark *config(XEON::PMU::ProgCounterSetConfig config);
+    // Measure with specified predefined event set returning this object
+
+  Benchmark *events(const std::vector<u_int64_t>& eventSelect, const std::vector<std::string>& description);
+    // Measure with specified 'eventSelect' values described by specified 'description' returning this object. The
+    // behavior is defined if both have the same size, at most 'k_MAX_PROG_COUNTERS_HT_OFF'.
+
+  Benchmark *warmup(u_int32_t iterations);
+    // Run specified 'iterations' unmeasured before measuring returning this object. This is in addition to the
+    // runner's changepoint warmup detection, which applies in adaptive mode.
+
+  Benchmark *repetitions(u_int32_t iterations);
+    // Measure exactly specified 'iterations' with no warmup detection or outlier rejection returning this object, or
+    // adaptively if 0. The behavior is defined if 'iterations' is 0 or at least 2.
+
+  Benchmark *precision(Runner::Counter counter, double relativeWidth, u_int32_t maxIterations = 100000);
+    // Measure adaptively until the CI of specified 'counter' is within specified 'relativeWidth' of its mean, or
+    // optionally specified 'maxIterations' ran, returning this object
+
+  Benchmark *calibrate();
+    // Before each run measure the overhead of an empty iteration with the run's PMU and event set, and subtract it
+    // from every iteration's counts, returning this object. Use when the measured code is about as cheap as reading
+    // the counters e.g. nanosecond scale lookups.
+
+  Benchmark *histogram();
+    // Keep percentile histograms of each run's counters and include them in console output returning this object
+
+  Benchmark *frequency(double maxVariation = 0.02, u_int32_t retries = 2);
+    // Read the effective frequency and throttle state around every iteration, and discard and rerun, up to
+    // optionally specified 'retries' times, runs that were throttled or whose GHz standard deviation over
+    // 'Stats::k_FREQUENCY_WINDOW_US' windows exceeds optionally specified 'maxVariation' of the average, returning
+    // this object. Needs the MSR device of the cpu the benchmark runs on; without it runs are measured as usual with
+    // a warning.
+
+  int run(u_int64_t param, BenchmarkResult *result, std::ostream *console);
+    // Return 0 after running this benchmark once with specified 'param' loading its statistics into specified
+    // 'result', and printing the runner to optionally specified 'console' if not 0, and errno otherwise.
+
+  Benchmark& operator=(const Benchmark& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+BenchmarkState::BenchmarkState(XEON::PMU& pmu, Runner& runner, u_int64_t param, u_int32_t warmup)
+: d_pmu(pmu)
+, d_runner(runner)
+, d_param(param)
+, d_warmup(warmup)
+, d_measuring(false)
+, d_done(false)
+, d_valid(runner.start()==0)
+, d_fence(runner.options().d_fence)
+{
+  d_done = !d_valid;
+}
+
+// ACCESSORS
+inline
+u_int64_t BenchmarkState::param() const {
+  return d_param;
+}
+
+inline
+bool BenchmarkState::valid() const {
+  return d_valid;
+}
+
+// MANIPULATORS
+inline
+bool BenchmarkState::next() {
+  if (d_measuring) {
+    d_pmu.snapshot(&d_end, d_fence);
+    if (d_warmup>0) {
+      --d_warmup;
+    } else if (!d_runner.add(d_begin, d_end)) {
+      d_measuring = false;
+      d_done = true;
+      return false;
+    }
+  } else if (d_done) {
+    return false;
+  }
+
+  d_measuring = true;
+  d_pmu.snapshotBegin(&d_begin, d_fence);
+  return true;
+}
+
+inline
+int BenchmarkState::pause() {
+  return d_pmu.pause();
+}
+
+inline
+int BenchmarkState::resume() {
+  return d_pmu.resume();
+}
+
+inline
+XEON::PMU& BenchmarkState::pmu() {
+  return d_pmu;
+}
+
+// ACCESSORS
+inline
+const std::string& Benchmark::name() const {
+  return d_name;
+}
+
+} // namespace Intel
+
+// MACROS
+#define PMCBENCH_CONCAT_IMPL(a, b) a##b
+#define PMCBENCH_CONCAT(a, b) PMCBENCH_CONCAT_IMPL(a, b)
+
+#define PMCBENCH(function)                                                                                             \
+  static Intel::Benchmark *PMCBENCH_CONCAT(pmcbench_, __LINE__) __attribute__((unused)) =                              \
+    Intel::Benchmark::define(#function, function)
+  // Register specified benchmark body 'function' under its own name. Chain configuration with '->' e.g.
+  // 'PMCBENCH(f)->range(1, 1024)->repetitions(10);'
+
+#define PMCBENCH_MAIN()                                                                                                \
+  int main(int argc, char **argv) {                                                                                    \
+    return Intel::Benchmark::main(argc, argv);                                                                         \
+  }
+  // Define 'main' running registered benchmarks per the command line
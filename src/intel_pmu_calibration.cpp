@@ -0,0 +1,110 @@
+#include <intel_pmu_calibration.h>
+
+#include <iostream>
+
+Intel::Calibration::Calibration()
+: d_histogram(new Histogram[k_COUNTERS])
+, d_samples(0)
+, d_migrations(0)
+, d_progCount(0)
+, d_percentile(50.0)
+, d_fence(XEON::PMU::k_FENCE_MFENCE_LFENCE)
+{
+  memset(d_overhead, 0, sizeof(d_overhead));
+}
+
+Intel::Calibration::~Calibration() {
+  delete [] d_histogram;
+}
+
+int Intel::Calibration::calibrate(const XEON::PMU& pmu, XEON::PMU::FencePolicy fence, u_int32_t samples,
+                                  double percentile) {
+  if (samples==0 || percentile<0.0 || percentile>100.0) {
+    fprintf(stderr, "Error: calibration needs samples>0 and percentile in [0, 100]\n");
+    return EINVAL;
+  }
+
+  for (u_int16_t i=0; i<k_COUNTERS; ++i) {
+    d_histogram[i].reset();
+  }
+  memset(d_overhead, 0, sizeof(d_overhead));
+
+  d_progCount = pmu.programmableCountersDefined();
+  d_percentile = percentile;
+  d_fence = fence;
+  d_samples = d_migrations = 0;
+
+  const u_int64_t fixedMask = pmu.fixedCounterMask();
+  const u_int64_t progMask = pmu.programmableCounterMask();
+  const u_int16_t fixed = 2;
+  const u_int16_t prog = 2+XEON::PMU::k_FIXED_COUNTERS;
+
+  // Unrecorded rounds first so code and data of the snapshot path are hot as they are in a measurement loop
+  XEON::Snapshot begin, end;
+  for (u_int32_t i=0; i<samples/10+1; ++i) {
+    pmu.snapshotBegin(&begin, fence);
+    pmu.snapshot(&end, fence);
+  }
+
+  const bool perCore = pmu.backend()==XEON::PMU::k_BACKEND_MSR;
+  for (u_int32_t s=0; s<samples; ++s) {
+    pmu.snapshotBegin(&begin, fence);
+    pmu.snapshot(&end, fence);
+
+    // Per core counters read on two cores don't subtract
+    if (perCore && begin.d_aux!=end.d_aux) {
+      ++d_migrations;
+      continue;
+    }
+
+    ++d_samples;
+    const u_int64_t tsc = end.d_tsc - begin.d_tsc;
+    d_histogram[0].record(tsc);
+    d_histogram[1].record(tsc - (end.d_paused - begin.d_paused));
+    for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+      d_histogram[fixed+i].record((end.d_fixed[i] - begin.d_fixed[i]) & fixedMask);
+    }
+    for (u_int16_t i=0; i<d_progCount; ++i) {
+      d_histogram[prog+i].record((end.d_prog[i] - begin.d_prog[i]) & progMask);
+    }
+  }
+
+  for (u_int16_t i=0; i<prog+d_progCount; ++i) {
+    d_overhead[i] = d_histogram[i].percentile(percentile);
+  }
+
+  return 0;
+}
+
+std::ostream& Intel::Calibration::print(std::ostream& stream, const XEON::PMU& pmu) const {
+  stream << "Intel XEON CPU HW Core "
+         << pmu.coreId()
+         << " PMU Calibration on "
+         << d_samples
+         << " empty regions ("
+         << d_migrations
+         << " dropped on cpu migration), overhead is p"
+         << d_percentile
+         << ":"
+         << std::endl;
+
+  char buf[256];
+  auto line = [&buf, &stream, this](u_int16_t i, const char *mnemonic, const char *description) {
+    const Histogram& h = d_histogram[i];
+    snprintf(buf, sizeof(buf), "%-3s [%-48s]: overhead: %012lu, min: %012lu, max: %012lu, avg: %lf\n",
+      mnemonic, description, d_overhead[i], h.min(), h.max(), h.mean());
+    stream << buf;
+  };
+
+  line(0, "R0", "rdtsc cycles");
+  line(1, "A0", "active (not paused) rdtsc cycles");
+  for (u_int16_t i=0; i<pmu.fixedCountersDefined(); ++i) {
+    line(2+i, pmu.fixedMnemonic()[i].c_str(), pmu.fixedDescription()[i].c_str());
+  }
+  for (u_int16_t i=0; i<pmu.programmableCountersDefined() && i<d_progCount; ++i) {
+    line(2+XEON::PMU::k_FIXED_COUNTERS+i, pmu.programmableMnemonic()[i].c_str(),
+      pmu.programmableDescription()[i].c_str());
+  }
+
+  return stream;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+// PURPOSE: Measure what reading the PMU itself adds to every delta so it can be subtracted
+//
+// CLASSES:
+//  Intel::Calibration: Takes many back-to-back 'PMU::snapshotBegin' and 'PMU::snapshot' pairs with nothing between
+//                      them i.e. measures an empty region, for the event set the PMU is programmed with. The delta
+//                      distribution of every counter (rdtsc, fixed, and programmable e.g. retired instructions,
+//                      cycles, branches, LLC references) is kept in a 'Histogram' and one overhead per counter, the
+//                      median by default, is chosen. 'Stats::setOverhead', 'Runner::Options::d_overhead', and
+//                      'correct' subtract it from deltas, saturating at 0. Recalibrate when the event set or fence
+//                      policy changes. With the MSR backend a pair read on two cpus mixes two cores' counters, so such
+//                      pairs are counted in 'migrations()' and dropped as 'Runner' and 'Stats' do.
+
+#include <intel_pmu_histogram.h>
+#include <intel_pmu_stats.h>
+#include <intel_xeon_pmu.h>
+
+#include <iosfwd>
+
+namespace Intel {
+
+class Calibration {
+public:
+  // ENUM
+  enum Support {
+    k_COUNTERS = Stats::k_HISTOGRAMS,   // rdtsc, active rdtsc, then fixed, then programmable counters
+  };
+
+private:
+  // DATA
+  Histogram             *d_histogram;            // empty region delta distribution by counter
+  u_int64_t              d_overhead[k_COUNTERS]; // chosen overhead by counter; 0 if not calibrated
+  u_int32_t              d_samples;              // empty regions kept by the last 'calibrate'
+  u_int32_t              d_migrations;           // empty regions dropped by the last 'calibrate' as the cpu changed
+  u_int16_t              d_progCount;            // programmable counters defined in the calibrated PMU
+  double                 d_percentile;           // percentile of each distribution taken as its overhead
+  XEON::PMU::FencePolicy d_fence;                // serialization used by the last 'calibrate'
+
+public:
+  // CREATORS
+  Calibration();
+    // Create an uncalibrated object: every overhead is 0. About 200Kb of histograms are allocated here.
+
+  Calibration(const Calibration& other) = delete;
+    // Copy constructor not supported
+
+  ~Calibration();
+    // Destroy this object
+
+  // ACCESSORS
+  u_int32_t samples() const;
+    // Return the number of empty regions measured and kept or 0 if not calibrated
+
+  u_int32_t migrations() const;
+    // Return the number of empty regions the last 'calibrate' dropped since their snapshots were read on different
+    // cpus of an MSR backend PMU
+
+  XEON::PMU::FencePolicy fence() const;
+    // Return the fence policy calibrated for
+
+  const u_int64_t *overhead() const;
+    // Return the array of 'k_COUNTERS' overheads in 'Stats' histogram order e.g. for 'Stats::setOverhead'
+
+  u_int64_t overhead(u_int16_t counter) const;
+    // Return the overhead of specified 'counter' in 'Stats' histogram order. The behavior is defined if
+    // 'counter<k_COUNTERS'.
+
+  const Histogram& distribution(u_int16_t counter) const;
+    // Return the empty region delta distribution of specified 'counter' in 'Stats' histogram order. The behavior is
+    // defined if 'counter<k_COUNTERS'.
+
+  void correct(u_int64_t *delta) const;
+    // Subtract from each of specified 'delta' array of 'k_COUNTERS' entries in 'Stats' histogram order its counter's
+    // overhead, saturating at 0
+
+  u_int64_t correct(u_int16_t counter, u_int64_t delta) const;
+    // Return specified 'delta' of specified 'counter' in 'Stats' histogram order less its overhead, saturating at 0.
+    // The behavior is defined if 'counter<k_COUNTERS'.
+
+  // MANIPULATORS
+  int calibrate(const XEON::PMU& pmu, XEON::PMU::FencePolicy fence = XEON::PMU::k_FENCE_MFENCE_LFENCE,
+                u_int32_t samples = 10000, double percentile = 50.0);
+    // Return 0 after measuring specified 'samples' empty regions between two 'pmu.snapshot' calls using specified
+    // 'fence' and setting each counter's overhead to specified 'percentile' of its distribution e.g. 0 for the
+    // minimum, and EINVAL if 'samples' is 0 or 'percentile' is outside '[0, 100]'. Regions whose snapshots an MSR
+    // backend PMU read on different cpus are dropped and counted in 'migrations()' instead. The behavior is defined
+    // if 'pmu' was started on the calling core.
+
+  Calibration& operator=(const Calibration& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream, const XEON::PMU& pmu) const;
+    // Pretty print to specified 'stream' the overhead and distribution summary of each counter of specified 'pmu'
+    // e.g. the PMU calibrated
+};
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+u_int32_t Calibration::samples() const {
+  return d_samples;
+}
+
+inline
+u_int32_t Calibration::migrations() const {
+  return d_migrations;
+}
+
+inline
+XEON::PMU::FencePolicy Calibration::fence() const {
+  return d_fence;
+}
+
+inline
+const u_int64_t *Calibration::overhead() const {
+  return d_overhead;
+}
+
+inline
+u_int64_t Calibration::overhead(u_int16_t counter) const {
+  assert(counter<k_COUNTERS);
+  return d_overhead[counter];
+}
+
+inline
+const Histogram& Calibration::distribution(u_int16_t counter) const {
+  assert(counter<k_COUNTERS);
+  return d_histogram[counter];
+}
+
+inline
+void Calibration::correct(u_int64_t *delta) const {
+  assert(delta);
+  for (u_int16_t i=0; i<k_COUNTERS; ++i) {
+    delta[i] -= delta[i]<d_overhead[i] ? delta[i] : d_overhead[i];
+  }
+}
+
+inline
+u_int64_t Calibration::correct(u_int16_t counter, u_int64_t delta) const {
+  assert(counter<k_COUNTERS);
+  return delta - (delta<d_overhead[counter] ? delta : d_overhead[counter]);
+}
+
+} // namespace Intel
@@ -0,0 +1,313 @@
+#include <intel_pmu_comparison.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <utility>
+
+namespace {
+
+struct Counter {
+  // A counter of a trace: its index in the values 'delta' loads, and its names
+  u_int16_t   d_index;
+  std::string d_mnemonic;
+  std::string d_description;
+};
+
+std::vector<Counter> counters(const Intel::TraceHeader& header) {
+  // Counters in the order 'delta' loads them: R0, A0, fixed, programmable
+  std::vector<Counter> result = {{0, "R0", "rdtsc cycles"}, {1, "A0", "active (not paused) rdtsc cycles"}};
+  for (u_int16_t i=0; i<header.d_fixedCnt+header.d_progCnt; ++i) {
+    result.push_back({(u_int16_t)(2+i), header.d_mnemonic[i], header.d_description[i]});
+  }
+  return result;
+}
+
+const Counter *find(const std::vector<Counter>& counter, const std::string& mnemonic) {
+  for (const Counter& c: counter) {
+    if (c.d_mnemonic==mnemonic) {
+      return &c;
+    }
+  }
+  return 0;
+}
+
+bool delta(const Intel::TraceHeader& header, const Intel::XEON::Snapshot& begin, const Intel::XEON::Snapshot& end,
+  u_int64_t *value) {
+  // Return false if 'begin' and 'end' were read on different cpus of an MSR backend PMU and the deltas don't subtract
+  if (header.d_backend==Intel::XEON::PMU::k_BACKEND_MSR && begin.d_aux!=end.d_aux) {
+    return false;
+  }
+  value[0] = end.d_tsc - begin.d_tsc;
+  value[1] = value[0] - (end.d_paused - begin.d_paused);
+  u_int16_t c = 2;
+  for (u_int16_t i=0; i<header.d_fixedCnt; ++i) {
+    value[c++] = (end.d_fixed[i] - begin.d_fixed[i]) & header.d_fixedMask;
+  }
+  for (u_int16_t i=0; i<header.d_progCnt; ++i) {
+    value[c++] = (end.d_prog[i] - begin.d_prog[i]) & header.d_progMask;
+  }
+  return true;
+}
+
+int load(Intel::TraceReader& reader, const std::vector<u_int16_t>& index, std::vector<std::vector<u_int64_t>> *value) {
+  // Append to 'value[i]' the deltas of counter 'index[i]' of every pair of consecutive samples of 'reader'
+  value->assign(index.size(), std::vector<u_int64_t>());
+  const Intel::TraceHeader& header = reader.header();
+  if (header.d_samples>1) {
+    for (std::vector<u_int64_t>& v: *value) {
+      v.reserve(header.d_samples-1);
+    }
+  }
+
+  u_int64_t deltas[Intel::TraceHeader::k_MAX_COUNTERS+2];
+  Intel::XEON::Snapshot prev, snap;
+  reader.rewind();
+  if (reader.next(&prev)) {
+    while (reader.next(&snap)) {
+      if (delta(header, prev, snap, deltas)) {
+        for (size_t i=0; i<index.size(); ++i) {
+          (*value)[i].push_back(deltas[index[i]]);
+        }
+      }
+      prev = snap;
+    }
+  }
+  return reader.status();
+}
+
+double relative(double baseline, double candidate) {
+  // Relative change of 'candidate' over 'baseline', or the absolute change if 'baseline' is 0
+  return (candidate - baseline)/(baseline!=0 ? baseline : 1.0);
+}
+
+} // namespace
+
+double Intel::Comparison::median(const std::vector<double>& sorted) {
+  const size_t n = sorted.size();
+  if (n==0) {
+    return 0.0;
+  }
+  return n%2 ? sorted[n/2] : (sorted[n/2-1] + sorted[n/2])/2.0;
+}
+
+double Intel::Comparison::mannWhitney(const std::vector<double>& baseline, const std::vector<double>& candidate,
+  double *u) {
+  assert(u);
+
+  *u = 0.0;
+  const double n1 = (double)baseline.size();
+  const double n2 = (double)candidate.size();
+  if (baseline.empty() || candidate.empty()) {
+    return 1.0;
+  }
+
+  // Rank the pooled values; the flag marks candidate values
+  std::vector<std::pair<double, bool>> pooled;
+  pooled.reserve(baseline.size()+candidate.size());
+  for (double x: baseline) {
+    pooled.push_back({x, false});
+  }
+  for (double x: candidate) {
+    pooled.push_back({x, true});
+  }
+  std::sort(pooled.begin(), pooled.end());
+
+  // Ties share their average rank; 'ties' accumulates sum(t^3-t) over tie groups for the variance correction
+  double rankSum = 0.0;
+  double ties = 0.0;
+  for (size_t i=0; i<pooled.size();) {
+    size_t j = i+1;
+    while (j<pooled.size() && pooled[j].first==pooled[i].first) {
+      ++j;
+    }
+    const double rank = (double)(i+1+j)/2.0;
+    for (size_t k=i; k<j; ++k) {
+      rankSum += pooled[k].second ? rank : 0.0;
+    }
+    const double t = (double)(j-i);
+    ties += t*t*t - t;
+    i = j;
+  }
+
+  *u = rankSum - n2*(n2+1.0)/2.0;
+
+  const double n = n1 + n2;
+  const double mean = n1*n2/2.0;
+  const double variance = n1*n2/12.0*((n+1.0) - ties/(n*(n-1.0)));
+  if (variance<=0.0) {
+    return 1.0;
+  }
+  const double distance = fabs(*u - mean);
+  const double z = (distance>0.5 ? distance-0.5 : 0.0)/sqrt(variance);
+  return erfc(z/M_SQRT2);
+}
+
+const char *Intel::Comparison::name(Verdict verdict) {
+  switch (verdict) {
+    case k_NOISE:     return "noise";
+    case k_IMPROVED:  return "improved";
+    case k_REGRESSED: return "REGRESSED";
+    default:          return "unknown";
+  }
+}
+
+void Intel::Comparison::bootstrap(const std::vector<double>& baseline, const std::vector<double>& candidate,
+  double *low, double *high) const {
+  assert(low);
+  assert(high);
+
+  std::mt19937_64 random(d_options.d_seed);
+  auto beta = [&random](double a, double b) -> double {
+    std::gamma_distribution<double> x(a, 1.0), y(b, 1.0);
+    const double g = x(random);
+    return g/(g + y(random));
+  };
+
+  // A resample draws n indices with replacement into the n sorted values and takes the median of the values they
+  // pick. The indices are 'floor(n*u)' of n uniform draws 'u', and the k-th smallest of n uniform draws is
+  // Beta(k, n+1-k) distributed, so the median index is drawn directly instead of n indices; for even n the next
+  // index up is the smallest of the n-k draws above it. Each resample is O(1) whatever n is.
+  auto resample = [&beta](const std::vector<double>& sorted) -> double {
+    const size_t n = sorted.size();
+    const size_t k = (n+1)/2;
+    const double u = beta((double)k, (double)(n+1-k));
+    const double lower = sorted[std::min(n-1, (size_t)(u*(double)n))];
+    if (n%2) {
+      return lower;
+    }
+    const double v = u + (1.0-u)*beta(1.0, (double)(n-k));
+    return (lower + sorted[std::min(n-1, (size_t)(v*(double)n))])/2.0;
+  };
+
+  std::vector<double> change(d_options.d_resamples);
+  for (double& x: change) {
+    const double m = resample(baseline);
+    x = relative(m, resample(candidate));
+  }
+  std::sort(change.begin(), change.end());
+
+  const double tail = (1.0 - d_options.d_confidence)/2.0;
+  const size_t last = change.size()-1;
+  *low = change[(size_t)floor(tail*(double)last)];
+  *high = change[(size_t)ceil((1.0-tail)*(double)last)];
+}
+
+int Intel::Comparison::compare(const std::string& mnemonic, const std::string& description,
+  const std::vector<u_int64_t>& baseline, const std::vector<u_int64_t>& candidate) {
+  if (d_options.d_threshold<0 || d_options.d_alpha<=0 || d_options.d_alpha>=1 || d_options.d_confidence<=0 ||
+      d_options.d_confidence>=1 || d_options.d_resamples<2) {
+    fprintf(stderr, "Error: invalid comparison options: threshold %lf, alpha %lf, confidence %lf, %u resamples\n",
+      d_options.d_threshold, d_options.d_alpha, d_options.d_confidence, d_options.d_resamples);
+    return EINVAL;
+  }
+  if (baseline.size()<2 || candidate.size()<2) {
+    fprintf(stderr, "Error: counter '%s' has %lu baseline and %lu candidate values; 2 or more each are required\n",
+      mnemonic.c_str(), baseline.size(), candidate.size());
+    return EINVAL;
+  }
+
+  std::vector<double> b(baseline.begin(), baseline.end());
+  std::vector<double> c(candidate.begin(), candidate.end());
+  std::sort(b.begin(), b.end());
+  std::sort(c.begin(), c.end());
+
+  Result result;
+  result.d_mnemonic = mnemonic;
+  result.d_description = description;
+  result.d_baselineCount = b.size();
+  result.d_candidateCount = c.size();
+  result.d_baselineMedian = median(b);
+  result.d_candidateMedian = median(c);
+  result.d_delta = relative(result.d_baselineMedian, result.d_candidateMedian);
+  bootstrap(b, c, &result.d_low, &result.d_high);
+  result.d_p = mannWhitney(b, c, &result.d_u);
+  result.d_probability = result.d_u/((double)b.size()*(double)c.size());
+
+  // All three must agree: the distributions differ, the median moved beyond resampling noise, and by enough to matter
+  const bool significant = result.d_p<d_options.d_alpha;
+  if (significant && result.d_low>0 && result.d_delta>d_options.d_threshold) {
+    result.d_verdict = k_REGRESSED;
+    ++d_regressions;
+  } else if (significant && result.d_high<0 && result.d_delta< -d_options.d_threshold) {
+    result.d_verdict = k_IMPROVED;
+    ++d_improvements;
+  } else {
+    result.d_verdict = k_NOISE;
+  }
+
+  d_result.push_back(result);
+  return 0;
+}
+
+int Intel::Comparison::compare(TraceReader& baseline, TraceReader& candidate) {
+  const std::vector<Counter> b = counters(baseline.header());
+  const std::vector<Counter> c = counters(candidate.header());
+
+  // Pair counters by mnemonic; the same mnemonic with another description is another event so it isn't compared
+  std::vector<std::pair<const Counter*, const Counter*>> pair;
+  if (d_options.d_counters.empty()) {
+    for (const Counter& x: b) {
+      const Counter *y = find(c, x.d_mnemonic);
+      if (y && y->d_description==x.d_description) {
+        pair.push_back({&x, y});
+      }
+    }
+  } else {
+    for (const std::string& mnemonic: d_options.d_counters) {
+      const Counter *x = find(b, mnemonic);
+      const Counter *y = find(c, mnemonic);
+      if (x==0 || y==0 || y->d_description!=x->d_description) {
+        fprintf(stderr, "Error: counter '%s' is not recorded in both traces with the same description\n",
+          mnemonic.c_str());
+        return EINVAL;
+      }
+      pair.push_back({x, y});
+    }
+  }
+
+  std::vector<u_int16_t> bIndex, cIndex;
+  for (const auto& p: pair) {
+    bIndex.push_back(p.first->d_index);
+    cIndex.push_back(p.second->d_index);
+  }
+
+  int rc;
+  std::vector<std::vector<u_int64_t>> bValue, cValue;
+  if ((rc = load(baseline, bIndex, &bValue))!=0 || (rc = load(candidate, cIndex, &cValue))!=0) {
+    fprintf(stderr, "Error: corrupt trace block\n");
+    return rc;
+  }
+
+  for (size_t i=0; i<pair.size(); ++i) {
+    if ((rc = compare(pair[i].first->d_mnemonic, pair[i].first->d_description, bValue[i], cValue[i]))!=0) {
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+std::ostream& Intel::Comparison::print(std::ostream& stream) const {
+  char buf[512];
+  snprintf(buf, sizeof(buf), "Intel PMU A/B comparison of %lu counters: %u regressed, %u improved (threshold %.2lf%%, "
+    "alpha %.3lf, %.0lf%% CI of %u resamples)\n", d_result.size(), d_regressions, d_improvements,
+    d_options.d_threshold*100, d_options.d_alpha, d_options.d_confidence*100, d_options.d_resamples);
+  stream << buf;
+
+  for (const Result& r: d_result) {
+    snprintf(buf, sizeof(buf), "%-3s [%-48s]: baseline median: %.2lf (n %lu), candidate median: %.2lf (n %lu), "
+      "delta: %+.2lf%% [%+.2lf%%, %+.2lf%%], U: %.0lf, p: %.4lf, P(candidate>baseline): %.3lf: %s\n",
+      r.d_mnemonic.c_str(), r.d_description.c_str(), r.d_baselineMedian, r.d_baselineCount, r.d_candidateMedian,
+      r.d_candidateCount, r.d_delta*100, r.d_low*100, r.d_high*100, r.d_u, r.d_p, r.d_probability,
+      name(r.d_verdict));
+    stream << buf;
+  }
+
+  return stream;
+}
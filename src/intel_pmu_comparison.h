@@ -0,0 +1,207 @@
+#pragma once
+
+// PURPOSE: Decide whether a candidate build's per-iteration PMU counts regressed against a baseline's
+//
+// CLASSES:
+//  Intel::Comparison: A/B comparator of two sets of per-iteration counter values e.g. the deltas of two traces
+//                     recorded by 'TraceWriter'. Per counter it reports both medians, the relative change of the
+//                     candidate's median over the baseline's with a percentile bootstrap confidence interval, and a
+//                     two-sided Mann-Whitney U test (normal approximation with tie correction), which assumes nothing
+//                     about the shape of either distribution so long tails and bimodal counts don't fool it. Every
+//                     counter is a cost per iteration: lower is better. A counter regressed if the change is
+//                     significant ('p<d_alpha'), its confidence interval excludes 0, and the change exceeds
+//                     'd_threshold'; improved likewise the other way; otherwise it's noise. 'regressions()' is what a
+//                     CI perf gate checks. Resampling is seeded so the same inputs always give the same verdict.
+//
+// Usage:
+//   Intel::TraceReader baseline, candidate;
+//   baseline.open("main.trace");
+//   candidate.open("branch.trace");
+//   Intel::Comparison comparison;
+//   comparison.compare(baseline, candidate);
+//   std::cout << comparison;
+//   return comparison.regressions() ? 1 : 0;
+
+#include <intel_pmu_trace.h>
+
+#include <sys/types.h>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Intel {
+
+class Comparison {
+public:
+  // ENUM
+  enum Verdict {
+    k_NOISE     = 0,                    // no difference beyond the thresholds
+    k_IMPROVED  = 1,                    // candidate counts significantly fewer per iteration
+    k_REGRESSED = 2,                    // candidate counts significantly more per iteration
+  };
+
+  struct Options {
+    double    d_threshold = 0.02;               // relative change of the median at or below which it's noise
+    double    d_alpha = 0.05;                   // Mann-Whitney p-value at or above which a change is noise
+    double    d_confidence = 0.95;              // coverage of the bootstrap confidence interval
+    u_int32_t d_resamples = 2000;               // bootstrap resamples; each draws as many values as its side has
+    u_int64_t d_seed = 1;                       // bootstrap random number seed
+    std::vector<std::string> d_counters;        // mnemonics compared by 'compare(TraceReader&, ...)'; empty
+                                                // compares every counter both traces have
+  };
+
+  struct Result {
+    std::string d_mnemonic;                     // e.g. "F1"
+    std::string d_description;                  // e.g. "no-halt cpu cycles"
+    u_int64_t   d_baselineCount;                // baseline values
+    u_int64_t   d_candidateCount;               // candidate values
+    double      d_baselineMedian;               // median of baseline values
+    double      d_candidateMedian;              // median of candidate values
+    double      d_delta;                        // 'd_candidateMedian/d_baselineMedian-1' dividing by 1 if that's 0
+    double      d_low;                          // lower bound of the bootstrap confidence interval of 'd_delta'
+    double      d_high;                         // upper bound of the bootstrap confidence interval of 'd_delta'
+    double      d_u;                            // Mann-Whitney U of the candidate's values
+    double      d_p;                            // two-sided p-value of 'd_u'
+    double      d_probability;                  // P(candidate value > baseline value) counting ties as half
+    Verdict     d_verdict;                      // classification per 'Options'
+  };
+
+private:
+  // DATA
+  Options             d_options;        // configuration
+  std::vector<Result> d_result;         // one per counter compared, in order
+  u_int32_t           d_regressions;    // results with 'k_REGRESSED'
+  u_int32_t           d_improvements;   // results with 'k_IMPROVED'
+
+  // PRIVATE ACCESSORS
+  void bootstrap(const std::vector<double>& baseline, const std::vector<double>& candidate, double *low,
+    double *high) const;
+    // Load into specified 'low' and 'high' the percentile bootstrap confidence interval of the relative change of
+    // the median of specified sorted 'candidate' over that of specified sorted 'baseline'. Every resample draws as
+    // many values with replacement as its side has, so the interval narrows as 1/sqrt(n) with the input size; the
+    // resampled median is drawn from the exact distribution of that order statistic in O(1) rather than by drawing
+    // all n values.
+
+public:
+  // CLASS METHODS
+  static double median(const std::vector<double>& sorted);
+    // Return the median of specified 'sorted' values, or 0 if empty
+
+  static double mannWhitney(const std::vector<double>& baseline, const std::vector<double>& candidate, double *u);
+    // Return the two-sided p-value of the Mann-Whitney U test of specified 'baseline' and 'candidate' values, loading
+    // specified 'u' with the candidate's U i.e. the number of (baseline, candidate) pairs whose candidate value is
+    // larger, ties counting half. Uses the normal approximation with continuity and tie corrections; returns 1 if
+    // either side is empty or all values are equal.
+
+  static const char *name(Verdict verdict);
+    // Return a printable name of specified 'verdict'
+
+  // CREATORS
+  Comparison();
+    // Create a comparator per default 'Options'
+
+  explicit Comparison(const Options& options);
+    // Create a comparator per specified 'options'
+
+  Comparison(const Comparison& other) = delete;
+    // Copy constructor not supported
+
+  ~Comparison() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  const Options& options() const;
+    // Return the options provided at construction
+
+  const std::vector<Result>& results() const;
+    // Return the results of the counters compared since construction or 'reset'
+
+  u_int32_t regressions() const;
+    // Return the number of counters that regressed
+
+  u_int32_t improvements() const;
+    // Return the number of counters that improved
+
+  // MANIPULATORS
+  int compare(const std::string& mnemonic, const std::string& description, const std::vector<u_int64_t>& baseline,
+    const std::vector<u_int64_t>& candidate);
+    // Return 0 after appending to 'results()' the comparison of specified per-iteration 'baseline' and 'candidate'
+    // values of the counter of specified 'mnemonic' and 'description', and EINVAL with a diagnostic on stderr if
+    // either has fewer than 2 values or the options are invalid.
+
+  int compare(TraceReader& baseline, TraceReader& candidate);
+    // Return 0 after comparing the deltas between consecutive samples of specified 'baseline' and 'candidate' traces
+    // counter by counter: rdtsc cycles 'R0', active cycles 'A0', then the counters both traces recorded with the
+    // same mnemonic and description, or just 'd_counters' if set. Deltas whose samples an MSR backend PMU read on
+    // different cpus are skipped. Return EINVAL with a diagnostic on stderr if a counter of 'd_counters' isn't in
+    // both traces or per 'compare' above, and the traces' 'status()' if either is corrupt. Both traces are read from
+    // their first sample; all deltas of the compared counters are held in memory at once.
+
+  void reset();
+    // Discard all results
+
+  Comparison& operator=(const Comparison& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the thresholds, then per counter medians, change with its confidence
+    // interval, U, p-value and verdict
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Comparison& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+Comparison::Comparison()
+: Comparison(Options())
+{
+}
+
+inline
+Comparison::Comparison(const Options& options)
+: d_options(options)
+, d_regressions(0)
+, d_improvements(0)
+{
+}
+
+// ACCESSORS
+inline
+const Comparison::Options& Comparison::options() const {
+  return d_options;
+}
+
+inline
+const std::vector<Comparison::Result>& Comparison::results() const {
+  return d_result;
+}
+
+inline
+u_int32_t Comparison::regressions() const {
+  return d_regressions;
+}
+
+inline
+u_int32_t Comparison::improvements() const {
+  return d_improvements;
+}
+
+// MANIPULATORS
+inline
+void Comparison::reset() {
+  d_result.clear();
+  d_regressions = d_improvements = 0;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Comparison& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
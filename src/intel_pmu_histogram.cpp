@@ -0,0 +1,56 @@
+#include <intel_pmu_histogram.h>
+
+#include <stdio.h>
+
+#include <iostream>
+
+u_int64_t Intel::Histogram::percentile(double percent) const {
+  assert(percent>=0.0 && percent<=100.0);
+
+  if (d_count==0) {
+    return 0;
+  }
+
+  // Rank of the wanted value counting from 1; the 0th percentile is the minimum
+  u_int64_t rank = (u_int64_t)(percent/100.0*(double)d_count + 0.5);
+  rank = rank==0 ? 1 : (rank>d_count ? d_count : rank);
+
+  u_int64_t seen = 0;
+  u_int32_t index = bucket(d_min);
+  const u_int32_t last = bucket(d_max);
+  for (; index<last; ++index) {
+    if ((seen += d_bucket[index])>=rank) {
+      break;
+    }
+  }
+
+  const u_int64_t low = lowerBound(index);
+  const u_int64_t value = low + (upperBound(index)-low)/2;
+  return value<d_min ? d_min : (value>d_max ? d_max : value);
+}
+
+void Intel::Histogram::merge(const Histogram& other) {
+  d_count += other.d_count;
+  d_min = other.d_min<d_min ? other.d_min : d_min;
+  d_max = other.d_max>d_max ? other.d_max : d_max;
+  d_total += other.d_total;
+  for (u_int32_t i=0; i<k_BUCKETS; ++i) {
+    d_bucket[i] += other.d_bucket[i];
+  }
+}
+
+std::ostream& Intel::Histogram::print(std::ostream& stream) const {
+  char buf[128];
+
+  snprintf(buf, sizeof(buf), "count: %lu, min: %lu, max: %lu, mean: %lf\n", d_count, min(), d_max, mean());
+  stream << buf;
+
+  for (u_int32_t i=0; i<k_BUCKETS; ++i) {
+    if (d_bucket[i]!=0) {
+      snprintf(buf, sizeof(buf), "  [%020lu, %020lu]: %lu\n", lowerBound(i), upperBound(i), d_bucket[i]);
+      stream << buf;
+    }
+  }
+
+  return stream;
+}
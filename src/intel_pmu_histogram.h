@@ -0,0 +1,197 @@
+#pragma once
+
+// PURPOSE: Summarize the distribution of counter deltas in fixed memory
+//
+// CLASSES:
+//  Intel::Histogram: Log-linear histogram of 64-bit values. Values below 2*k_SUB_BUCKETS get a bucket each; above
+//                    that every power of 2 is split into 'k_SUB_BUCKETS' equal buckets so any reported percentile is
+//                    within 1/k_SUB_BUCKETS (about 3%) of the recorded value. 'record' finds the bucket with one
+//                    'lzcnt' and a shift, no branches and no allocation. Histograms of the same type merge by adding
+//                    bucket counts e.g. to combine runs or threads.
+
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <iosfwd>
+
+namespace Intel {
+
+class Histogram {
+public:
+  // ENUM
+  enum Support {
+    k_SUB_BUCKET_BITS = 5,                                   // log2 of buckets per power of 2
+    k_SUB_BUCKETS     = 1<<k_SUB_BUCKET_BITS,                // buckets per power of 2
+    k_BUCKETS         = (65-k_SUB_BUCKET_BITS)*k_SUB_BUCKETS, // buckets covering [0, 2^64)
+  };
+
+private:
+  // DATA
+  u_int64_t d_count;                    // number of recorded values
+  u_int64_t d_min;                      // minimum recorded value
+  u_int64_t d_max;                      // maximum recorded value
+  u_int64_t d_total;                    // sum of recorded values
+  u_int64_t d_bucket[k_BUCKETS];        // number of recorded values by bucket
+
+public:
+  // CLASS METHODS
+  static u_int32_t bucket(u_int64_t value);
+    // Return the index of the bucket holding specified 'value'
+
+  static u_int64_t lowerBound(u_int32_t index);
+    // Return the smallest value in the bucket with specified 'index'. The behavior is defined if 'index<k_BUCKETS'.
+
+  static u_int64_t upperBound(u_int32_t index);
+    // Return the largest value in the bucket with specified 'index'. The behavior is defined if 'index<k_BUCKETS'.
+
+  // CREATORS
+  Histogram();
+    // Create an empty histogram
+
+  Histogram(const Histogram& other) = default;
+    // Create a copy of specified 'other'
+
+  ~Histogram() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  u_int64_t count() const;
+    // Return the number of recorded values
+
+  u_int64_t min() const;
+    // Return the minimum recorded value or 0 if none
+
+  u_int64_t max() const;
+    // Return the maximum recorded value or 0 if none
+
+  u_int64_t total() const;
+    // Return the sum of recorded values
+
+  double mean() const;
+    // Return the average recorded value or 0 if none
+
+  u_int64_t bucketCount(u_int32_t index) const;
+    // Return the number of recorded values in the bucket with specified 'index'. The behavior is defined if
+    // 'index<k_BUCKETS'.
+
+  u_int64_t percentile(double percent) const;
+    // Return the value at or below which specified 'percent' of recorded values lie e.g. 99.9 for the 99.9th
+    // percentile, or 0 if none were recorded. The result is the midpoint of the bucket holding that rank clamped to
+    // '[min(), max()]'. The behavior is defined if '0<=percent<=100'.
+
+  // MANIPULATORS
+  void record(u_int64_t value);
+    // Add specified 'value'
+
+  void merge(const Histogram& other);
+    // Add all values recorded in specified 'other'
+
+  void reset();
+    // Reset to 0 recorded values
+
+  Histogram& operator=(const Histogram& rhs) = default;
+    // Assign specified 'rhs' to this object returning a reference to this object
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' count, min, max, mean, and every non-empty bucket
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Histogram& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+inline
+u_int32_t Histogram::bucket(u_int64_t value) {
+  // OR-ing in k_SUB_BUCKETS makes values below it land in the first, linear, power of 2 with a 0 shift
+  const u_int32_t shift = (u_int32_t)(63-__builtin_clzll(value | k_SUB_BUCKETS)) - k_SUB_BUCKET_BITS;
+  return (shift<<k_SUB_BUCKET_BITS) + (u_int32_t)(value>>shift);
+}
+
+inline
+u_int64_t Histogram::lowerBound(u_int32_t index) {
+  assert(index<k_BUCKETS);
+  if (index<2*k_SUB_BUCKETS) {
+    return index;
+  }
+  const u_int32_t shift = (index>>k_SUB_BUCKET_BITS)-1;
+  return (u_int64_t)((index & (k_SUB_BUCKETS-1)) | k_SUB_BUCKETS) << shift;
+}
+
+inline
+u_int64_t Histogram::upperBound(u_int32_t index) {
+  assert(index<k_BUCKETS);
+  if (index<2*k_SUB_BUCKETS) {
+    return index;
+  }
+  const u_int32_t shift = (index>>k_SUB_BUCKET_BITS)-1;
+  return lowerBound(index) + ((1ull<<shift)-1);
+}
+
+// CREATORS
+inline
+Histogram::Histogram() {
+  reset();
+}
+
+// ACCESSORS
+inline
+u_int64_t Histogram::count() const {
+  return d_count;
+}
+
+inline
+u_int64_t Histogram::min() const {
+  return d_count ? d_min : 0;
+}
+
+inline
+u_int64_t Histogram::max() const {
+  return d_max;
+}
+
+inline
+u_int64_t Histogram::total() const {
+  return d_total;
+}
+
+inline
+double Histogram::mean() const {
+  return d_count ? (double)d_total/(double)d_count : 0.0;
+}
+
+inline
+u_int64_t Histogram::bucketCount(u_int32_t index) const {
+  assert(index<k_BUCKETS);
+  return d_bucket[index];
+}
+
+// MANIPULATORS
+inline
+void Histogram::record(u_int64_t value) {
+  ++d_count;
+  d_min = value<d_min ? value : d_min;
+  d_max = value>d_max ? value : d_max;
+  d_total += value;
+  ++d_bucket[bucket(value)];
+}
+
+inline
+void Histogram::reset() {
+  d_count = 0;
+  d_min = ~0ull;
+  d_max = 0;
+  d_total = 0;
+  memset(d_bucket, 0, sizeof(d_bucket));
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Histogram& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
@@ -0,0 +1,330 @@
+#include <intel_pmu_metric.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+const char *const k_MNEMONIC[Intel::Metric::k_VARIABLES] = {
+  "R0", "A0", "F0", "F1", "F2", "P0", "P1", "P2", "P3", "P4", "P5", "P6", "P7",
+};
+
+class Parser {
+  // Recursive descent over 'expr := term (('+'|'-') term)*', 'term := unary (('*'|'/') unary)*',
+  // 'unary := '-' unary | number | mnemonic | '(' expr ')'' emitting postfix as it goes
+public:
+  struct Emitted {
+    Intel::Metric::Opcode d_op;
+    u_int32_t             d_index;
+    double                d_value;
+  };
+
+  const std::string&   d_name;
+  const char          *d_begin;
+  const char          *d_at;
+  std::vector<Emitted> d_out;
+  int                  d_status;
+
+  Parser(const std::string& name, const std::string& expression)
+  : d_name(name)
+  , d_begin(expression.c_str())
+  , d_at(expression.c_str())
+  , d_status(0)
+  {
+  }
+
+  void error(const char *what) {
+    if (d_status==0) {
+      fprintf(stderr, "Error: metric '%s': %s at offset %ld of '%s'\n", d_name.c_str(), what, (long)(d_at-d_begin),
+        d_begin);
+      d_status = EINVAL;
+    }
+  }
+
+  char peek() {
+    while (isspace((unsigned char)*d_at)) {
+      ++d_at;
+    }
+    return *d_at;
+  }
+
+  void emit(Intel::Metric::Opcode op, u_int32_t index = 0, double value = 0.0) {
+    d_out.push_back(Emitted{op, index, value});
+  }
+
+  void expr() {
+    term();
+    for (char c = peek(); d_status==0 && (c=='+' || c=='-'); c = peek()) {
+      ++d_at;
+      term();
+      emit(c=='+' ? Intel::Metric::k_ADD : Intel::Metric::k_SUB);
+    }
+  }
+
+  void term() {
+    unary();
+    for (char c = peek(); d_status==0 && (c=='*' || c=='/'); c = peek()) {
+      ++d_at;
+      unary();
+      emit(c=='*' ? Intel::Metric::k_MUL : Intel::Metric::k_DIV);
+    }
+  }
+
+  void unary() {
+    const char c = peek();
+    if (c=='-') {
+      ++d_at;
+      unary();
+      emit(Intel::Metric::k_NEG);
+    } else if (c=='(') {
+      ++d_at;
+      expr();
+      if (peek()!=')') {
+        error("expected ')'");
+        return;
+      }
+      ++d_at;
+    } else if (isdigit((unsigned char)c) || c=='.') {
+      char *end = 0;
+      const double value = strtod(d_at, &end);
+      if (end==d_at) {
+        error("bad number");
+        return;
+      }
+      d_at = end;
+      emit(Intel::Metric::k_CONST, 0, value);
+    } else if (isalpha((unsigned char)c)) {
+      const char *start = d_at;
+      while (isalnum((unsigned char)*d_at) || *d_at=='_') {
+        ++d_at;
+      }
+      const u_int32_t index = Intel::Metric::variable(std::string(start, d_at));
+      if (index==Intel::Metric::k_VARIABLES) {
+        d_at = start;
+        error("unknown counter mnemonic");
+        return;
+      }
+      emit(Intel::Metric::k_LOAD, index);
+    } else {
+      error(c ? "unexpected character" : "unexpected end of expression");
+    }
+  }
+};
+
+} // namespace
+
+u_int32_t Intel::Metric::variable(const std::string& mnemonic) {
+  for (u_int32_t i=0; i<k_VARIABLES; ++i) {
+    if (mnemonic==k_MNEMONIC[i]) {
+      return i;
+    }
+  }
+  return k_VARIABLES;
+}
+
+const char *Intel::Metric::mnemonic(u_int32_t variable) {
+  assert(variable<k_VARIABLES);
+  return k_MNEMONIC[variable];
+}
+
+std::vector<Intel::Metric> Intel::Metric::library(XEON::PMU::ProgCounterSetConfig config) {
+  struct Definition {
+    const char *d_name;
+    const char *d_expression;
+    const char *d_description;
+  };
+
+  // Fixed counters of every configuration
+  static const Definition fixed[] = {
+    {"IPC",                "F0/F1",         "retired instructions per unhalted core cycle"},
+    {"CPI",                "F1/F0",         "unhalted core cycles per retired instruction"},
+    {"TURBO_RATIO",        "F1/F2",         "core cycles per reference cycle; >1 above base frequency"},
+    {"UTILIZATION",        "F2/R0",         "fraction of wall time unhalted"},
+  };
+
+  // P0-P3 of the default configurations: LLC references, LLC misses, branches, branches not taken
+  static const Definition config0[] = {
+    {"LLC_MISS_RATIO",     "P1/P0",         "LLC misses per LLC reference"},
+    {"LLC_MPKI",           "1000*P1/F0",    "LLC misses per 1000 instructions"},
+    {"BRANCH_PKI",         "1000*P2/F0",    "retired branches per 1000 instructions"},
+    {"BRANCH_TAKEN_RATIO", "(P2-P3)/P2",    "taken branches per retired branch"},
+  };
+
+  // P4-P7 of 'k_DEFAULT_XEON_CONFIG_1': DTLB load walks, DTLB store walks, loads, stores
+  static const Definition config1[] = {
+    {"DTLB_LOAD_WALK_PKI",  "1000*P4/F0",   "DTLB load misses causing a walk per 1000 instructions"},
+    {"DTLB_STORE_WALK_PKI", "1000*P5/F0",   "DTLB store misses causing a walk per 1000 instructions"},
+    {"LOADS_PER_INSN",      "P6/F0",        "retired loads per retired instruction"},
+    {"STORES_PER_INSN",     "P7/F0",        "retired stores per retired instruction"},
+  };
+
+  // P0-P3 of 'k_TOPDOWN_XEON_CONFIG': undelivered slots, issued uops, retire slots, recovery cycles over the
+  // '4*F1' issue slots of a 4-wide core. Back end bound is the remainder.
+  static const Definition topDown[] = {
+    {"FRONTEND_BOUND",     "P0/(4*F1)",              "slots the front end delivered no uop"},
+    {"BAD_SPECULATION",    "(P1-P2+4*P3)/(4*F1)",    "slots wasted on uops that never retire"},
+    {"RETIRING",           "P2/(4*F1)",              "slots retiring uops"},
+    {"BACKEND_BOUND",      "1-(P0+P1+4*P3)/(4*F1)",  "slots stalled for lack of back end resources"},
+  };
+
+  std::vector<Metric> result;
+  if (config==XEON::PMU::k_DEFAULT_CONFIG_UNDEFINED) {
+    return result;
+  }
+
+  Metric metric;
+  for (const Definition& def: fixed) {
+    metric.compile(def.d_name, def.d_expression, def.d_description);
+    result.push_back(metric);
+  }
+  if (config==XEON::PMU::k_TOPDOWN_XEON_CONFIG) {
+    for (const Definition& def: topDown) {
+      metric.compile(def.d_name, def.d_expression, def.d_description);
+      result.push_back(metric);
+    }
+    return result;
+  }
+  for (const Definition& def: config0) {
+    metric.compile(def.d_name, def.d_expression, def.d_description);
+    result.push_back(metric);
+  }
+  if (config==XEON::PMU::k_DEFAULT_XEON_CONFIG_1 || config==XEON::PMU::k_AUTO_XEON_CONFIG) {
+    for (const Definition& def: config1) {
+      metric.compile(def.d_name, def.d_expression, def.d_description);
+      result.push_back(metric);
+    }
+  }
+
+  return result;
+}
+
+bool Intel::Metric::defined(u_int16_t fixedCount, u_int16_t programmableCount) const {
+  if (!compiled()) {
+    return false;
+  }
+  for (u_int32_t i=0; i<k_VARIABLES; ++i) {
+    if (!uses(i)) {
+      continue;
+    }
+    if (i>=2 && i<2+XEON::PMU::k_FIXED_COUNTERS && i-2>=fixedCount) {
+      return false;
+    }
+    if (i>=2+XEON::PMU::k_FIXED_COUNTERS && i-2-XEON::PMU::k_FIXED_COUNTERS>=programmableCount) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Intel::Metric::evaluate(const u_int64_t *const *column, u_int32_t count, double *result) const {
+  assert(compiled());
+  assert(result);
+
+  // One row per stack slot; each instruction is a loop over the rows of one block of samples
+  double stack[k_MAX_STACK][k_BATCH] __attribute__((aligned(64)));
+
+  for (u_int32_t base=0; base<count; base+=k_BATCH) {
+    const u_int32_t n = count-base<(u_int32_t)k_BATCH ? count-base : (u_int32_t)k_BATCH;
+    u_int32_t top = 0;
+
+    for (const Instruction& insn: d_program) {
+      switch (insn.d_op) {
+        case k_LOAD: {
+          double *out = stack[top++];
+          const u_int64_t *in = column[insn.d_index] + base;
+          for (u_int32_t i=0; i<n; ++i) {
+            out[i] = (double)in[i];
+          }
+        } break;
+        case k_CONST: {
+          double *out = stack[top++];
+          const double value = insn.d_value;
+          for (u_int32_t i=0; i<n; ++i) {
+            out[i] = value;
+          }
+        } break;
+        case k_ADD: {
+          double *a = stack[top-2];
+          const double *b = stack[--top];
+          for (u_int32_t i=0; i<n; ++i) {
+            a[i] += b[i];
+          }
+        } break;
+        case k_SUB: {
+          double *a = stack[top-2];
+          const double *b = stack[--top];
+          for (u_int32_t i=0; i<n; ++i) {
+            a[i] -= b[i];
+          }
+        } break;
+        case k_MUL: {
+          double *a = stack[top-2];
+          const double *b = stack[--top];
+          for (u_int32_t i=0; i<n; ++i) {
+            a[i] *= b[i];
+          }
+        } break;
+        case k_DIV: {
+          double *a = stack[top-2];
+          const double *b = stack[--top];
+          for (u_int32_t i=0; i<n; ++i) {
+            a[i] /= b[i];
+          }
+        } break;
+        case k_NEG: {
+          double *a = stack[top-1];
+          for (u_int32_t i=0; i<n; ++i) {
+            a[i] = -a[i];
+          }
+        } break;
+      }
+    }
+
+    memcpy(result+base, stack[0], sizeof(double)*n);
+  }
+}
+
+int Intel::Metric::compile(const std::string& name, const std::string& expression, const std::string& description) {
+  d_program.clear();
+  d_variables = 0;
+  d_name = name;
+  d_expression = expression;
+  d_description = description;
+
+  Parser parser(name, expression);
+  parser.expr();
+  if (parser.d_status==0 && parser.peek()!=0) {
+    parser.error("unexpected character");
+  }
+  if (parser.d_status!=0) {
+    return parser.d_status;
+  }
+
+  // Stack depth is known statically for postfix code; the evaluators rely on it fitting 'k_MAX_STACK'
+  u_int32_t depth = 0;
+  u_int32_t variables = 0;
+  std::vector<Instruction> program;
+  for (const Parser::Emitted& op: parser.d_out) {
+    if (op.d_op==k_LOAD || op.d_op==k_CONST) {
+      if (++depth>k_MAX_STACK) {
+        fprintf(stderr, "Error: metric '%s': '%s' needs more than %d operands on the stack\n", name.c_str(),
+          expression.c_str(), (int)k_MAX_STACK);
+        return E2BIG;
+      }
+    } else if (op.d_op!=k_NEG) {
+      --depth;
+    }
+    if (op.d_op==k_LOAD) {
+      variables |= 1u<<op.d_index;
+    }
+    program.push_back(Instruction{op.d_op, op.d_index, op.d_value});
+  }
+  assert(depth==1);
+
+  d_program.swap(program);
+  d_variables = variables;
+  return 0;
+}
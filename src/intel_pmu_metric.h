@@ -0,0 +1,214 @@
+#pragma once
+
+// PURPOSE: Compute derived metrics e.g. IPC or LLC MPKI from counter deltas
+//
+// CLASSES:
+//  Intel::Metric: An arithmetic expression over counter mnemonics e.g. "1000*P1/F0" compiled once into a flat postfix
+//                 program. Variables are the counters 'Stats' reports, in its histogram order: R0 (rdtsc cycles), A0
+//                 (active rdtsc cycles), F0-F2, P0-P7. Operators are + - * / and unary minus with the usual
+//                 precedence, and parentheses; constants are decimal numbers. Arithmetic is IEEE double so x/0 is inf
+//                 and 0/0 is NaN. A metric evaluates one sample's deltas, aggregate totals e.g. 'Stats::metric' (a
+//                 ratio of sums, not a mean of per sample ratios), or a batch of stored samples: the batch evaluator
+//                 runs each instruction over a block of samples at a time so every step is a straight loop the
+//                 compiler vectorizes, instead of interpreting the program once per sample. 'library' gives the
+//                 standard metrics of the default counter configurations.
+//
+// Usage:
+//   Intel::Metric ipc;
+//   ipc.compile("IPC", "F0/F1", "retired instructions per cycle");
+//   Intel::Stats stats(pmu);
+//   ...
+//   printf("IPC %.2lf\n", stats.metric(ipc));
+
+#include <intel_xeon_pmu.h>
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace Intel {
+
+class Metric {
+public:
+  // ENUM
+  enum Support {
+    k_VARIABLES = 2+XEON::PMU::k_FIXED_COUNTERS+XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF,
+                                        // R0, A0, fixed, then programmable counters; equals 'Stats::k_HISTOGRAMS'
+    k_MAX_STACK = 8,                    // deepest operand stack a program may need
+    k_BATCH     = 256,                  // samples per step of the batch evaluator
+  };
+
+  enum Opcode {
+    k_LOAD = 0,                         // push variable 'd_index'
+    k_CONST,                            // push 'd_value'
+    k_ADD,                              // pop b, pop a, push a+b
+    k_SUB,                              // pop b, pop a, push a-b
+    k_MUL,                              // pop b, pop a, push a*b
+    k_DIV,                              // pop b, pop a, push a/b
+    k_NEG,                              // pop a, push -a
+  };
+
+private:
+  // PRIVATE TYPES
+  struct Instruction {
+    Opcode    d_op;                     // operation
+    u_int32_t d_index;                  // variable of 'k_LOAD'
+    double    d_value;                  // constant of 'k_CONST'
+  };
+
+  // DATA
+  std::string              d_name;        // short name e.g. "IPC"
+  std::string              d_expression;  // source expression e.g. "F0/F1"
+  std::string              d_description; // human readable description
+  std::vector<Instruction> d_program;     // postfix program; empty until 'compile' succeeds
+  u_int32_t                d_variables;   // bit 'i' set if variable 'i' is loaded
+
+public:
+  // CLASS METHODS
+  static u_int32_t variable(const std::string& mnemonic);
+    // Return the variable index of specified counter 'mnemonic' e.g. 2 for "F0", or 'k_VARIABLES' if it names none
+
+  static const char *mnemonic(u_int32_t variable);
+    // Return the mnemonic of specified 'variable'. The behavior is defined if 'variable<k_VARIABLES'.
+
+  static std::vector<Metric> library(XEON::PMU::ProgCounterSetConfig config);
+    // Return the standard metrics of the counters specified 'config' programs: instructions per cycle, cycles per
+    // instruction, turbo ratio, utilization, and for config 0's events LLC miss ratio and misses per 1000
+    // instructions, branches per 1000 instructions and taken ratio; config 1 adds DTLB walks per 1000 instructions
+    // and loads and stores per instruction. 'k_AUTO_XEON_CONFIG' gives config 1's; use 'defined' to keep those the
+    // PMU actually programmed. 'k_TOPDOWN_XEON_CONFIG' gives the fixed counter metrics and the top-down level 1
+    // fractions of pipeline slots: front end bound, bad speculation, retiring, back end bound.
+
+  // CREATORS
+  Metric();
+    // Create an empty metric. Call 'compile' before evaluating it.
+
+  Metric(const Metric& other) = default;
+    // Create a copy of specified 'other'
+
+  ~Metric() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  const std::string& name() const;
+    // Return the name given to 'compile'
+
+  const std::string& expression() const;
+    // Return the expression given to 'compile'
+
+  const std::string& description() const;
+    // Return the description given to 'compile'
+
+  bool compiled() const;
+    // Return true if 'compile' succeeded
+
+  u_int32_t size() const;
+    // Return the number of instructions in the compiled program
+
+  bool uses(u_int32_t variable) const;
+    // Return true if the expression reads specified 'variable'
+
+  bool defined(const XEON::PMU& pmu) const;
+    // Return true if compiled and every counter the expression reads is defined in specified 'pmu'
+
+  bool defined(u_int16_t fixedCount, u_int16_t programmableCount) const;
+    // Return true if compiled and every counter the expression reads is among the first specified 'fixedCount' fixed
+    // and 'programmableCount' programmable counters
+
+  double evaluate(const u_int64_t *value) const;
+    // Return the metric of specified 'value' array of 'k_VARIABLES' counter values in variable order e.g. one
+    // sample's deltas or totals. Entries the expression doesn't read may hold anything. The behavior is defined if
+    // 'compiled()'.
+
+  double evaluate(const double *value) const;
+    // Same as the above for values already in double e.g. means
+
+  void evaluate(const u_int64_t *const *column, u_int32_t count, double *result) const;
+    // Write into specified 'result' the metric of each of specified 'count' samples whose values are in specified
+    // 'column' arrays: 'column[v][i]' is variable 'v' of sample 'i'. Columns the expression doesn't read may be 0.
+    // The behavior is defined if 'compiled()' and 'result' holds 'count' entries.
+
+  // MANIPULATORS
+  int compile(const std::string& name, const std::string& expression, const std::string& description = "");
+    // Return 0 if specified 'expression' was parsed and compiled as the metric of specified 'name' and optionally
+    // specified 'description', and errno otherwise with a diagnostic on stderr leaving 'compiled()' false: EINVAL
+    // for a syntax error or unknown mnemonic, E2BIG if evaluation would need more than 'k_MAX_STACK' operands.
+
+  Metric& operator=(const Metric& rhs) = default;
+    // Assign to this object the value of specified 'rhs'
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+Metric::Metric()
+: d_variables(0)
+{
+}
+
+// ACCESSORS
+inline
+const std::string& Metric::name() const {
+  return d_name;
+}
+
+inline
+const std::string& Metric::expression() const {
+  return d_expression;
+}
+
+inline
+const std::string& Metric::description() const {
+  return d_description;
+}
+
+inline
+bool Metric::compiled() const {
+  return !d_program.empty();
+}
+
+inline
+u_int32_t Metric::size() const {
+  return (u_int32_t)d_program.size();
+}
+
+inline
+bool Metric::uses(u_int32_t variable) const {
+  return variable<k_VARIABLES && (d_variables & (1u<<variable))!=0;
+}
+
+inline
+bool Metric::defined(const XEON::PMU& pmu) const {
+  return defined(pmu.fixedCountersDefined(), pmu.programmableCountersDefined());
+}
+
+inline
+double Metric::evaluate(const double *value) const {
+  assert(compiled());
+  double stack[k_MAX_STACK];
+  u_int32_t top = 0;
+  for (const Instruction& insn: d_program) {
+    switch (insn.d_op) {
+      case k_LOAD:  stack[top++] = value[insn.d_index]; break;
+      case k_CONST: stack[top++] = insn.d_value; break;
+      case k_ADD:   --top; stack[top-1] += stack[top]; break;
+      case k_SUB:   --top; stack[top-1] -= stack[top]; break;
+      case k_MUL:   --top; stack[top-1] *= stack[top]; break;
+      case k_DIV:   --top; stack[top-1] /= stack[top]; break;
+      case k_NEG:   stack[top-1] = -stack[top-1]; break;
+    }
+  }
+  return stack[0];
+}
+
+inline
+double Metric::evaluate(const u_int64_t *value) const {
+  double real[k_VARIABLES];
+  for (u_int32_t i=0; i<k_VARIABLES; ++i) {
+    real[i] = uses(i) ? (double)value[i] : 0.0;
+  }
+  return evaluate(real);
+}
+
+} // namespace Intel
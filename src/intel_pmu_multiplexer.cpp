@@ -0,0 +1,208 @@
+#include <intel_pmu_multiplexer.h>
+
+#include <math.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+
+Intel::Multiplexer::Multiplexer(XEON::PMU& pmu, const std::vector<u_int64_t>& eventSelect,
+                                const std::vector<std::string>& description, u_int64_t tick, u_int16_t groupSize)
+: d_pmu(pmu)
+, d_eventSelect(eventSelect)
+, d_description(description)
+, d_slices(eventSelect.size())
+, d_groupSize(groupSize)
+, d_groups(0)
+, d_group(0)
+, d_tick(tick)
+, d_groupStart(0)
+, d_rotations(0)
+, d_status(0)
+{
+  assert(!eventSelect.empty());
+  assert(eventSelect.size()==description.size());
+  assert(groupSize>0 && groupSize<=XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF);
+
+  for (const auto& text: d_description) {
+    d_descriptionPtr.push_back(text.c_str());
+  }
+
+  d_groups = (u_int16_t)((d_eventSelect.size()+d_groupSize-1)/d_groupSize);
+  d_enabled.resize(d_groups);
+
+  // Same validation 'PMU::program' applies on every rotation, once up front so 'start' fails instead of a rotation
+  for (u_int16_t g=0; g<d_groups && d_status==0; ++g) {
+    const size_t first = (size_t)g*d_groupSize;
+    const u_int16_t count = (u_int16_t)std::min<size_t>(d_groupSize, d_eventSelect.size()-first);
+    d_status = XEON::PMU::check(d_pmu.capability(), count, d_eventSelect.data()+first);
+  }
+
+  memset(&d_first, 0, sizeof(d_first));
+  memset(&d_last, 0, sizeof(d_last));
+  memset(d_slices.data(), 0, sizeof(Slices)*d_slices.size());
+}
+
+double Intel::Multiplexer::estimate(u_int16_t event) const {
+  assert(event<events());
+
+  const Slices& s = d_slices[event];
+  if (s.d_time==0) {
+    return 0;
+  }
+
+  double total = 0;
+  for (u_int16_t g=0; g<d_groups; ++g) {
+    total += (double)d_enabled[g];
+  }
+
+  return s.d_count/s.d_time*total;
+}
+
+double Intel::Multiplexer::standardError(u_int16_t event) const {
+  assert(event<events());
+
+  // Ratio estimator r = sum(c)/sum(t). With mean slice time tbar its standard error is
+  //   sqrt(sum((c - r*t)^2) / (n*(n-1))) / tbar
+  // scaled by total measured time like the estimate itself.
+  const Slices& s = d_slices[event];
+  if (s.d_n<2 || s.d_time==0) {
+    return -1;
+  }
+
+  const double r = s.d_count/s.d_time;
+  const double tbar = s.d_time/s.d_n;
+  double ss = s.d_count2 - 2*r*s.d_countTime + r*r*s.d_time2;
+  ss = ss<0 ? 0 : ss;
+
+  double total = 0;
+  for (u_int16_t g=0; g<d_groups; ++g) {
+    total += (double)d_enabled[g];
+  }
+
+  return sqrt(ss/(s.d_n*(s.d_n-1)))/tbar*total;
+}
+
+double Intel::Multiplexer::enabledFraction(u_int16_t event) const {
+  assert(event<events());
+
+  double total = 0;
+  for (u_int16_t g=0; g<d_groups; ++g) {
+    total += (double)d_enabled[g];
+  }
+
+  return total==0 ? 0 : (double)d_enabled[event/d_groupSize]/total;
+}
+
+int Intel::Multiplexer::start() {
+  int rc;
+
+  if (d_status!=0) {
+    return d_status;
+  }
+
+  d_group = 0;
+  d_rotations = 0;
+  memset(d_slices.data(), 0, sizeof(Slices)*d_slices.size());
+  for (auto& enabled: d_enabled) {
+    enabled = 0;
+  }
+
+  if ((rc = program(0))!=0 || (rc = d_pmu.reset())!=0) {
+    return rc;
+  }
+
+  d_pmu.snapshotBegin(&d_first);
+  d_last = d_first;
+  d_groupStart = __rdtsc();
+
+  return d_pmu.start();
+}
+
+int Intel::Multiplexer::rotate() {
+  accumulate();
+
+  d_group = (u_int16_t)((d_group+1)%d_groups);
+  ++d_rotations;
+
+  int rc = program(d_group);
+  d_groupStart = __rdtsc();
+  return rc;
+}
+
+int Intel::Multiplexer::stop() {
+  accumulate();
+  return d_pmu.pause();
+}
+
+std::ostream& Intel::Multiplexer::print(std::ostream& stream) const {
+  stream << "Intel XEON CPU HW Core "
+         << d_pmu.coreId()
+         << " PMU multiplexed "
+         << events()
+         << " events in "
+         << d_groups
+         << " groups over "
+         << d_rotations
+         << " rotations:"
+         << std::endl;
+
+  char buf[512];
+  snprintf(buf, sizeof(buf), "%-4s [%-48s]: value   : %015lu\n", "R0", "rdtsc cycles", elapsed());
+  stream << buf;
+
+  for (u_int16_t i = 0; i<d_pmu.fixedCountersDefined(); ++i) {
+    snprintf(buf, sizeof(buf), "%-4s [%-48s]: value   : %015lu\n",
+      d_pmu.fixedMnemonic()[i].c_str(),
+      d_pmu.fixedDescription()[i].c_str(),
+      fixedValue(i));
+    stream << buf;
+  }
+
+  for (u_int16_t i = 0; i<events(); ++i) {
+    char mnemonic[16];
+    snprintf(mnemonic, sizeof(mnemonic), "M%u", i);
+    const double error = standardError(i);
+    if (error<0) {
+      snprintf(buf, sizeof(buf), "%-4s [%-48s]: estimate: %015.0lf +/- unknown, enabled: %5.1lf%%\n",
+        mnemonic, d_description[i].c_str(), estimate(i), 100.0*enabledFraction(i));
+    } else {
+      snprintf(buf, sizeof(buf), "%-4s [%-48s]: estimate: %015.0lf +/- %.0lf, enabled: %5.1lf%%\n",
+        mnemonic, d_description[i].c_str(), estimate(i), error, 100.0*enabledFraction(i));
+    }
+    stream << buf;
+  }
+
+  return stream;
+}
+
+void Intel::Multiplexer::accumulate() {
+  XEON::Snapshot snap;
+  d_pmu.snapshot(&snap);
+
+  const u_int64_t time = snap.d_tsc - d_groupStart;
+  d_enabled[d_group] += time;
+
+  // Programmable counters were zeroed when this group was programmed
+  const u_int16_t first = (u_int16_t)(d_group*d_groupSize);
+  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {
+    Slices& s = d_slices[first+i];
+    const double c = (double)snap.d_prog[i];
+    const double t = (double)time;
+    s.d_n += 1;
+    s.d_count += c;
+    s.d_time += t;
+    s.d_count2 += c*c;
+    s.d_time2 += t*t;
+    s.d_countTime += c*t;
+  }
+
+  d_last = snap;
+}
+
+int Intel::Multiplexer::program(u_int16_t group) {
+  assert(group<d_groups);
+
+  const size_t first = (size_t)group*d_groupSize;
+  const u_int16_t count = (u_int16_t)std::min<size_t>(d_groupSize, d_eventSelect.size()-first);
+  return d_pmu.program(count, d_eventSelect.data()+first, d_descriptionPtr.data()+first);
+}
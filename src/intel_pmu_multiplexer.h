@@ -0,0 +1,193 @@
+#pragma once
+
+// PURPOSE: Count more events than there are programmable counters in one run by time-multiplexing event groups
+//
+// CLASSES:
+//  Intel::Multiplexer: Rotates groups of events through a PMU's programmable counters every 'tick' rdtsc cycles
+//                      while the three fixed counters run throughout. Each group's enabled time is tracked with
+//                      rdtsc. Totals are reported as scaled estimates 'count * (total time / enabled time)' with a
+//                      standard error from the variation of the counting rate between the group's time slices.
+//                      Rotation is cooperative: call 'poll()' from the measured thread e.g. once per iteration. It
+//                      costs one rdtsc unless the tick expired. Every group is validated by 'PMU::check' at
+//                      construction and programmed through 'PMU::program', i.e. the PMU's own MSR plan. Attach to a
+//                      'Stats' with 'Stats::setMultiplexer' to have it report the estimates per iteration.
+
+#include <intel_xeon_pmu.h>
+
+#include <x86intrin.h>
+
+#include <string>
+#include <vector>
+
+namespace Intel {
+
+class Multiplexer {
+  // PRIVATE TYPES
+  struct Slices {
+    // Streaming sums over time slices (count c, enabled rdtsc cycles t) of one event to estimate its rate c/t
+    double d_n;                         // number of slices
+    double d_count;                     // sum c
+    double d_time;                      // sum t
+    double d_count2;                    // sum c*c
+    double d_time2;                     // sum t*t
+    double d_countTime;                 // sum c*t
+  };
+
+  // DATA
+  XEON::PMU&               d_pmu;                 // PMU whose programmable counters are multiplexed
+  std::vector<u_int64_t>   d_eventSelect;         // IA32_PERFEVTSEL value by event
+  std::vector<std::string> d_description;         // description by event
+  std::vector<const char*> d_descriptionPtr;      // 'd_description' as C strings for 'PMU::program'
+  std::vector<Slices>      d_slices;              // slice sums by event
+  std::vector<u_int64_t>   d_enabled;             // enabled rdtsc cycles by group
+  u_int16_t                d_groupSize;           // events per group (last group may be smaller)
+  u_int16_t                d_groups;              // number of groups
+  u_int16_t                d_group;               // group currently in the programmable counters
+  u_int64_t                d_tick;                // rdtsc cycles between rotations
+  u_int64_t                d_groupStart;          // rdtsc value when current group started counting
+  u_int64_t                d_rotations;           // number of group switches since 'start()'
+  int                      d_status;              // 0 if every group passed 'PMU::check' else its errno value
+  XEON::Snapshot           d_first;               // snapshot at 'start()'
+  XEON::Snapshot           d_last;                // snapshot at last 'rotate()' or 'stop()'
+
+public:
+  // CREATORS
+  Multiplexer(XEON::PMU& pmu, const std::vector<u_int64_t>& eventSelect, const std::vector<std::string>& description,
+              u_int64_t tick, u_int16_t groupSize = XEON::PMU::k_MAX_PROG_COUNTERS_HT_ON);
+    // Create a multiplexer running the events with specified 'eventSelect' IA32_PERFEVTSEL values and 'description'
+    // on specified 'pmu' in groups of specified 'groupSize' events, rotating groups every specified 'tick' rdtsc
+    // cycles. If a group doesn't fit 'pmu.capability()' per 'PMU::check', a diagnostic is printed on stderr and
+    // 'status()' is non-zero. The behavior is defined if 'eventSelect' and 'description' have the same non-zero size,
+    // and '0<groupSize<=k_MAX_PROG_COUNTERS_HT_OFF'.
+
+  Multiplexer(const Multiplexer& other) = delete;
+    // Copy constructor is not supported.
+
+  ~Multiplexer() = default;
+    // Destroy this object.
+
+  // ACCESSORS
+  int status() const;
+    // Return 0 if every group can run on the host, and the errno value of the first one that can't otherwise
+
+  u_int16_t groups() const;
+    // Return the number of event groups
+
+  u_int64_t rotations() const;
+    // Return the number of group switches since 'start()'
+
+  u_int16_t events() const;
+    // Return the number of multiplexed events
+
+  double estimate(u_int16_t event) const;
+    // Return the scaled estimate of specified 'event' over the time between 'start()' and the last 'rotate()' or
+    // 'stop()'. The behavior is defined if 'event<events()'.
+
+  double standardError(u_int16_t event) const;
+    // Return the standard error of 'estimate(event)' or a negative value if fewer than two time slices were seen
+
+  double enabledFraction(u_int16_t event) const;
+    // Return the fraction of measured time specified 'event' was in a programmable counter
+
+  u_int64_t fixedValue(u_int16_t counter) const;
+    // Return the exact count of fixed 'counter' between 'start()' and the last 'rotate()' or 'stop()'
+
+  u_int64_t elapsed() const;
+    // Return the rdtsc cycles between 'start()' and the last 'rotate()' or 'stop()'
+
+  const std::string& description(u_int16_t event) const;
+    // Return the description of specified 'event'. The behavior is defined if 'event<events()'.
+
+  // MANIPULATORS
+  int start();
+    // Return 0 if the first group was programmed and all counters reset and started, and 'status()' or another
+    // errno value otherwise
+
+  int poll();
+    // Return 0 if counting continues, rotating to the next group if 'tick' cycles passed since the current group
+    // started, and non-zero if a rotation failed. The behavior is defined if 'start()' ran without error.
+
+  int rotate();
+    // Return 0 if the current group's counts were accumulated and the next group programmed and started, and non-zero
+    // otherwise. The behavior is defined if 'start()' ran without error.
+
+  int stop();
+    // Return 0 if the current group's counts were accumulated and all counters paused, and non-zero otherwise. The
+    // behavior is defined if 'start()' ran without error.
+
+  Multiplexer& operator=(const Multiplexer& rhs) = delete;
+    // Assignment operator not provided
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' exact fixed counter values and estimate, standard error, and enabled
+    // percentage by multiplexed event through the last 'rotate()' or 'stop()'.
+
+private:
+  // PRIVATE MANIPULATORS
+  void accumulate();
+    // Fold the current group's counts since it started into 'd_slices'
+
+  int program(u_int16_t group);
+    // Return 0 if specified 'group' was programmed into the PMU and non-zero otherwise
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Multiplexer& object);
+    // Pretty print 'object' to specified 'stream' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+int Multiplexer::status() const {
+  return d_status;
+}
+
+inline
+u_int16_t Multiplexer::groups() const {
+  return d_groups;
+}
+
+inline
+u_int64_t Multiplexer::rotations() const {
+  return d_rotations;
+}
+
+inline
+u_int16_t Multiplexer::events() const {
+  return (u_int16_t)d_eventSelect.size();
+}
+
+inline
+u_int64_t Multiplexer::fixedValue(u_int16_t counter) const {
+  assert(counter<XEON::PMU::k_FIXED_COUNTERS);
+  return (d_last.d_fixed[counter] - d_first.d_fixed[counter]) & d_pmu.fixedCounterMask();
+}
+
+inline
+u_int64_t Multiplexer::elapsed() const {
+  return d_last.d_tsc - d_first.d_tsc;
+}
+
+inline
+const std::string& Multiplexer::description(u_int16_t event) const {
+  assert(event<events());
+  return d_description[event];
+}
+
+// MANIPULATORS
+inline
+int Multiplexer::poll() {
+  if (__builtin_expect(__rdtsc()-d_groupStart<d_tick, 1)) {
+    return 0;
+  }
+  return rotate();
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Multiplexer& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
@@ -0,0 +1,179 @@
+#include <intel_pmu_probe.h>
+#include <intel_tsc_clock.h>
+
+#include <x86intrin.h>
+
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+struct ProbeNames {
+  // Interned region names. A deque keeps 'c_str()' of earlier names valid as later ones are added.
+  std::mutex                                 d_mutex;
+  std::deque<std::string>                    d_name;
+  std::unordered_map<std::string, u_int32_t> d_id;
+};
+
+ProbeNames& probeNames() {
+  static ProbeNames names;
+  return names;
+}
+
+} // namespace
+
+u_int32_t Intel::Probe::intern(const char *name) {
+  assert(name);
+  ProbeNames& names = probeNames();
+  std::lock_guard<std::mutex> lock(names.d_mutex);
+
+  auto iter = names.d_id.find(name);
+  if (iter!=names.d_id.end()) {
+    return iter->second;
+  }
+
+  const u_int32_t id = (u_int32_t)names.d_name.size();
+  names.d_name.emplace_back(name);
+  names.d_id.emplace(name, id);
+  return id;
+}
+
+const char *Intel::Probe::name(u_int32_t id) {
+  ProbeNames& names = probeNames();
+  std::lock_guard<std::mutex> lock(names.d_mutex);
+  assert(id<names.d_name.size());
+  return names.d_name[id].c_str();
+}
+
+u_int32_t Intel::Probe::regions() {
+  ProbeNames& names = probeNames();
+  std::lock_guard<std::mutex> lock(names.d_mutex);
+  return (u_int32_t)names.d_name.size();
+}
+
+int Intel::Probe::attach(const XEON::PMU& pmu, XEON::PMU::FencePolicy fence, Stats::Mode mode) {
+  if (s_thread) {
+    fprintf(stderr, "Error: thread already attached to a PMU for probes\n");
+    return EEXIST;
+  }
+  if (pmu.status()!=0) {
+    fprintf(stderr, "Error: cannot attach probes to a PMU that failed construction\n");
+    return pmu.status();
+  }
+
+  // First use may calibrate the TSC; keep that out of the first 'dumpEvery'
+  TscClock::instance();
+
+  Thread *thread = new Thread;
+  thread->d_pmu = &pmu;
+  thread->d_fence = fence;
+  thread->d_mode = mode;
+  thread->d_depth = 0;
+  thread->d_dropped = 0;
+  thread->d_lastDump = __rdtsc();
+  thread->d_region.reserve(regions());
+  s_thread = thread;
+
+  return 0;
+}
+
+void Intel::Probe::detach() {
+  Thread *thread = s_thread;
+  if (thread==0) {
+    return;
+  }
+
+  s_thread = 0;
+  for (Region& region: thread->d_region) {
+    delete region.d_inclusive;
+    delete region.d_exclusive;
+  }
+  delete thread;
+}
+
+Intel::Probe::Region& Intel::Probe::create(Thread *thread, u_int32_t id) {
+  if (id>=thread->d_region.size()) {
+    thread->d_region.resize(id+1, Region{0, 0});
+  }
+
+  Region& region = thread->d_region[id];
+  region.d_inclusive = new Stats(*thread->d_pmu, thread->d_fence, thread->d_mode);
+  region.d_exclusive = new Stats(*thread->d_pmu, thread->d_fence, thread->d_mode);
+  return region;
+}
+
+const Intel::Stats *Intel::Probe::inclusive(u_int32_t id) {
+  if (s_thread==0 || id>=s_thread->d_region.size()) {
+    return 0;
+  }
+  return s_thread->d_region[id].d_inclusive;
+}
+
+const Intel::Stats *Intel::Probe::exclusive(u_int32_t id) {
+  if (s_thread==0 || id>=s_thread->d_region.size()) {
+    return 0;
+  }
+  return s_thread->d_region[id].d_exclusive;
+}
+
+void Intel::Probe::reset() {
+  if (s_thread==0) {
+    return;
+  }
+
+  for (Region& region: s_thread->d_region) {
+    if (region.d_inclusive) {
+      region.d_inclusive->reset();
+      region.d_exclusive->reset();
+    }
+  }
+  s_thread->d_dropped = 0;
+}
+
+void Intel::Probe::dump(std::ostream& stream, bool reset) {
+  Thread *thread = s_thread;
+  if (thread==0) {
+    return;
+  }
+
+  stream << "Intel XEON CPU HW Core "
+         << thread->d_pmu->coreId()
+         << " PMU Probes: "
+         << thread->d_dropped
+         << " regions nested deeper than "
+         << (u_int32_t)k_MAX_DEPTH
+         << " not measured"
+         << std::endl;
+
+  for (u_int32_t id=0; id<thread->d_region.size(); ++id) {
+    const Region& region = thread->d_region[id];
+    if (region.d_inclusive==0 || region.d_inclusive->iterations()==0) {
+      continue;
+    }
+    stream << "Region '" << name(id) << "' inclusive:" << std::endl << *region.d_inclusive;
+    stream << "Region '" << name(id) << "' exclusive of nested regions:" << std::endl << *region.d_exclusive;
+  }
+
+  if (reset) {
+    Probe::reset();
+  }
+}
+
+bool Intel::Probe::dumpEvery(u_int64_t intervalNs, std::ostream& stream, bool reset) {
+  Thread *thread = s_thread;
+  if (thread==0) {
+    return false;
+  }
+
+  const u_int64_t now = __rdtsc();
+  if (TscClock::instance().toNanoseconds(now - thread->d_lastDump)<intervalNs) {
+    return false;
+  }
+
+  dump(stream, reset);
+  thread->d_lastDump = now;
+  return true;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+// PURPOSE: Scoped instrumentation probes left in production code and aggregated by named region per thread
+//
+// CLASSES:
+//  Intel::Probe:      Class methods only. A thread 'attach'es a started 'PMU' once; from then on every
+//                     'PMU_SCOPE("name")' it enters snapshots the PMU on entry and on exit and nothing else on the hot
+//                     path. Region names are interned into ids once per probe site, at its first use, and each thread
+//                     keeps a table of 'Stats' by region id. Nested regions are attributed both inclusively (all
+//                     counts between entry and exit) and exclusively (less the inclusive counts of regions nested
+//                     directly inside). 'dump' or 'dumpEvery' prints the calling thread's table e.g. once a second.
+//                     Threads not attached pay one thread local load and branch per probe.
+//  Intel::ProbeScope: RAII guard 'PMU_SCOPE' declares: 'Probe::enter' at construction, 'Probe::exit' at destruction.
+//
+// Probes compile to nothing if 'PMU_PROBES_DISABLED' is defined, e.g. '-DPMU_PROBES_DISABLED'.
+//
+// Usage:
+//   void parse(const Message& msg) {
+//     PMU_SCOPE("parse");                                // inclusive: all of parse; exclusive: less decode
+//     ...
+//     {
+//       PMU_SCOPE("decode");
+//       ...
+//     }
+//   }
+//
+//   Intel::XEON::PMU pmu(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0);
+//   pmu.reset(); pmu.start();
+//   Intel::Probe::attach(pmu);
+//   while (running) {
+//     parse(next());
+//     Intel::Probe::dumpEvery(1000000000, std::cout);    // print and reset once a second
+//   }
+//   Intel::Probe::detach();
+
+#include <intel_pmu_stats.h>
+#include <intel_xeon_pmu.h>
+
+#include <iosfwd>
+#include <vector>
+
+namespace Intel {
+
+class Probe {
+public:
+  // ENUM
+  enum Support {
+    k_MAX_DEPTH = 64,                   // deepest region nesting measured per thread; deeper regions are dropped
+  };
+
+private:
+  // PRIVATE TYPES
+  struct Region {
+    Stats *d_inclusive;                 // counts between entry and exit; 0 until the region is first exited
+    Stats *d_exclusive;                 // same less the inclusive counts of directly nested regions
+  };
+
+  struct Frame {
+    u_int32_t      d_id;                // region entered
+    XEON::Snapshot d_begin;             // snapshot on entry
+    XEON::Snapshot d_child;             // sum of the inclusive deltas of directly nested regions
+  };
+
+  struct Thread {
+    const XEON::PMU        *d_pmu;      // PMU attached by this thread
+    XEON::PMU::FencePolicy  d_fence;    // serialization of probe snapshots
+    Stats::Mode             d_mode;     // mode of each region's 'Stats'
+    u_int32_t               d_depth;    // regions entered and not exited including dropped ones
+    u_int64_t               d_dropped;  // regions not measured because they nested deeper than 'k_MAX_DEPTH'
+    u_int64_t               d_lastDump; // rdtsc of the last 'dumpEvery' dump or of 'attach'
+    std::vector<Region>     d_region;   // statistics by region id
+    Frame                   d_frame[k_MAX_DEPTH]; // entered regions outermost first
+  };
+
+  // CLASS DATA
+  static inline thread_local Thread *s_thread = 0; // calling thread's table or 0 if not attached
+
+  // PRIVATE CLASS METHODS
+  static Region& region(Thread *thread, u_int32_t id);
+    // Return the statistics of specified region 'id' in specified 'thread' creating them on first use
+
+  static Region& create(Thread *thread, u_int32_t id);
+    // Return the statistics of specified region 'id' in specified 'thread' after allocating them. Out of line since
+    // it runs once per region and thread.
+
+  static void accumulate(XEON::Snapshot *sum, const XEON::Snapshot& begin, const XEON::Snapshot& end);
+    // Add to specified 'sum' counter by counter the delta from specified 'begin' to specified 'end'
+
+public:
+  // CLASS METHODS
+  static u_int32_t intern(const char *name);
+    // Return the id of the region of specified 'name' adding it on first call for that name. Thread safe. Ids are
+    // small dense integers starting at 0.
+
+  static const char *name(u_int32_t id);
+    // Return the name of the region of specified 'id'. The behavior is defined if 'id' was returned by 'intern'.
+
+  static u_int32_t regions();
+    // Return the number of interned region names
+
+  static int attach(const XEON::PMU& pmu, XEON::PMU::FencePolicy fence = XEON::PMU::k_FENCE_LFENCE,
+                    Stats::Mode mode = Stats::k_MIN_MAX);
+    // Return 0 if probes entered by the calling thread from now on snapshot specified 'pmu' using optionally
+    // specified 'fence' into per region 'Stats' of optionally specified 'mode', and errno otherwise e.g. EEXIST if
+    // the thread is already attached or 'pmu.status()' if non-zero. The behavior is defined if 'pmu' was started on
+    // the calling thread's core and outlives 'detach()'.
+
+  static void detach();
+    // Stop measuring probes entered by the calling thread and free its region table. Call before the thread or its
+    // PMU goes away. No-op if not attached.
+
+  static bool attached();
+    // Return true if the calling thread is attached, and false otherwise
+
+  static u_int32_t depth();
+    // Return the number of regions the calling thread entered and didn't exit yet, or 0 if not attached
+
+  static u_int64_t dropped();
+    // Return the number of regions the calling thread didn't measure because they nested deeper than 'k_MAX_DEPTH'
+
+  static const Stats *inclusive(u_int32_t id);
+    // Return the calling thread's inclusive statistics of region 'id', or 0 if not attached or never exited
+
+  static const Stats *exclusive(u_int32_t id);
+    // Return the calling thread's exclusive statistics of region 'id', or 0 if not attached or never exited
+
+  static void enter(u_int32_t id);
+    // Snapshot the attached PMU as the start of region 'id'. No-op if the calling thread is not attached.
+
+  static void exit();
+    // Snapshot the attached PMU as the end of the innermost region entered, record its inclusive and exclusive
+    // deltas, and add its inclusive delta to the enclosing region's nested total. No-op if not attached. The
+    // behavior is defined if every 'exit' matches an earlier 'enter' on the same thread.
+
+  static void reset();
+    // Clear the calling thread's statistics of every region. No-op if not attached.
+
+  static void dump(std::ostream& stream, bool reset = false);
+    // Pretty print to specified 'stream' the inclusive and exclusive statistics of every region the calling thread
+    // exited at least once, then clear them if optionally specified 'reset' is true. No-op if not attached.
+
+  static bool dumpEvery(u_int64_t intervalNs, std::ostream& stream, bool reset = true);
+    // Return true after doing 'dump(stream, reset)' if at least specified 'intervalNs' nanoseconds passed since the
+    // last such dump or 'attach', and false otherwise without printing. Cheap enough to call from a service loop:
+    // one rdtsc and a compare when not due.
+};
+
+class ProbeScope {
+public:
+  // CREATORS
+  explicit ProbeScope(u_int32_t id);
+    // Enter region specified 'id'
+
+  ProbeScope(const ProbeScope& other) = delete;
+    // Copy constructor not supported
+
+  ~ProbeScope();
+    // Exit the region entered at construction
+
+  // MANIPULATORS
+  ProbeScope& operator=(const ProbeScope& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// INLINE DEFINITIONS
+// PRIVATE CLASS METHODS
+inline
+Probe::Region& Probe::region(Thread *thread, u_int32_t id) {
+  if (__builtin_expect(id<thread->d_region.size() && thread->d_region[id].d_inclusive!=0, 1)) {
+    return thread->d_region[id];
+  }
+  return create(thread, id);
+}
+
+inline
+void Probe::accumulate(XEON::Snapshot *sum, const XEON::Snapshot& begin, const XEON::Snapshot& end) {
+  sum->d_tsc += end.d_tsc - begin.d_tsc;
+  sum->d_paused += end.d_paused - begin.d_paused;
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::Snapshot::k_FIXED_COUNTERS; ++i) {
+    sum->d_fixed[i] += end.d_fixed[i] - begin.d_fixed[i];
+  }
+#pragma GCC unroll 8
+  for (u_int16_t i=0; i<XEON::Snapshot::k_MAX_PROG_COUNTERS; ++i) {
+    sum->d_prog[i] += end.d_prog[i] - begin.d_prog[i];
+  }
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::Snapshot::k_ENERGY_DOMAINS; ++i) {
+    sum->d_energy[i] += XEON::Rapl::delta(begin.d_energy[i], end.d_energy[i]);
+  }
+  sum->d_aperf += end.d_aperf - begin.d_aperf;
+  sum->d_mperf += end.d_mperf - begin.d_mperf;
+}
+
+// CLASS METHODS
+inline
+bool Probe::attached() {
+  return s_thread!=0;
+}
+
+inline
+u_int32_t Probe::depth() {
+  return s_thread ? s_thread->d_depth : 0;
+}
+
+inline
+u_int64_t Probe::dropped() {
+  return s_thread ? s_thread->d_dropped : 0;
+}
+
+inline
+void Probe::enter(u_int32_t id) {
+  Thread *thread = s_thread;
+  if (__builtin_expect(thread==0, 0)) {
+    return;
+  }
+
+  const u_int32_t depth = thread->d_depth++;
+  if (__builtin_expect(depth>=k_MAX_DEPTH, 0)) {
+    ++thread->d_dropped;
+    return;
+  }
+
+  Frame& frame = thread->d_frame[depth];
+  frame.d_id = id;
+  memset(&frame.d_child, 0, sizeof(frame.d_child));
+  thread->d_pmu->snapshotBegin(&frame.d_begin, thread->d_fence);
+}
+
+inline
+void Probe::exit() {
+  Thread *thread = s_thread;
+  if (__builtin_expect(thread==0, 0)) {
+    return;
+  }
+
+  XEON::Snapshot end;
+  thread->d_pmu->snapshot(&end, thread->d_fence);
+
+  assert(thread->d_depth>0);
+  const u_int32_t depth = --thread->d_depth;
+  if (__builtin_expect(depth>=k_MAX_DEPTH, 0)) {
+    return;
+  }
+
+  const Frame& frame = thread->d_frame[depth];
+  Region& stats = region(thread, frame.d_id);
+  stats.d_inclusive->record(frame.d_begin, end);
+
+  // Exclusive delta is the inclusive delta less nested regions' i.e. 'end-child' relative to 'begin'
+  XEON::Snapshot self = end;
+  self.d_tsc -= frame.d_child.d_tsc;
+  self.d_paused -= frame.d_child.d_paused;
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::Snapshot::k_FIXED_COUNTERS; ++i) {
+    self.d_fixed[i] -= frame.d_child.d_fixed[i];
+  }
+#pragma GCC unroll 8
+  for (u_int16_t i=0; i<XEON::Snapshot::k_MAX_PROG_COUNTERS; ++i) {
+    self.d_prog[i] -= frame.d_child.d_prog[i];
+  }
+  // RAPL counts and their child sums are both modulo 2^32 so the wrapping difference is the exclusive count
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::Snapshot::k_ENERGY_DOMAINS; ++i) {
+    self.d_energy[i] -= frame.d_child.d_energy[i];
+  }
+  self.d_aperf -= frame.d_child.d_aperf;
+  self.d_mperf -= frame.d_child.d_mperf;
+  stats.d_exclusive->record(frame.d_begin, self);
+
+  if (depth>0) {
+    accumulate(&thread->d_frame[depth-1].d_child, frame.d_begin, end);
+  }
+}
+
+// CREATORS
+inline
+ProbeScope::ProbeScope(u_int32_t id) {
+  Probe::enter(id);
+}
+
+inline
+ProbeScope::~ProbeScope() {
+  Probe::exit();
+}
+
+} // namespace Intel
+
+// MACROS
+#define PMU_PROBE_CONCAT_IMPL(a, b) a##b
+#define PMU_PROBE_CONCAT(a, b) PMU_PROBE_CONCAT_IMPL(a, b)
+
+#ifndef PMU_PROBES_DISABLED
+#define PMU_SCOPE(name)                                                                                                \
+  static const u_int32_t PMU_PROBE_CONCAT(pmuProbeId_, __LINE__) = Intel::Probe::intern(name);                         \
+  Intel::ProbeScope PMU_PROBE_CONCAT(pmuProbeScope_, __LINE__)(PMU_PROBE_CONCAT(pmuProbeId_, __LINE__))
+  // Measure the enclosing block from here to its end as region specified 'name', a string literal. The name is
+  // interned once per probe site at first use.
+#else
+#define PMU_SCOPE(name) do {} while (0)
+  // Compiled out
+#endif
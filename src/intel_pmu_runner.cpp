@@ -0,0 +1,295 @@
+#include <intel_pmu_runner.h>
+
+#include <algorithm>
+
+u_int32_t Intel::Runner::changepoint(const u_int64_t *value, u_int32_t count, double threshold) {
+  assert(value || count==0);
+
+  if (count<4) {
+    return 0;
+  }
+
+  // Prefix sums of values and squares relative to the overall mean so large cycle counts don't cancel out
+  double mean = 0.0;
+  for (u_int32_t i=0; i<count; ++i) {
+    mean += (double)value[i];
+  }
+  mean /= (double)count;
+
+  std::vector<double> sum(count+1), square(count+1);
+  sum[0] = square[0] = 0.0;
+  for (u_int32_t i=0; i<count; ++i) {
+    const double x = (double)value[i] - mean;
+    sum[i+1] = sum[i] + x;
+    square[i+1] = square[i] + x*x;
+  }
+
+  // Split minimizing the total squared error of both runs. Each run has at least 2 values so has a variance.
+  u_int32_t best = 0;
+  double bestError = 0.0;
+  for (u_int32_t k=2; k+2<=count; ++k) {
+    const double n1 = (double)k;
+    const double n2 = (double)(count-k);
+    const double s1 = sum[k];
+    const double s2 = sum[count]-sum[k];
+    const double error = (square[k] - s1*s1/n1) + (square[count]-square[k] - s2*s2/n2);
+    if (best==0 || error<bestError) {
+      best = k;
+      bestError = error;
+    }
+  }
+
+  const double n1 = (double)best;
+  const double n2 = (double)(count-best);
+  const double m1 = sum[best]/n1;
+  const double m2 = (sum[count]-sum[best])/n2;
+  const double v1 = (square[best] - n1*m1*m1)/(n1-1.0);
+  const double v2 = (square[count]-square[best] - n2*m2*m2)/(n2-1.0);
+  const double se = sqrt((v1>0.0 ? v1 : 0.0)/n1 + (v2>0.0 ? v2 : 0.0)/n2);
+
+  if (se==0.0) {
+    return m1!=m2 ? best : 0;
+  }
+  return fabs(m1-m2)/se>threshold ? best : 0;
+}
+
+void Intel::Runner::medianMad(const u_int64_t *value, u_int32_t count, double *median, double *mad) {
+  assert(value);
+  assert(count>0);
+  assert(median);
+  assert(mad);
+
+  std::vector<double> scratch(value, value+count);
+
+  auto middle = [&scratch]() -> double {
+    const size_t half = scratch.size()/2;
+    std::nth_element(scratch.begin(), scratch.begin()+half, scratch.end());
+    const double upper = scratch[half];
+    if (scratch.size()%2) {
+      return upper;
+    }
+    return (*std::max_element(scratch.begin(), scratch.begin()+half) + upper)/2.0;
+  };
+
+  *median = middle();
+  for (double& x: scratch) {
+    x = fabs(x - *median);
+  }
+  *mad = middle();
+}
+
+Intel::Runner::Runner(const XEON::PMU& pmu)
+: Runner(pmu, Options())
+{
+}
+
+Intel::Runner::Runner(const XEON::PMU& pmu, const Options& options, Stats::Mode mode)
+: d_pmu(pmu)
+, d_options(options)
+, d_stats(pmu, options.d_fence, mode)
+, d_warming(true)
+, d_windowCount(0)
+, d_windowBegin(options.d_warmupWindow)
+, d_windowEnd(options.d_warmupWindow)
+, d_windowValue(options.d_warmupWindow)
+, d_checkpoint(0)
+, d_median(0.0)
+, d_mad(0.0)
+{
+  d_result.d_iterations = 0;
+  d_result.d_warmup = 0;
+  d_result.d_outliers = 0;
+  d_result.d_migrations = 0;
+  d_result.d_converged = false;
+  d_result.d_stable = true;
+  d_result.d_retries = 0;
+  d_value.reserve(options.d_maxIterations);
+
+  for (u_int16_t i=0; i<k_COUNTERS; ++i) {
+    d_overhead[i] = options.d_overhead ? options.d_overhead[i] : 0;
+  }
+  d_options.d_overhead = options.d_overhead ? d_overhead : 0;
+  d_stats.setOverhead(options.d_overhead);
+  d_stats.setFrequencyVariation(options.d_maxFrequencyVariation);
+}
+
+int Intel::Runner::run(const std::function<void()>& body) {
+  d_result.d_retries = 0;
+
+  XEON::Snapshot begin, end;
+  do {
+    int rc = start();
+    if (rc!=0) {
+      return rc;
+    }
+    do {
+      measure(body, &begin, &end);
+    } while (add(begin, end));
+  } while (retry());
+
+  return 0;
+}
+
+bool Intel::Runner::retry() {
+  if (d_result.d_stable || d_result.d_retries>=d_options.d_retries) {
+    return false;
+  }
+  ++d_result.d_retries;
+  return true;
+}
+
+int Intel::Runner::start() {
+  if (d_options.d_counter>=k_P0+d_pmu.programmableCountersDefined()) {
+    fprintf(stderr, "Error: runner counter %d not defined; PMU has %u programmable counters\n",
+      (int)d_options.d_counter, d_pmu.programmableCountersDefined());
+    return EINVAL;
+  }
+  if (d_options.d_minIterations<2 || d_options.d_maxIterations<d_options.d_minIterations ||
+      d_options.d_warmupWindow<4 || d_options.d_relativeWidth<=0.0 || d_options.d_maxFrequencyVariation<0.0) {
+    fprintf(stderr, "Error: runner options invalid: need 2<=minIterations<=maxIterations, warmupWindow>=4, "
+      "relativeWidth>0, maxFrequencyVariation>=0\n");
+    return EINVAL;
+  }
+
+  d_result.d_iterations = 0;
+  d_result.d_warmup = 0;
+  d_result.d_outliers = 0;
+  d_result.d_migrations = 0;
+  d_result.d_converged = false;
+  d_result.d_stable = true;
+  for (u_int16_t i=0; i<k_COUNTERS; ++i) {
+    d_result.d_counter[i].reset();
+  }
+  d_warming = true;
+  d_windowCount = 0;
+  d_value.clear();
+  d_stats.reset();
+
+  return 0;
+}
+
+bool Intel::Runner::add(const XEON::Snapshot& begin, const XEON::Snapshot& end) {
+  const Counter counter = d_options.d_counter;
+  u_int64_t delta[k_COUNTERS];
+
+  ++d_result.d_iterations;
+
+  // Per core counters read on two cores don't subtract
+  if (begin.d_aux!=end.d_aux && d_pmu.backend()==XEON::PMU::k_BACKEND_MSR) {
+    ++d_result.d_migrations;
+    return d_result.d_iterations<d_options.d_maxIterations || stop();
+  }
+
+  deltas(begin, end, delta);
+
+  if (!d_warming) {
+    steady(begin, end, delta);
+  } else {
+    // Warmup: fill the window, cut everything before a significant changepoint, refill, repeat
+    d_windowBegin[d_windowCount] = begin;
+    d_windowEnd[d_windowCount] = end;
+    d_windowValue[d_windowCount] = delta[counter];
+    ++d_windowCount;
+
+    const bool full = d_windowCount==d_options.d_warmupWindow;
+    const bool last = d_result.d_iterations>=d_options.d_maxIterations;
+    if (!full && !last) {
+      return true;
+    }
+
+    if (!last && d_result.d_warmup<d_options.d_maxWarmup) {
+      const u_int32_t cut = changepoint(d_windowValue.data(), d_windowCount, d_options.d_changepointT);
+      if (cut!=0) {
+        std::copy(d_windowBegin.begin()+cut, d_windowBegin.begin()+d_windowCount, d_windowBegin.begin());
+        std::copy(d_windowEnd.begin()+cut, d_windowEnd.begin()+d_windowCount, d_windowEnd.begin());
+        std::copy(d_windowValue.begin()+cut, d_windowValue.begin()+d_windowCount, d_windowValue.begin());
+        d_windowCount -= cut;
+        d_result.d_warmup += cut;
+        return true;
+      }
+    }
+
+    // Steady state: the rest of the window seeds median and MAD
+    d_warming = false;
+    medianMad(d_windowValue.data(), d_windowCount, &d_median, &d_mad);
+    d_checkpoint = 2*d_windowCount;
+    for (u_int32_t i=0; i<d_windowCount; ++i) {
+      deltas(d_windowBegin[i], d_windowEnd[i], delta);
+      steady(d_windowBegin[i], d_windowEnd[i], delta);
+    }
+  }
+
+  const Welford& chosen = d_result.d_counter[counter];
+  d_result.d_converged = chosen.count()>=d_options.d_minIterations &&
+                         chosen.halfWidth(d_options.d_z)<=d_options.d_relativeWidth*fabs(chosen.mean());
+
+  return (!d_result.d_converged && d_result.d_iterations<d_options.d_maxIterations) || stop();
+}
+
+bool Intel::Runner::stop() {
+  d_result.d_stable = d_stats.frequencyStable();
+  return false;
+}
+
+std::ostream& Intel::Runner::print(std::ostream& stream) const {
+  stream << "Intel XEON CPU HW Core "
+         << d_pmu.coreId()
+         << " PMU Runner on "
+         << d_result.d_iterations
+         << " iterations ("
+         << d_result.d_warmup
+         << " warmup, "
+         << d_result.d_outliers
+         << " outliers, "
+         << d_result.d_migrations
+         << " migrated) "
+         << (d_result.d_converged ? "converged" : "did not converge")
+         << (d_result.d_stable ? "" : ", frequency unstable")
+         << (d_result.d_retries ? ", " + std::to_string(d_result.d_retries) + " unstable runs retried" : "")
+         << ":"
+         << std::endl;
+
+  char buf[256];
+  auto line = [&buf, &stream, this](const char *mnemonic, const char *description, const Welford& w) {
+    const double half = w.halfWidth(d_options.d_z);
+    snprintf(buf, sizeof(buf), "%-3s [%-48s]: mean: %lf, stddev: %lf, ci: +/-%lf (%.3lf%%)\n",
+      mnemonic, description, w.mean(), w.stddev(), half, w.mean()!=0.0 ? 100.0*half/fabs(w.mean()) : 0.0);
+    stream << buf;
+  };
+
+  line("R0", "rdtsc cycles", d_result.d_counter[k_RDTSC]);
+  line("A0", "active (not paused) rdtsc cycles", d_result.d_counter[k_ACTIVE]);
+  for (u_int16_t i=0; i<d_pmu.fixedCountersDefined(); ++i) {
+    line(d_pmu.fixedMnemonic()[i].c_str(), d_pmu.fixedDescription()[i].c_str(), d_result.d_counter[k_F0+i]);
+  }
+  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {
+    line(d_pmu.programmableMnemonic()[i].c_str(), d_pmu.programmableDescription()[i].c_str(),
+      d_result.d_counter[k_P0+i]);
+  }
+
+  return stream << d_stats;
+}
+
+void Intel::Runner::steady(const XEON::Snapshot& begin, const XEON::Snapshot& end, const u_int64_t *delta) {
+  const u_int64_t value = delta[d_options.d_counter];
+  d_value.push_back(value);
+
+  if (d_value.size()>=d_checkpoint) {
+    medianMad(d_value.data(), (u_int32_t)d_value.size(), &d_median, &d_mad);
+    d_checkpoint *= 2;
+  }
+
+  if (outlier(value)) {
+    ++d_result.d_outliers;
+  } else {
+    keep(begin, end, delta);
+  }
+}
+
+void Intel::Runner::keep(const XEON::Snapshot& begin, const XEON::Snapshot& end, const u_int64_t *delta) {
+  const u_int16_t count = (u_int16_t)(k_P0+d_pmu.programmableCountersDefined());
+  for (u_int16_t i=0; i<count; ++i) {
+    d_result.d_counter[i].add((double)delta[i]);
+  }
+  d_stats.record(begin, end);
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+// PURPOSE: Run a benchmark body until its measurement is precise enough instead of a fixed number of times
+//
+// CLASSES:
+//  Intel::Runner: Wraps a callable with 'PMU' snapshots and a 'Stats'. Iterations run in three phases:
+//                 1. Warmup: a window of iterations is searched for the single split that best separates two levels
+//                    of the chosen counter (least squares changepoint). If the split is significant (Welch t above
+//                    'd_changepointT') the iterations before it are discarded as warmup and the window is refilled
+//                    and searched again.
+//                 2. Steady state: each iteration is an outlier if its modified z-score '0.6745*|x-median|/MAD' in
+//                    the chosen counter exceeds 'd_outlierZ'. Median and MAD are recomputed each time the number of
+//                    steady state iterations doubles. Outliers are counted and left out of everything else.
+//                 3. Stop: once 'd_minIterations' iterations were kept and the confidence interval of the chosen
+//                    counter's mean is narrower than 'd_relativeWidth' of the mean, or 'd_maxIterations' ran.
+//                 Mean, variance, and confidence interval of every counter are kept with streaming 'Welford' updates.
+//                 Kept iterations are also recorded into 'stats()' for min/max and, optionally, percentiles. If the
+//                 PMU has a 'Frequency' attached and the run was throttled or its effective GHz varied beyond
+//                 'd_maxFrequencyVariation', the run is unstable and 'run' discards it and runs again, up to
+//                 'd_retries' times. Callers owning the measurement loop e.g. 'BenchmarkState' feed snapshots
+//                 through 'start' and 'add' instead of calling 'run', and ask 'retry' whether to run again.
+
+#include <intel_pmu_stats.h>
+#include <intel_pmu_welford.h>
+
+#include <functional>
+#include <vector>
+
+namespace Intel {
+
+class Runner {
+public:
+  // ENUM
+  enum Counter {
+    // Counters by index. Same order as 'Stats' histograms.
+    k_RDTSC        = 0,                 // rdtsc cycles
+    k_ACTIVE       = 1,                 // rdtsc cycles less cycles spent paused
+    k_F0           = 2,                 // fixed counter 0: retired instructions
+    k_F1           = 3,                 // fixed counter 1: no-halt cpu cycles
+    k_F2           = 4,                 // fixed counter 2: reference no-halt cpu cycles
+    k_P0           = 5,                 // programmable counter 0; programmable counter 'i' is 'k_P0+i'
+    k_COUNTERS     = Stats::k_HISTOGRAMS,
+  };
+
+  struct Options {
+    Counter   d_counter = k_F1;                 // counter whose confidence interval decides when to stop
+    double    d_relativeWidth = 0.01;           // stop when CI half width is at most this fraction of the mean
+    double    d_z = 1.96;                       // normal quantile of the CI e.g. 1.96 is 95%, 2.576 is 99%
+    u_int32_t d_minIterations = 30;             // kept iterations required before stopping
+    u_int32_t d_maxIterations = 100000;         // iterations after which to stop regardless
+    u_int32_t d_warmupWindow = 64;              // iterations searched for a changepoint at a time
+    u_int32_t d_maxWarmup = 10000;              // iterations after which to stop looking for warmup
+    double    d_changepointT = 5.0;             // t statistic above which a changepoint is accepted
+    double    d_outlierZ = 3.5;                 // modified z-score above which an iteration is an outlier
+    XEON::PMU::FencePolicy d_fence = XEON::PMU::k_FENCE_MFENCE_LFENCE; // serialization of snapshots
+    const u_int64_t *d_overhead = 0;            // 'k_COUNTERS' overheads subtracted from deltas e.g.
+                                                // 'Calibration::overhead()', or 0. Copied at construction.
+    double    d_maxFrequencyVariation = 0.02;   // window GHz stddev over the average making a run unstable
+    u_int32_t d_retries = 2;                    // unstable runs discarded and run again before keeping one
+  };
+
+  struct Result {
+    u_int64_t d_iterations;                     // times the body ran
+    u_int64_t d_warmup;                         // iterations discarded as warmup
+    u_int64_t d_outliers;                       // steady state iterations discarded as outliers
+    u_int64_t d_migrations;                     // iterations discarded since the thread changed cpu in them
+    bool      d_converged;                      // true if stopped by CI width, false if by 'd_maxIterations'
+    bool      d_stable;                         // false if throttled or frequency varied per 'Stats::frequencyStable'
+    u_int32_t d_retries;                        // unstable runs discarded before this one
+    Welford   d_counter[k_COUNTERS];            // statistics of kept iterations by counter
+  };
+
+private:
+  // DATA
+  const XEON::PMU&            d_pmu;          // PMU read around each iteration
+  Options                     d_options;      // configuration
+  Stats                       d_stats;        // min/max/avg and histograms of kept iterations
+  Result                      d_result;       // statistics of the last 'run'
+  u_int64_t                   d_overhead[k_COUNTERS]; // subtracted from deltas; all 0 without 'd_overhead'
+  bool                        d_warming;      // true while looking for the end of warmup
+  u_int32_t                   d_windowCount;  // iterations held in the warmup window
+  std::vector<XEON::Snapshot> d_windowBegin;  // snapshot before each iteration in the warmup window
+  std::vector<XEON::Snapshot> d_windowEnd;    // snapshot after each iteration in the warmup window
+  std::vector<u_int64_t>      d_windowValue;  // chosen counter of each iteration in the warmup window
+  std::vector<u_int64_t>      d_value;        // chosen counter of every steady state iteration, for median and MAD
+  size_t                      d_checkpoint;   // 'd_value' size at which median and MAD are next recomputed
+  double                      d_median;       // median of 'd_value' at the last recompute
+  double                      d_mad;          // median absolute deviation of 'd_value' at the last recompute
+
+public:
+  // CLASS METHODS
+  static u_int32_t changepoint(const u_int64_t *value, u_int32_t count, double threshold);
+    // Return the index of the first value after the split of specified 'value' array of specified 'count' entries
+    // into two runs of 2 or more values minimizing the sum of squared differences from each run's mean, if the
+    // Welch t statistic of the two means exceeds specified 'threshold', and 0 otherwise.
+
+  static void medianMad(const u_int64_t *value, u_int32_t count, double *median, double *mad);
+    // Load into specified 'median' and 'mad' the median and median absolute deviation of specified 'value' array of
+    // specified 'count' entries. The behavior is defined if 'count>0'.
+
+  // CREATORS
+  explicit Runner(const XEON::PMU& pmu);
+    // Create a runner measuring with specified 'pmu' per default 'Options'. See below.
+
+  Runner(const XEON::PMU& pmu, const Options& options, Stats::Mode mode = Stats::k_MIN_MAX);
+    // Create a runner measuring with specified 'pmu' per specified 'options'. Kept iterations are recorded in a
+    // 'Stats' of optionally specified 'mode'. 'd_maxIterations' values are allocated here so 'run' doesn't allocate
+    // per iteration. The behavior is defined if 'pmu' is started before 'run' and outlives this object.
+
+  Runner(const Runner& other) = delete;
+    // Copy constructor not supported
+
+  ~Runner() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  const Options& options() const;
+    // Return the options provided at construction
+
+  const Result& result() const;
+    // Return the statistics of the last 'run'
+
+  const Stats& stats() const;
+    // Return the min/max/avg, and histograms if enabled, of iterations kept in the last 'run'
+
+  // MANIPULATORS
+  int run(const std::function<void()>& body);
+    // Return 0 after running specified 'body' per the options provided at construction, and EINVAL without running
+    // it if the options are invalid e.g. the chosen counter isn't defined in 'pmu'. Results of a prior 'run' are
+    // discarded. Equivalent to 'start()' then snapshotting around 'body' and calling 'add' until it returns false.
+
+  int start();
+    // Return 0 if the options are valid, discarding results of a prior run, and EINVAL otherwise
+
+  bool add(const XEON::Snapshot& begin, const XEON::Snapshot& end);
+    // Return true if more iterations are wanted after folding the one from specified 'begin' to specified 'end', both
+    // taken from 'pmu', and false once the stop rule is met, setting 'd_stable'. An iteration whose snapshots were
+    // read on different cpus of an MSR backend PMU counts toward 'd_maxIterations' but is otherwise discarded. The
+    // behavior is defined if 'start()' returned 0.
+
+  bool retry();
+    // Return true, counting it in 'd_retries', if the run just ended was unstable and fewer than 'd_retries' runs
+    // were discarded so far, in which case the caller runs again from 'start()', and false otherwise. 'd_retries'
+    // survives 'start()'; it is reset by 'run' and at construction.
+
+  Runner& operator=(const Runner& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' iteration counts, mean, standard deviation and CI by counter, then 'stats()'
+
+private:
+  // PRIVATE ACCESSORS
+  void measure(const std::function<void()>& body, XEON::Snapshot *begin, XEON::Snapshot *end) const;
+    // Run specified 'body' once between snapshots loaded into specified 'begin' and 'end'
+
+  void deltas(const XEON::Snapshot& begin, const XEON::Snapshot& end, u_int64_t *delta) const;
+    // Load into specified 'delta' array of 'k_COUNTERS' entries each counter's change from specified 'begin' to
+    // specified 'end' taken modulo the counter width less the configured overhead
+
+  bool outlier(u_int64_t value) const;
+    // Return true if specified 'value' of the chosen counter is an outlier relative to the current median and MAD
+
+  // PRIVATE MANIPULATORS
+  bool stop();
+    // Return false after setting 'd_stable' per 'stats()' at the end of a run
+
+  void steady(const XEON::Snapshot& begin, const XEON::Snapshot& end, const u_int64_t *delta);
+    // Fold the steady state iteration from specified 'begin' to specified 'end' with specified 'delta' unless it's an
+    // outlier
+
+  void keep(const XEON::Snapshot& begin, const XEON::Snapshot& end, const u_int64_t *delta);
+    // Fold the iteration from specified 'begin' to specified 'end' with specified 'delta' into the result and stats
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Runner& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+const Runner::Options& Runner::options() const {
+  return d_options;
+}
+
+inline
+const Runner::Result& Runner::result() const {
+  return d_result;
+}
+
+inline
+const Stats& Runner::stats() const {
+  return d_stats;
+}
+
+// PRIVATE ACCESSORS
+inline
+void Runner::measure(const std::function<void()>& body, XEON::Snapshot *begin, XEON::Snapshot *end) const {
+  d_pmu.snapshotBegin(begin, d_options.d_fence);
+  body();
+  d_pmu.snapshot(end, d_options.d_fence);
+}
+
+inline
+void Runner::deltas(const XEON::Snapshot& begin, const XEON::Snapshot& end, u_int64_t *delta) const {
+  delta[k_RDTSC] = end.d_tsc - begin.d_tsc;
+  delta[k_ACTIVE] = delta[k_RDTSC] - (end.d_paused - begin.d_paused);
+  for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+    delta[k_F0+i] = (end.d_fixed[i] - begin.d_fixed[i]) & d_pmu.fixedCounterMask();
+  }
+  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {
+    delta[k_P0+i] = (end.d_prog[i] - begin.d_prog[i]) & d_pmu.programmableCounterMask();
+  }
+  for (u_int16_t i=0; i<k_P0+d_pmu.programmableCountersDefined(); ++i) {
+    delta[i] -= delta[i]<d_overhead[i] ? delta[i] : d_overhead[i];
+  }
+}
+
+inline
+bool Runner::outlier(u_int64_t value) const {
+  // 0.6745 makes MAD comparable to a standard deviation for normal data. A MAD of 0 e.g. retired instructions of a
+  // deterministic body is floored at 1 count so equal values are never outliers.
+  const double mad = d_mad<1.0 ? 1.0 : d_mad;
+  return 0.6745*fabs((double)value - d_median)/mad > d_options.d_outlierZ;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Runner& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
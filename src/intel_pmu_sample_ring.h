@@ -0,0 +1,144 @@
+#pragma once
+
+// PURPOSE: Hand PMU samples from one producer thread to one consumer thread without locks or allocation
+//
+// CLASSES:
+//  Intel::Sample:     One timestamped PMU snapshot from one HW cpu plus what it cost to take.
+//  Intel::SampleRing: Bounded single-producer single-consumer ring of 'Sample' over caller provided storage e.g. a
+//                     slice of a preallocated arena. 'push' never blocks: when the ring is full the sample is dropped
+//                     and counted. Producer and consumer indexes live on separate cache lines, and each side caches
+//                     the other's index so the shared lines move only when the cached view runs out.
+
+#include <intel_pmu_snapshot.h>
+
+#include <assert.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+namespace Intel {
+
+struct Sample {
+  XEON::Snapshot d_snapshot;            // rdtsc and counter values when the sample was taken
+  u_int32_t      d_cpu;                 // HW cpu the sample was taken on
+  u_int32_t      d_overhead;            // rdtsc cycles spent taking the sample
+};
+
+class SampleRing {
+  // DATA
+  // Producer cache line
+  alignas(64) std::atomic<u_int64_t> d_head;    // index of next slot to write; written by producer only
+  u_int64_t                          d_tailCache;// producer's last seen value of 'd_tail'
+  std::atomic<u_int64_t>             d_drops;   // samples dropped because ring was full; written by producer only
+
+  // Consumer cache line
+  alignas(64) std::atomic<u_int64_t> d_tail;    // index of next slot to read; written by consumer only
+  u_int64_t                          d_headCache;// consumer's last seen value of 'd_head'
+
+  // Read-only after construction
+  alignas(64) Sample                *d_slot;    // storage for 'capacity' samples
+  u_int64_t                          d_mask;    // capacity - 1
+
+public:
+  // CREATORS
+  SampleRing(Sample *slot, u_int32_t capacity);
+    // Create an empty ring over specified 'slot' array of specified 'capacity' entries. The behavior is defined if
+    // 'capacity' is a non-zero power of 2 and 'slot' outlives this object.
+
+  SampleRing(const SampleRing& other) = delete;
+    // Copy constructor is not supported.
+
+  ~SampleRing() = default;
+    // Destroy this object. 'slot' storage is not freed.
+
+  // ACCESSORS
+  u_int32_t capacity() const;
+    // Return the number of samples the ring holds
+
+  u_int64_t drops() const;
+    // Return the number of samples dropped so far because the ring was full. Callable from any thread
+
+  // MANIPULATORS
+  bool push(const Sample& sample);
+    // Return true if specified 'sample' was appended and false if the ring was full and the sample dropped. Call
+    // from the producer thread only.
+
+  u_int32_t peek(const Sample **first);
+    // Return the number of samples readable as one contiguous run starting at the address loaded into specified
+    // 'first', or 0 if the ring is empty. Runs wrap at the end of the storage so a full drain may take two calls.
+    // Call from the consumer thread only.
+
+  void consume(u_int32_t count);
+    // Release specified 'count' samples returned by 'peek' back to the producer. Call from the consumer thread only.
+    // The behavior is defined if 'count' is at most the last 'peek' result.
+
+  SampleRing& operator=(const SampleRing& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+SampleRing::SampleRing(Sample *slot, u_int32_t capacity)
+: d_head(0)
+, d_tailCache(0)
+, d_drops(0)
+, d_tail(0)
+, d_headCache(0)
+, d_slot(slot)
+, d_mask(capacity-1)
+{
+  assert(slot);
+  assert(capacity>0 && (capacity & (capacity-1))==0);
+}
+
+// ACCESSORS
+inline
+u_int32_t SampleRing::capacity() const {
+  return (u_int32_t)(d_mask+1);
+}
+
+inline
+u_int64_t SampleRing::drops() const {
+  return d_drops.load(std::memory_order_relaxed);
+}
+
+// MANIPULATORS
+inline
+bool SampleRing::push(const Sample& sample) {
+  const u_int64_t head = d_head.load(std::memory_order_relaxed);
+  if (head-d_tailCache>d_mask) {
+    d_tailCache = d_tail.load(std::memory_order_acquire);
+    if (head-d_tailCache>d_mask) {
+      d_drops.store(d_drops.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  d_slot[head & d_mask] = sample;
+  d_head.store(head+1, std::memory_order_release);
+  return true;
+}
+
+inline
+u_int32_t SampleRing::peek(const Sample **first) {
+  assert(first);
+  const u_int64_t tail = d_tail.load(std::memory_order_relaxed);
+  if (tail==d_headCache) {
+    d_headCache = d_head.load(std::memory_order_acquire);
+    if (tail==d_headCache) {
+      return 0;
+    }
+  }
+  const u_int64_t index = tail & d_mask;
+  const u_int64_t available = d_headCache-tail;
+  const u_int64_t untilEnd = d_mask+1-index;
+  *first = d_slot+index;
+  return (u_int32_t)(available<untilEnd ? available : untilEnd);
+}
+
+inline
+void SampleRing::consume(u_int32_t count) {
+  d_tail.store(d_tail.load(std::memory_order_relaxed)+count, std::memory_order_release);
+}
+
+} // namespace Intel
@@ -0,0 +1,276 @@
+#include <intel_pmu_sampler.h>
+
+#include <pthread.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#include <new>
+
+namespace {
+
+// Same names 'PMU' gives its fixed counters
+const char *const k_FIXED_DESCRIPTION[] = {
+  "retired instructions",
+  "no-halt cpu cycles",
+  "reference no-halt cpu cycles",
+};
+
+size_t ringBytes(u_int32_t capacity) {
+  // Ring header then its slots, rounded up to a cache line so neighbouring cores don't share lines
+  const size_t bytes = sizeof(Intel::SampleRing) + capacity*sizeof(Intel::Sample);
+  return (bytes+63) & ~(size_t)63;
+}
+
+} // anon namespace
+
+Intel::Sampler::Sampler(const std::vector<int>& cpu, u_int16_t count, const u_int64_t *eventSelect,
+                        const char *const *description, u_int64_t intervalNs, u_int32_t capacity,
+                        const std::string& msrRoot)
+: d_arena(0)
+, d_capacity(capacity)
+, d_interval(intervalNs)
+, d_cnt(count)
+, d_fixedMask(0)
+, d_progMask(0)
+, d_msrRoot(msrRoot)
+, d_running(false)
+{
+  assert(!cpu.empty());
+  assert(count<=XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF);
+  assert(capacity>0 && (capacity & (capacity-1))==0);
+
+  for (u_int16_t i=0; i<count; ++i) {
+    d_pcfg[i] = eventSelect[i];
+    d_progDescription.push_back(description[i]);
+  }
+
+  u_int16_t fixedWidth, progWidth;
+  XEON::PMU::counterWidth(&fixedWidth, &progWidth);
+  d_fixedMask = fixedWidth>=64 ? ~0ull : (1ull<<fixedWidth)-1;
+  d_progMask = progWidth>=64 ? ~0ull : (1ull<<progWidth)-1;
+
+  // One allocation for every ring, touched now so the sample path never faults a page in
+  const size_t bytes = ringBytes(capacity)*cpu.size();
+  d_arena = static_cast<char*>(aligned_alloc(64, bytes));
+  assert(d_arena);
+  memset(d_arena, 0, bytes);
+
+  for (u_int32_t c=0; c<cpu.size(); ++c) {
+    Core *core = new Core;
+    core->d_cpu = cpu[c];
+    core->d_status = -1;
+    clear(&core->d_summary);
+    memset(&core->d_last, 0, sizeof(core->d_last));
+    char *base = d_arena + ringBytes(capacity)*c;
+    core->d_ring = new (base) SampleRing(reinterpret_cast<Sample*>(base+sizeof(SampleRing)), capacity);
+    d_core.push_back(core);
+  }
+}
+
+Intel::Sampler::~Sampler() {
+  stop();
+  for (auto core: d_core) {
+    core->d_ring->~SampleRing();
+    delete core;
+  }
+  free(d_arena);
+}
+
+int Intel::Sampler::start() {
+  assert(!running());
+
+  for (u_int32_t c=0; c<d_core.size(); ++c) {
+    Core *core = d_core[c];
+    char *base = d_arena + ringBytes(d_capacity)*c;
+    core->d_ring->~SampleRing();
+    core->d_ring = new (base) SampleRing(reinterpret_cast<Sample*>(base+sizeof(SampleRing)), d_capacity);
+    core->d_status = -1;
+    clear(&core->d_summary);
+  }
+
+  d_running.store(true);
+  for (auto core: d_core) {
+    core->d_thread = std::thread(&Sampler::run, this, core);
+  }
+
+  // Wait for every thread to set up its PMU so failures are reported here
+  int rc = 0;
+  for (auto core: d_core) {
+    int status;
+    while ((status = core->d_status.load(std::memory_order_acquire))==-1) {
+      sched_yield();
+    }
+    if (status!=0 && rc==0) {
+      rc = status;
+    }
+  }
+
+  if (rc!=0) {
+    stop();
+  }
+  return rc;
+}
+
+void Intel::Sampler::stop() {
+  d_running.store(false);
+  for (auto core: d_core) {
+    if (core->d_thread.joinable()) {
+      core->d_thread.join();
+    }
+  }
+}
+
+u_int64_t Intel::Sampler::drain(const std::function<void(const Sample *sample, u_int32_t count)>& batch) {
+  u_int64_t drained = 0;
+  for (auto core: d_core) {
+    const Sample *first;
+    u_int32_t count;
+    while ((count = core->d_ring->peek(&first))!=0) {
+      if (batch) {
+        batch(first, count);
+      }
+      for (u_int32_t i=0; i<count; ++i) {
+        fold(core, first[i]);
+      }
+      core->d_ring->consume(count);
+      drained += count;
+    }
+  }
+  return drained;
+}
+
+std::ostream& Intel::Sampler::print(std::ostream& stream) const {
+  char buf[256];
+
+  for (u_int32_t c=0; c<d_core.size(); ++c) {
+    const Summary& s = d_core[c]->d_summary;
+    const double intervals = (double)s.d_intervals;
+    const double samples = (double)s.d_samples;
+
+    stream << "Intel XEON CPU HW Core "
+           << d_core[c]->d_cpu
+           << " PMU Sampler on "
+           << s.d_samples
+           << " samples, "
+           << drops(c)
+           << " dropped:"
+           << std::endl;
+
+    if (s.d_samples==0) {
+      continue;
+    }
+
+    snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
+      "O0", "rdtsc cycles per sample", s.d_overheadMin, s.d_overheadMax, (double)s.d_overheadTotal/samples);
+    stream << buf;
+
+    if (s.d_intervals==0) {
+      continue;
+    }
+
+    snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
+      "R0", "rdtsc cycles", s.d_rdtscMin, s.d_rdtscMax, (double)s.d_rdtscTotal/intervals);
+    stream << buf;
+
+    for (u_int16_t i = 0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+      char mnemonic[16];
+      snprintf(mnemonic, sizeof(mnemonic), "F%u", i);
+      snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
+        mnemonic, k_FIXED_DESCRIPTION[i], s.d_fixedMin[i], s.d_fixedMax[i], (double)s.d_fixedTotal[i]/intervals);
+      stream << buf;
+    }
+
+    for (u_int16_t i = 0; i<d_cnt; ++i) {
+      char mnemonic[16];
+      snprintf(mnemonic, sizeof(mnemonic), "P%u", i);
+      snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
+        mnemonic, d_progDescription[i].c_str(), s.d_progMin[i], s.d_progMax[i], (double)s.d_progTotal[i]/intervals);
+      stream << buf;
+    }
+  }
+
+  return stream;
+}
+
+void Intel::Sampler::run(Core *core) {
+  assert(core);
+
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(core->d_cpu, &cpuSet);
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  if (rc!=0) {
+    fprintf(stderr, "Error: cannot pin sampler thread to cpu %d: %s\n", core->d_cpu, strerror(rc));
+    core->d_status.store(rc, std::memory_order_release);
+    return;
+  }
+
+  const char *description[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];
+  for (u_int16_t i=0; i<d_cnt; ++i) {
+    description[i] = d_progDescription[i].c_str();
+  }
+
+  // Constructed on the pinned thread so the PMU programs and 'rdpmc' reads this cpu
+  XEON::PMU pmu(d_cnt, d_pcfg, description, d_msrRoot);
+  if ((rc = pmu.reset())!=0 || (rc = pmu.start())!=0) {
+    core->d_status.store(rc, std::memory_order_release);
+    return;
+  }
+  core->d_status.store(0, std::memory_order_release);
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  Sample sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.d_cpu = (u_int32_t)core->d_cpu;
+
+  while (d_running.load(std::memory_order_relaxed)) {
+    next.tv_nsec += (long)(d_interval%1000000000ull);
+    next.tv_sec += (time_t)(d_interval/1000000000ull);
+    if (next.tv_nsec>=1000000000l) {
+      next.tv_nsec -= 1000000000l;
+      ++next.tv_sec;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+
+    const u_int64_t begin = __rdtsc();
+    pmu.snapshot(&sample.d_snapshot);
+    sample.d_overhead = (u_int32_t)(__rdtsc()-begin);
+    core->d_ring->push(sample);
+  }
+
+  pmu.pause();
+}
+
+void Intel::Sampler::clear(Summary *summary) {
+  assert(summary);
+  memset(summary, 0, sizeof(Summary));
+  summary->d_rdtscMin = ~0ull;
+  summary->d_overheadMin = ~0ull;
+  memset(summary->d_fixedMin, 0xff, sizeof(summary->d_fixedMin));
+  memset(summary->d_progMin, 0xff, sizeof(summary->d_progMin));
+}
+
+void Intel::Sampler::fold(Core *core, const Sample& sample) {
+  assert(core);
+
+  Summary& s = core->d_summary;
+  const XEON::Snapshot& snap = sample.d_snapshot;
+  const XEON::Snapshot& last = core->d_last;
+
+  update(sample.d_overhead, &s.d_overheadMin, &s.d_overheadMax, &s.d_overheadTotal);
+
+  if (s.d_samples++>0) {
+    ++s.d_intervals;
+    update(snap.d_tsc - last.d_tsc, &s.d_rdtscMin, &s.d_rdtscMax, &s.d_rdtscTotal);
+    for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+      update((snap.d_fixed[i] - last.d_fixed[i]) & d_fixedMask, s.d_fixedMin+i, s.d_fixedMax+i, s.d_fixedTotal+i);
+    }
+    for (u_int16_t i=0; i<d_cnt; ++i) {
+      update((snap.d_prog[i] - last.d_prog[i]) & d_progMask, s.d_progMin+i, s.d_progMax+i, s.d_progTotal+i);
+    }
+  }
+
+  core->d_last = snap;
+}
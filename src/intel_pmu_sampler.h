@@ -0,0 +1,187 @@
+#pragma once
+
+// PURPOSE: Always-on PMU telemetry: periodically sample the counters of a set of HW cores in the background
+//
+// CLASSES:
+//  Intel::Sampler: Runs one sampling thread per monitored cpu. Each thread pins itself to its cpu, runs a 'PMU' there,
+//                  and every 'interval' nanoseconds pushes a timestamped 'PMU::snapshot' into that cpu's
+//                  'SampleRing'. All rings live in one arena allocated and touched at construction so the sample path
+//                  never allocates. A consumer thread calls 'drain' to hand off batches of samples and fold the
+//                  deltas between consecutive samples into per cpu min/max/avg summaries. Per sample overhead and
+//                  drop counts are kept so the interval can be tuned.
+
+#include <intel_xeon_pmu.h>
+#include <intel_pmu_sample_ring.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Intel {
+
+class Sampler {
+public:
+  struct Summary {
+    // Min/max/total of the deltas between consecutive samples of one cpu
+    u_int64_t d_samples;                                          // samples drained
+    u_int64_t d_intervals;                                        // deltas folded i.e. samples less one
+    u_int64_t d_rdtscMin;                                         // minimum rdtsc delta
+    u_int64_t d_rdtscMax;                                         // maximum rdtsc delta
+    u_int64_t d_rdtscTotal;                                       // sum of rdtsc deltas
+    u_int64_t d_fixedMin[XEON::PMU::k_FIXED_COUNTERS];            // minimum delta by fixed counter
+    u_int64_t d_fixedMax[XEON::PMU::k_FIXED_COUNTERS];            // maximum delta by fixed counter
+    u_int64_t d_fixedTotal[XEON::PMU::k_FIXED_COUNTERS];          // sum of deltas by fixed counter
+    u_int64_t d_progMin[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];   // minimum delta by programmable counter
+    u_int64_t d_progMax[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];   // maximum delta by programmable counter
+    u_int64_t d_progTotal[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF]; // sum of deltas by programmable counter
+    u_int64_t d_overheadMin;                                      // minimum rdtsc cycles to take one sample
+    u_int64_t d_overheadMax;                                      // maximum rdtsc cycles to take one sample
+    u_int64_t d_overheadTotal;                                    // sum of rdtsc cycles taking samples
+  };
+
+private:
+  // PRIVATE TYPES
+  struct Core {
+    int                  d_cpu;         // HW cpu sampled
+    SampleRing          *d_ring;        // ring in 'd_arena' written by this cpu's thread
+    std::thread          d_thread;      // sampling thread
+    std::atomic<int>     d_status;      // -1 until the thread set up its PMU, then 0 or errno
+    Summary              d_summary;     // consumer side summary
+    XEON::Snapshot       d_last;        // consumer side last sample
+  };
+
+  // DATA
+  std::vector<Core*>       d_core;      // state by core in construction order
+  char                    *d_arena;     // rings and their slots for all cores
+  u_int32_t                d_capacity;  // samples per ring
+  u_int64_t                d_interval;  // nanoseconds between samples
+  u_int16_t                d_cnt;       // # programmable counters sampled
+  u_int64_t                d_fixedMask; // valid bits of fixed counter values
+  u_int64_t                d_progMask;  // valid bits of programmable counter values
+  u_int64_t                d_pcfg[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF]; // configuration by programmable counter
+  std::vector<std::string> d_progDescription;                               // description by programmable counter
+  std::string              d_msrRoot;   // directory holding '<cpu>/msr' device files
+  std::atomic<bool>        d_running;   // true between 'start()' and 'stop()'
+
+public:
+  // CREATORS
+  Sampler(const std::vector<int>& cpu, u_int16_t count, const u_int64_t *eventSelect,
+          const char *const *description, u_int64_t intervalNs, u_int32_t capacity = 4096,
+          const std::string& msrRoot = "/dev/cpu");
+    // Create a sampler of all fixed counters and specified 'count' programmable counters configured per specified
+    // 'eventSelect' and 'description' on each HW cpu in specified 'cpu' every specified 'intervalNs' nanoseconds.
+    // Each cpu's ring holds specified 'capacity' samples. See 'PMU' for specified 'msrRoot'. The behavior is defined
+    // if 'cpu' is non-empty without duplicates, 'count<=k_MAX_PROG_COUNTERS_HT_OFF', and 'capacity' is a non-zero
+    // power of 2. The sampler takes ownership of the PMUs of 'cpu' while running.
+
+  Sampler(const Sampler& other) = delete;
+    // Copy constructor is not supported.
+
+  ~Sampler();
+    // Stop sampling if running and destroy this object
+
+  // ACCESSORS
+  u_int32_t cores() const;
+    // Return the number of sampled cpus
+
+  int cpu(u_int32_t core) const;
+    // Return the HW cpu number of specified 'core'. The behavior is defined if 'core<cores()'
+
+  bool running() const;
+    // Return true if sampling threads are running
+
+  u_int64_t drops(u_int32_t core) const;
+    // Return the number of samples of specified 'core' dropped because its ring was full. Callable from any thread.
+    // The behavior is defined if 'core<cores()'.
+
+  const Summary& summary(u_int32_t core) const;
+    // Return a non-modifiable reference to the summary of specified 'core' through the last 'drain'. The behavior is
+    // defined if 'core<cores()'.
+
+  // MANIPULATORS
+  int start();
+    // Return 0 if one sampling thread per cpu was started and its PMU reset and started, and the first errno
+    // otherwise in which case no thread is left running. Summaries are reset.
+
+  void stop();
+    // Stop and join all sampling threads. Samples already in the rings remain for 'drain'
+
+  u_int64_t drain(const std::function<void(const Sample *sample, u_int32_t count)>& batch = nullptr);
+    // Return the number of samples taken out of all rings. Each contiguous run of samples is passed to optionally
+    // specified 'batch' in place before it's folded into its core's summary and released. Call from one consumer
+    // thread at a time.
+
+  Sampler& operator=(const Sampler& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' per cpu sample and drop counts, per sample overhead, and min/max/avg deltas
+    // between samples by counter through the last 'drain'
+
+private:
+  // PRIVATE MANIPULATORS
+  void run(Core *core);
+    // Body of the sampling thread of specified 'core'
+
+  static void clear(Summary *summary);
+    // Reset specified 'summary' reflecting 0 drained samples
+
+  void fold(Core *core, const Sample& sample);
+    // Fold specified 'sample' into the summary of specified 'core'. Deltas are taken modulo the counter widths
+
+  static void update(u_int64_t delta, u_int64_t *min, u_int64_t *max, u_int64_t *total);
+    // Fold specified 'delta' into specified 'min', 'max', and 'total' without branching
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Sampler& object);
+    // Pretty print 'object' to specified 'stream' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+u_int32_t Sampler::cores() const {
+  return (u_int32_t)d_core.size();
+}
+
+inline
+int Sampler::cpu(u_int32_t core) const {
+  assert(core<d_core.size());
+  return d_core[core]->d_cpu;
+}
+
+inline
+bool Sampler::running() const {
+  return d_running.load(std::memory_order_relaxed);
+}
+
+inline
+u_int64_t Sampler::drops(u_int32_t core) const {
+  assert(core<d_core.size());
+  return d_core[core]->d_ring->drops();
+}
+
+inline
+const Sampler::Summary& Sampler::summary(u_int32_t core) const {
+  assert(core<d_core.size());
+  return d_core[core]->d_summary;
+}
+
+// PRIVATE MANIPULATORS
+inline
+void Sampler::update(u_int64_t delta, u_int64_t *min, u_int64_t *max, u_int64_t *total) {
+  *min = delta<*min ? delta : *min;
+  *max = delta>*max ? delta : *max;
+  *total += delta;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Sampler& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
@@ -0,0 +1,57 @@
+#pragma once
+
+// PURPOSE: Hold the values of all PMU counters read at one point in time
+//
+// CLASSES:
+//  Intel::XEON::Snapshot: rdtsc plus every fixed and programmable counter value read back-to-back after one
+//                         serialization by 'PMU::snapshot'. The layout is fixed: 'PMU::snapshot' writes fields by
+//                         offset from inline assembler. The cpu the values were read on is kept with them so a thread
+//                         migrating between two snapshots, whose counter deltas then mix two cores, is detectable.
+//                         With a 'Rapl' attached to the 'PMU' the package's 32-bit energy counters follow, read by
+//                         system call after the counters; otherwise they are 0. Likewise with a 'Frequency' attached
+//                         APERF, MPERF, and the thermal/power throttle bits follow.
+
+#include <sys/types.h>
+#include <stddef.h>
+
+namespace Intel {
+namespace XEON {
+
+struct Snapshot {
+  // ENUM
+  enum Support {
+    k_FIXED_COUNTERS    = 3,            // Must equal PMU::k_FIXED_COUNTERS
+    k_MAX_PROG_COUNTERS = 8,            // Must equal PMU::k_MAX_PROG_COUNTERS_HT_OFF
+    k_ENERGY_DOMAINS    = 3,            // Must equal Rapl::k_DOMAINS
+  };
+
+  // DATA
+  u_int64_t d_tsc;                                // rdtsc value
+  u_int64_t d_fixed[k_FIXED_COUNTERS];            // value by fixed counter
+  u_int64_t d_prog[k_MAX_PROG_COUNTERS];          // value by programmable counter; only 'PMU::d_cnt' entries set
+  u_int64_t d_paused;                             // 'PMU::pausedCycles()' when the snapshot was taken
+  u_int32_t d_aux;                                // IA32_TSC_AUX read with rdtsc: '(node<<12)|cpu' on Linux
+  u_int32_t d_energy[k_ENERGY_DOMAINS];           // RAPL counter by 'Rapl::Domain' or 0 without 'PMU::setRapl'
+  u_int32_t d_throttle;                           // 'Frequency::Throttle' bits or 0 without 'PMU::setFrequency'
+  u_int64_t d_aperf;                              // IA32_APERF or 0 without 'PMU::setFrequency'
+  u_int64_t d_mperf;                              // IA32_MPERF or 0 without 'PMU::setFrequency'
+
+  // ACCESSORS
+  u_int32_t cpu() const;
+    // Return the cpu the snapshot was read on per 'd_aux'
+};
+
+static_assert(offsetof(Snapshot, d_tsc)==0,    "PMU::snapshot writes d_tsc at offset 0");
+static_assert(offsetof(Snapshot, d_fixed)==8,  "PMU::snapshot writes d_fixed at offset 8");
+static_assert(offsetof(Snapshot, d_prog)==32,  "PMU::snapshot writes d_prog at offset 32");
+static_assert(offsetof(Snapshot, d_aux)==104,  "PMU::snapshot writes d_aux at offset 104");
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+u_int32_t Snapshot::cpu() const {
+  return d_aux & 0xfff;
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -5,97 +5,237 @@ std::ostream& Intel::Stats::print(std::ostream& stream) const {
          << d_pmu.coreId()
          << " PMU Summary on "
          << d_iterations
-         << " iterations:"
-         << std::endl;
+         << " iterations"
+         << (d_corrected ? " less measurement overhead" : "");
+  if (d_migrations>0) {
+    stream << " (" << d_migrations << " dropped: thread migrated to another cpu)";
+  }
+  stream << ":" << std::endl;
+
+  const TscClock& clock = TscClock::instance();
 
-  char buf[256];
-  snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
-    "R0", "rdtsc cycles", d_rdtscMin, d_rdtscMax, (double)d_rdtscTotal/(double)d_iterations);
-  stream << buf;
+  print(stream, "R0", "rdtsc cycles", d_rdtscMin, d_rdtscMax, d_rdtscTotal,
+    d_histogram ? &rdtscHistogram() : 0, &clock);
+
+  print(stream, "A0", "active (not paused) rdtsc cycles", d_activeMin, d_activeMax, d_activeTotal,
+    d_histogram ? &activeHistogram() : 0, &clock);
 
   for (u_int16_t i = 0; i<d_pmu.fixedCountersDefined(); ++i) {
-    snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
+    print(stream,
       d_pmu.fixedMnemonic()[i].c_str(),
       d_pmu.fixedDescription()[i].c_str(),
       d_fixedMin[i],
       d_fixedMax[i],
-      (double)d_fixedTotal[i]/(double)d_iterations);
-    stream << buf;
+      d_fixedTotal[i],
+      d_histogram ? &fixedHistogram(i) : 0,
+      0);
   }
 
-  for (u_int16_t i = 0; i<d_pmu.programmableCountersDefined(); ++i) {
-    snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf\n",
+  for (u_int16_t i = 0; d_multiplexer==0 && i<d_pmu.programmableCountersDefined(); ++i) {
+    print(stream,
       d_pmu.programmableMnemonic()[i].c_str(),
       d_pmu.programmableDescription()[i].c_str(),
       d_progMin[i],
       d_progMax[i],
-      (double)d_progTotal[i]/(double)d_iterations);
-    stream << buf;
+      d_progTotal[i],
+      d_histogram ? &programmableHistogram(i) : 0,
+      0);
+  }
+
+  char buf[320];
+  for (u_int16_t i=0; d_multiplexer && i<d_multiplexer->events(); ++i) {
+    // Same scale as the estimate: the rate's standard error over the run, per iteration
+    const double error = d_multiplexer->standardError(i);
+    char mnemonic[16];
+    snprintf(mnemonic, sizeof(mnemonic), "M%u", i);
+    int len = snprintf(buf, sizeof(buf), "%-3s [%-48s]: estimate avg: %lf", mnemonic,
+      d_multiplexer->description(i).c_str(), estimate(i));
+    if (len>0 && (size_t)len<sizeof(buf)) {
+      if (error<0 || d_iterations==0) {
+        len += snprintf(buf+len, sizeof(buf)-len, " +/- unknown");
+      } else {
+        len += snprintf(buf+len, sizeof(buf)-len, " +/- %lf", error/(double)d_iterations);
+      }
+    }
+    if (len>0 && (size_t)len<sizeof(buf)) {
+      snprintf(buf+len, sizeof(buf)-len, ", enabled: %.1lf%%", 100.0*d_multiplexer->enabledFraction(i));
+    }
+    stream << buf << std::endl;
+  }
+
+  const XEON::Rapl *rapl = d_pmu.rapl();
+  for (u_int16_t d=0; rapl && d<XEON::Rapl::k_DOMAINS; ++d) {
+    const XEON::Rapl::Domain domain = static_cast<XEON::Rapl::Domain>(d);
+    if (!rapl->available(domain)) {
+      continue;
+    }
+    char description[64];
+    snprintf(description, sizeof(description), "%s energy joules", XEON::Rapl::name(domain));
+    int len = snprintf(buf, sizeof(buf), "E%-2u [%-48s]: min: %.6lf, max: %.6lf, avg: %.6lf, watts: %.3lf", d,
+      description, d_iterations ? rapl->joules(domain, d_energyMin[d]) : 0, rapl->joules(domain, d_energyMax[d]),
+      d_iterations ? joules(domain)/(double)d_iterations : 0, watts(domain));
+    if (d_operations && d_iterations && len>0 && (size_t)len<sizeof(buf)) {
+      snprintf(buf+len, sizeof(buf)-len, ", joules/op: %.4le", joules(domain)/(double)(d_iterations*d_operations));
+    }
+    stream << buf << std::endl;
+  }
+
+  if (d_pmu.frequency()) {
+    snprintf(buf, sizeof(buf),
+      "%-3s [%-48s]: min: %.3lf, max: %.3lf, avg: %.3lf, stddev: %.3lf over %lu windows, throttled: %lu deltas%s",
+      "FQ", "effective GHz (APERF/MPERF)", minGhz(), maxGhz(), effectiveGhz(), deviationGhz(), frequencyWindows(),
+      d_throttled, frequencyStable() ? "" : " UNSTABLE");
+    stream << buf << std::endl;
+  }
+
+  // Programmable counter totals mix multiplexed groups so metrics reading them are skipped
+  const u_int16_t progCnt = d_multiplexer ? 0 : d_pmu.programmableCountersDefined();
+  for (const Metric& m: d_metric) {
+    if (m.defined(d_pmu.fixedCountersDefined(), progCnt)) {
+      snprintf(buf, sizeof(buf), "%-3s [%-48s]: %.4lf = %s, %s", "M", m.name().c_str(), metric(m),
+        m.expression().c_str(), m.description().c_str());
+      stream << buf << std::endl;
+    }
   }
 
   return stream;
 }
 
-void Intel::Stats::recordFirstDatum() {
-  const u_int64_t current = d_pmu.timeStampCounter();
-  const u_int64_t delta   = current - d_rdtscLast;
-  d_rdtscMin = d_rdtscMax = d_rdtscTotal = delta;
-  d_rdtscLast = current;
-
-  for (u_int16_t i=0; i<d_pmu.fixedCountersDefined(); ++i) {                                                              
-    const u_int64_t current = d_pmu.fixedCounterValue(i);
-    const u_int64_t delta   = current - d_fixedLast[i];
-    d_fixedMin[i] = d_fixedMax[i] = delta;
-    d_fixedLast[i] = current;
-    d_fixedTotal[i] = delta;
-  }                                                                                                                     
-
-  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {                                                       
-    const u_int64_t current = d_pmu.programmableCounterValue(i);
-    const u_int64_t delta   = current - d_progLast[i];
-    d_progMin[i] = d_progMax[i] = delta;
-    d_progLast[i] = current;
-    d_progTotal[i] = delta;
+double Intel::Stats::metric(const Metric& metric) const {
+  u_int64_t total[k_HISTOGRAMS];
+  total[0] = d_rdtscTotal;
+  total[1] = d_activeTotal;
+  for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+    total[2+i] = d_fixedTotal[i];
   }
+  for (u_int16_t i=0; i<XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF; ++i) {
+    total[2+XEON::PMU::k_FIXED_COUNTERS+i] = d_progTotal[i];
+  }
+  return metric.evaluate(total);
 }
 
-void Intel::Stats::record() {
-  if (0==d_iterations++) {
-    recordFirstDatum(); 
-    return;
-  }
-
-  const u_int64_t current = d_pmu.timeStampCounter();
-  const u_int64_t delta   = current - d_rdtscLast;
-  if (delta<d_rdtscMin) {
-    d_rdtscMin = delta;
-  } else if (delta>d_rdtscMax) {
-    d_rdtscMax = delta;
-  }
-  d_rdtscLast = current;
-  d_rdtscTotal += delta;
-
-  for (u_int16_t i=0; i<d_pmu.fixedCountersDefined(); ++i) {                                                              
-    const u_int64_t current = d_pmu.fixedCounterValue(i);
-    const u_int64_t delta   = current - d_fixedLast[i];
-    if (delta<d_fixedMin[i]) {
-      d_fixedMin[i] = delta;
-    } else if (delta>d_fixedMax[i]) {
-      d_fixedMax[i] = delta;
+void Intel::Stats::print(std::ostream& stream, const char *mnemonic, const char *description, u_int64_t min,
+                         u_int64_t max, u_int64_t total, const Histogram *histogram,
+                         const TscClock *clock) const {
+  char buf[320];
+  int len = snprintf(buf, sizeof(buf), "%-3s [%-48s]: min: %012lu, max: %012lu, avg: %lf",
+    mnemonic, description, min, max, (double)total/(double)d_iterations);
+
+  if (histogram) {
+    for (double p: d_percentile) {
+      if (len>0 && (size_t)len<sizeof(buf)) {
+        len += snprintf(buf+len, sizeof(buf)-len, ", p%g: %012lu", p, histogram->percentile(p));
+      }
     }
-    d_fixedLast[i] = current;
-    d_fixedTotal[i] += delta;
-  }                                                                                                                     
-
-  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {                                                       
-    const u_int64_t current = d_pmu.programmableCounterValue(i);
-    const u_int64_t delta   = current - d_progLast[i];
-    if (delta<d_progMin[i]) {
-      d_progMin[i] = delta;
-    } else if (delta>d_progMax[i]) {
-      d_progMax[i] = delta;
+  }
+
+  if (clock && d_iterations>0 && len>0 && (size_t)len<sizeof(buf)) {
+    snprintf(buf+len, sizeof(buf)-len, ", ns min: %lu, max: %lu, avg: %.2lf",
+      clock->toNanoseconds(min), clock->toNanoseconds(max), clock->nanoseconds((double)total/(double)d_iterations));
+  }
+
+  stream << buf << std::endl;
+}
+
+int Intel::Stats::merge(const Stats& other) {
+  if (other.d_pmu.fixedCountersDefined()!=d_pmu.fixedCountersDefined() ||
+      other.d_pmu.programmableCountersDefined()!=d_pmu.programmableCountersDefined()) {
+    fprintf(stderr, "Error: cannot merge stats of %u fixed and %u programmable counters into stats of %u and %u\n",
+      other.d_pmu.fixedCountersDefined(), other.d_pmu.programmableCountersDefined(), d_pmu.fixedCountersDefined(),
+      d_pmu.programmableCountersDefined());
+    return EINVAL;
+  }
+  if ((other.d_pmu.rapl()==0)!=(d_pmu.rapl()==0) || (other.d_pmu.frequency()==0)!=(d_pmu.frequency()==0)) {
+    fprintf(stderr, "Error: cannot merge stats of a PMU %s RAPL and %s frequency into one %s RAPL and %s frequency\n",
+      other.d_pmu.rapl() ? "with" : "without", other.d_pmu.frequency() ? "with" : "without",
+      d_pmu.rapl() ? "with" : "without", d_pmu.frequency() ? "with" : "without");
+    return EINVAL;
+  }
+  if (d_histogram && !other.d_histogram) {
+    fprintf(stderr, "Error: cannot merge stats without histograms into stats with histograms\n");
+    return EINVAL;
+  }
+
+  d_iterations += other.d_iterations;
+  d_migrations += other.d_migrations;
+
+  d_rdtscMin = other.d_rdtscMin<d_rdtscMin ? other.d_rdtscMin : d_rdtscMin;
+  d_rdtscMax = other.d_rdtscMax>d_rdtscMax ? other.d_rdtscMax : d_rdtscMax;
+  d_rdtscTotal += other.d_rdtscTotal;
+
+  d_activeMin = other.d_activeMin<d_activeMin ? other.d_activeMin : d_activeMin;
+  d_activeMax = other.d_activeMax>d_activeMax ? other.d_activeMax : d_activeMax;
+  d_activeTotal += other.d_activeTotal;
+
+  for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+    d_fixedMin[i] = other.d_fixedMin[i]<d_fixedMin[i] ? other.d_fixedMin[i] : d_fixedMin[i];
+    d_fixedMax[i] = other.d_fixedMax[i]>d_fixedMax[i] ? other.d_fixedMax[i] : d_fixedMax[i];
+    d_fixedTotal[i] += other.d_fixedTotal[i];
+  }
+
+  // Closed windows combine; 'other's open window only counts in the totals
+  if (other.d_ghz.count()) {
+    d_ghzMin = d_ghz.count()==0 || other.d_ghzMin<d_ghzMin ? other.d_ghzMin : d_ghzMin;
+    d_ghzMax = d_ghz.count()==0 || other.d_ghzMax>d_ghzMax ? other.d_ghzMax : d_ghzMax;
+    d_ghz.merge(other.d_ghz);
+  }
+  d_aperfTotal += other.d_aperfTotal;
+  d_mperfTotal += other.d_mperfTotal;
+  d_throttled += other.d_throttled;
+
+  for (u_int16_t i=0; i<XEON::Rapl::k_DOMAINS; ++i) {
+    d_energyMin[i] = other.d_energyMin[i]<d_energyMin[i] ? other.d_energyMin[i] : d_energyMin[i];
+    d_energyMax[i] = other.d_energyMax[i]>d_energyMax[i] ? other.d_energyMax[i] : d_energyMax[i];
+    d_energyTotal[i] += other.d_energyTotal[i];
+  }
+
+  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {
+    d_progMin[i] = other.d_progMin[i]<d_progMin[i] ? other.d_progMin[i] : d_progMin[i];
+    d_progMax[i] = other.d_progMax[i]>d_progMax[i] ? other.d_progMax[i] : d_progMax[i];
+    d_progTotal[i] += other.d_progTotal[i];
+  }
+
+  if (d_histogram) {
+    for (u_int16_t i=0; i<k_HISTOGRAMS; ++i) {
+      d_histogram[i].merge(other.d_histogram[i]);
     }
-    d_progLast[i] = current;
-    d_progTotal[i] += delta;
+  }
+
+  return 0;
+}
+
+void Intel::Stats::record(const XEON::Snapshot& snap) {
+  switch (d_pmu.programmableCountersDefined()) {
+    case 0: record<0>(snap); break;
+    case 1: record<1>(snap); break;
+    case 2: record<2>(snap); break;
+    case 3: record<3>(snap); break;
+    case 4: record<4>(snap); break;
+    case 5: record<5>(snap); break;
+    case 6: record<6>(snap); break;
+    case 7: record<7>(snap); break;
+    default: record<8>(snap); break;
+  }
+}
+
+void Intel::Stats::frequency(const XEON::Snapshot& begin, const XEON::Snapshot& end) {
+  const u_int64_t aperf = end.d_aperf - begin.d_aperf;
+  const u_int64_t mperf = end.d_mperf - begin.d_mperf;
+  d_aperfTotal += aperf;
+  d_mperfTotal += mperf;
+
+  // Per delta GHz of microsecond iterations mostly shows read jitter; judge windows of many deltas instead
+  d_windowAperf += aperf;
+  d_windowMperf += mperf;
+  if (d_windowMperf>=d_windowLength) {
+    const double ghz = XEON::Frequency::ghz(d_windowAperf, d_windowMperf);
+    d_ghzMin = d_ghz.count()==0 || ghz<d_ghzMin ? ghz : d_ghzMin;
+    d_ghzMax = d_ghz.count()==0 || ghz>d_ghzMax ? ghz : d_ghzMax;
+    d_ghz.add(ghz);
+    d_windowAperf = d_windowMperf = 0;
+  }
+
+  if (XEON::Frequency::throttled(begin.d_throttle, end.d_throttle)) {
+    ++d_throttled;
   }
 }
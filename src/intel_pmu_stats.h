@@ -4,49 +4,272 @@
 //
 // CLASSES:
 //  Intel::Stats: Provide min/max/avg by counter. Average is computed equivalent to (end-start)/iterations by counter.
-//                Note this class does not check for overflow when computing values
+//                Deltas are taken modulo the counter width reported by CPUID so a counter wrapping between two
+//                records is counted correctly, and totals are 64-bit virtual counters that don't wrap in practice.
+//                Besides wall rdtsc cycles the 'active' rdtsc cycles, that is wall cycles less time spent in
+//                'PMU::pause()', are reported. In 'k_HISTOGRAM' mode every delta is also recorded into a per counter
+//                'Histogram' so tail percentiles e.g. p99.9 are reported, and stats of several runs or threads can be
+//                merged into one. With 'setOverhead' e.g. from a 'Calibration' the cost of reading the counters is
+//                subtracted from every delta. rdtsc cycles are also printed in nanoseconds per 'TscClock::instance()'.
+//                With the MSR backend counters are per core, so a delta across a thread migration mixes two cores'
+//                counts: each snapshot carries its cpu, and such deltas are counted in 'migrations()' and dropped,
+//                the next delta starting from the snapshot after the move. Only clean deltas are aggregated.
+//                Derived metrics e.g. IPC are evaluated over the totals, and those given to 'setMetrics' printed.
+//                If the PMU has a 'Rapl' attached, RAPL energy deltas (modulo 2^32) are aggregated too and printed
+//                as joules per iteration and average watts, and per operation with 'setOperations'. If it has a
+//                'Frequency' attached, APERF/MPERF deltas are summed into windows of at least 'k_FREQUENCY_WINDOW_US'
+//                of MPERF and the effective GHz of every window, and whether the core or package was thermally or
+//                power throttled during a delta, are kept too. A run whose window GHz standard deviation exceeds
+//                'frequencyVariation()' of the average, or that was throttled, is flagged unstable: single short
+//                deltas carry too much read jitter to judge on. With a 'Multiplexer' attached by 'setMultiplexer' its
+//                programmable counters rotate between event groups, so instead of their deltas each multiplexed
+//                event's scaled estimate per iteration is reported.
 
+#include <intel_pmu_histogram.h>
+#include <intel_pmu_metric.h>
+#include <intel_pmu_multiplexer.h>
+#include <intel_pmu_welford.h>
+#include <intel_tsc_clock.h>
 #include <intel_xeon_pmu.h>
 
+#include <math.h>
+
+#include <vector>
+
 namespace Intel {
 
 class Stats {
+public:
+  // ENUM
+  enum Mode {
+    k_MIN_MAX   = 0,                    // min/max/avg by counter only
+    k_HISTOGRAM = 1,                    // also a histogram by counter for percentiles
+  };
+
+  enum Support {
+    k_HISTOGRAMS = 2+XEON::PMU::k_FIXED_COUNTERS+XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF,
+                                        // rdtsc, active rdtsc, then fixed, then programmable counter histograms
+    k_FREQUENCY_WINDOW_US = 1000,       // least MPERF time, in TSC microseconds, summed into one frequency window
+  };
+
+private:
   // DATA
   u_int64_t d_fixedMin[XEON::PMU::k_FIXED_COUNTERS];            // minimum relative value by fixed counter
   u_int64_t d_fixedMax[XEON::PMU::k_FIXED_COUNTERS];            // maximum relative value by fixed counter
   u_int64_t d_progMin[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];   // minimum relative value by programmable counter
   u_int64_t d_progMax[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];   // maximum relative value by programmable counter
-  u_int64_t d_fixedLast[XEON::PMU::k_FIXED_COUNTERS];           // last absolute fixed counter value
-  u_int64_t d_progLast[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];  // last absolute programmable counter value
   u_int64_t d_fixedTotal[XEON::PMU::k_FIXED_COUNTERS];          // running sum of relative values by fixed counter
   u_int64_t d_progTotal[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF]; // running sum of relative values by prog counter
   u_int64_t d_rdtscMin;                                         // minimum relative value of rdtsc counter
   u_int64_t d_rdtscMax;                                         // maximum relative value of rdtsc counter
-  u_int64_t d_rdtscLast;                                        // last absolute value of rdtsc timer
   u_int64_t d_rdtscTotal;                                       // running sum of relative rdtsc values
-  u_int64_t d_iterations;                                       // number of times 'record' called
+  u_int64_t d_activeMin;                                        // minimum relative rdtsc value less paused cycles
+  u_int64_t d_activeMax;                                        // maximum relative rdtsc value less paused cycles
+  u_int64_t d_activeTotal;                                      // running sum of relative rdtsc less paused cycles
+  u_int64_t d_energyMin[XEON::Rapl::k_DOMAINS];                 // minimum RAPL count delta by domain
+  u_int64_t d_energyMax[XEON::Rapl::k_DOMAINS];                 // maximum RAPL count delta by domain
+  u_int64_t d_energyTotal[XEON::Rapl::k_DOMAINS];               // running sum of RAPL count deltas by domain
+  u_int64_t d_operations;                                       // operations per iteration or 0 if not given
+  u_int64_t d_aperfTotal;                                       // running sum of APERF deltas
+  u_int64_t d_mperfTotal;                                       // running sum of MPERF deltas
+  u_int64_t d_windowAperf;                                      // APERF delta sum of the open frequency window
+  u_int64_t d_windowMperf;                                      // MPERF delta sum of the open frequency window
+  u_int64_t d_windowLength;                                     // MPERF closing a window: 'k_FREQUENCY_WINDOW_US'
+  Welford d_ghz;                                                // effective GHz of closed frequency windows
+  double d_ghzMin;                                              // minimum effective GHz of a closed window
+  double d_ghzMax;                                              // maximum effective GHz of a closed window
+  u_int64_t d_throttled;                                        // deltas during which a throttle bit was seen
+  double d_variation;                                           // window GHz stddev over average deemed unstable
+  u_int64_t d_iterations;                                       // number of deltas aggregated
+  u_int64_t d_migrations;                                       // deltas dropped since the cpu changed
+  u_int64_t d_fixedMask;                                        // valid bits of fixed counter values
+  u_int64_t d_progMask;                                         // valid bits of programmable counter values
+  XEON::Snapshot d_last;                                        // last absolute counter values
+  XEON::PMU::FencePolicy d_fence;                               // serialization used by 'record'
+  Histogram *d_histogram;                                       // 'k_HISTOGRAMS' histograms or 0 if 'k_MIN_MAX'
+  u_int64_t d_overhead[k_HISTOGRAMS];                           // subtracted from deltas in histogram order
+  bool d_corrected;                                             // true if any 'd_overhead' is non-zero
+  bool d_migratable;                                            // true if counters are per core i.e. MSR backend
+  std::vector<double> d_percentile;                             // percentiles 'print' reports in 'k_HISTOGRAM' mode
+  std::vector<Metric> d_metric;                                 // derived metrics 'print' reports
+  const Multiplexer *d_multiplexer;                             // estimates 'print' reports instead of programmable
+                                                                // counters, or 0
   const Intel::XEON::PMU& d_pmu;                                // the PMU object providing counter values
 
   // CREATORS
 public:
-  Stats(const Intel::XEON::PMU& pmu);
-    // Create a Stats object collecting statistics from specified 'pmu'. Callers must call reset()
+  Stats(const Intel::XEON::PMU& pmu, XEON::PMU::FencePolicy fence = XEON::PMU::k_FENCE_MFENCE_LFENCE,
+        Mode mode = k_MIN_MAX);
+    // Create a Stats object collecting statistics from specified 'pmu' reading counters with 'PMU::snapshot' using
+    // optionally specified 'fence'. With optionally specified 'mode' of 'k_HISTOGRAM' about 200Kb of histograms are
+    // allocated here, once, and percentiles 50, 99, and 99.9 are reported by default. Callers must call reset()
 
   Stats(const Stats& other) = delete;
     // Copy constructor not defined
 
-  ~Stats() = default;
+  ~Stats();
     // Destroy this object
 
+  // ACCESSORS
+  u_int64_t iterations() const;
+    // Return the number of deltas aggregated since 'reset()' i.e. calls to 'record' less 'migrations()'
+
+  u_int64_t migrations() const;
+    // Return the number of deltas dropped since 'reset()' because the thread ran on another cpu than at the previous
+    // snapshot. Always 0 for a 'k_BACKEND_PERF' PMU whose counts follow the thread.
+
+  u_int64_t rdtscTotal() const;
+    // Return the rdtsc cycles between 'reset()' and the last 'record'
+
+  u_int64_t fixedTotal(u_int16_t counter) const;
+    // Return the 64-bit count of specified fixed 'counter' between 'reset()' and the last 'record'. The behavior is
+    // defined if 'counter<PMU::k_FIXED_COUNTERS'.
+
+  u_int64_t programmableTotal(u_int16_t counter) const;
+    // Return the 64-bit count of specified programmable 'counter' between 'reset()' and the last 'record'. The
+    // behavior is defined if 'counter<pmu.programmableCountersDefined()'.
+
+  u_int64_t energyTotal(XEON::Rapl::Domain domain) const;
+    // Return the RAPL counts of specified 'domain' between 'reset()' and the last 'record', or 0 if the PMU has no
+    // 'Rapl' attached
+
+  double joules(XEON::Rapl::Domain domain) const;
+    // Return 'energyTotal(domain)' in joules per the PMU's 'Rapl', or 0 if the PMU has none
+
+  double watts(XEON::Rapl::Domain domain) const;
+    // Return the average power of specified 'domain' i.e. 'joules(domain)' over the rdtsc time aggregated, or 0 if
+    // nothing was aggregated
+
+  u_int64_t operations() const;
+    // Return the operations per iteration given to 'setOperations', or 0 if none
+
+  double effectiveGhz() const;
+    // Return the average effective frequency in GHz over the deltas aggregated i.e. total APERF over total MPERF
+    // times the TSC frequency, or 0 if the PMU has no 'Frequency' attached or nothing was aggregated
+
+  u_int64_t frequencyWindows() const;
+    // Return the number of closed frequency windows i.e. runs of consecutive deltas whose MPERF sum reached
+    // 'k_FREQUENCY_WINDOW_US' of TSC time. Deltas after the last closed window count in 'effectiveGhz()' only.
+
+  double minGhz() const;
+    // Return the lowest effective GHz of one frequency window, 'effectiveGhz()' if no window closed
+
+  double maxGhz() const;
+    // Return the highest effective GHz of one frequency window, 'effectiveGhz()' if no window closed
+
+  double deviationGhz() const;
+    // Return the standard deviation of the effective GHz of frequency windows, or 0 if fewer than two closed
+
+  u_int64_t throttled() const;
+    // Return the number of deltas during which the core or package was thermally or power throttled per
+    // 'Frequency::throttled'
+
+  double frequencyVariation() const;
+    // Return the relative standard deviation of window GHz, 'deviationGhz()/effectiveGhz()', above which a run is
+    // unstable; 0.02 by default
+
+  bool frequencyStable() const;
+    // Return true if no delta was throttled and 'deviationGhz()' is at most 'frequencyVariation()' of the average,
+    // or if no frequency was read, and false otherwise. Runs too short to close two windows are only judged on
+    // throttling.
+
+  Mode mode() const;
+    // Return the mode provided at construction
+
+  const Histogram& rdtscHistogram() const;
+    // Return a non-modifiable reference to the histogram of rdtsc deltas. The behavior is defined if
+    // 'mode()==k_HISTOGRAM'.
+
+  const Histogram& activeHistogram() const;
+    // Return a non-modifiable reference to the histogram of rdtsc deltas less paused cycles. The behavior is defined
+    // if 'mode()==k_HISTOGRAM'.
+
+  const Histogram& fixedHistogram(u_int16_t counter) const;
+    // Return a non-modifiable reference to the histogram of specified fixed 'counter' deltas. The behavior is defined
+    // if 'mode()==k_HISTOGRAM' and 'counter<PMU::k_FIXED_COUNTERS'.
+
+  const Histogram& programmableHistogram(u_int16_t counter) const;
+    // Return a non-modifiable reference to the histogram of specified programmable 'counter' deltas. The behavior is
+    // defined if 'mode()==k_HISTOGRAM' and 'counter<pmu.programmableCountersDefined()'.
+
+  const std::vector<double>& percentiles() const;
+    // Return the percentiles 'print' reports in 'k_HISTOGRAM' mode
+
+  const std::vector<Metric>& metrics() const;
+    // Return the derived metrics 'print' reports
+
+  const Multiplexer *multiplexer() const;
+    // Return the multiplexer whose estimates 'print' reports per 'setMultiplexer', or 0 if none
+
+  double estimate(u_int16_t event) const;
+    // Return the scaled estimate of specified multiplexed 'event' per iteration i.e. 'multiplexer()->estimate(event)'
+    // over 'iterations()', or 0 if nothing was aggregated. The average is meaningful if this object recorded the
+    // iterations between the multiplexer's 'start()' and its last 'rotate()' or 'stop()'. The behavior is defined if
+    // 'multiplexer()' is not 0 and 'event<multiplexer()->events()'.
+
+  double metric(const Metric& metric) const;
+    // Return specified 'metric' evaluated over the totals of every counter since 'reset()' e.g. IPC as total
+    // instructions over total cycles. The behavior is defined if 'metric.defined(pmu)'.
+
   // MANIPULATORS
   void record();
     // Update internal state by reading the current value of all defined counters from PMU object provided at
     // construction time. Behavior is defined if 'pmu' was successfully started, and 'reset()' run before recording
     // starts.
 
+  void record(const XEON::Snapshot& snap);
+    // Update internal state with specified 'snap' taken from the PMU object provided at construction time. Behavior
+    // is defined if 'pmu' was successfully started, and 'reset()' run before recording starts.
+
+  void record(const XEON::Snapshot& begin, const XEON::Snapshot& end);
+    // Update internal state with the deltas from specified 'begin' to specified 'end' both taken from the PMU object
+    // provided at construction time e.g. to record only selected iterations. The next 'record(snap)' delta starts at
+    // 'end'. Behavior is defined if 'pmu' was successfully started.
+
+  template <u_int16_t COUNT>
+  void record(const XEON::Snapshot& snap);
+    // Same as the above except the number of programmable counters is the compile time constant 'COUNT' so all loops
+    // are fully unrolled. Behavior is defined if 'COUNT==pmu.programmableCountersDefined()'. If 'snap' was read on
+    // another cpu than the last snapshot the delta is dropped and counted in 'migrations()'; 'snap' becomes the last
+    // snapshot either way.
+
   void reset();
     // Reset collected state reflecting 0 recorded samples.
 
+  int merge(const Stats& other);
+    // Return 0 if the data recorded in specified 'other' e.g. from another run or another thread's PMU, including its
+    // migration count, was added to this object, and EINVAL otherwise without changing this object. Counters are
+    // matched by position so both PMUs must define the same number of fixed and programmable counters, both or
+    // neither must have a 'Rapl' and a 'Frequency' attached, and 'other' must have histograms if this object does.
+    // The last snapshot, and hence where the next 'record' delta starts, is unchanged.
+
+  void setOverhead(const u_int64_t *overhead);
+    // Subtract from each later delta, saturating at 0, its counter's entry in specified 'overhead' array of
+    // 'k_HISTOGRAMS' entries in histogram order e.g. 'Calibration::overhead()', or stop subtracting if 'overhead' is
+    // 0. The values are copied.
+
+  void setPercentiles(const std::vector<double>& percentiles);
+    // Report specified 'percentiles' e.g. '{50, 90, 99, 99.99}' in 'print'. The behavior is defined if each is in
+    // '[0, 100]'.
+
+  void setMetrics(const std::vector<Metric>& metrics);
+    // Report specified 'metrics' over the totals in 'print' e.g. 'Metric::library(config)'. Metrics reading counters
+    // the PMU doesn't define are skipped.
+
+  void setOperations(u_int64_t operations);
+    // Make 'print' also report energy per operation taking each iteration to run specified 'operations' e.g. the
+    // elements a loop body processes, or stop if 'operations' is 0
+
+  void setMultiplexer(const Multiplexer *multiplexer);
+    // Make 'print' report the scaled estimates of specified 'multiplexer', running on the PMU provided at
+    // construction, per iteration with their standard errors instead of programmable counter deltas, which mix event
+    // groups, and skip metrics reading programmable counters; or go back to programmable counters if 'multiplexer' is
+    // 0. 'multiplexer' must outlive its use here.
+
+  void setFrequencyVariation(double variation);
+    // Deem runs whose window effective GHz standard deviation is more than specified 'variation' of the average
+    // unstable e.g. 0.02 for 2%. The behavior is defined if 'variation>=0'.
+
   Stats& operator=(const Stats& rhs) = delete;
     // Assignment operator not provided
   
@@ -54,11 +277,26 @@ public:
   std::ostream& print(std::ostream& stream) const;
     // Pretty print to specified 'stream' min/max/avg by counter for all data collected through last call to 'record'.
 
+private:
+  // PRIVATE ACCESSORS
+  void print(std::ostream& stream, const char *mnemonic, const char *description, u_int64_t min, u_int64_t max,
+             u_int64_t total, const Histogram *histogram, const TscClock *clock) const;
+    // Print to specified 'stream' one line of specified 'min', 'max' and average of specified 'total' for the
+    // counter of specified 'mnemonic' and 'description' followed by percentiles of specified 'histogram' if not 0,
+    // and by min/max/avg in nanoseconds per specified 'clock' if not 0 i.e. for rdtsc counters
+
+  // PRIVATE CLASS METHODS
+  static void update(u_int64_t delta, u_int64_t *min, u_int64_t *max, u_int64_t *total);
+    // Fold specified 'delta' into specified 'min', 'max', and 'total' without branching
+
   // PRIVATE MANIPULATORS
-  void recordFirstDatum();
-    // Special case for 'record' when d_iterations==0
+  void frequency(const XEON::Snapshot& begin, const XEON::Snapshot& end);
+    // Fold the APERF/MPERF deltas and throttle state from specified 'begin' to specified 'end' into the open
+    // frequency window, closing it into the window stats once its MPERF reaches 'd_windowLength'
 };
 
+static_assert((int)Stats::k_HISTOGRAMS==(int)Metric::k_VARIABLES, "metric variables are in histogram order");
+
 // FREE OPERATORS
 std::ostream& operator<<(std::ostream& stream, const Stats& object);
     // Pretty print to specified 'stream' min/max/avg by counter for all data collected through last call to 'record'
@@ -67,31 +305,331 @@ std::ostream& operator<<(std::ostream& stream, const Stats& object);
 // INLINE DEFINITIONS
 // CREATORS
 inline
-Stats::Stats(const Intel::XEON::PMU& pmu)
-: d_pmu(pmu)
+Stats::Stats(const Intel::XEON::PMU& pmu, XEON::PMU::FencePolicy fence, Mode mode)
+: d_operations(0)
+, d_windowLength(TscClock::instance().hz()/1000000*k_FREQUENCY_WINDOW_US)
+, d_variation(0.02)
+, d_fixedMask(pmu.fixedCounterMask())
+, d_progMask(pmu.programmableCounterMask())
+, d_fence(fence)
+, d_histogram(mode==k_HISTOGRAM ? new Histogram[k_HISTOGRAMS] : 0)
+, d_corrected(false)
+, d_migratable(pmu.backend()==XEON::PMU::k_BACKEND_MSR)
+, d_percentile({50.0, 99.0, 99.9})
+, d_multiplexer(0)
+, d_pmu(pmu)
 {
+  memset(d_overhead, 0, sizeof(d_overhead));
   reset();
 }
 
-// INLINE DEFINITIONS
+inline
+Stats::~Stats() {
+  delete [] d_histogram;
+}
+
+// ACCESSORS
+inline
+u_int64_t Stats::iterations() const {
+  return d_iterations;
+}
+
+inline
+u_int64_t Stats::migrations() const {
+  return d_migrations;
+}
+
+inline
+u_int64_t Stats::rdtscTotal() const {
+  return d_rdtscTotal;
+}
+
+inline
+u_int64_t Stats::fixedTotal(u_int16_t counter) const {
+  assert(counter<XEON::PMU::k_FIXED_COUNTERS);
+  return d_fixedTotal[counter];
+}
+
+inline
+u_int64_t Stats::programmableTotal(u_int16_t counter) const {
+  assert(counter<d_pmu.programmableCountersDefined());
+  return d_progTotal[counter];
+}
+
+inline
+u_int64_t Stats::energyTotal(XEON::Rapl::Domain domain) const {
+  assert(domain<XEON::Rapl::k_DOMAINS);
+  return d_energyTotal[domain];
+}
+
+inline
+double Stats::joules(XEON::Rapl::Domain domain) const {
+  return d_pmu.rapl() ? d_pmu.rapl()->joules(domain, energyTotal(domain)) : 0;
+}
+
+inline
+double Stats::watts(XEON::Rapl::Domain domain) const {
+  const double ns = TscClock::instance().nanoseconds((double)d_rdtscTotal);
+  return ns>0 ? joules(domain)*1e9/ns : 0;
+}
+
+inline
+u_int64_t Stats::operations() const {
+  return d_operations;
+}
+
+inline
+double Stats::effectiveGhz() const {
+  return XEON::Frequency::ghz(d_aperfTotal, d_mperfTotal);
+}
+
+inline
+u_int64_t Stats::frequencyWindows() const {
+  return d_ghz.count();
+}
+
+inline
+double Stats::minGhz() const {
+  return d_ghz.count() ? d_ghzMin : effectiveGhz();
+}
+
+inline
+double Stats::maxGhz() const {
+  return d_ghz.count() ? d_ghzMax : effectiveGhz();
+}
+
+inline
+double Stats::deviationGhz() const {
+  return d_ghz.stddev();
+}
+
+inline
+u_int64_t Stats::throttled() const {
+  return d_throttled;
+}
+
+inline
+double Stats::frequencyVariation() const {
+  return d_variation;
+}
+
+inline
+bool Stats::frequencyStable() const {
+  const double average = effectiveGhz();
+  return d_throttled==0 && (average==0 || deviationGhz()<=d_variation*average);
+}
+
+inline
+Stats::Mode Stats::mode() const {
+  return d_histogram ? k_HISTOGRAM : k_MIN_MAX;
+}
+
+inline
+const Histogram& Stats::rdtscHistogram() const {
+  assert(d_histogram);
+  return d_histogram[0];
+}
+
+inline
+const Histogram& Stats::activeHistogram() const {
+  assert(d_histogram);
+  return d_histogram[1];
+}
+
+inline
+const Histogram& Stats::fixedHistogram(u_int16_t counter) const {
+  assert(d_histogram);
+  assert(counter<XEON::PMU::k_FIXED_COUNTERS);
+  return d_histogram[2+counter];
+}
+
+inline
+const Histogram& Stats::programmableHistogram(u_int16_t counter) const {
+  assert(d_histogram);
+  assert(counter<d_pmu.programmableCountersDefined());
+  return d_histogram[2+XEON::PMU::k_FIXED_COUNTERS+counter];
+}
+
+inline
+const std::vector<double>& Stats::percentiles() const {
+  return d_percentile;
+}
+
+inline
+const std::vector<Metric>& Stats::metrics() const {
+  return d_metric;
+}
+
+inline
+const Multiplexer *Stats::multiplexer() const {
+  return d_multiplexer;
+}
+
+inline
+double Stats::estimate(u_int16_t event) const {
+  assert(d_multiplexer);
+  return d_iterations ? d_multiplexer->estimate(event)/(double)d_iterations : 0;
+}
+
 // MANIPULATORS
+inline
+void Stats::setOverhead(const u_int64_t *overhead) {
+  d_corrected = false;
+  for (u_int16_t i=0; i<k_HISTOGRAMS; ++i) {
+    d_overhead[i] = overhead ? overhead[i] : 0;
+    d_corrected |= d_overhead[i]!=0;
+  }
+}
+
+inline
+void Stats::setPercentiles(const std::vector<double>& percentiles) {
+  d_percentile = percentiles;
+}
+
+inline
+void Stats::setMetrics(const std::vector<Metric>& metrics) {
+  d_metric = metrics;
+}
+
+inline
+void Stats::setOperations(u_int64_t operations) {
+  d_operations = operations;
+}
+
+inline
+void Stats::setMultiplexer(const Multiplexer *multiplexer) {
+  d_multiplexer = multiplexer;
+}
+
+inline
+void Stats::setFrequencyVariation(double variation) {
+  assert(variation>=0);
+  d_variation = variation;
+}
+
 inline
 void Stats::reset() {
   d_iterations = 0;
+  d_migrations = 0;
   d_rdtscTotal = 0;
+  d_activeTotal = 0;
+
+  d_rdtscMin = d_activeMin = ~0ull;
+  d_rdtscMax = d_activeMax = 0;
 
   memset(d_fixedTotal, 0, sizeof(d_fixedTotal));
   memset(d_progTotal,  0, sizeof(d_progTotal));
+  memset(d_fixedMin, 0xff, sizeof(d_fixedMin));
+  memset(d_progMin,  0xff, sizeof(d_progMin));
+  memset(d_fixedMax, 0, sizeof(d_fixedMax));
+  memset(d_progMax,  0, sizeof(d_progMax));
+  memset(d_energyTotal, 0, sizeof(d_energyTotal));
+  memset(d_energyMin, 0xff, sizeof(d_energyMin));
+  memset(d_energyMax, 0, sizeof(d_energyMax));
+  d_aperfTotal = d_mperfTotal = 0;
+  d_windowAperf = d_windowMperf = 0;
+  d_ghz.reset();
+  d_ghzMin = d_ghzMax = 0;
+  d_throttled = 0;
+
+  if (d_histogram) {
+    for (u_int16_t i=0; i<k_HISTOGRAMS; ++i) {
+      d_histogram[i].reset();
+    }
+  }
+
+  d_pmu.snapshotBegin(&d_last, d_fence);
+}
+
+template <u_int16_t COUNT>
+inline
+void Stats::record(const XEON::Snapshot& snap) {
+  static_assert(COUNT<=XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF, "at most 8 programmable counters");
+  assert(COUNT==d_pmu.programmableCountersDefined());
+
+  // Counts from two cores don't subtract: re-baseline on the new cpu
+  if (__builtin_expect(d_migratable && snap.d_aux!=d_last.d_aux, 0)) {
+    ++d_migrations;
+    d_last = snap;
+    return;
+  }
+
+  ++d_iterations;
+
+  u_int64_t delta[k_HISTOGRAMS];
+  delta[0] = snap.d_tsc - d_last.d_tsc;
+  delta[1] = delta[0] - (snap.d_paused - d_last.d_paused);
 
-  d_rdtscLast = d_pmu.timeStampCounter();
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+    delta[2+i] = (snap.d_fixed[i] - d_last.d_fixed[i]) & d_fixedMask;
+  }
+
+#pragma GCC unroll 8
+  for (u_int16_t i=0; i<COUNT; ++i) {
+    delta[2+XEON::PMU::k_FIXED_COUNTERS+i] = (snap.d_prog[i] - d_last.d_prog[i]) & d_progMask;
+  }
+
+  // Saturating subtract of measurement overhead; all zero unless 'setOverhead' was called
+#pragma GCC unroll 13
+  for (u_int16_t i=0; i<2+XEON::PMU::k_FIXED_COUNTERS+COUNT; ++i) {
+    delta[i] -= delta[i]<d_overhead[i] ? delta[i] : d_overhead[i];
+  }
+
+  update(delta[0], &d_rdtscMin, &d_rdtscMax, &d_rdtscTotal);
+  update(delta[1], &d_activeMin, &d_activeMax, &d_activeTotal);
+
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::PMU::k_FIXED_COUNTERS; ++i) {
+    update(delta[2+i], d_fixedMin+i, d_fixedMax+i, d_fixedTotal+i);
+  }
+
+#pragma GCC unroll 8
+  for (u_int16_t i=0; i<COUNT; ++i) {
+    update(delta[2+XEON::PMU::k_FIXED_COUNTERS+i], d_progMin+i, d_progMax+i, d_progTotal+i);
+  }
+
+  // RAPL counters are 32 bits wide; all zero unless the PMU has a 'Rapl' attached
+#pragma GCC unroll 3
+  for (u_int16_t i=0; i<XEON::Rapl::k_DOMAINS; ++i) {
+    update(XEON::Rapl::delta(d_last.d_energy[i], snap.d_energy[i]), d_energyMin+i, d_energyMax+i, d_energyTotal+i);
+  }
 
-  for (u_int16_t i=0; i<d_pmu.fixedCountersDefined(); ++i) {
-    d_fixedLast[i] = d_pmu.fixedCounterValue(i);
+  // MPERF doesn't move unless the PMU has a 'Frequency' attached
+  if (__builtin_expect(snap.d_mperf!=d_last.d_mperf, 0)) {
+    frequency(d_last, snap);
   }
 
-  for (u_int16_t i=0; i<d_pmu.programmableCountersDefined(); ++i) {
-    d_progLast[i] = d_pmu.programmableCounterValue(i);
+  // Mode is fixed at construction so this branch always predicts
+  if (d_histogram) {
+#pragma GCC unroll 13
+    for (u_int16_t i=0; i<2+XEON::PMU::k_FIXED_COUNTERS+COUNT; ++i) {
+      d_histogram[i].record(delta[i]);
+    }
   }
+
+  d_last = snap;
+}
+
+// PRIVATE CLASS METHODS
+inline
+void Stats::update(u_int64_t delta, u_int64_t *min, u_int64_t *max, u_int64_t *total) {
+  *min = delta<*min ? delta : *min;
+  *max = delta>*max ? delta : *max;
+  *total += delta;
+}
+
+inline
+void Stats::record(const XEON::Snapshot& begin, const XEON::Snapshot& end) {
+  d_last = begin;
+  record(end);
+}
+
+inline
+void Stats::record() {
+  XEON::Snapshot snap;
+  d_pmu.snapshot(&snap, d_fence);
+  record(snap);
 }
 
 // INLINE DEFINITIONS
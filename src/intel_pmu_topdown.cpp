@@ -0,0 +1,322 @@
+#include <intel_pmu_topdown.h>
+#include <intel_pmu_metric.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+
+namespace {
+
+struct EventDefinition {
+  u_int64_t   d_eventSelect;
+  const char *d_name;
+  const char *d_description;
+};
+
+template <class EVENT>
+constexpr EventDefinition define() {
+  return EventDefinition{EVENT::k_VALUE, EVENT::k_NAME, EVENT::k_DESCRIPTION};
+}
+
+// In 'Intel::TopDown::Event' order
+const EventDefinition k_EVENT[Intel::TopDown::k_EVENTS] = {
+  define<Intel::XEON::Events::IDQ_UOPS_NOT_DELIVERED>(),
+  define<Intel::XEON::Events::UOPS_ISSUED>(),
+  define<Intel::XEON::Events::RETIRE_SLOTS>(),
+  define<Intel::XEON::Events::RECOVERY_CYCLES>(),
+  define<Intel::XEON::Events::FETCH_LATENCY_CYCLES>(),
+  define<Intel::XEON::Events::BRANCH_MISPREDICTS>(),
+  define<Intel::XEON::Events::MACHINE_CLEARS>(),
+  define<Intel::XEON::Events::MICROCODE_UOPS>(),
+  define<Intel::XEON::Events::STALLS_MEM_ANY>(),
+  define<Intel::XEON::Events::BOUND_ON_STORES>(),
+  define<Intel::XEON::Events::EXE_BOUND_0_PORTS>(),
+  define<Intel::XEON::Events::PORTS_UTIL_1>(),
+  define<Intel::XEON::Events::PORTS_UTIL_2>(),
+};
+
+const char *const k_NODE[Intel::TopDown::k_NODES] = {
+  "FRONTEND_BOUND", "BAD_SPECULATION", "RETIRING", "BACKEND_BOUND",
+  "FETCH_LATENCY", "FETCH_BANDWIDTH", "BRANCH_MISPREDICTS", "MACHINE_CLEARS",
+  "BASE", "MICROCODE_SEQUENCER", "MEMORY_BOUND", "CORE_BOUND",
+};
+
+inline
+double positive(double value) {
+  return value>0 ? value : 0;
+}
+
+inline
+double share(double part, double whole) {
+  return whole>0 ? part/whole : 0;
+}
+
+void split(const double *rate, double ipc, double *fraction) {
+  // Level 2 of the TMA spreadsheet for Skylake with SMT off given level 1 already in 'fraction'
+  using Intel::TopDown;
+
+  fraction[TopDown::k_FETCH_LATENCY] = rate[TopDown::k_FETCH_LATENCY_CYCLES];
+  if (fraction[TopDown::k_FETCH_LATENCY]>fraction[TopDown::k_FRONTEND_BOUND]) {
+    fraction[TopDown::k_FETCH_LATENCY] = fraction[TopDown::k_FRONTEND_BOUND];
+  }
+  fraction[TopDown::k_FETCH_BANDWIDTH] = positive(fraction[TopDown::k_FRONTEND_BOUND] -
+                                                  fraction[TopDown::k_FETCH_LATENCY]);
+
+  const double mispredicts = rate[TopDown::k_MISPREDICTED_BRANCHES];
+  fraction[TopDown::k_BRANCH_MISPREDICTS] = fraction[TopDown::k_BAD_SPECULATION] *
+                                            share(mispredicts, mispredicts+rate[TopDown::k_CLEARS]);
+  fraction[TopDown::k_MACHINE_CLEARS] = fraction[TopDown::k_BAD_SPECULATION] -
+                                        fraction[TopDown::k_BRANCH_MISPREDICTS];
+
+  // Uops retire in the proportion they issue
+  fraction[TopDown::k_MICROCODE_SEQUENCER] = fraction[TopDown::k_RETIRING] *
+                                             share(rate[TopDown::k_MICROCODE_UOPS], rate[TopDown::k_ISSUED_UOPS]);
+  if (fraction[TopDown::k_MICROCODE_SEQUENCER]>fraction[TopDown::k_RETIRING]) {
+    fraction[TopDown::k_MICROCODE_SEQUENCER] = fraction[TopDown::k_RETIRING];
+  }
+  fraction[TopDown::k_BASE] = fraction[TopDown::k_RETIRING] - fraction[TopDown::k_MICROCODE_SEQUENCER];
+
+  // Back end bound cycles split by whether a load or a full store buffer stalled execution. Cycles using two ports
+  // count as stalls only when the region runs at a high IPC where two ports is under-utilization.
+  const double memory = rate[TopDown::k_STALLS_MEM_ANY] + rate[TopDown::k_BOUND_ON_STORES];
+  const double bound = memory + rate[TopDown::k_EXE_BOUND_0_PORTS] + rate[TopDown::k_PORTS_UTIL_1] +
+                       (ipc>1.8 ? rate[TopDown::k_PORTS_UTIL_2] : 0);
+  fraction[TopDown::k_MEMORY_BOUND] = fraction[TopDown::k_BACKEND_BOUND] * share(memory, bound);
+  fraction[TopDown::k_CORE_BOUND] = fraction[TopDown::k_BACKEND_BOUND] - fraction[TopDown::k_MEMORY_BOUND];
+}
+
+} // namespace
+
+const char *Intel::TopDown::name(Node node) {
+  assert(node<k_NODES);
+  return k_NODE[node];
+}
+
+Intel::TopDown::Node Intel::TopDown::parent(Node node) {
+  assert(node<k_NODES);
+  return node<=k_BACKEND_BOUND ? node : static_cast<Node>((node-k_FETCH_LATENCY)/2);
+}
+
+u_int64_t Intel::TopDown::eventSelect(Event event) {
+  assert(event<k_EVENTS);
+  return k_EVENT[event].d_eventSelect;
+}
+
+const char *Intel::TopDown::eventName(Event event) {
+  assert(event<k_EVENTS);
+  return k_EVENT[event].d_name;
+}
+
+const char *Intel::TopDown::eventDescription(Event event) {
+  assert(event<k_EVENTS);
+  return k_EVENT[event].d_description;
+}
+
+void Intel::TopDown::breakdown(const double *rate, double ipc, double *fraction) {
+  assert(rate);
+  assert(fraction);
+
+  // A thread has 'k_SLOTS_PER_CYCLE' slots a cycle. Bad speculation is uops issued but not retired plus the slots of
+  // recovery cycles; back end bound is what's left.
+  const double width = k_SLOTS_PER_CYCLE;
+  fraction[k_FRONTEND_BOUND] = positive(rate[k_UNDELIVERED_SLOTS]/width);
+  fraction[k_BAD_SPECULATION] = positive((rate[k_ISSUED_UOPS] - rate[k_RETIRE_SLOTS] +
+                                          width*rate[k_RECOVERY_CYCLES])/width);
+  fraction[k_RETIRING] = positive(rate[k_RETIRE_SLOTS]/width);
+  fraction[k_BACKEND_BOUND] = positive(1 - fraction[k_FRONTEND_BOUND] - fraction[k_BAD_SPECULATION] -
+                                       fraction[k_RETIRING]);
+
+  split(rate, ipc, fraction);
+}
+
+Intel::TopDown::TopDown(XEON::PMU& pmu, Level level, XEON::PMU::FencePolicy fence)
+: d_pmu(pmu)
+, d_level(level)
+, d_fence(fence)
+, d_current(k_NO_PASS)
+, d_stats(pmu, fence)
+{
+  const XEON::Capability& capability = pmu.capability();
+  u_int16_t budget = capability.known() ? capability.programmableBudget()
+                                        : (u_int16_t)XEON::PMU::k_MAX_PROG_COUNTERS_HT_ON;
+  if (budget<k_LEVEL_1_EVENTS) {
+    budget = k_LEVEL_1_EVENTS;
+  }
+
+  // Level 1 events lead the last pass so its P0-P3 match 'k_TOPDOWN_XEON_CONFIG'. Level 2 events fill the rest of
+  // it from the end, then as few passes as fit ahead of it.
+  std::vector<u_int16_t> last;
+  for (u_int16_t e=0; e<k_LEVEL_1_EVENTS; ++e) {
+    last.push_back(e);
+  }
+
+  u_int16_t end = level==k_LEVEL_2 ? (u_int16_t)k_EVENTS : (u_int16_t)k_LEVEL_1_EVENTS;
+  u_int16_t tail = (u_int16_t)(budget-k_LEVEL_1_EVENTS);
+  if (tail>end-k_LEVEL_1_EVENTS) {
+    tail = (u_int16_t)(end-k_LEVEL_1_EVENTS);
+  }
+  for (u_int16_t e=(u_int16_t)(end-tail); e<end; ++e) {
+    last.push_back(e);
+  }
+  end = (u_int16_t)(end-tail);
+
+  for (u_int16_t e=k_LEVEL_1_EVENTS; e<end; e=(u_int16_t)(e+budget)) {
+    std::vector<u_int16_t> pass;
+    for (u_int16_t i=e; i<end && i<e+budget; ++i) {
+      pass.push_back(i);
+    }
+    d_pass.push_back(pass);
+  }
+  d_pass.push_back(last);
+
+  d_stats.setMetrics(Metric::library(XEON::PMU::k_TOPDOWN_XEON_CONFIG));
+  reset();
+}
+
+int Intel::TopDown::run(const std::function<void()>& body, u_int64_t iterations) {
+  reset();
+
+  XEON::Snapshot begin, end;
+  for (u_int16_t p=0; p<passes(); ++p) {
+    int rc;
+    if ((rc = beginPass(p))!=0) {
+      return rc;
+    }
+    for (u_int64_t i=0; i<iterations; ++i) {
+      d_pmu.snapshotBegin(&begin, d_fence);
+      body();
+      d_pmu.snapshot(&end, d_fence);
+      record(begin, end);
+    }
+    if ((rc = endPass())!=0) {
+      return rc;
+    }
+  }
+
+  compute();
+  return 0;
+}
+
+int Intel::TopDown::beginPass(u_int16_t pass) {
+  assert(pass<passes());
+  assert(d_current==k_NO_PASS);
+
+  u_int64_t eventSelect[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];
+  const char *description[XEON::PMU::k_MAX_PROG_COUNTERS_HT_OFF];
+  const std::vector<u_int16_t>& event = d_pass[pass];
+  for (u_int16_t i=0; i<event.size(); ++i) {
+    eventSelect[i] = k_EVENT[event[i]].d_eventSelect;
+    description[i] = k_EVENT[event[i]].d_description;
+  }
+
+  int rc;
+  if ((rc = d_pmu.program((u_int16_t)event.size(), eventSelect, description))!=0 ||
+      (rc = d_pmu.reset())!=0) {
+    return rc;
+  }
+  if (pass+1==passes()) {
+    d_stats.reset();
+  }
+  if ((rc = d_pmu.start())!=0) {
+    return rc;
+  }
+
+  d_current = pass;
+  return 0;
+}
+
+int Intel::TopDown::endPass() {
+  assert(d_current!=k_NO_PASS);
+
+  int rc = d_pmu.pause();
+
+  if (rc==0 && d_current+1==passes() && d_pmu.perfMetrics()) {
+    // Shares of the slots since 'reset()' in 255ths: retiring, bad speculation, front end, back end
+    u_int64_t slots, metrics;
+    d_pmu.topDownMetrics(&slots, &metrics);
+    const Node node[4] = {k_RETIRING, k_BAD_SPECULATION, k_FRONTEND_BOUND, k_BACKEND_BOUND};
+    for (u_int16_t i=0; i<4; ++i) {
+      d_slots[node[i]] += (double)slots*(double)((metrics>>(8*i)) & 0xff)/255.0;
+    }
+  }
+
+  d_current = k_NO_PASS;
+  return rc;
+}
+
+void Intel::TopDown::compute() {
+  double rate[k_EVENTS];
+  for (u_int16_t e=0; e<k_EVENTS; ++e) {
+    rate[e] = share((double)d_count[e], (double)d_cycles[e]);
+  }
+
+  breakdown(rate, share((double)d_instructions, (double)d_coreCycles), d_fraction);
+
+  const double slots = d_slots[k_FRONTEND_BOUND] + d_slots[k_BAD_SPECULATION] + d_slots[k_RETIRING] +
+                       d_slots[k_BACKEND_BOUND];
+  d_perfMetrics = slots>0;
+  if (d_perfMetrics) {
+    for (u_int16_t n=k_FRONTEND_BOUND; n<=k_BACKEND_BOUND; ++n) {
+      d_fraction[n] = d_slots[n]/slots;
+    }
+    split(rate, share((double)d_instructions, (double)d_coreCycles), d_fraction);
+  }
+
+  if (d_level==k_LEVEL_1) {
+    for (u_int16_t n=k_FETCH_LATENCY; n<k_NODES; ++n) {
+      d_fraction[n] = 0;
+    }
+  }
+}
+
+void Intel::TopDown::reset() {
+  memset(d_count, 0, sizeof(d_count));
+  memset(d_cycles, 0, sizeof(d_cycles));
+  memset(d_slots, 0, sizeof(d_slots));
+  memset(d_fraction, 0, sizeof(d_fraction));
+  d_instructions = 0;
+  d_coreCycles = 0;
+  d_iterations = 0;
+  d_migrations = 0;
+  d_perfMetrics = false;
+}
+
+std::ostream& Intel::TopDown::print(std::ostream& stream) const {
+  stream << "Intel XEON CPU HW Core "
+         << d_pmu.coreId()
+         << " PMU top-down level "
+         << (int)d_level
+         << " in "
+         << passes()
+         << " passes over "
+         << d_iterations
+         << " iterations, "
+         << d_migrations
+         << " migrated, level 1 from "
+         << (d_perfMetrics ? "IA32_PERF_METRICS" : "events")
+         << ":"
+         << std::endl;
+
+  char buf[256];
+  for (u_int16_t n=k_FRONTEND_BOUND; n<=k_BACKEND_BOUND; ++n) {
+    snprintf(buf, sizeof(buf), "%-24s: %6.2lf%%\n", k_NODE[n], 100.0*d_fraction[n]);
+    stream << buf;
+    for (u_int16_t c=k_FETCH_LATENCY; d_level==k_LEVEL_2 && c<k_NODES; ++c) {
+      if (parent(static_cast<Node>(c))==n) {
+        snprintf(buf, sizeof(buf), "  %-22s: %6.2lf%%\n", k_NODE[c], 100.0*d_fraction[c]);
+        stream << buf;
+      }
+    }
+  }
+
+  for (u_int16_t p=0; p<passes(); ++p) {
+    for (u_int16_t e: d_pass[p]) {
+      snprintf(buf, sizeof(buf), "pass %u [%-48s]: value: %015lu, per cycle: %.4lf\n", p, k_EVENT[e].d_name,
+        d_count[e], share((double)d_count[e], (double)d_cycles[e]));
+      stream << buf;
+    }
+  }
+
+  return d_stats.print(stream);
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+// PURPOSE: Break a measured region's pipeline slots down by top-down microarchitecture analysis (TMA)
+//
+// CLASSES:
+//  Intel::TopDown: Runs a region once per pass of events through a PMU's programmable counters and computes the TMA
+//                  level 1 breakdown (front end bound, bad speculation, retiring, back end bound) and optionally the
+//                  level 2 split of each: fetch latency/bandwidth, branch mispredicts/machine clears, base/microcode
+//                  sequencer, and memory/core bound. Formulas are those of Skylake class cores which issue and retire
+//                  at most 4 uops a cycle, so a thread has '4*F1' slots. Counts of different passes are combined as
+//                  rates per core cycle (F1) of their own pass. The level 1 pass runs last and its iterations are
+//                  also recorded into a 'Stats' reporting the level 1 'Metric::library' so the PMU is left programmed
+//                  as 'k_TOPDOWN_XEON_CONFIG'. When the PMU enabled fixed counter 3 and IA32_PERF_METRICS (see
+//                  'PMU::perfMetrics') level 1 comes from them instead, which is exact on wider cores too.
+//
+// Usage:
+//   Intel::XEON::PMU pmu(Intel::XEON::PMU::k_TOPDOWN_XEON_CONFIG);
+//   Intel::TopDown topDown(pmu);
+//   topDown.run([&]() { work(); }, 1000);
+//   std::cout << topDown;
+//
+// The formulas assume one thread per core; with hyper threading ON the level 1 events count this thread's share of
+// the core. Level 2 ratios combine passes so the region must behave the same every pass.
+
+#include <intel_pmu_stats.h>
+#include <intel_xeon_pmu.h>
+
+#include <sys/types.h>
+
+#include <functional>
+#include <iosfwd>
+#include <vector>
+
+namespace Intel {
+
+class TopDown {
+public:
+  // ENUM
+  enum Level {
+    k_LEVEL_1 = 1,                      // front end bound, bad speculation, retiring, back end bound
+    k_LEVEL_2 = 2,                      // level 1 and the split of each level 1 node in two
+  };
+
+  enum Node {
+    k_FRONTEND_BOUND = 0,               // level 1: slots the front end delivered no uop to a ready back end
+    k_BAD_SPECULATION,                  // level 1: slots issuing uops that never retire or recovering from them
+    k_RETIRING,                         // level 1: slots retiring uops
+    k_BACKEND_BOUND,                    // level 1: slots stalled for lack of back end resources
+    k_FETCH_LATENCY,                    // front end bound: cycles no uop was delivered e.g. i-cache misses
+    k_FETCH_BANDWIDTH,                  // front end bound: cycles fewer than 4 uops were delivered
+    k_BRANCH_MISPREDICTS,               // bad speculation: mispredicted branches
+    k_MACHINE_CLEARS,                   // bad speculation: memory ordering, self-modifying code etc.
+    k_BASE,                             // retiring: uops not from the microcode sequencer
+    k_MICROCODE_SEQUENCER,              // retiring: uops from the microcode sequencer
+    k_MEMORY_BOUND,                     // back end bound: stalls on loads and full store buffers
+    k_CORE_BOUND,                       // back end bound: stalls on execution ports and units
+    k_NODES,                            // number of nodes
+  };
+
+  enum Event {
+    k_UNDELIVERED_SLOTS = 0,            // IDQ_UOPS_NOT_DELIVERED.CORE
+    k_ISSUED_UOPS,                      // UOPS_ISSUED.ANY
+    k_RETIRE_SLOTS,                     // UOPS_RETIRED.RETIRE_SLOTS
+    k_RECOVERY_CYCLES,                  // INT_MISC.RECOVERY_CYCLES
+    k_FETCH_LATENCY_CYCLES,             // IDQ_UOPS_NOT_DELIVERED.CYCLES_0_UOPS_DELIV.CORE
+    k_MISPREDICTED_BRANCHES,            // BR_MISP_RETIRED.ALL_BRANCHES
+    k_CLEARS,                           // MACHINE_CLEARS.COUNT
+    k_MICROCODE_UOPS,                   // IDQ.MS_UOPS
+    k_STALLS_MEM_ANY,                   // CYCLE_ACTIVITY.STALLS_MEM_ANY
+    k_BOUND_ON_STORES,                  // EXE_ACTIVITY.BOUND_ON_STORES
+    k_EXE_BOUND_0_PORTS,                // EXE_ACTIVITY.EXE_BOUND_0_PORTS
+    k_PORTS_UTIL_1,                     // EXE_ACTIVITY.1_PORTS_UTIL
+    k_PORTS_UTIL_2,                     // EXE_ACTIVITY.2_PORTS_UTIL
+    k_EVENTS,                           // number of events
+  };
+
+  enum Support {
+    k_SLOTS_PER_CYCLE = 4,              // issue width of Skylake class cores
+    k_LEVEL_1_EVENTS  = 4,              // events 0-3 are level 1; they go first in the last pass
+    k_NO_PASS         = 0xffff,         // 'pass()' when no pass is running
+  };
+
+private:
+  // DATA
+  XEON::PMU&                          d_pmu;                 // PMU whose programmable counters run each pass
+  Level                               d_level;               // deepest level computed
+  XEON::PMU::FencePolicy              d_fence;               // serialization of 'run' snapshots
+  std::vector<std::vector<u_int16_t>> d_pass;                // events by pass; the last pass is the level 1 pass
+  u_int16_t                           d_current;             // pass between 'beginPass' and 'endPass'
+  u_int64_t                           d_count[k_EVENTS];     // event counts over the iterations of its pass
+  u_int64_t                           d_cycles[k_EVENTS];    // F1 over the same iterations
+  u_int64_t                           d_instructions;        // F0 over the level 1 pass's iterations
+  u_int64_t                           d_coreCycles;          // F1 over the level 1 pass's iterations
+  u_int64_t                           d_iterations;          // iterations recorded over all passes
+  u_int64_t                           d_migrations;          // iterations dropped for changing cpu
+  double                              d_slots[k_NODES];      // IA32_PERF_METRICS slots by level 1 node
+  bool                                d_perfMetrics;         // true if 'compute' used 'd_slots'
+  double                              d_fraction[k_NODES];   // share of slots by node per 'compute'
+  Stats                               d_stats;               // the level 1 pass's iterations
+
+public:
+  // CLASS METHODS
+  static const char *name(Node node);
+    // Return the name of specified 'node' e.g. "FRONTEND_BOUND". The behavior is defined if 'node<k_NODES'.
+
+  static Node parent(Node node);
+    // Return the level 1 node specified 'node' splits, or 'node' itself if it is level 1. The behavior is defined if
+    // 'node<k_NODES'.
+
+  static u_int64_t eventSelect(Event event);
+    // Return the IA32_PERFEVTSEL value of specified 'event'. The behavior is defined if 'event<k_EVENTS'.
+
+  static const char *eventName(Event event);
+    // Return the perfmon name of specified 'event'. The behavior is defined if 'event<k_EVENTS'.
+
+  static const char *eventDescription(Event event);
+    // Return a short description of specified 'event'. The behavior is defined if 'event<k_EVENTS'.
+
+  static void breakdown(const double *rate, double ipc, double *fraction);
+    // Write into specified 'fraction' array of 'k_NODES' entries each node's share of slots given specified 'rate'
+    // array of 'k_EVENTS' counts per core cycle and the specified 'ipc' of the region. Fractions of a node's children
+    // sum to the node; negative shares from counting noise are clamped to 0. Nodes whose events have no rate are 0.
+
+  // CREATORS
+  TopDown(XEON::PMU& pmu, Level level = k_LEVEL_2,
+          XEON::PMU::FencePolicy fence = XEON::PMU::k_FENCE_MFENCE_LFENCE);
+    // Create a top-down analysis of specified 'level' running its passes on specified 'pmu' and reading counters
+    // with optionally specified 'fence'. Passes hold at most 'pmu.capability().programmableBudget()' events, or 4 if
+    // the PMU isn't reported. The behavior is defined if 'pmu' outlives this object.
+
+  TopDown(const TopDown& other) = delete;
+    // Copy constructor not supported
+
+  ~TopDown() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  Level level() const;
+    // Return the level provided at construction
+
+  u_int16_t passes() const;
+    // Return the number of passes a region must be run for
+
+  const std::vector<u_int16_t>& events(u_int16_t pass) const;
+    // Return the events counted by specified 'pass'. The behavior is defined if 'pass<passes()'.
+
+  u_int16_t pass() const;
+    // Return the pass between 'beginPass' and 'endPass' or 'k_NO_PASS'
+
+  u_int64_t count(Event event) const;
+    // Return the total of specified 'event' recorded since 'reset()'
+
+  u_int64_t cycles(Event event) const;
+    // Return the core cycles (F1) recorded alongside specified 'event' since 'reset()'
+
+  u_int64_t iterations() const;
+    // Return the number of iterations recorded over all passes since 'reset()'
+
+  u_int64_t migrations() const;
+    // Return the number of iterations dropped since 'reset()' because their snapshots were read on different cpus
+
+  bool perfMetrics() const;
+    // Return true if the level 1 breakdown of the last 'compute' came from IA32_PERF_METRICS
+
+  double fraction(Node node) const;
+    // Return the share of pipeline slots of specified 'node' per the last 'compute'
+
+  const Stats& stats() const;
+    // Return the statistics of the level 1 pass's iterations with the level 1 metrics
+
+  // MANIPULATORS
+  int run(const std::function<void()>& body, u_int64_t iterations);
+    // Return 0 after running every pass of specified 'body' specified 'iterations' times, snapshotting around each
+    // call, then 'compute()', and non-zero if programming or starting the PMU failed. Prior results are discarded.
+
+  int beginPass(u_int16_t pass);
+    // Return 0 if the events of specified 'pass' were programmed and the PMU reset and started, and non-zero
+    // otherwise. Call 'record' per iteration, then 'endPass'. The behavior is defined if 'pass<passes()'.
+
+  void record(const XEON::Snapshot& begin, const XEON::Snapshot& end);
+    // Add the deltas from specified 'begin' to specified 'end' to the current pass's events, dropping them if they
+    // were read on different cpus of an MSR backend PMU. The behavior is defined if 'pass()!=k_NO_PASS'.
+
+  int endPass();
+    // Return 0 if the PMU was paused ending the current pass, and non-zero otherwise. The level 1 pass also reads
+    // IA32_PERF_METRICS if enabled. The behavior is defined if 'pass()!=k_NO_PASS'.
+
+  void compute();
+    // Compute the share of slots of every node from the counts recorded since 'reset()'
+
+  void reset();
+    // Discard all recorded counts
+
+  TopDown& operator=(const TopDown& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the breakdown per the last 'compute', each event's count per cycle, then
+    // 'stats()'
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const TopDown& object);
+    // Pretty print 'object' to specified 'stream' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+TopDown::Level TopDown::level() const {
+  return d_level;
+}
+
+inline
+u_int16_t TopDown::passes() const {
+  return (u_int16_t)d_pass.size();
+}
+
+inline
+const std::vector<u_int16_t>& TopDown::events(u_int16_t pass) const {
+  assert(pass<passes());
+  return d_pass[pass];
+}
+
+inline
+u_int16_t TopDown::pass() const {
+  return d_current;
+}
+
+inline
+u_int64_t TopDown::count(Event event) const {
+  assert(event<k_EVENTS);
+  return d_count[event];
+}
+
+inline
+u_int64_t TopDown::cycles(Event event) const {
+  assert(event<k_EVENTS);
+  return d_cycles[event];
+}
+
+inline
+u_int64_t TopDown::iterations() const {
+  return d_iterations;
+}
+
+inline
+u_int64_t TopDown::migrations() const {
+  return d_migrations;
+}
+
+inline
+bool TopDown::perfMetrics() const {
+  return d_perfMetrics;
+}
+
+inline
+double TopDown::fraction(Node node) const {
+  assert(node<k_NODES);
+  return d_fraction[node];
+}
+
+inline
+const Stats& TopDown::stats() const {
+  return d_stats;
+}
+
+// MANIPULATORS
+inline
+void TopDown::record(const XEON::Snapshot& begin, const XEON::Snapshot& end) {
+  assert(d_current!=k_NO_PASS);
+
+  if (d_pmu.backend()==XEON::PMU::k_BACKEND_MSR && begin.cpu()!=end.cpu()) {
+    ++d_migrations;
+    return;
+  }
+
+  const u_int64_t cycles = (end.d_fixed[1] - begin.d_fixed[1]) & d_pmu.fixedCounterMask();
+  const std::vector<u_int16_t>& event = d_pass[d_current];
+  for (u_int16_t i=0; i<event.size(); ++i) {
+    d_count[event[i]] += (end.d_prog[i] - begin.d_prog[i]) & d_pmu.programmableCounterMask();
+    d_cycles[event[i]] += cycles;
+  }
+
+  if (d_current+1==passes()) {
+    d_instructions += (end.d_fixed[0] - begin.d_fixed[0]) & d_pmu.fixedCounterMask();
+    d_coreCycles += cycles;
+    d_stats.record(begin, end);
+  }
+
+  ++d_iterations;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const TopDown& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
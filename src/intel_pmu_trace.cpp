@@ -0,0 +1,369 @@
+#include <intel_pmu_trace.h>
+#include <intel_tsc_clock.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+inline
+char *encode(char *out, u_int64_t value, u_int64_t prev) {
+  // Zigzag so small negative differences e.g. a wrapped counter stay short too
+  const int64_t delta = (int64_t)(value - prev);
+  u_int64_t zigzag = ((u_int64_t)delta << 1) ^ (u_int64_t)(delta >> 63);
+  while (zigzag>=0x80) {
+    *out++ = (char)(zigzag | 0x80);
+    zigzag >>= 7;
+  }
+  *out++ = (char)zigzag;
+  return out;
+}
+
+inline
+const char *decode(const char *in, const char *end, u_int64_t prev, u_int64_t *value) {
+  // Return the byte after the varint at 'in' or 0 if it runs past 'end' or is longer than 10 bytes
+  u_int64_t zigzag = 0;
+  for (u_int32_t shift=0; shift<64 && in<end; shift+=7) {
+    const u_int8_t byte = (u_int8_t)*in++;
+    zigzag |= (u_int64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80)==0) {
+      *value = prev + ((zigzag >> 1) ^ (0-(zigzag & 1)));
+      return in;
+    }
+  }
+  return 0;
+}
+
+void copyName(char *dst, size_t size, const std::string& src) {
+  strncpy(dst, src.c_str(), size-1);
+  dst[size-1] = 0;
+}
+
+} // namespace
+
+int Intel::TraceWriter::remap(u_int64_t bytes) {
+  if (d_map && d_offset+bytes<=d_mapOffset+d_mapSize) {
+    return 0;
+  }
+
+  if (d_map) {
+    munmap(d_map, d_mapSize);
+    d_map = 0;
+  }
+
+  const u_int64_t page = (u_int64_t)sysconf(_SC_PAGESIZE);
+  const u_int64_t offset = d_offset & ~(page-1);
+  u_int64_t size = (d_offset-offset+bytes+page-1) & ~(page-1);
+  if (size<k_WINDOW_SIZE) {
+    size = k_WINDOW_SIZE;
+  }
+
+  if (offset+size>d_fileSize) {
+    // Real blocks, not a sparse hole: running out of disk is ENOSPC here instead of SIGBUS on a store later
+    int rc = posix_fallocate(d_fd, (off_t)d_fileSize, (off_t)(offset+size-d_fileSize));
+    if (rc!=0) {
+      fprintf(stderr, "Error: cannot grow trace to %lu bytes: %s\n", offset+size, strerror(rc));
+      return rc;
+    }
+    d_fileSize = offset+size;
+  }
+
+  void *map = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, d_fd, (off_t)offset);
+  if (map==MAP_FAILED) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot mmap trace at offset %lu: %s\n", offset, strerror(rc));
+    return rc;
+  }
+
+  d_map = (char*)map;
+  d_mapOffset = offset;
+  d_mapSize = size;
+  return 0;
+}
+
+int Intel::TraceWriter::open(const std::string& path, const XEON::PMU& pmu, u_int32_t blockSamples) {
+  close();
+
+  if (blockSamples==0 || blockSamples>TraceHeader::k_MAX_BLOCK_SAMPLES) {
+    fprintf(stderr, "Error: %u samples per trace block; expected 1 to %d\n", blockSamples,
+      (int)TraceHeader::k_MAX_BLOCK_SAMPLES);
+    return EINVAL;
+  }
+
+  if (pmu.status()!=0) {
+    fprintf(stderr, "Error: cannot trace a PMU that failed construction\n");
+    return pmu.status();
+  }
+
+  d_fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (d_fd<0) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot create '%s': %s\n", path.c_str(), strerror(rc));
+    return rc;
+  }
+
+  d_fixedCnt = pmu.fixedCountersDefined();
+  d_progCnt = pmu.programmableCountersDefined();
+
+  const TscClock& clock = TscClock::instance();
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  memset(&d_header, 0, sizeof(d_header));
+  memcpy(d_header.d_magic, TraceHeader::k_MAGIC, sizeof(d_header.d_magic));
+  d_header.d_version = TraceHeader::k_VERSION;
+  d_header.d_blockSamples = blockSamples;
+  d_header.d_fixedCnt = d_fixedCnt;
+  d_header.d_progCnt = d_progCnt;
+  d_header.d_coreId = pmu.coreId();
+  d_header.d_backend = (u_int32_t)pmu.backend();
+  d_header.d_tscSource = (u_int32_t)clock.source();
+  d_header.d_tscHz = clock.hz();
+  d_header.d_fixedMask = pmu.fixedCounterMask();
+  d_header.d_progMask = pmu.programmableCounterMask();
+  d_header.d_createdNs = (u_int64_t)now.tv_sec*1000000000ull + (u_int64_t)now.tv_nsec;
+  for (u_int16_t i=0; i<d_fixedCnt; ++i) {
+    const XEON::PerfEvent event = XEON::PMU::fixedEvent(i);
+    copyName(d_header.d_mnemonic[i], TraceHeader::k_MNEMONIC_SIZE, pmu.fixedMnemonic()[i]);
+    copyName(d_header.d_description[i], TraceHeader::k_DESCRIPTION_SIZE, pmu.fixedDescription()[i]);
+    d_header.d_eventType[i] = event.d_type;
+    d_header.d_eventConfig[i] = event.d_config;
+  }
+  for (u_int16_t i=0; i<d_progCnt; ++i) {
+    const XEON::PerfEvent event = pmu.programmableEvent(i);
+    copyName(d_header.d_mnemonic[d_fixedCnt+i], TraceHeader::k_MNEMONIC_SIZE, pmu.programmableMnemonic()[i]);
+    copyName(d_header.d_description[d_fixedCnt+i], TraceHeader::k_DESCRIPTION_SIZE,
+      pmu.programmableDescription()[i]);
+    d_header.d_eventType[d_fixedCnt+i] = event.d_type;
+    d_header.d_eventConfig[d_fixedCnt+i] = event.d_config;
+  }
+
+  // Touched now so 'append' doesn't take page faults on first use
+  d_blockSamples = blockSamples;
+  d_column = new u_int64_t[(size_t)d_header.columns()*blockSamples];
+  memset(d_column, 0, sizeof(u_int64_t)*d_header.columns()*blockSamples);
+  d_count = 0;
+  d_status = 0;
+  d_fileSize = 0;
+  d_offset = TraceHeader::k_HEADER_SIZE;
+
+  int rc;
+  if ((rc = remap(0))!=0) {
+    close();
+    return rc;
+  }
+  memcpy(d_map, &d_header, sizeof(d_header));
+
+  return 0;
+}
+
+int Intel::TraceWriter::flush() {
+  if (d_status!=0 || d_count==0) {
+    return d_status;
+  }
+
+  const u_int16_t columns = d_header.columns();
+  int rc;
+  if ((rc = remap(TraceHeader::k_BLOCK_HEADER + (u_int64_t)columns*d_count*k_MAX_VARINT))!=0) {
+    // 'd_count' stays put so a full block makes 'append' return this without touching 'd_column'
+    d_status = rc;
+    return rc;
+  }
+
+  char *block = d_map + (d_offset-d_mapOffset);
+  char *out = block + TraceHeader::k_BLOCK_HEADER;
+  for (u_int16_t c=0; c<columns; ++c) {
+    const u_int64_t *value = d_column + (size_t)c*d_blockSamples;
+    u_int64_t prev = 0;
+    for (u_int32_t i=0; i<d_count; ++i) {
+      out = encode(out, value[i], prev);
+      prev = value[i];
+    }
+  }
+
+  const u_int32_t header[2] = {d_count, (u_int32_t)(out - block - TraceHeader::k_BLOCK_HEADER)};
+  memcpy(block, header, sizeof(header));
+
+  d_offset += (u_int64_t)(out - block);
+  d_header.d_samples += d_count;
+  ++d_header.d_blocks;
+  d_count = 0;
+
+  return 0;
+}
+
+int Intel::TraceWriter::close() {
+  if (d_fd<0) {
+    return 0;
+  }
+
+  int rc = d_column ? flush() : 0;
+
+  if (d_map) {
+    munmap(d_map, d_mapSize);
+    d_map = 0;
+  }
+
+  if (rc==0 && ftruncate(d_fd, (off_t)d_offset)!=0) {
+    rc = errno;
+    fprintf(stderr, "Error: cannot truncate trace: %s\n", strerror(rc));
+  }
+
+  // Totals mark the trace complete; a reader of a trace without them scans for the last whole block
+  if (rc==0) {
+    d_header.d_bytes = d_offset;
+    if (pwrite(d_fd, &d_header, sizeof(d_header), 0)!=(ssize_t)sizeof(d_header)) {
+      rc = errno ? errno : EIO;
+      fprintf(stderr, "Error: cannot write trace header: %s\n", strerror(rc));
+    }
+  }
+
+  ::close(d_fd);
+  d_fd = -1;
+  delete [] d_column;
+  d_column = 0;
+  d_count = 0;
+  d_blockSamples = 0;
+  d_status = 0;
+  d_mapOffset = 0;
+  d_mapSize = 0;
+  d_fileSize = 0;
+
+  return rc;
+}
+
+bool Intel::TraceReader::load() {
+  d_count = 0;
+  d_next = 0;
+
+  if (d_offset+TraceHeader::k_BLOCK_HEADER>d_end) {
+    return false;
+  }
+
+  u_int32_t header[2];
+  memcpy(header, d_base+d_offset, sizeof(header));
+  if (header[0]==0) {
+    // Zero fill past the last block of a trace whose writer didn't close
+    return false;
+  }
+
+  const u_int64_t begin = d_offset + TraceHeader::k_BLOCK_HEADER;
+  if (header[0]>d_header->d_blockSamples || begin+header[1]>d_end) {
+    if (complete()) {
+      fprintf(stderr, "Error: trace block at offset %lu is corrupt\n", d_offset);
+      d_status = EINVAL;
+    }
+    return false;
+  }
+
+  const char *in = d_base + begin;
+  const char *end = in + header[1];
+  const u_int16_t columns = d_header->columns();
+  for (u_int16_t c=0; c<columns && in; ++c) {
+    u_int64_t *value = d_column.data() + (size_t)c*d_header->d_blockSamples;
+    u_int64_t prev = 0;
+    for (u_int32_t i=0; i<header[0] && in; ++i) {
+      in = decode(in, end, prev, value+i);
+      prev = value[i];
+    }
+  }
+
+  if (in!=end) {
+    fprintf(stderr, "Error: trace block at offset %lu is corrupt\n", d_offset);
+    d_status = EINVAL;
+    return false;
+  }
+
+  d_offset = begin + header[1];
+  d_count = header[0];
+  return true;
+}
+
+int Intel::TraceReader::open(const std::string& path) {
+  close();
+
+  int fid = ::open(path.c_str(), O_RDONLY);
+  if (fid<0) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot open '%s': %s\n", path.c_str(), strerror(rc));
+    return rc;
+  }
+
+  struct stat info;
+  if (fstat(fid, &info)!=0) {
+    int rc = errno;
+    ::close(fid);
+    return rc;
+  }
+
+  if ((size_t)info.st_size<TraceHeader::k_HEADER_SIZE) {
+    ::close(fid);
+    fprintf(stderr, "Error: '%s' is not a PMU trace\n", path.c_str());
+    return EINVAL;
+  }
+
+  void *base = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fid, 0);
+  ::close(fid);
+  if (base==MAP_FAILED) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot mmap '%s': %s\n", path.c_str(), strerror(rc));
+    return rc;
+  }
+  madvise(base, info.st_size, MADV_SEQUENTIAL);
+
+  d_base = (const char*)base;
+  d_size = info.st_size;
+
+  const TraceHeader *header = (const TraceHeader*)d_base;
+  const bool valid = memcmp(header->d_magic, TraceHeader::k_MAGIC, sizeof(header->d_magic))==0
+                  && header->d_version==TraceHeader::k_VERSION
+                  && header->d_blockSamples>0
+                  && header->d_blockSamples<=TraceHeader::k_MAX_BLOCK_SAMPLES
+                  && header->d_fixedCnt<=XEON::Snapshot::k_FIXED_COUNTERS
+                  && header->d_progCnt<=XEON::Snapshot::k_MAX_PROG_COUNTERS
+                  && header->d_bytes<=d_size
+                  && (header->d_bytes==0 || header->d_bytes>=TraceHeader::k_HEADER_SIZE);
+  if (!valid) {
+    close();
+    fprintf(stderr, "Error: '%s' is not a valid PMU trace\n", path.c_str());
+    return EINVAL;
+  }
+
+  d_header = header;
+  d_end = header->d_bytes ? header->d_bytes : d_size;
+  d_column.resize((size_t)header->columns()*header->d_blockSamples);
+  rewind();
+
+  return 0;
+}
+
+void Intel::TraceReader::rewind() {
+  d_offset = TraceHeader::k_HEADER_SIZE;
+  d_count = 0;
+  d_next = 0;
+  d_samples = 0;
+  d_status = 0;
+}
+
+void Intel::TraceReader::close() {
+  if (d_base) {
+    munmap((void*)d_base, d_size);
+  }
+  d_base = 0;
+  d_size = 0;
+  d_header = 0;
+  d_end = 0;
+  d_offset = 0;
+  d_count = 0;
+  d_next = 0;
+  d_samples = 0;
+  d_status = 0;
+  d_column.clear();
+}
@@ -0,0 +1,409 @@
+#pragma once
+
+// PURPOSE: Keep every raw PMU snapshot of a run in a compact file for offline analysis
+//
+// CLASSES:
+//  Intel::TraceHeader: On-disk description of a trace: counters recorded, their mnemonics, descriptions, events and
+//                      valid bit masks, the TSC frequency, and once the writer closed, sample and byte totals.
+//  Intel::TraceWriter: Append-only trace file writer. 'append' copies a snapshot's values into a column-major block
+//                      buffer allocated at 'open'; a full block is encoded column by column as zigzag varints of the
+//                      difference from the previous sample straight into a shared 'mmap' window of the file. Counters
+//                      move little between samples so most values take one to three bytes. The append path never
+//                      allocates or makes a system call; encoding runs once per block and remaps the window only when
+//                      it runs out. File space is reserved with 'posix_fallocate' so a full disk is an error, not a
+//                      SIGBUS. Blocks written are in the page cache: they survive the process dying before 'close'.
+//                      Errors are sticky: once a block can't be written every later 'append', 'flush' and 'close'
+//                      returns the same error and staged samples are dropped; blocks written before stay readable.
+//  Intel::TraceReader: Streams a trace file through a read-only 'mmap' one decoded block at a time, so memory use is
+//                      one block whatever the file size. Reads files whose writer never closed up to the last whole
+//                      block.
+//
+// FILE FORMAT:
+//  TraceHeader | pad to k_HEADER_SIZE | Block* | zero fill if not closed. Counters' events are recorded as perf event
+//  type and config: fixed counters as 'PMU::fixedEvent', MSR programmable counters as 'PerfEvent::raw'.
+//  Block: samples (u32) | bytes (u32) | 'bytes' of column data
+//  Column data: for each column in the order tsc, aux, paused, fixed[0, d_fixedCnt), prog[0, d_progCnt): 'samples'
+//  LEB128 varints of 'zigzag(value[i]-value[i-1])' with 'value[-1]=0' so each block decodes on its own. All integers
+//  are host byte order. A block with 0 samples or running past the file ends the trace.
+//
+// Usage:
+//   Intel::XEON::PMU pmu(Intel::XEON::PMU::k_DEFAULT_XEON_CONFIG_0);
+//   Intel::TraceWriter trace;
+//   pmu.reset(); pmu.start();
+//   trace.open("run.trace", pmu);
+//   while (running) {
+//     work();
+//     pmu.snapshot(&snap);
+//     trace.append(snap);
+//   }
+//   trace.close();
+
+#include <intel_xeon_pmu.h>
+
+#include <string.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace Intel {
+
+struct TraceHeader {
+  // ENUM
+  enum Support {
+    k_VERSION           = 1,            // format version written and read, the digit ending 'k_MAGIC'
+    k_HEADER_SIZE       = 1024,         // file offset of the first block
+    k_BLOCK_HEADER      = 8,            // bytes of 'samples' and 'bytes' before each block's column data
+    k_MAX_COUNTERS      = XEON::Snapshot::k_FIXED_COUNTERS + XEON::Snapshot::k_MAX_PROG_COUNTERS,
+    k_MNEMONIC_SIZE     = 8,            // bytes per mnemonic including NUL
+    k_DESCRIPTION_SIZE  = 64,           // bytes per description including NUL; longer ones are truncated
+    k_MAX_BLOCK_SAMPLES = 1<<20,        // most samples per block a writer writes or a reader accepts
+  };
+
+  enum Column {
+    k_COLUMN_TSC    = 0,                // 'Snapshot::d_tsc'
+    k_COLUMN_AUX    = 1,                // 'Snapshot::d_aux'
+    k_COLUMN_PAUSED = 2,                // 'Snapshot::d_paused'
+    k_COLUMN_FIXED  = 3,                // first of 'd_fixedCnt' fixed counter columns then 'd_progCnt' programmable
+  };
+
+  // CONSTANTS
+  static constexpr char k_MAGIC[8] = "PMCTRC1";
+
+  // DATA
+  char      d_magic[8];                 // 'k_MAGIC'
+  u_int32_t d_version;                  // 'k_VERSION'
+  u_int32_t d_blockSamples;             // most samples in one block
+  u_int16_t d_fixedCnt;                 // fixed counters recorded
+  u_int16_t d_progCnt;                  // programmable counters recorded
+  int32_t   d_coreId;                   // 'PMU::coreId()' of the writer's PMU
+  u_int32_t d_backend;                  // 'PMU::Backend' of the writer's PMU
+  u_int32_t d_tscSource;                // 'TscClock::Source' of 'd_tscHz'
+  u_int64_t d_tscHz;                    // TSC frequency of the writing host
+  u_int64_t d_fixedMask;                // 'PMU::fixedCounterMask()'
+  u_int64_t d_progMask;                 // 'PMU::programmableCounterMask()'
+  u_int64_t d_createdNs;                // CLOCK_REALTIME nanoseconds at 'TraceWriter::open'
+  u_int64_t d_samples;                  // samples in the file; 0 until the writer closed
+  u_int64_t d_blocks;                   // blocks in the file; 0 until the writer closed
+  u_int64_t d_bytes;                    // file offset just past the last block; 0 until the writer closed
+  char      d_mnemonic[k_MAX_COUNTERS][k_MNEMONIC_SIZE];       // fixed counters' then programmable counters'
+  char      d_description[k_MAX_COUNTERS][k_DESCRIPTION_SIZE]; // fixed counters' then programmable counters'
+  u_int64_t d_eventConfig[k_MAX_COUNTERS];                     // 'perf_event_attr::config' counted, in the same order
+  u_int32_t d_eventType[k_MAX_COUNTERS];                       // 'perf_event_attr::type' counted, in the same order
+
+  // ACCESSORS
+  u_int16_t columns() const;
+    // Return the number of columns in each block: 3 plus fixed and programmable counters
+
+  bool counts(u_int16_t counter, const XEON::PerfEvent& event) const;
+    // Return true if specified 'counter', fixed counters first then programmable, counted specified 'event' (type
+    // and config; user/kernel filters aren't recorded), and false otherwise
+};
+
+static_assert(sizeof(TraceHeader)<=TraceHeader::k_HEADER_SIZE, "header must fit before the first block");
+
+class TraceWriter {
+public:
+  // ENUM
+  enum Support {
+    k_DEFAULT_BLOCK_SAMPLES = 4096,     // samples per block unless 'open' is told otherwise
+    k_WINDOW_SIZE           = 16<<20,   // bytes of file mapped at a time unless a block needs more
+    k_MAX_VARINT            = 10,       // most bytes one encoded value takes
+  };
+
+private:
+  // DATA
+  int          d_fd;                    // trace file descriptor or -1 if not open
+  char        *d_map;                   // writable mapping of the file at 'd_mapOffset' or 0
+  u_int64_t    d_mapOffset;             // file offset of 'd_map'; page aligned
+  u_int64_t    d_mapSize;               // bytes mapped
+  u_int64_t    d_fileSize;              // bytes of file allocated
+  u_int64_t    d_offset;                // file offset of the next block
+  u_int32_t    d_count;                 // samples staged in 'd_column'
+  u_int32_t    d_blockSamples;          // capacity of 'd_column' in samples
+  u_int16_t    d_fixedCnt;              // fixed counters recorded
+  u_int16_t    d_progCnt;               // programmable counters recorded
+  u_int64_t   *d_column;                // staged values; column 'c' at 'd_column+c*d_blockSamples'
+  int          d_status;                // 0 or errno of the first block that couldn't be written
+  TraceHeader  d_header;                // header written at 'open' and rewritten by 'close'
+
+  // PRIVATE MANIPULATORS
+  int remap(u_int64_t bytes);
+    // Return 0 if at least specified 'bytes' from 'd_offset' are mapped, and errno otherwise
+
+public:
+  // CREATORS
+  TraceWriter();
+    // Create a writer with no file open
+
+  TraceWriter(const TraceWriter& other) = delete;
+    // Copy constructor not supported
+
+  ~TraceWriter();
+    // Close the trace if open
+
+  // ACCESSORS
+  bool isOpen() const;
+    // Return true if a trace is open
+
+  u_int64_t samples() const;
+    // Return the number of samples appended since 'open' including staged ones
+
+  u_int64_t bytes() const;
+    // Return the size in bytes of the header and blocks written so far, not counting staged samples
+
+  const TraceHeader& header() const;
+    // Return a non-modifiable reference to the header of the open trace
+
+  int status() const;
+    // Return 0 if every block so far was written, and the errno of the first failure otherwise
+
+  // MANIPULATORS
+  int open(const std::string& path, const XEON::PMU& pmu, u_int32_t blockSamples = k_DEFAULT_BLOCK_SAMPLES);
+    // Return 0 if specified 'path' was created or truncated for a trace of snapshots of specified 'pmu' in blocks of
+    // optionally specified 'blockSamples', and errno otherwise with a diagnostic on stderr e.g. 'pmu.status()' if
+    // non-zero, or EINVAL if 'blockSamples' is 0 or above 'TraceHeader::k_MAX_BLOCK_SAMPLES'. Counter names and masks
+    // come from 'pmu', TSC frequency from 'TscClock::instance()'. Any open trace is closed first.
+
+  int append(const XEON::Snapshot& snap);
+    // Return 0 if specified 'snap' was added to the trace and errno otherwise. Copies values only; every
+    // 'blockSamples' calls it also encodes the block into the file. Once that failed 'snap' is dropped and
+    // 'status()' returned. The behavior is defined if 'open' returned 0 and 'snap' was taken from a PMU with the
+    // counters of the one given to 'open'.
+
+  int flush();
+    // Return 0 if staged samples, if any, were encoded into the file as a block and errno otherwise. A failure is
+    // kept in 'status()' and returned by every later call.
+
+  int close();
+    // Return 0 if staged samples were flushed, the file truncated to its used size, and the header totals written,
+    // and errno otherwise e.g. 'status()' if non-zero, leaving the blocks written before the failure readable as an
+    // unclosed trace. No-op returning 0 if not open.
+
+  TraceWriter& operator=(const TraceWriter& rhs) = delete;
+    // Assignment operator not supported
+};
+
+class TraceReader {
+  // DATA
+  const char             *d_base;       // read-only mapping of the trace file or 0
+  size_t                  d_size;       // bytes mapped
+  const TraceHeader      *d_header;     // header at 'd_base'
+  u_int64_t               d_end;        // file offset where blocks end
+  u_int64_t               d_offset;     // file offset of the next block to decode
+  u_int32_t               d_count;      // samples in the decoded block
+  u_int32_t               d_next;       // index in the decoded block of the next sample returned
+  u_int64_t               d_samples;    // samples returned since 'open' or 'rewind'
+  int                     d_status;     // 0 or EINVAL once a corrupt block was met
+  std::vector<u_int64_t>  d_column;     // decoded block; column 'c' at 'c*d_header->d_blockSamples'
+
+  // PRIVATE MANIPULATORS
+  bool load();
+    // Return true if the next block was decoded into 'd_column', and false at the end of the trace or if the block
+    // is corrupt, then setting 'd_status'
+
+public:
+  // CREATORS
+  TraceReader();
+    // Create a reader with no file open
+
+  TraceReader(const TraceReader& other) = delete;
+    // Copy constructor not supported
+
+  ~TraceReader();
+    // Unmap the trace if open
+
+  // ACCESSORS
+  const TraceHeader& header() const;
+    // Return a non-modifiable reference to the header of the open trace. The behavior is defined if 'open'
+    // returned 0.
+
+  bool complete() const;
+    // Return true if the writer closed the trace so the header totals are set, and false otherwise
+
+  u_int64_t samples() const;
+    // Return the number of samples 'next' returned since 'open' or 'rewind'
+
+  int status() const;
+    // Return 0 if the blocks read so far decoded, and EINVAL if 'next' stopped early at a corrupt block
+
+  // MANIPULATORS
+  int open(const std::string& path);
+    // Return 0 if the trace at specified 'path' was mapped and its header validated, and errno otherwise with a
+    // diagnostic on stderr e.g. EINVAL if its block size exceeds 'TraceHeader::k_MAX_BLOCK_SAMPLES'. Any open trace
+    // is closed first.
+
+  bool next(XEON::Snapshot *snap);
+    // Return true after writing into specified 'snap' the next sample of the trace, and false at its end. Counters
+    // not recorded are 0. The behavior is defined if 'open' returned 0.
+
+  void rewind();
+    // Restart 'next' from the first sample
+
+  void close();
+    // Unmap the trace if open
+
+  TraceReader& operator=(const TraceReader& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+u_int16_t TraceHeader::columns() const {
+  return (u_int16_t)(k_COLUMN_FIXED + d_fixedCnt + d_progCnt);
+}
+
+inline
+bool TraceHeader::counts(u_int16_t counter, const XEON::PerfEvent& event) const {
+  return counter<d_fixedCnt+d_progCnt
+      && d_eventType[counter]==event.d_type
+      && d_eventConfig[counter]==event.d_config;
+}
+
+// CREATORS
+inline
+TraceWriter::TraceWriter()
+: d_fd(-1)
+, d_map(0)
+, d_mapOffset(0)
+, d_mapSize(0)
+, d_fileSize(0)
+, d_offset(0)
+, d_count(0)
+, d_blockSamples(0)
+, d_fixedCnt(0)
+, d_progCnt(0)
+, d_column(0)
+, d_status(0)
+{
+  memset(&d_header, 0, sizeof(d_header));
+}
+
+inline
+TraceWriter::~TraceWriter() {
+  close();
+}
+
+// ACCESSORS
+inline
+bool TraceWriter::isOpen() const {
+  return d_fd>=0;
+}
+
+inline
+u_int64_t TraceWriter::samples() const {
+  return d_header.d_samples + d_count;
+}
+
+inline
+u_int64_t TraceWriter::bytes() const {
+  return d_offset;
+}
+
+inline
+const TraceHeader& TraceWriter::header() const {
+  return d_header;
+}
+
+inline
+int TraceWriter::status() const {
+  return d_status;
+}
+
+// MANIPULATORS
+inline
+int TraceWriter::append(const XEON::Snapshot& snap) {
+  // Only a block that failed to flush stays full
+  if (__builtin_expect(d_count==d_blockSamples, 0)) {
+    return d_status;
+  }
+
+  u_int64_t *column = d_column + d_count;
+  column[TraceHeader::k_COLUMN_TSC*d_blockSamples] = snap.d_tsc;
+  column[TraceHeader::k_COLUMN_AUX*d_blockSamples] = snap.d_aux;
+  column[TraceHeader::k_COLUMN_PAUSED*d_blockSamples] = snap.d_paused;
+  column += TraceHeader::k_COLUMN_FIXED*d_blockSamples;
+  for (u_int16_t i=0; i<d_fixedCnt; ++i, column+=d_blockSamples) {
+    *column = snap.d_fixed[i];
+  }
+  for (u_int16_t i=0; i<d_progCnt; ++i, column+=d_blockSamples) {
+    *column = snap.d_prog[i];
+  }
+
+  if (__builtin_expect(++d_count==d_blockSamples, 0)) {
+    return flush();
+  }
+  return 0;
+}
+
+// CREATORS
+inline
+TraceReader::TraceReader()
+: d_base(0)
+, d_size(0)
+, d_header(0)
+, d_end(0)
+, d_offset(0)
+, d_count(0)
+, d_next(0)
+, d_samples(0)
+, d_status(0)
+{
+}
+
+inline
+TraceReader::~TraceReader() {
+  close();
+}
+
+// ACCESSORS
+inline
+const TraceHeader& TraceReader::header() const {
+  assert(d_header);
+  return *d_header;
+}
+
+inline
+bool TraceReader::complete() const {
+  return d_header && d_header->d_bytes!=0;
+}
+
+inline
+u_int64_t TraceReader::samples() const {
+  return d_samples;
+}
+
+inline
+int TraceReader::status() const {
+  return d_status;
+}
+
+// MANIPULATORS
+inline
+bool TraceReader::next(XEON::Snapshot *snap) {
+  assert(snap);
+  if (__builtin_expect(d_next==d_count, 0) && !load()) {
+    return false;
+  }
+
+  const u_int32_t stride = d_header->d_blockSamples;
+  const u_int64_t *column = d_column.data() + d_next;
+  memset(snap, 0, sizeof(*snap));
+  snap->d_tsc = column[TraceHeader::k_COLUMN_TSC*stride];
+  snap->d_aux = (u_int32_t)column[TraceHeader::k_COLUMN_AUX*stride];
+  snap->d_paused = column[TraceHeader::k_COLUMN_PAUSED*stride];
+  column += TraceHeader::k_COLUMN_FIXED*stride;
+  for (u_int16_t i=0; i<d_header->d_fixedCnt; ++i, column+=stride) {
+    snap->d_fixed[i] = *column;
+  }
+  for (u_int16_t i=0; i<d_header->d_progCnt; ++i, column+=stride) {
+    snap->d_prog[i] = *column;
+  }
+
+  ++d_next;
+  ++d_samples;
+  return true;
+}
+
+} // namespace Intel
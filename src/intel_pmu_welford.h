@@ -0,0 +1,127 @@
+#pragma once
+
+// PURPOSE: Streaming mean, variance, and confidence interval of a sequence of values
+//
+// CLASSES:
+//  Intel::Welford: Welford's single pass update of count, mean, and sum of squared differences from the mean. Unlike
+//                  summing values and squares it doesn't lose precision when the variance is small relative to the
+//                  mean, which is the usual case for cycle counts. Two objects merge (Chan et al.) e.g. across threads.
+
+#include <math.h>
+#include <sys/types.h>
+
+namespace Intel {
+
+class Welford {
+  // DATA
+  u_int64_t d_count;                    // number of values added
+  double    d_mean;                     // running mean
+  double    d_m2;                       // running sum of squared differences from the mean
+
+public:
+  // CREATORS
+  Welford();
+    // Create an object reflecting 0 values
+
+  Welford(const Welford& other) = default;
+    // Create a copy of specified 'other'
+
+  ~Welford() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  u_int64_t count() const;
+    // Return the number of values added
+
+  double mean() const;
+    // Return the mean of values added or 0 if none
+
+  double variance() const;
+    // Return the unbiased sample variance of values added or 0 if fewer than 2
+
+  double stddev() const;
+    // Return the square root of 'variance()'
+
+  double halfWidth(double z) const;
+    // Return the half width of the confidence interval of the mean for specified normal quantile 'z' e.g. 1.96 for
+    // 95% i.e. 'z*stddev()/sqrt(count())', or 0 if fewer than 2 values were added
+
+  // MANIPULATORS
+  void add(double value);
+    // Add specified 'value'
+
+  void merge(const Welford& other);
+    // Add all values added to specified 'other'
+
+  void reset();
+    // Reset to 0 values
+
+  Welford& operator=(const Welford& rhs) = default;
+    // Assign specified 'rhs' to this object returning a reference to this object
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+Welford::Welford()
+: d_count(0)
+, d_mean(0.0)
+, d_m2(0.0)
+{
+}
+
+// ACCESSORS
+inline
+u_int64_t Welford::count() const {
+  return d_count;
+}
+
+inline
+double Welford::mean() const {
+  return d_mean;
+}
+
+inline
+double Welford::variance() const {
+  return d_count>1 ? d_m2/(double)(d_count-1) : 0.0;
+}
+
+inline
+double Welford::stddev() const {
+  return sqrt(variance());
+}
+
+inline
+double Welford::halfWidth(double z) const {
+  return d_count>1 ? z*sqrt(variance()/(double)d_count) : 0.0;
+}
+
+// MANIPULATORS
+inline
+void Welford::add(double value) {
+  ++d_count;
+  const double delta = value - d_mean;
+  d_mean += delta/(double)d_count;
+  d_m2 += delta*(value - d_mean);
+}
+
+inline
+void Welford::merge(const Welford& other) {
+  if (other.d_count==0) {
+    return;
+  }
+  const u_int64_t count = d_count + other.d_count;
+  const double delta = other.d_mean - d_mean;
+  d_mean += delta*(double)other.d_count/(double)count;
+  d_m2 += other.d_m2 + delta*delta*(double)d_count*(double)other.d_count/(double)count;
+  d_count = count;
+}
+
+inline
+void Welford::reset() {
+  d_count = 0;
+  d_mean = 0.0;
+  d_m2 = 0.0;
+}
+
+} // namespace Intel
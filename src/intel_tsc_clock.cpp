@@ -0,0 +1,118 @@
+#include <intel_tsc_clock.h>
+
+#include <time.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+void tscClockPair(u_int64_t *tsc, u_int64_t *ns) {
+  // Read CLOCK_MONOTONIC_RAW between two rdtsc several times keeping the read bracketed most tightly; its time is
+  // paired with the midpoint of its brackets
+  u_int64_t best = ~0ull;
+  for (u_int16_t i=0; i<8; ++i) {
+    struct timespec ts;
+    _mm_lfence();
+    const u_int64_t before = __rdtsc();
+    _mm_lfence();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    _mm_lfence();
+    const u_int64_t after = __rdtsc();
+    _mm_lfence();
+    if (after-before<best) {
+      best = after-before;
+      *tsc = before + best/2;
+      *ns = (u_int64_t)ts.tv_sec*1000000000ull + (u_int64_t)ts.tv_nsec;
+    }
+  }
+}
+
+} // namespace
+
+const Intel::TscClock& Intel::TscClock::instance() {
+  static const TscClock clock;
+  return clock;
+}
+
+u_int64_t Intel::TscClock::cpuidFrequency(XEON::Capability::CpuidFunction cpuid, Source *source) {
+  assert(cpuid);
+  assert(source);
+
+  u_int32_t eax, ebx, ecx, edx;
+
+  // CPUID leaf 0x15: EAX denominator and EBX numerator of the TSC/crystal ratio, ECX crystal Hz or 0 if not
+  // enumerated. See SDM vol 3 section 18.7.3.
+  cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+  if (eax!=0 && ebx!=0 && ecx!=0) {
+    *source = k_CPUID_CRYSTAL;
+    return (u_int64_t)ecx * ebx / eax;
+  }
+
+  // CPUID leaf 0x16: EAX[15:0] base frequency in MHz, which is the TSC frequency when the crystal isn't enumerated
+  cpuid(0x16, 0, &eax, &ebx, &ecx, &edx);
+  if ((eax & 0xffff)!=0) {
+    *source = k_CPUID_BASE;
+    return (u_int64_t)(eax & 0xffff) * 1000000ull;
+  }
+
+  return 0;
+}
+
+bool Intel::TscClock::invariant(XEON::Capability::CpuidFunction cpuid) {
+  assert(cpuid);
+
+  u_int32_t eax, ebx, ecx, edx;
+  cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+  return (edx & (1u<<8))!=0;
+}
+
+u_int64_t Intel::TscClock::calibrate(u_int32_t windowUs, u_int32_t rounds) {
+  assert(windowUs>0);
+  assert(rounds>0);
+
+  std::vector<double> hz;
+  hz.reserve(rounds);
+
+  for (u_int32_t r=0; r<rounds; ++r) {
+    u_int64_t tsc0 = 0, ns0 = 0, tsc1 = 0, ns1 = 0;
+    tscClockPair(&tsc0, &ns0);
+
+    // Spin rather than sleep so the cpu stays awake and the window ends on time
+    const u_int64_t until = ns0 + (u_int64_t)windowUs*1000ull;
+    do {
+      tscClockPair(&tsc1, &ns1);
+    } while (ns1<until);
+
+    hz.push_back((double)(tsc1-tsc0) * 1e9 / (double)(ns1-ns0));
+  }
+
+  std::nth_element(hz.begin(), hz.begin()+hz.size()/2, hz.end());
+  return (u_int64_t)(hz[hz.size()/2] + 0.5);
+}
+
+Intel::TscClock::TscClock(XEON::Capability::CpuidFunction cpuid)
+: TscClock(1, k_CALIBRATED, false)
+{
+  Source source = k_CALIBRATED;
+  u_int64_t hz = cpuidFrequency(cpuid, &source);
+  if (hz==0) {
+    hz = calibrate();
+  }
+  *this = TscClock(hz, source, invariant(cpuid));
+}
+
+std::ostream& Intel::TscClock::print(std::ostream& stream) const {
+  static const char *k_SOURCE[] = {
+    "CPUID leaf 0x15 crystal clock",
+    "CPUID leaf 0x16 base frequency",
+    "calibration against CLOCK_MONOTONIC_RAW",
+  };
+
+  char buf[256];
+  snprintf(buf, sizeof(buf), "TSC frequency: %lu Hz (%.6lf ns/cycle) from %s; invariant TSC: %s\n",
+    d_hz, nanoseconds(1.0), k_SOURCE[d_source], d_invariant ? "yes" : "no");
+  return stream << buf;
+}
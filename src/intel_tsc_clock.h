@@ -0,0 +1,149 @@
+#pragma once
+
+// PURPOSE: Convert rdtsc cycles to nanoseconds with the exact TSC frequency
+//
+// CLASSES:
+//  Intel::TscClock: TSC frequency from CPUID leaf 0x15 (crystal clock times the TSC/crystal ratio) when the crystal is
+//                   enumerated, else from leaf 0x16 (base frequency, which the TSC runs at), else calibrated against
+//                   CLOCK_MONOTONIC_RAW in a few milliseconds. Whether the TSC is invariant (constant rate in every
+//                   P/C-state; CPUID 0x80000007:EDX bit 8) is reported too since without it cycles don't convert to
+//                   time. 'instance()' does this once per process. Conversion is one 64x64->128 bit multiply and
+//                   shift by a fixed-point rate with no branches or divisions so it's cheap enough for hot paths.
+
+#include <intel_xeon_capability.h>
+
+#include <assert.h>
+#include <sys/types.h>
+
+#include <iosfwd>
+
+namespace Intel {
+
+class TscClock {
+public:
+  // ENUM
+  enum Source {
+    k_CPUID_CRYSTAL = 0,                // CPUID 0x15: crystal Hz * EBX/EAX; exact
+    k_CPUID_BASE    = 1,                // CPUID 0x16: base frequency in MHz; exact to 1MHz
+    k_CALIBRATED    = 2,                // measured against CLOCK_MONOTONIC_RAW
+  };
+
+  enum Support {
+    k_SHIFT = 32,                       // fraction bits of the fixed-point ns per cycle rate
+  };
+
+private:
+  // DATA
+  u_int64_t d_hz;                       // TSC frequency in Hz
+  u_int64_t d_mult;                     // ns per cycle times 2^k_SHIFT, rounded
+  Source    d_source;                   // where 'd_hz' came from
+  bool      d_invariant;                // true if CPUID reports an invariant TSC
+
+public:
+  // CLASS METHODS
+  static const TscClock& instance();
+    // Return the clock of the host, built by the first call from CPUID or, failing that, calibrated. Thread safe.
+
+  static u_int64_t cpuidFrequency(XEON::Capability::CpuidFunction cpuid, Source *source);
+    // Return the TSC frequency in Hz reported by specified 'cpuid' setting specified 'source' to the leaf used, or 0
+    // if neither leaf 0x15 nor 0x16 enumerates it e.g. in most VMs
+
+  static bool invariant(XEON::Capability::CpuidFunction cpuid);
+    // Return true if specified 'cpuid' reports an invariant TSC, and false otherwise
+
+  static u_int64_t calibrate(u_int32_t windowUs = 2000, u_int32_t rounds = 5);
+    // Return the TSC frequency in Hz measured against CLOCK_MONOTONIC_RAW: the median of optionally specified 'rounds'
+    // spins of optionally specified 'windowUs' microseconds each. Each end of a window reads the clock several times
+    // between two rdtsc and keeps the tightest pair, so preemption or a slow clock read doesn't skew the result. The
+    // behavior is defined if 'windowUs>0' and 'rounds>0'.
+
+  // CREATORS
+  explicit TscClock(XEON::Capability::CpuidFunction cpuid = &XEON::Capability::hostCpuid);
+    // Create a clock at the TSC frequency reported by specified 'cpuid', or calibrated on the calling cpu if not
+    // reported
+
+  TscClock(u_int64_t hz, Source source, bool invariant);
+    // Create a clock at specified 'hz' from specified 'source' with specified 'invariant' state. The behavior is
+    // defined if 'hz>0'.
+
+  TscClock(const TscClock& other) = default;
+    // Create a copy of specified 'other'
+
+  ~TscClock() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  u_int64_t hz() const;
+    // Return the TSC frequency in Hz
+
+  Source source() const;
+    // Return where the frequency came from
+
+  bool invariant() const;
+    // Return true if the TSC ticks at a constant rate regardless of P/C-state, and false otherwise in which case
+    // conversions are only approximations
+
+  u_int64_t toNanoseconds(u_int64_t cycles) const;
+    // Return specified 'cycles' in nanoseconds, rounded down. Exact to the fixed-point rate's 2^-32 ns per cycle.
+
+  double nanoseconds(double cycles) const;
+    // Return specified 'cycles' e.g. an average in nanoseconds
+
+  TscClock& operator=(const TscClock& rhs) = default;
+    // Assign specified 'rhs' to this object returning a reference to this object
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the frequency, its source, and TSC invariance
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const TscClock& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+TscClock::TscClock(u_int64_t hz, Source source, bool invariant)
+: d_hz(hz)
+, d_mult(0)
+, d_source(source)
+, d_invariant(invariant)
+{
+  assert(hz>0);
+  d_mult = (u_int64_t)((((unsigned __int128)1000000000ull<<k_SHIFT) + hz/2) / hz);
+}
+
+// ACCESSORS
+inline
+u_int64_t TscClock::hz() const {
+  return d_hz;
+}
+
+inline
+TscClock::Source TscClock::source() const {
+  return d_source;
+}
+
+inline
+bool TscClock::invariant() const {
+  return d_invariant;
+}
+
+inline
+u_int64_t TscClock::toNanoseconds(u_int64_t cycles) const {
+  return (u_int64_t)(((unsigned __int128)cycles * d_mult) >> k_SHIFT);
+}
+
+inline
+double TscClock::nanoseconds(double cycles) const {
+  return cycles * (double)d_mult / (double)(1ull<<k_SHIFT);
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const TscClock& object) {
+  return object.print(stream);
+}
+
+} // namespace Intel
@@ -0,0 +1,40 @@
+#include <intel_xeon_capability.h>
+
+#include <stdio.h>
+
+#include <iostream>
+
+std::ostream& Intel::XEON::Capability::print(std::ostream& stream) const {
+  static const char *const k_ARCH_EVENT_NAME[k_ARCH_EVENTS] = {
+    "core cycles",
+    "instructions retired",
+    "reference cycles",
+    "LLC references",
+    "LLC misses",
+    "branch instructions retired",
+    "branch mispredicts retired",
+    "top-down slots",
+  };
+
+  char buf[256];
+  snprintf(buf, sizeof(buf), "PMU version                  : %u%s\n", d_version, known() ? "" : " (not reported)");
+  stream << buf;
+  snprintf(buf, sizeof(buf), "programmable counters        : %u x %u bits\n", d_progCounters, d_progWidth);
+  stream << buf;
+  snprintf(buf, sizeof(buf), "fixed counters               : %u x %u bits\n", d_fixedCounters, d_fixedWidth);
+  stream << buf;
+  snprintf(buf, sizeof(buf), "threads per core             : %u (hyper threading %s)\n", d_threadsPerCore,
+    hyperThreading() ? "ON" : "OFF");
+  stream << buf;
+  snprintf(buf, sizeof(buf), "programmable counter budget  : %u\n", programmableBudget());
+  stream << buf;
+
+  for (u_int16_t i=0; i<k_ARCH_EVENTS; ++i) {
+    const ArchEvent event = static_cast<ArchEvent>(i);
+    snprintf(buf, sizeof(buf), "architectural event 0x%04x   : %-28s %s\n", archEventSelect(event),
+      k_ARCH_EVENT_NAME[i], supports(event) ? "available" : "unavailable");
+    stream << buf;
+  }
+
+  return stream;
+}
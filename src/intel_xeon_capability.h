@@ -0,0 +1,250 @@
+#pragma once
+
+// PURPOSE: Discover what the host PMU supports from CPUID
+//
+// CLASSES:
+//  Intel::XEON::Capability: PMU version, fixed and programmable counter counts and widths, which architectural events
+//                           are available (CPUID leaf 0xA), and hyper threading state (CPUID topology leaf 0xB). The
+//                           CPUID instruction is reached through a function pointer so callers can inject register
+//                           values e.g. to check 'PMU' behavior for hosts they don't have.
+
+#include <assert.h>
+#include <cpuid.h>
+
+#include <sys/types.h>
+
+#include <iosfwd>
+
+namespace Intel {
+namespace XEON {
+
+class Capability {
+public:
+  // TYPES
+  typedef void (*CpuidFunction)(u_int32_t leaf, u_int32_t subleaf, u_int32_t *eax, u_int32_t *ebx, u_int32_t *ecx,
+                                u_int32_t *edx);
+    // Run CPUID for specified 'leaf' and 'subleaf' writing the result registers. Leaves above the host maximum must
+    // return all zeros.
+
+  // ENUM
+  enum ArchEvent {
+    // Architectural events by CPUID.0AH:EBX bit. A set bit means NOT available. See SDM vol 3 table 20-1.
+    k_CORE_CYCLES          = 0,         // event 0x3C umask 0x00
+    k_INSTRUCTIONS_RETIRED = 1,         // event 0xC0 umask 0x00
+    k_REFERENCE_CYCLES     = 2,         // event 0x3C umask 0x01
+    k_LLC_REFERENCE        = 3,         // event 0x2E umask 0x4F
+    k_LLC_MISS             = 4,         // event 0x2E umask 0x41
+    k_BRANCHES_RETIRED     = 5,         // event 0xC4 umask 0x00
+    k_BRANCH_MISSES        = 6,         // event 0xC5 umask 0x00
+    k_TOPDOWN_SLOTS        = 7,         // event 0xA4 umask 0x01
+    k_ARCH_EVENTS          = 8,         // number of architectural events known here
+  };
+
+private:
+  // DATA
+  u_int16_t d_version;                  // architectural PMU version ID or 0 if none/unknown
+  u_int16_t d_progCounters;             // programmable counters per logical processor
+  u_int16_t d_progWidth;                // programmable counter bit width
+  u_int16_t d_fixedCounters;            // fixed function counters
+  u_int16_t d_fixedWidth;               // fixed counter bit width
+  u_int16_t d_eventsLength;             // number of valid bits in 'd_eventsUnavailable'
+  u_int32_t d_eventsUnavailable;        // CPUID.0AH:EBX; bit 'i' set if architectural event 'i' is unavailable
+  u_int16_t d_threadsPerCore;           // logical processors per core; 2 with hyper threading ON
+
+public:
+  // CLASS METHODS
+  static void hostCpuid(u_int32_t leaf, u_int32_t subleaf, u_int32_t *eax, u_int32_t *ebx, u_int32_t *ecx,
+                        u_int32_t *edx);
+    // Run the CPUID instruction on the calling cpu. Leaves above the host maximum, basic or extended (0x8000000x),
+    // return all zeros.
+
+  static const Capability& host();
+    // Return the capabilities of the host probed by 'hostCpuid' on first use. CPUID runs once per process; hybrid
+    // hosts whose cores differ aren't distinguished.
+
+  static u_int16_t archEventSelect(ArchEvent event);
+    // Return the 16 low bits (event code and umask) of the IA32_PERFEVTSEL value counting specified 'event'. The
+    // behavior is defined if 'event<k_ARCH_EVENTS'.
+
+  // CREATORS
+  explicit Capability(CpuidFunction cpuid = &hostCpuid);
+    // Create an object describing the PMU reported by specified 'cpuid'
+
+  Capability(const Capability& other) = default;
+    // Create a copy of specified 'other'
+
+  ~Capability() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  bool known() const;
+    // Return true if CPUID reports an architectural PMU, and false otherwise e.g. in a VM hiding the PMU. All
+    // counts below are 0 when false.
+
+  u_int16_t version() const;
+    // Return the architectural PMU version ID
+
+  u_int16_t programmableCounters() const;
+    // Return the number of programmable counters CPUID reports per logical processor
+
+  u_int16_t programmableWidth() const;
+    // Return the bit width of programmable counters
+
+  u_int16_t fixedCounters() const;
+    // Return the number of fixed function counters. Reported for version 2 and later, otherwise 0
+
+  u_int16_t fixedWidth() const;
+    // Return the bit width of fixed counters. Reported for version 2 and later, otherwise 0
+
+  bool supports(ArchEvent event) const;
+    // Return true if specified architectural 'event' is available and false otherwise
+
+  u_int16_t threadsPerCore() const;
+    // Return the number of logical processors per core e.g. 2 with hyper threading ON, or 1 if not reported
+
+  bool hyperThreading() const;
+    // Return true if hyper threading is ON i.e. 'threadsPerCore()>1'
+
+  u_int16_t programmableBudget() const;
+    // Return the number of programmable counters one thread can safely use: 'programmableCounters()' capped at
+    // 'k_MAX_PROG_COUNTERS_HT_ON' (4) when hyper threading is ON since siblings share a core's counters, and at 8.
+
+  Capability& operator=(const Capability& rhs) = default;
+    // Assign specified 'rhs' to this object returning a reference to this object
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the capabilities
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Capability& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+inline
+void Capability::hostCpuid(u_int32_t leaf, u_int32_t subleaf, u_int32_t *eax, u_int32_t *ebx, u_int32_t *ecx,
+                           u_int32_t *edx) {
+  assert(eax && ebx && ecx && edx);
+  *eax = *ebx = *ecx = *edx = 0;
+  if (__get_cpuid_max(leaf & 0x80000000, 0)<leaf) {
+    return;
+  }
+  __cpuid_count(leaf, subleaf, *eax, *ebx, *ecx, *edx);
+}
+
+inline
+const Capability& Capability::host() {
+  static const Capability k_HOST;
+  return k_HOST;
+}
+
+inline
+u_int16_t Capability::archEventSelect(ArchEvent event) {
+  assert(event<k_ARCH_EVENTS);
+  static const u_int16_t k_SELECT[k_ARCH_EVENTS] = {
+    0x003c, 0x00c0, 0x013c, 0x4f2e, 0x412e, 0x00c4, 0x00c5, 0x01a4,
+  };
+  return k_SELECT[event];
+}
+
+// CREATORS
+inline
+Capability::Capability(CpuidFunction cpuid)
+: d_version(0)
+, d_progCounters(0)
+, d_progWidth(0)
+, d_fixedCounters(0)
+, d_fixedWidth(0)
+, d_eventsLength(0)
+, d_eventsUnavailable(0)
+, d_threadsPerCore(1)
+{
+  assert(cpuid);
+
+  u_int32_t eax, ebx, ecx, edx;
+
+  // CPUID leaf 0xA: EAX[7:0] version, EAX[15:8] programmable counters, EAX[23:16] programmable width, EAX[31:24]
+  // length of EBX event vector; EDX[4:0] fixed counters, EDX[12:5] fixed width (version 2 and later)
+  cpuid(0xa, 0, &eax, &ebx, &ecx, &edx);
+  d_version = (u_int16_t)(eax & 0xff);
+  if (d_version>0) {
+    d_progCounters = (u_int16_t)((eax>>8) & 0xff);
+    d_progWidth = (u_int16_t)((eax>>16) & 0xff);
+    d_eventsLength = (u_int16_t)((eax>>24) & 0xff);
+    d_eventsUnavailable = ebx;
+  }
+  if (d_version>1) {
+    d_fixedCounters = (u_int16_t)(edx & 0x1f);
+    d_fixedWidth = (u_int16_t)((edx>>5) & 0xff);
+  }
+
+  // CPUID leaf 0xB subleaf 0: ECX[15:8] level type (1 is SMT), EBX[15:0] logical processors at this level
+  cpuid(0xb, 0, &eax, &ebx, &ecx, &edx);
+  if (((ecx>>8) & 0xff)==1 && (ebx & 0xffff)>0) {
+    d_threadsPerCore = (u_int16_t)(ebx & 0xffff);
+  }
+}
+
+// ACCESSORS
+inline
+bool Capability::known() const {
+  return d_version>0;
+}
+
+inline
+u_int16_t Capability::version() const {
+  return d_version;
+}
+
+inline
+u_int16_t Capability::programmableCounters() const {
+  return d_progCounters;
+}
+
+inline
+u_int16_t Capability::programmableWidth() const {
+  return d_progWidth;
+}
+
+inline
+u_int16_t Capability::fixedCounters() const {
+  return d_fixedCounters;
+}
+
+inline
+u_int16_t Capability::fixedWidth() const {
+  return d_fixedWidth;
+}
+
+inline
+bool Capability::supports(ArchEvent event) const {
+  assert(event<k_ARCH_EVENTS);
+  return event<d_eventsLength && (d_eventsUnavailable & (1u<<event))==0;
+}
+
+inline
+u_int16_t Capability::threadsPerCore() const {
+  return d_threadsPerCore;
+}
+
+inline
+bool Capability::hyperThreading() const {
+  return d_threadsPerCore>1;
+}
+
+inline
+u_int16_t Capability::programmableBudget() const {
+  const u_int16_t limit = hyperThreading() ? 4 : 8;
+  return d_progCounters<limit ? d_progCounters : limit;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Capability& object) {
+  return object.print(stream);
+}
+
+} // namespace XEON
+} // namespace Intel
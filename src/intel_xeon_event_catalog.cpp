@@ -0,0 +1,627 @@
+#include <intel_xeon_event_catalog.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace {
+
+// Minimal JSON document model: just enough to walk perfmon event files
+struct Json {
+  enum Type {
+    k_NULL   = 0,
+    k_BOOL   = 1,
+    k_NUMBER = 2,
+    k_STRING = 3,
+    k_ARRAY  = 4,
+    k_OBJECT = 5,
+  };
+
+  Type                                     d_type;      // type of this value
+  std::string                              d_text;      // string contents, or number/bool literal text
+  std::vector<Json>                        d_array;     // elements if 'k_ARRAY'
+  std::vector<std::pair<std::string, Json>> d_object;   // members in file order if 'k_OBJECT'
+
+  Json() : d_type(k_NULL) {}
+
+  const Json *get(const char *key) const {
+    for (const auto& member: d_object) {
+      if (member.first==key) {
+        return &member.second;
+      }
+    }
+    return 0;
+  }
+};
+
+class JsonParser {
+  const char *d_begin;                  // start of document
+  const char *d_p;                      // parse position
+  const char *d_end;                    // one past end of document
+
+  int error(const char *what) {
+    fprintf(stderr, "Error: JSON parse error at byte %ld: %s\n", (long)(d_p-d_begin), what);
+    return EINVAL;
+  }
+
+  void skipSpace() {
+    while (d_p<d_end && (*d_p==' ' || *d_p=='\t' || *d_p=='\n' || *d_p=='\r')) {
+      ++d_p;
+    }
+  }
+
+  int parseString(std::string *out) {
+    assert(*d_p=='"');
+    ++d_p;
+    out->clear();
+    while (d_p<d_end && *d_p!='"') {
+      if (*d_p!='\\') {
+        out->push_back(*d_p++);
+        continue;
+      }
+      if (++d_p>=d_end) {
+        break;
+      }
+      switch (*d_p++) {
+        case 'b': out->push_back('\b'); break;
+        case 'f': out->push_back('\f'); break;
+        case 'n': out->push_back('\n'); break;
+        case 'r': out->push_back('\r'); break;
+        case 't': out->push_back('\t'); break;
+        case 'u': {
+          if (d_end-d_p<4) {
+            return error("short \\u escape");
+          }
+          char hex[5] = { d_p[0], d_p[1], d_p[2], d_p[3], 0 };
+          unsigned code = (unsigned)strtoul(hex, 0, 16);
+          d_p += 4;
+          // Descriptions are ASCII in practice; keep anything else as '?'
+          out->push_back(code<0x80 ? (char)code : '?');
+          break;
+        }
+        default: out->push_back(d_p[-1]); break;
+      }
+    }
+    if (d_p>=d_end) {
+      return error("unterminated string");
+    }
+    ++d_p;
+    return 0;
+  }
+
+  int parseValue(Json *value) {
+    int rc;
+    skipSpace();
+    if (d_p>=d_end) {
+      return error("unexpected end of document");
+    }
+
+    if (*d_p=='{') {
+      value->d_type = Json::k_OBJECT;
+      ++d_p;
+      skipSpace();
+      if (d_p<d_end && *d_p=='}') {
+        ++d_p;
+        return 0;
+      }
+      while (true) {
+        skipSpace();
+        if (d_p>=d_end || *d_p!='"') {
+          return error("expected member name");
+        }
+        value->d_object.emplace_back();
+        if ((rc = parseString(&value->d_object.back().first))!=0) {
+          return rc;
+        }
+        skipSpace();
+        if (d_p>=d_end || *d_p!=':') {
+          return error("expected ':'");
+        }
+        ++d_p;
+        if ((rc = parseValue(&value->d_object.back().second))!=0) {
+          return rc;
+        }
+        skipSpace();
+        if (d_p<d_end && *d_p==',') {
+          ++d_p;
+          continue;
+        }
+        if (d_p<d_end && *d_p=='}') {
+          ++d_p;
+          return 0;
+        }
+        return error("expected ',' or '}'");
+      }
+    }
+
+    if (*d_p=='[') {
+      value->d_type = Json::k_ARRAY;
+      ++d_p;
+      skipSpace();
+      if (d_p<d_end && *d_p==']') {
+        ++d_p;
+        return 0;
+      }
+      while (true) {
+        value->d_array.emplace_back();
+        if ((rc = parseValue(&value->d_array.back()))!=0) {
+          return rc;
+        }
+        skipSpace();
+        if (d_p<d_end && *d_p==',') {
+          ++d_p;
+          continue;
+        }
+        if (d_p<d_end && *d_p==']') {
+          ++d_p;
+          return 0;
+        }
+        return error("expected ',' or ']'");
+      }
+    }
+
+    if (*d_p=='"') {
+      value->d_type = Json::k_STRING;
+      return parseString(&value->d_text);
+    }
+
+    // number, true, false, null
+    const char *start = d_p;
+    while (d_p<d_end && (isalnum(*d_p) || *d_p=='-' || *d_p=='+' || *d_p=='.')) {
+      ++d_p;
+    }
+    if (start==d_p) {
+      return error("unexpected character");
+    }
+    value->d_text.assign(start, d_p-start);
+    if (value->d_text=="null") {
+      value->d_type = Json::k_NULL;
+    } else if (value->d_text=="true" || value->d_text=="false") {
+      value->d_type = Json::k_BOOL;
+    } else {
+      value->d_type = Json::k_NUMBER;
+    }
+    return 0;
+  }
+
+public:
+  JsonParser(const char *begin, const char *end)
+  : d_begin(begin)
+  , d_p(begin)
+  , d_end(end)
+  {
+  }
+
+  int parse(Json *document) {
+    int rc;
+    if ((rc = parseValue(document))!=0) {
+      return rc;
+    }
+    skipSpace();
+    return d_p==d_end ? 0 : error("trailing characters");
+  }
+};
+
+u_int64_t mix(u_int64_t x) {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+u_int32_t bucketOf(u_int64_t hash, u_int32_t buckets) {
+  return (u_int32_t)(mix(hash) % buckets);
+}
+
+u_int32_t slotOf(u_int64_t hash, u_int32_t displacement, u_int32_t slots) {
+  return (u_int32_t)(mix(hash ^ ((u_int64_t)(displacement+1) * 0x9e3779b97f4a7c15ull)) % slots);
+}
+
+u_int64_t toInteger(const Json *value) {
+  // perfmon stores most numbers as strings e.g. "0x2E", "0", or "0xB7,0xBB" (first code wins)
+  if (value==0 || value->d_text.empty()) {
+    return 0;
+  }
+  return strtoull(value->d_text.c_str(), 0, 0);
+}
+
+const char *toString(const Json *value) {
+  return (value && value->d_type==Json::k_STRING) ? value->d_text.c_str() : "";
+}
+
+struct Event {
+  std::string                    d_name;          // perfmon event name
+  std::string                    d_description;   // perfmon brief description
+  Intel::XEON::EventCatalog::Entry d_entry;       // encoded entry less string offsets
+};
+
+void toEvent(const Json& json, Event *event) {
+  memset(&event->d_entry, 0, sizeof(event->d_entry));
+  event->d_name = toString(json.get("EventName"));
+  event->d_description = toString(json.get("BriefDescription"));
+
+  u_int64_t value = toInteger(json.get("EventCode")) & 0xff;
+  value |= (toInteger(json.get("UMask")) & 0xff) << 8;
+  value |= 1ull << 16;                                        // usr
+  value |= (toInteger(json.get("EdgeDetect")) ? 1ull : 0) << 18;
+  value |= (toInteger(json.get("AnyThread")) ? 1ull : 0) << 21;
+  value |= 1ull << 22;                                        // enable
+  value |= (toInteger(json.get("Invert")) ? 1ull : 0) << 23;
+  value |= (toInteger(json.get("CounterMask")) & 0xff) << 24;
+  value |= (toInteger(json.get("UMaskExt")) & 0xff) << 40;
+  event->d_entry.d_eventSelect = value;
+
+  const char *counter = toString(json.get("Counter"));
+  if (strncasecmp(counter, "Fixed", 5)==0) {
+    event->d_entry.d_flags |= Intel::XEON::EventCatalog::k_FIXED;
+  } else {
+    // e.g. "0,1,2,3"
+    for (const char *p=counter; *p; ) {
+      char *next;
+      unsigned long c = strtoul(p, &next, 10);
+      if (next==p) {
+        ++p;
+        continue;
+      }
+      if (c<32) {
+        event->d_entry.d_counters |= (1u<<c);
+      }
+      p = next;
+    }
+  }
+
+  if (toInteger(json.get("MSRIndex"))!=0) {
+    event->d_entry.d_flags |= Intel::XEON::EventCatalog::k_NEEDS_MSR;
+  }
+  if (toInteger(json.get("Deprecated"))!=0) {
+    event->d_entry.d_flags |= Intel::XEON::EventCatalog::k_DEPRECATED;
+  }
+}
+
+int readFile(const std::string& path, std::string *contents) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file==0) {
+    fprintf(stderr, "Error: cannot open '%s': %s\n", path.c_str(), strerror(errno));
+    return errno;
+  }
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file))>0) {
+    contents->append(buf, n);
+  }
+  int rc = ferror(file) ? EIO : 0;
+  fclose(file);
+  if (rc) {
+    fprintf(stderr, "Error: cannot read '%s'\n", path.c_str());
+  }
+  return rc;
+}
+
+int buildHash(const std::vector<u_int64_t>& hash, u_int32_t buckets, u_int32_t slots,
+              std::vector<u_int32_t> *displacement, std::vector<u_int32_t> *slot) {
+  // Hash and displace: place the biggest buckets first, searching per bucket for a displacement putting all its
+  // keys in distinct free slots.
+  const u_int32_t k_MAX_DISPLACEMENT = 1u<<20;
+
+  std::vector<std::vector<u_int32_t>> bucket(buckets);
+  for (u_int32_t i=0; i<hash.size(); ++i) {
+    bucket[bucketOf(hash[i], buckets)].push_back(i);
+  }
+
+  std::vector<u_int32_t> order(buckets);
+  for (u_int32_t i=0; i<buckets; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](u_int32_t a, u_int32_t b) {
+    return bucket[a].size()>bucket[b].size();
+  });
+
+  displacement->assign(buckets, 0);
+  slot->assign(slots, ~0u);
+
+  std::vector<u_int32_t> candidate;
+  for (u_int32_t b: order) {
+    if (bucket[b].empty()) {
+      break;
+    }
+    u_int32_t d = 0;
+    for (; d<k_MAX_DISPLACEMENT; ++d) {
+      candidate.clear();
+      bool ok = true;
+      for (u_int32_t key: bucket[b]) {
+        u_int32_t s = slotOf(hash[key], d, slots);
+        if ((*slot)[s]!=~0u || std::find(candidate.begin(), candidate.end(), s)!=candidate.end()) {
+          ok = false;
+          break;
+        }
+        candidate.push_back(s);
+      }
+      if (ok) {
+        break;
+      }
+    }
+    if (d==k_MAX_DISPLACEMENT) {
+      return EAGAIN;
+    }
+    (*displacement)[b] = d;
+    for (u_int32_t i=0; i<bucket[b].size(); ++i) {
+      (*slot)[candidate[i]] = bucket[b][i];
+    }
+  }
+
+  return 0;
+}
+
+bool augment(u_int16_t event, u_int16_t count, const u_int32_t *counters, bool *seen, int *owner) {
+  // Kuhn's augmenting path: give 'event' a free counter, or one whose owner can move to another
+  const u_int32_t mask = counters[event] ? counters[event] : ~0u;
+  for (u_int16_t c=0; c<count; ++c) {
+    if ((mask & (1u<<c))==0 || seen[c]) {
+      continue;
+    }
+    seen[c] = true;
+    if (owner[c]<0 || augment((u_int16_t)owner[c], count, counters, seen, owner)) {
+      owner[c] = event;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // anonymous namespace
+
+int Intel::XEON::EventCatalog::place(u_int16_t count, const u_int32_t *counters, u_int16_t *counter) {
+  assert(count<=32);
+  int owner[32];
+  bool seen[32];
+  std::fill(owner, owner+count, -1);
+
+  // Events keep their own counter first; only those that can't are matched, moving others as needed
+  for (u_int16_t e=0; e<count; ++e) {
+    if (counters[e]==0 || (counters[e] & (1u<<e))) {
+      owner[e] = e;
+    }
+  }
+  for (u_int16_t e=0; e<count; ++e) {
+    if (counters[e]==0 || (counters[e] & (1u<<e))) {
+      continue;
+    }
+    std::fill(seen, seen+count, false);
+    if (!augment(e, count, counters, seen, owner)) {
+      return EINVAL;
+    }
+  }
+
+  for (u_int16_t c=0; c<count; ++c) {
+    counter[owner[c]] = c;
+  }
+  return 0;
+}
+
+int Intel::XEON::EventCatalog::compile(const std::vector<std::string>& jsonFile, const std::string& output) {
+  int rc;
+  std::vector<Event> event;
+  std::map<std::string, u_int32_t> seen;
+
+  for (const auto& path: jsonFile) {
+    std::string contents;
+    if ((rc = readFile(path, &contents))!=0) {
+      return rc;
+    }
+
+    Json document;
+    JsonParser parser(contents.data(), contents.data()+contents.size());
+    if ((rc = parser.parse(&document))!=0) {
+      fprintf(stderr, "Error: '%s' is not valid JSON\n", path.c_str());
+      return rc;
+    }
+
+    const Json *list = document.d_type==Json::k_ARRAY ? &document : document.get("Events");
+    if (list==0 || list->d_type!=Json::k_ARRAY) {
+      fprintf(stderr, "Error: '%s' has no perfmon event array\n", path.c_str());
+      return EINVAL;
+    }
+
+    for (const auto& item: list->d_array) {
+      if (item.d_type!=Json::k_OBJECT || item.get("EventName")==0) {
+        continue;
+      }
+      Event e;
+      toEvent(item, &e);
+      if (e.d_name.empty() || seen.count(e.d_name)) {
+        continue;
+      }
+      seen[e.d_name] = (u_int32_t)event.size();
+      event.push_back(e);
+    }
+  }
+
+  if (event.empty()) {
+    fprintf(stderr, "Error: no events found\n");
+    return EINVAL;
+  }
+
+  // String pool: offset 0 is the empty string
+  std::string pool(1, '\0');
+  for (auto& e: event) {
+    e.d_entry.d_name = (u_int32_t)pool.size();
+    pool.append(e.d_name).push_back('\0');
+    e.d_entry.d_description = (u_int32_t)pool.size();
+    pool.append(e.d_description).push_back('\0');
+  }
+
+  std::vector<u_int64_t> hash;
+  for (const auto& e: event) {
+    hash.push_back(EventCatalog::hash(e.d_name.c_str()));
+  }
+
+  const u_int32_t count = (u_int32_t)event.size();
+  u_int32_t buckets = (count+3)/4;
+  u_int32_t slots = count;
+  std::vector<u_int32_t> displacement, slot;
+  while ((rc = buildHash(hash, buckets, slots, &displacement, &slot))!=0) {
+    // Practically never: trade a few empty slots for success
+    slots += slots/16+1;
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  strcpy(header.d_magic, "PMCEVT1");
+  header.d_count = count;
+  header.d_buckets = buckets;
+  header.d_slots = slots;
+  header.d_displacementOffset = sizeof(Header);
+  header.d_slotOffset = header.d_displacementOffset + sizeof(u_int32_t)*buckets;
+  header.d_entryOffset = header.d_slotOffset + sizeof(u_int32_t)*slots;
+  header.d_entryOffset = (header.d_entryOffset+7) & ~7ull;
+  header.d_stringOffset = header.d_entryOffset + sizeof(Entry)*count;
+  header.d_stringSize = pool.size();
+
+  FILE *file = fopen(output.c_str(), "wb");
+  if (file==0) {
+    fprintf(stderr, "Error: cannot open '%s': %s\n", output.c_str(), strerror(errno));
+    return errno;
+  }
+
+  const char pad[8] = {0};
+  bool ok = fwrite(&header, sizeof(header), 1, file)==1
+         && fwrite(displacement.data(), sizeof(u_int32_t), buckets, file)==buckets
+         && fwrite(slot.data(), sizeof(u_int32_t), slots, file)==slots;
+  const size_t padding = header.d_entryOffset - (header.d_slotOffset + sizeof(u_int32_t)*slots);
+  ok = ok && fwrite(pad, 1, padding, file)==padding;
+  for (u_int32_t i=0; ok && i<count; ++i) {
+    ok = fwrite(&event[i].d_entry, sizeof(Entry), 1, file)==1;
+  }
+  ok = ok && fwrite(pool.data(), 1, pool.size(), file)==pool.size();
+
+  if (fclose(file)!=0 || !ok) {
+    fprintf(stderr, "Error: cannot write '%s'\n", output.c_str());
+    return EIO;
+  }
+
+  return 0;
+}
+
+Intel::XEON::EventCatalog::EventCatalog()
+: d_base(0)
+, d_size(0)
+, d_header(0)
+, d_displacement(0)
+, d_slot(0)
+, d_entry(0)
+, d_string(0)
+{
+}
+
+Intel::XEON::EventCatalog::~EventCatalog() {
+  close();
+}
+
+const Intel::XEON::EventCatalog::Entry *Intel::XEON::EventCatalog::find(const char *name) const {
+  assert(name);
+
+  if (d_header==0) {
+    return 0;
+  }
+
+  const u_int64_t h = hash(name);
+  const u_int32_t d = d_displacement[bucketOf(h, d_header->d_buckets)];
+  const u_int32_t i = d_slot[slotOf(h, d, d_header->d_slots)];
+  if (i>=d_header->d_count || strcmp(d_string+d_entry[i].d_name, name)!=0) {
+    return 0;
+  }
+
+  return d_entry+i;
+}
+
+int Intel::XEON::EventCatalog::open(const std::string& path) {
+  close();
+
+  int fid = ::open(path.c_str(), O_RDONLY);
+  if (fid<0) {
+    fprintf(stderr, "Error: cannot open '%s': %s\n", path.c_str(), strerror(errno));
+    return errno;
+  }
+
+  struct stat info;
+  if (fstat(fid, &info)!=0) {
+    int rc = errno;
+    ::close(fid);
+    return rc;
+  }
+
+  if ((size_t)info.st_size<sizeof(Header)) {
+    ::close(fid);
+    fprintf(stderr, "Error: '%s' is not an event catalog\n", path.c_str());
+    return EINVAL;
+  }
+
+  void *base = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fid, 0);
+  ::close(fid);
+  if (base==MAP_FAILED) {
+    fprintf(stderr, "Error: cannot mmap '%s': %s\n", path.c_str(), strerror(errno));
+    return errno;
+  }
+
+  d_base = (const char*)base;
+  d_size = info.st_size;
+
+  const Header *header = (const Header*)d_base;
+  const bool valid = memcmp(header->d_magic, "PMCEVT1", 8)==0
+                  && header->d_buckets>0 && header->d_slots>=header->d_count
+                  && header->d_displacementOffset+sizeof(u_int32_t)*header->d_buckets<=d_size
+                  && header->d_slotOffset+sizeof(u_int32_t)*header->d_slots<=d_size
+                  && header->d_entryOffset%8==0
+                  && header->d_entryOffset+sizeof(Entry)*header->d_count<=d_size
+                  && header->d_stringOffset+header->d_stringSize<=d_size
+                  && header->d_stringSize>0
+                  && d_base[header->d_stringOffset+header->d_stringSize-1]=='\0';
+  if (!valid) {
+    close();
+    fprintf(stderr, "Error: '%s' is not a valid event catalog\n", path.c_str());
+    return EINVAL;
+  }
+
+  d_displacement = (const u_int32_t*)(d_base+header->d_displacementOffset);
+  d_slot = (const u_int32_t*)(d_base+header->d_slotOffset);
+  d_entry = (const Entry*)(d_base+header->d_entryOffset);
+  d_string = d_base+header->d_stringOffset;
+
+  for (u_int32_t i=0; i<header->d_count; ++i) {
+    if (d_entry[i].d_name>=header->d_stringSize || d_entry[i].d_description>=header->d_stringSize) {
+      close();
+      fprintf(stderr, "Error: '%s' is not a valid event catalog\n", path.c_str());
+      return EINVAL;
+    }
+  }
+
+  d_header = header;
+  return 0;
+}
+
+void Intel::XEON::EventCatalog::close() {
+  if (d_base) {
+    munmap((void*)d_base, d_size);
+  }
+  d_base = 0;
+  d_size = 0;
+  d_header = 0;
+  d_displacement = 0;
+  d_slot = 0;
+  d_entry = 0;
+  d_string = 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+// PURPOSE: Look up programmable counter events by perfmon name from a compiled, mmap-able catalog
+//
+// CLASSES:
+//  Intel::XEON::EventCatalog: Read-only view of a binary event index compiled from Intel perfmon JSON files (see
+//                             https://github.com/intel/perfmon, one directory per microarchitecture). Lookup by name
+//                             e.g. "LONGEST_LAT_CACHE.MISS" is a minimal perfect hash probe plus one string compare,
+//                             and opening is one 'mmap' so startup is microseconds.
+//
+// FILE FORMAT:
+//  Header | displacement[buckets] (u32) | slot[slots] (u32 entry index) | Entry[count] | NUL terminated strings
+//  All integers are host byte order. Offsets in 'Entry' are relative to the start of the string pool.
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace Intel {
+namespace XEON {
+
+class EventCatalog {
+public:
+  // ENUM
+  enum Flags {
+    k_FIXED      = 0x1,                 // Event is counted by a fixed counter; not programmable
+    k_NEEDS_MSR  = 0x2,                 // Event needs an extra MSR e.g. offcore response; not supported by PMU
+    k_DEPRECATED = 0x4,                 // perfmon marks event deprecated
+  };
+
+  struct Header {
+    char      d_magic[8];               // "PMCEVT1"
+    u_int32_t d_count;                  // number of entries
+    u_int32_t d_buckets;                // number of displacement buckets
+    u_int32_t d_slots;                  // number of hash slots
+    u_int32_t d_reserved;               // zero
+    u_int64_t d_displacementOffset;     // file offset of displacement array
+    u_int64_t d_slotOffset;             // file offset of slot array
+    u_int64_t d_entryOffset;            // file offset of entry array
+    u_int64_t d_stringOffset;           // file offset of string pool
+    u_int64_t d_stringSize;             // size in bytes of string pool
+  };
+
+  struct Entry {
+    u_int64_t d_eventSelect;            // IA32_PERFEVTSEL value: usr and enable bits set, os clear
+    u_int32_t d_name;                   // string pool offset of perfmon 'EventName'
+    u_int32_t d_description;            // string pool offset of perfmon 'BriefDescription'
+    u_int32_t d_counters;               // bit 'i' set if programmable counter 'i' can count this event
+    u_int32_t d_flags;                  // bitwise OR of 'Flags'
+  };
+
+private:
+  // DATA
+  const char      *d_base;              // mmap'd catalog file or 0
+  size_t           d_size;              // size in bytes of mapping
+  const Header    *d_header;            // header at 'd_base'
+  const u_int32_t *d_displacement;      // displacement by bucket
+  const u_int32_t *d_slot;              // entry index by slot
+  const Entry     *d_entry;             // entries
+  const char      *d_string;            // string pool
+
+public:
+  // CLASS METHODS
+  static int compile(const std::vector<std::string>& jsonFile, const std::string& output);
+    // Return 0 if all events in specified 'jsonFile' perfmon JSON files were compiled into a catalog written to
+    // specified 'output', and non-zero otherwise with a diagnostic on stderr. Both the current '{"Header":..,
+    // "Events":[..]}' and the older top level array formats are accepted. Duplicate names keep the first seen.
+
+  static u_int64_t hash(const char *name);
+    // Return the 64-bit hash of specified NUL terminated 'name' used for lookup
+
+  static int place(u_int16_t count, const u_int32_t *counters, u_int16_t *counter);
+    // Return 0 if each of specified 'count' events, event 'i' countable by the programmable counters whose bits are
+    // set in specified 'counters[i]' per 'Entry::d_counters' (0 meaning any), was assigned a distinct counter below
+    // 'count' loaded into specified 'counter[i]', and EINVAL otherwise. Events start on their own counter and only
+    // move to make room for restricted ones, so unrestricted events stay in order. The behavior is defined if
+    // 'count<=32'.
+
+  // CREATORS
+  EventCatalog();
+    // Create an empty catalog. Call 'open' to map a compiled catalog
+
+  EventCatalog(const EventCatalog& other) = delete;
+    // Copy constructor is not supported.
+
+  ~EventCatalog();
+    // Destroy this object unmapping any catalog file
+
+  // ACCESSORS
+  u_int32_t size() const;
+    // Return the number of events in the catalog
+
+  const Entry& entry(u_int32_t i) const;
+    // Return a non-modifiable reference to the specified entry 'i'. The behavior is defined if 'i<size()'
+
+  const Entry *find(const char *name) const;
+    // Return the entry for specified perfmon event 'name' or 0 if not found
+
+  const char *name(const Entry& entry) const;
+    // Return the perfmon event name of specified 'entry'
+
+  const char *description(const Entry& entry) const;
+    // Return the perfmon brief description of specified 'entry'
+
+  // MANIPULATORS
+  int open(const std::string& path);
+    // Return 0 if the catalog at specified 'path' was mapped and validated, and non-zero otherwise with a diagnostic
+    // on stderr. Any previously opened catalog is closed first.
+
+  void close();
+    // Unmap the catalog if open. 'size()' is 0 afterwards.
+
+  EventCatalog& operator=(const EventCatalog& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+inline
+u_int64_t EventCatalog::hash(const char *name) {
+  // FNV-1a
+  u_int64_t h = 0xcbf29ce484222325ull;
+  for (; *name; ++name) {
+    h ^= (u_int8_t)*name;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// ACCESSORS
+inline
+u_int32_t EventCatalog::size() const {
+  return d_header ? d_header->d_count : 0;
+}
+
+inline
+const EventCatalog::Entry& EventCatalog::entry(u_int32_t i) const {
+  return d_entry[i];
+}
+
+inline
+const char *EventCatalog::name(const Entry& entry) const {
+  return d_string+entry.d_name;
+}
+
+inline
+const char *EventCatalog::description(const Entry& entry) const {
+  return d_string+entry.d_description;
+}
+
+} // namespace XEON
+} // namespace Intel
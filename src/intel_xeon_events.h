@@ -0,0 +1,179 @@
+#pragma once
+
+// PURPOSE: Encode IA32_PERFEVTSEL programmable counter configurations at compile time
+//
+// CLASSES:
+//  Intel::XEON::EventSelect: Compile time IA32_PERFEVTSEL value from event/umask/cmask/usr/os/edge/inv fields. Same
+//                            bit layout as 'CounterConfig' in 'example/config.cpp'; see 'doc/pmu.md'. The enable bit
+//                            is always set.
+//  Intel::XEON::Events:      Named events for Skylake and later Xeon PMUs. Each is an 'EventSelect' plus its
+//                            perfmon name and a short description. Lift more from https://perfmon-events.intel.com/
+
+#include <sys/types.h>
+
+namespace Intel {
+namespace XEON {
+
+template <u_int8_t EVENT, u_int8_t UMASK, u_int8_t CMASK = 0, bool USR = true, bool OS = false, bool EDGE = false,
+          bool INV = false>
+struct EventSelect {
+  static_assert(USR || OS, "event counts nothing unless it counts user code, kernel code or both");
+  static_assert(!INV || CMASK, "invert is only meaningful with a non-zero cmask");
+
+  static constexpr u_int64_t k_VALUE = (u_int64_t)EVENT           // bits 0-7   event select
+                                     | ((u_int64_t)UMASK  << 8)   // bits 8-15  unit mask
+                                     | ((u_int64_t)USR    << 16)  // bit  16    count ring 1-3 (user)
+                                     | ((u_int64_t)OS     << 17)  // bit  17    count ring 0 (kernel)
+                                     | ((u_int64_t)EDGE   << 18)  // bit  18    count edges not levels
+                                     | (1ull              << 22)  // bit  22    enable
+                                     | ((u_int64_t)INV    << 23)  // bit  23    invert cmask comparison
+                                     | ((u_int64_t)CMASK  << 24); // bits 24-31 counter mask
+};
+
+namespace Events {
+
+struct LLC_REFERENCE : EventSelect<0x2e, 0x4f> {
+  static constexpr const char *k_NAME        = "LONGEST_LAT_CACHE.REFERENCE";
+  static constexpr const char *k_DESCRIPTION = "LLC references";
+};
+
+struct LLC_MISS : EventSelect<0x2e, 0x41> {
+  static constexpr const char *k_NAME        = "LONGEST_LAT_CACHE.MISS";
+  static constexpr const char *k_DESCRIPTION = "LLC misses";
+};
+
+struct BRANCHES : EventSelect<0xc4, 0x04> {
+  static constexpr const char *k_NAME        = "BR_INST_RETIRED.ALL_BRANCHES";
+  static constexpr const char *k_DESCRIPTION = "retired branch instructions";
+};
+
+struct BRANCHES_NOT_TAKEN : EventSelect<0xc4, 0x10> {
+  static constexpr const char *k_NAME        = "BR_INST_RETIRED.COND_NTAKEN";
+  static constexpr const char *k_DESCRIPTION = "retired branch instructions not taken";
+};
+
+struct CYCLES_L1D_MISS : EventSelect<0xa3, 0x08, 8> {
+  static constexpr const char *k_NAME        = "CYCLE_ACTIVITY.CYCLES_L1D_MISS";
+  static constexpr const char *k_DESCRIPTION = "cycles L1 demand load miss outstanding";
+};
+
+struct CYCLES_L2_MISS : EventSelect<0xa3, 0x01, 1> {
+  static constexpr const char *k_NAME        = "CYCLE_ACTIVITY.CYCLES_L2_MISS";
+  static constexpr const char *k_DESCRIPTION = "cycles L2 demand load miss outstanding";
+};
+
+struct CYCLES_L3_MISS : EventSelect<0xa3, 0x02, 2> {
+  static constexpr const char *k_NAME        = "CYCLE_ACTIVITY.CYCLES_L3_MISS";
+  static constexpr const char *k_DESCRIPTION = "cycles L3 demand load miss outstanding";
+};
+
+struct CYCLES_MEM_ANY : EventSelect<0xa3, 0x10, 16> {
+  static constexpr const char *k_NAME        = "CYCLE_ACTIVITY.CYCLES_MEM_ANY";
+  static constexpr const char *k_DESCRIPTION = "cycles memory subsystem has outstanding load";
+};
+
+struct DTLB_LOAD_WALK : EventSelect<0x08, 0x01> {
+  static constexpr const char *k_NAME        = "DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK";
+  static constexpr const char *k_DESCRIPTION = "loads causing a page walk";
+};
+
+struct DTLB_LOAD_WALK_COMPLETED : EventSelect<0x08, 0x0e> {
+  static constexpr const char *k_NAME        = "DTLB_LOAD_MISSES.WALK_COMPLETED";
+  static constexpr const char *k_DESCRIPTION = "load page walks completed";
+};
+
+struct DTLB_STORE_WALK : EventSelect<0x49, 0x01> {
+  static constexpr const char *k_NAME        = "DTLB_STORE_MISSES.MISS_CAUSES_A_WALK";
+  static constexpr const char *k_DESCRIPTION = "stores causing a page walk";
+};
+
+struct DTLB_STORE_WALK_COMPLETED : EventSelect<0x49, 0x0e> {
+  static constexpr const char *k_NAME        = "DTLB_STORE_MISSES.WALK_COMPLETED";
+  static constexpr const char *k_DESCRIPTION = "store page walks completed";
+};
+
+struct LOADS : EventSelect<0xd0, 0x81> {
+  static constexpr const char *k_NAME        = "MEM_INST_RETIRED.ALL_LOADS";
+  static constexpr const char *k_DESCRIPTION = "retired load instructions";
+};
+
+struct STORES : EventSelect<0xd0, 0x82> {
+  static constexpr const char *k_NAME        = "MEM_INST_RETIRED.ALL_STORES";
+  static constexpr const char *k_DESCRIPTION = "retired store instructions";
+};
+
+struct MEMORY_INSTRUCTIONS : EventSelect<0xd0, 0x83> {
+  static constexpr const char *k_NAME        = "MEM_INST_RETIRED.ANY";
+  static constexpr const char *k_DESCRIPTION = "retired memory instructions";
+};
+
+// Top-down microarchitecture analysis (TMA) events of Skylake class cores. A core issues and retires at most 4 uops a
+// cycle so it has '4*F1' pipeline slots; see 'Intel::TopDown'
+struct IDQ_UOPS_NOT_DELIVERED : EventSelect<0x9c, 0x01> {
+  static constexpr const char *k_NAME        = "IDQ_UOPS_NOT_DELIVERED.CORE";
+  static constexpr const char *k_DESCRIPTION = "slots the front end delivered no uop";
+};
+
+struct UOPS_ISSUED : EventSelect<0x0e, 0x01> {
+  static constexpr const char *k_NAME        = "UOPS_ISSUED.ANY";
+  static constexpr const char *k_DESCRIPTION = "uops issued to the back end";
+};
+
+struct RETIRE_SLOTS : EventSelect<0xc2, 0x02> {
+  static constexpr const char *k_NAME        = "UOPS_RETIRED.RETIRE_SLOTS";
+  static constexpr const char *k_DESCRIPTION = "retirement slots used";
+};
+
+struct RECOVERY_CYCLES : EventSelect<0x0d, 0x01> {
+  static constexpr const char *k_NAME        = "INT_MISC.RECOVERY_CYCLES";
+  static constexpr const char *k_DESCRIPTION = "cycles allocation stalled recovering a clear";
+};
+
+struct FETCH_LATENCY_CYCLES : EventSelect<0x9c, 0x01, 4> {
+  static constexpr const char *k_NAME        = "IDQ_UOPS_NOT_DELIVERED.CYCLES_0_UOPS_DELIV.CORE";
+  static constexpr const char *k_DESCRIPTION = "cycles the front end delivered no uops";
+};
+
+struct BRANCH_MISPREDICTS : EventSelect<0xc5, 0x00> {
+  static constexpr const char *k_NAME        = "BR_MISP_RETIRED.ALL_BRANCHES";
+  static constexpr const char *k_DESCRIPTION = "retired mispredicted branches";
+};
+
+struct MACHINE_CLEARS : EventSelect<0xc3, 0x01, 1, true, false, true> {
+  static constexpr const char *k_NAME        = "MACHINE_CLEARS.COUNT";
+  static constexpr const char *k_DESCRIPTION = "machine clears of any cause";
+};
+
+struct MICROCODE_UOPS : EventSelect<0x79, 0x30> {
+  static constexpr const char *k_NAME        = "IDQ.MS_UOPS";
+  static constexpr const char *k_DESCRIPTION = "uops delivered by the microcode sequencer";
+};
+
+struct STALLS_MEM_ANY : EventSelect<0xa3, 0x14, 20> {
+  static constexpr const char *k_NAME        = "CYCLE_ACTIVITY.STALLS_MEM_ANY";
+  static constexpr const char *k_DESCRIPTION = "execution stall cycles with a load outstanding";
+};
+
+struct BOUND_ON_STORES : EventSelect<0xa6, 0x40> {
+  static constexpr const char *k_NAME        = "EXE_ACTIVITY.BOUND_ON_STORES";
+  static constexpr const char *k_DESCRIPTION = "cycles the store buffer was full";
+};
+
+struct EXE_BOUND_0_PORTS : EventSelect<0xa6, 0x01> {
+  static constexpr const char *k_NAME        = "EXE_ACTIVITY.EXE_BOUND_0_PORTS";
+  static constexpr const char *k_DESCRIPTION = "cycles no uop executed, no load outstanding";
+};
+
+struct PORTS_UTIL_1 : EventSelect<0xa6, 0x02> {
+  static constexpr const char *k_NAME        = "EXE_ACTIVITY.1_PORTS_UTIL";
+  static constexpr const char *k_DESCRIPTION = "cycles one uop executed";
+};
+
+struct PORTS_UTIL_2 : EventSelect<0xa6, 0x04> {
+  static constexpr const char *k_NAME        = "EXE_ACTIVITY.2_PORTS_UTIL";
+  static constexpr const char *k_DESCRIPTION = "cycles two uops executed";
+};
+
+} // namespace Events
+} // namespace XEON
+} // namespace Intel
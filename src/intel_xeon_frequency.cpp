@@ -0,0 +1,134 @@
+#include <intel_xeon_frequency.h>
+#include <intel_tsc_clock.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <iostream>
+
+namespace {
+
+int rdmsr(int fid, int cpu, u_int32_t reg, u_int64_t *value) {
+  if (pread(fid, value, sizeof(*value), reg)!=sizeof(*value)) {
+    const int rc = errno ? errno : EIO;
+    fprintf(stderr, "Error: MSR read error on cpu %d register 0x%x: %s\n", cpu, reg, strerror(rc));
+    return rc;
+  }
+  return 0;
+}
+
+} // namespace
+
+double Intel::XEON::Frequency::ghz(u_int64_t aperf, u_int64_t mperf) {
+  // MPERF counts at the TSC frequency while unhalted so APERF/MPERF scales it
+  return mperf ? (double)TscClock::instance().hz()*(double)aperf/(double)mperf/1e9 : 0;
+}
+
+Intel::XEON::Frequency::Frequency(const Options& options)
+: d_fid(-1)
+, d_cpu(options.d_cpu<0 ? sched_getcpu() : options.d_cpu)
+, d_status(0)
+, d_package(false)
+{
+  char msr_file_name[PATH_MAX];
+  snprintf(msr_file_name, sizeof(msr_file_name), "%s/%d/msr", options.d_msrRoot.c_str(), d_cpu);
+  d_path = msr_file_name;
+
+  // Reads need no write access; 'clear' asks for it only when called
+  d_fid = ::open(msr_file_name, O_RDONLY);
+  if (d_fid<0) {
+    d_status = errno;
+    fprintf(stderr, "Error: cannot open '%s': %s\n", msr_file_name, strerror(d_status));
+    return;
+  }
+
+  u_int64_t value;
+  if ((d_status = rdmsr(d_fid, d_cpu, IA32_APERF, &value))!=0 ||
+      (d_status = rdmsr(d_fid, d_cpu, IA32_MPERF, &value))!=0 ||
+      (d_status = rdmsr(d_fid, d_cpu, IA32_THERM_STATUS, &value))!=0) {
+    return;
+  }
+
+  // Package thermal management is optional (CPUID.06H:EAX bit 6); probe quietly
+  d_package = pread(d_fid, &value, sizeof(value), IA32_PACKAGE_THERM_STATUS)==sizeof(value);
+}
+
+Intel::XEON::Frequency::~Frequency() {
+  if (d_fid!=-1) {
+    close(d_fid);
+  }
+}
+
+int Intel::XEON::Frequency::read(u_int64_t *aperf, u_int64_t *mperf, u_int32_t *throttle) const {
+  assert(aperf);
+  assert(mperf);
+  assert(throttle);
+
+  // MPERF first and APERF last so both bracket the same interval the same way between reads
+  int rc;
+  u_int64_t core, package = 0;
+  if ((rc = rdmsr(d_fid, d_cpu, IA32_MPERF, mperf))!=0 ||
+      (rc = rdmsr(d_fid, d_cpu, IA32_APERF, aperf))!=0 ||
+      (rc = rdmsr(d_fid, d_cpu, IA32_THERM_STATUS, &core))!=0 ||
+      (d_package && (rc = rdmsr(d_fid, d_cpu, IA32_PACKAGE_THERM_STATUS, &package))!=0)) {
+    return rc;
+  }
+
+  *throttle = (u_int32_t)(core & 0xffff) | (u_int32_t)((package & 0xffff)<<k_PACKAGE_SHIFT);
+  return 0;
+}
+
+int Intel::XEON::Frequency::clear() {
+  const int fid = ::open(d_path.c_str(), O_WRONLY);
+  if (fid<0) {
+    const int rc = errno;
+    fprintf(stderr, "Error: cannot open '%s' for writing: %s\n", d_path.c_str(), strerror(rc));
+    return rc;
+  }
+
+  // Log bits are cleared by writing 0; status bits are read only
+  int rc = 0;
+  const u_int64_t zero = 0;
+  if (pwrite(fid, &zero, sizeof(zero), IA32_THERM_STATUS)!=sizeof(zero) ||
+      (d_package && pwrite(fid, &zero, sizeof(zero), IA32_PACKAGE_THERM_STATUS)!=sizeof(zero))) {
+    rc = errno ? errno : EIO;
+    fprintf(stderr, "Error: cannot clear thermal status log on cpu %d: %s\n", d_cpu, strerror(rc));
+  }
+  close(fid);
+  return rc;
+}
+
+std::ostream& Intel::XEON::Frequency::print(std::ostream& stream) const {
+  stream << "Intel XEON effective frequency and throttling of cpu " << d_cpu << ":" << std::endl;
+
+  u_int64_t aperf[2], mperf[2];
+  u_int32_t throttle[2];
+  if (d_status!=0 || read(aperf, mperf, throttle)!=0) {
+    return stream << "not available" << std::endl;
+  }
+  // About a millisecond busy so the core is unhalted throughout
+  const u_int64_t until = __rdtsc() + TscClock::instance().hz()/1000;
+  while (__rdtsc()<until) {
+  }
+  if (read(aperf+1, mperf+1, throttle+1)!=0) {
+    return stream << "not available" << std::endl;
+  }
+
+  const u_int32_t status = k_STATUS_BITS | (k_STATUS_BITS<<k_PACKAGE_SHIFT);
+  const u_int32_t log = k_LOG_BITS | (k_LOG_BITS<<k_PACKAGE_SHIFT);
+  char buf[256];
+  snprintf(buf, sizeof(buf), "effective GHz: %.3lf, TSC GHz: %.3lf, core throttle bits: 0x%04x, package throttle bits: "
+    "0x%04x%s, throttled now: %s, since clear: %s\n", ghz(aperf[1]-aperf[0], mperf[1]-mperf[0]),
+    (double)TscClock::instance().hz()/1e9, throttle[1] & 0xffff, throttle[1]>>k_PACKAGE_SHIFT,
+    d_package ? "" : " (not read)", (throttle[1] & status) ? "yes" : "no", (throttle[1] & log) ? "yes" : "no");
+  stream << buf;
+
+  return stream;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+// PURPOSE: Read the effective frequency and thermal/power throttling state of the cpu a thread runs on
+//
+// CLASSES:
+//  Intel::XEON::Frequency: Reads IA32_APERF and IA32_MPERF, whose deltas' ratio is the average core frequency
+//                          over the TSC frequency while unhalted, and IA32_THERM_STATUS plus
+//                          IA32_PACKAGE_THERM_STATUS, whose status bits say the core or package is thermally
+//                          (PROCHOT) or power limited now and whose sticky log bits say it was since they were last
+//                          cleared. All go through '<msrRoot>/<cpu>/msr', one system call each. Attach to a 'PMU' with
+//                          'PMU::setFrequency' to have every 'Snapshot' carry them and 'Stats' report effective GHz
+//                          and throttled deltas, or 'Runner' retry runs whose frequency wasn't steady.
+//
+// Usage:
+//   Intel::XEON::Frequency frequency;
+//   frequency.clear();
+//   u_int64_t aperf[2], mperf[2];
+//   u_int32_t throttle[2];
+//   frequency.read(aperf, mperf, throttle);
+//   ...
+//   frequency.read(aperf+1, mperf+1, throttle+1);
+//   double ghz = Intel::XEON::Frequency::ghz(aperf[1]-aperf[0], mperf[1]-mperf[0]);
+//   bool hot = Intel::XEON::Frequency::throttled(throttle[0], throttle[1]);
+
+#include <sys/types.h>
+
+#include <iosfwd>
+#include <string>
+
+namespace Intel {
+namespace XEON {
+
+class Frequency {
+public:
+  // ENUM
+  enum Throttle {
+    // Bits of a throttle word: IA32_THERM_STATUS bits 0-15 then IA32_PACKAGE_THERM_STATUS bits 0-15 in bits 16-31
+    k_THERMAL           = 1u<<0,        // at or above the thermal limit now
+    k_THERMAL_LOG       = 1u<<1,        // 'k_THERMAL' was set since the last 'clear'
+    k_PROCHOT           = 1u<<2,        // PROCHOT# asserted now
+    k_PROCHOT_LOG       = 1u<<3,        // 'k_PROCHOT' was set since the last 'clear'
+    k_POWER_LIMIT       = 1u<<10,       // frequency reduced below the OS request by a power limit now
+    k_POWER_LIMIT_LOG   = 1u<<11,       // 'k_POWER_LIMIT' was set since the last 'clear'
+    k_PACKAGE_SHIFT     = 16,           // package bits are the core bits shifted left this far
+    k_STATUS_BITS       = 0x0405,       // 'k_THERMAL|k_PROCHOT|k_POWER_LIMIT'
+    k_LOG_BITS          = 0x080a,       // 'k_THERMAL_LOG|k_PROCHOT_LOG|k_POWER_LIMIT_LOG'
+  };
+
+  struct Options {
+    std::string d_msrRoot = "/dev/cpu"; // directory holding '<cpu>/msr'
+    int         d_cpu = -1;             // cpu read; -1 is the calling thread's cpu
+  };
+
+  // CONSTANTS
+  // 'doc/intel_msr.pdf' architectural MSRs
+  static constexpr u_int32_t IA32_MPERF                = 0xe7;
+  static constexpr u_int32_t IA32_APERF                = 0xe8;
+  static constexpr u_int32_t IA32_THERM_STATUS         = 0x19c;
+  static constexpr u_int32_t IA32_PACKAGE_THERM_STATUS = 0x1b1;
+
+private:
+  // DATA
+  std::string d_path;                   // '<msrRoot>/<d_cpu>/msr'
+  int  d_fid;                           // read only file handle for 'd_path' or -1 if not open
+  int  d_cpu;                           // cpu read
+  int  d_status;                        // 0 if construction succeeded else errno-style reason
+  bool d_package;                       // true if IA32_PACKAGE_THERM_STATUS can be read
+
+public:
+  // CLASS METHODS
+  static double ghz(u_int64_t aperf, u_int64_t mperf);
+    // Return the effective frequency in GHz of specified 'aperf' and 'mperf' deltas per the TSC frequency of
+    // 'TscClock::instance()', or 0 if 'mperf' is 0
+
+  static bool throttled(u_int32_t begin, u_int32_t end);
+    // Return true if specified 'end' throttle word has a status bit set, or a log bit not set in specified 'begin'
+    // i.e. the core or package was throttled some time between the two reads, and false otherwise
+
+  // CREATORS
+  Frequency();
+    // Create an object reading the calling thread's cpu with default 'Options'. Otherwise as per the constructor
+    // below.
+
+  explicit Frequency(const Options& options);
+    // Create an object reading the MSRs of specified 'options.d_cpu'. The MSR device is opened read only. If it can't
+    // be opened, or IA32_APERF, IA32_MPERF or IA32_THERM_STATUS can't be read, a diagnostic is printed on stderr and
+    // 'status()' is non-zero.
+
+  Frequency(const Frequency& other) = delete;
+    // Copy constructor is not supported.
+
+  ~Frequency();
+    // Destroy this object closing the MSR device
+
+  // ACCESSORS
+  int status() const;
+    // Return 0 if this object was constructed as requested and an errno value otherwise
+
+  int cpu() const;
+    // Return the cpu whose MSR device is read
+
+  bool package() const;
+    // Return true if the package throttle bits are read, and false if they read 0
+
+  int read(u_int64_t *aperf, u_int64_t *mperf, u_int32_t *throttle) const;
+    // Return 0 if IA32_APERF, IA32_MPERF, and the throttle word were read into specified 'aperf', 'mperf', and
+    // 'throttle', and an errno value otherwise. The behavior is defined if 'status()==0'.
+
+  // MANIPULATORS
+  int clear();
+    // Return 0 if the log bits of IA32_THERM_STATUS and IA32_PACKAGE_THERM_STATUS were cleared so later reads only
+    // log throttling from now on, and an errno value otherwise e.g. if the MSR device isn't writable. The device is
+    // opened for writing for the duration of the call only.
+
+  Frequency& operator=(const Frequency& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the cpu, frequency over a short busy wait, and current throttle state
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Frequency& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+inline
+bool Frequency::throttled(u_int32_t begin, u_int32_t end) {
+  const u_int32_t status = k_STATUS_BITS | (k_STATUS_BITS<<k_PACKAGE_SHIFT);
+  const u_int32_t log = k_LOG_BITS | (k_LOG_BITS<<k_PACKAGE_SHIFT);
+  return (end & status)!=0 || (end & ~begin & log)!=0;
+}
+
+// CREATORS
+inline
+Frequency::Frequency()
+: Frequency(Options())
+{
+}
+
+// ACCESSORS
+inline
+int Frequency::status() const {
+  return d_status;
+}
+
+inline
+int Frequency::cpu() const {
+  return d_cpu;
+}
+
+inline
+bool Frequency::package() const {
+  return d_package;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Frequency& object) {
+  return object.print(stream);
+}
+
+} // namespace XEON
+} // namespace Intel
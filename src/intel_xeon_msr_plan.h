@@ -0,0 +1,183 @@
+#pragma once
+
+// PURPOSE: Apply a precompiled sequence of MSR writes with the fewest kernel crossings the host allows
+//
+// CLASSES:
+//  Intel::XEON::MSRPlan: Fixed capacity, ordered list of (MSR, value) writes built once and applied many times. A
+//                        plan applies in one 'ioctl' through the msr-safe batch device when the host provides it,
+//                        and otherwise falls back to one 'pwrite' per write on the '/dev/cpu/<n>/msr' device.
+
+#include <assert.h>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace Intel {
+namespace XEON {
+
+class MSRPlan {
+public:
+  // ENUM
+  enum Support {
+    k_MAX_WRITES = 32,                  // Upper bound on writes in one plan. PMU needs at most 22
+  };
+
+private:
+  // msr-safe batch ABI (https://github.com/LLNL/msr-safe 'msr_safe.h'). Opening '<root>/msr_batch' and issuing
+  // X86_IOC_MSR_BATCH runs every op in one kernel crossing.
+  struct BatchOp {
+    u_int16_t cpu;                      // In: CPU to execute wrmsr on
+    u_int16_t isrdmsr;                  // In: 0=wrmsr, non-zero=rdmsr
+    int32_t   err;                      // Out: set if error occurred with this operation
+    u_int32_t msr;                      // In: MSR address
+    u_int64_t msrdata;                  // In: value to write
+    u_int64_t wmask;                    // Out: write mask applied by the driver
+  };
+
+  struct BatchArray {
+    u_int32_t numops;                   // In: number of entries in 'ops'
+    BatchOp  *ops;                      // In: array of 'numops' operations
+  };
+
+  static const unsigned long X86_IOC_MSR_BATCH = _IOWR('c', 0xA2, BatchArray);
+
+  // DATA
+  u_int16_t d_count;                    // number of writes in plan [0, k_MAX_WRITES)
+  u_int32_t d_reg[k_MAX_WRITES];        // MSR address of write 'i'
+  u_int64_t d_value[k_MAX_WRITES];      // value of write 'i'
+  BatchOp   d_batch[k_MAX_WRITES];      // write 'i' pre-encoded for the batch device
+
+public:
+  // CREATORS
+  MSRPlan();
+    // Create an empty plan
+
+  MSRPlan(const MSRPlan& other) = default;
+    // Create a copy of specified 'other'
+
+  ~MSRPlan() = default;
+    // Destroy this object
+
+  // ACCESSORS
+  u_int16_t writes() const;
+    // Return the number of writes in this plan
+
+  u_int32_t reg(u_int16_t i) const;
+    // Return the MSR address of the specified write 'i'. The behavior is defined if 'i<writes()'
+
+  u_int64_t value(u_int16_t i) const;
+    // Return the value of the specified write 'i'. The behavior is defined if 'i<writes()'
+
+  int apply(int fid) const;
+    // Return 0 if every write in this plan was applied in order with one 'pwrite' each to the MSR device opened as
+    // specified 'fid', and errno of the first failed write otherwise. Writes after a failure are not attempted.
+
+  // MANIPULATORS
+  void clear(int cpu);
+    // Remove all writes from this plan, and target the plan at specified HW 'cpu' for 'applyBatch'
+
+  void append(u_int32_t reg, u_int64_t value);
+    // Append a write of specified 'value' into specified MSR 'reg'. The behavior is defined if
+    // 'writes()<k_MAX_WRITES'
+
+  int applyBatch(int batchFid);
+    // Return 0 if every write in this plan was applied in order with one ioctl on the msr-safe batch device opened
+    // as specified 'batchFid', and errno otherwise. ENOTTY or EINVAL mean 'batchFid' is not a batch device: callers
+    // should fall back to 'apply'.
+
+  MSRPlan& operator=(const MSRPlan& rhs) = default;
+    // Assign specified 'rhs' to this object returning a reference to this object
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+MSRPlan::MSRPlan()
+: d_count(0)
+{
+  memset(d_batch, 0, sizeof(d_batch));
+}
+
+// ACCESSORS
+inline
+u_int16_t MSRPlan::writes() const {
+  return d_count;
+}
+
+inline
+u_int32_t MSRPlan::reg(u_int16_t i) const {
+  assert(i<d_count);
+  return d_reg[i];
+}
+
+inline
+u_int64_t MSRPlan::value(u_int16_t i) const {
+  assert(i<d_count);
+  return d_value[i];
+}
+
+inline
+int MSRPlan::apply(int fid) const {
+  assert(fid>0);
+
+  for (u_int16_t i=0; i<d_count; ++i) {
+    if (pwrite(fid, d_value+i, sizeof(u_int64_t), d_reg[i]) != sizeof(u_int64_t)) {
+      fprintf(stderr, "Error: MSR write error on register 0x%x value 0x%lx: %s\n", d_reg[i], d_value[i],
+        strerror(errno));
+      return errno;
+    }
+  }
+
+  return 0;
+}
+
+// MANIPULATORS
+inline
+void MSRPlan::clear(int cpu) {
+  assert(cpu>=0);
+  d_count = 0;
+  for (u_int16_t i=0; i<k_MAX_WRITES; ++i) {
+    d_batch[i].cpu = (u_int16_t)cpu;
+  }
+}
+
+inline
+void MSRPlan::append(u_int32_t reg, u_int64_t value) {
+  assert(d_count<k_MAX_WRITES);
+  d_reg[d_count] = reg;
+  d_value[d_count] = value;
+  d_batch[d_count].isrdmsr = 0;
+  d_batch[d_count].msr = reg;
+  d_batch[d_count].msrdata = value;
+  ++d_count;
+}
+
+inline
+int MSRPlan::applyBatch(int batchFid) {
+  assert(batchFid>0);
+
+  BatchArray array;
+  array.numops = d_count;
+  array.ops = d_batch;
+
+  if (ioctl(batchFid, X86_IOC_MSR_BATCH, &array) != 0) {
+    return errno;
+  }
+
+  for (u_int16_t i=0; i<d_count; ++i) {
+    if (d_batch[i].err!=0) {
+      fprintf(stderr, "Error: MSR batch write error on register 0x%x value 0x%lx: %s\n", d_reg[i], d_value[i],
+        strerror(-d_batch[i].err));
+      return -d_batch[i].err;
+    }
+  }
+
+  return 0;
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -0,0 +1,164 @@
+#include <intel_xeon_perf_events.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+
+int perfEventOpen(perf_event_attr *attr, int groupFd) {
+  // No glibc wrapper. pid 0 and cpu -1: the calling thread on whatever cpu it runs
+  return (int)syscall(SYS_perf_event_open, attr, 0, -1, groupFd, 0);
+}
+
+} // namespace
+
+Intel::XEON::PerfEvent Intel::XEON::PerfEvent::raw(u_int64_t eventSelect, const char *description) {
+  assert(description);
+
+  // Same layout as IA32_PERFEVTSEL; the kernel owns the USR, OS, INT, and EN bits so they become attributes
+  const u_int64_t owned = (1ull<<16) | (1ull<<17) | (1ull<<20) | (1ull<<22);
+  PerfEvent event;
+  event.d_type = PERF_TYPE_RAW;
+  event.d_config = eventSelect & 0xffffffffull & ~owned;
+  event.d_excludeUser = (eventSelect & (1ull<<16))==0;
+  event.d_excludeKernel = (eventSelect & (1ull<<17))==0;
+  event.d_description = description;
+  return event;
+}
+
+Intel::XEON::PerfEvent Intel::XEON::PerfEvent::hardware(u_int64_t id, const char *description) {
+  assert(description);
+  return PerfEvent{PERF_TYPE_HARDWARE, id, false, true, description};
+}
+
+Intel::XEON::PerfEvent Intel::XEON::PerfEvent::software(u_int64_t id, const char *description) {
+  assert(description);
+  return PerfEvent{PERF_TYPE_SOFTWARE, id, false, true, description};
+}
+
+u_int64_t Intel::XEON::PerfEvents::readSlow(u_int16_t index) const {
+  u_int64_t value = 0;
+  if (::read(d_counter[index].d_fd, &value, sizeof(value))!=sizeof(value)) {
+    return 0;
+  }
+  return value;
+}
+
+bool Intel::XEON::PerfEvents::userRdpmc(u_int16_t index) const {
+  assert(index<d_count);
+  return d_counter[index].d_page->cap_user_rdpmc && d_counter[index].d_page->index!=0;
+}
+
+int Intel::XEON::PerfEvents::add(const PerfEvent& event) {
+  if (d_count>=k_MAX_EVENTS) {
+    fprintf(stderr, "Error: perf event '%s': group holds at most %d events\n", event.d_description.c_str(),
+      (int)k_MAX_EVENTS);
+    return E2BIG;
+  }
+
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_hv = 1;
+
+  if (d_leader<0) {
+    // Created disabled so nothing counts until 'enable'; members follow the leader's state
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_DUMMY;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    if ((d_leader = perfEventOpen(&attr, -1))<0) {
+      int rc = errno;
+      fprintf(stderr, "Error: cannot open perf group leader: %s\n", strerror(rc));
+      return rc;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.exclude_hv = 1;
+  }
+
+  attr.type = event.d_type;
+  attr.config = event.d_config;
+  attr.exclude_user = event.d_excludeUser;
+  attr.exclude_kernel = event.d_excludeKernel;
+
+  const int fd = perfEventOpen(&attr, d_leader);
+  if (fd<0) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot open perf event '%s' (type %u config 0x%lx): %s\n", event.d_description.c_str(),
+      event.d_type, event.d_config, strerror(rc));
+    return rc;
+  }
+
+  // The first page is the control page; no ring buffer pages since nothing is sampled
+  void *page = mmap(0, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+  if (page==MAP_FAILED) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot map perf event '%s': %s\n", event.d_description.c_str(), strerror(rc));
+    ::close(fd);
+    return rc;
+  }
+
+  // Joining an enabled group starts counting now; start from 0 like the rest did at their reset
+  ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+
+  d_counter[d_count].d_fd = fd;
+  d_counter[d_count].d_page = (const volatile perf_event_mmap_page*)page;
+  ++d_count;
+
+  return 0;
+}
+
+void Intel::XEON::PerfEvents::truncate(u_int16_t count) {
+  assert(count<=d_count);
+  while (d_count>count) {
+    --d_count;
+    munmap((void*)d_counter[d_count].d_page, (size_t)sysconf(_SC_PAGESIZE));
+    ::close(d_counter[d_count].d_fd);
+  }
+}
+
+int Intel::XEON::PerfEvents::enable() {
+  if (d_leader<0 || ioctl(d_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)!=0) {
+    int rc = d_leader<0 ? EBADF : errno;
+    fprintf(stderr, "Error: cannot enable perf events: %s\n", strerror(rc));
+    return rc;
+  }
+  return 0;
+}
+
+int Intel::XEON::PerfEvents::disable() {
+  if (d_leader<0 || ioctl(d_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP)!=0) {
+    int rc = d_leader<0 ? EBADF : errno;
+    fprintf(stderr, "Error: cannot disable perf events: %s\n", strerror(rc));
+    return rc;
+  }
+  return 0;
+}
+
+int Intel::XEON::PerfEvents::reset() {
+  int rc;
+  if ((rc = disable())!=0) {
+    return rc;
+  }
+  if (ioctl(d_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP)!=0) {
+    rc = errno;
+    fprintf(stderr, "Error: cannot reset perf events: %s\n", strerror(rc));
+    return rc;
+  }
+  return 0;
+}
+
+void Intel::XEON::PerfEvents::close() {
+  truncate(0);
+  if (d_leader>=0) {
+    ::close(d_leader);
+    d_leader = -1;
+  }
+}
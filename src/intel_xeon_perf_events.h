@@ -0,0 +1,177 @@
+#pragma once
+
+// PURPOSE: Program and read counters through Linux 'perf_event_open' instead of MSRs
+//
+// CLASSES:
+//  Intel::XEON::PerfEvent:  One perf event: type and config as 'perf_event_attr' takes them, which privilege levels
+//                           it counts, and a description. Made from an IA32_PERFEVTSEL value, a generic hardware
+//                           event, or a software event e.g. task-clock or page-faults.
+//  Intel::XEON::PerfEvents: A group of perf events counting the calling thread on any cpu it runs on, under a dummy
+//                           software leader so they are enabled, disabled and reset together, and scheduled as one
+//                           when the kernel multiplexes. Each event's 'perf_event_mmap_page' is mapped so a read is
+//                           the kernel's seqlock protocol around one 'rdpmc': no system call, no MSR access, no
+//                           'setcap'. Events 'rdpmc' can't read, software events or all events when the kernel
+//                           disables user space 'rdpmc', are read with one 'read' system call each. Values are 64-bit
+//                           virtual counts: the kernel folds in counts from before migrations and context switches so
+//                           they don't wrap and aren't per cpu.
+
+#include <intel_pmu_snapshot.h>
+
+#include <linux/perf_event.h>
+#include <sys/types.h>
+
+#include <assert.h>
+
+#include <string>
+
+namespace Intel {
+namespace XEON {
+
+struct PerfEvent {
+  // DATA
+  u_int32_t   d_type;                   // 'perf_event_attr::type' e.g. PERF_TYPE_RAW, PERF_TYPE_SOFTWARE
+  u_int64_t   d_config;                 // 'perf_event_attr::config' e.g. PERF_COUNT_SW_PAGE_FAULTS
+  bool        d_excludeUser;            // true to not count user code
+  bool        d_excludeKernel;          // true to not count kernel code
+  std::string d_description;            // human readable description
+
+  // CLASS METHODS
+  static PerfEvent raw(u_int64_t eventSelect, const char *description);
+    // Return the raw event counting what IA32_PERFEVTSEL value specified 'eventSelect' counts, including its USR and
+    // OS bits, described by specified 'description'. See 'EventSelect'.
+
+  static PerfEvent hardware(u_int64_t id, const char *description);
+    // Return generic hardware event specified 'id' e.g. PERF_COUNT_HW_INSTRUCTIONS counting user code described by
+    // specified 'description'
+
+  static PerfEvent software(u_int64_t id, const char *description);
+    // Return software event specified 'id' e.g. PERF_COUNT_SW_TASK_CLOCK (nanoseconds) or PERF_COUNT_SW_PAGE_FAULTS
+    // counting user code described by specified 'description'. Available without a PMU e.g. in VMs.
+};
+
+class PerfEvents {
+public:
+  // ENUM
+  enum Support {
+    k_MAX_EVENTS = Snapshot::k_FIXED_COUNTERS + Snapshot::k_MAX_PROG_COUNTERS, // events in one group
+  };
+
+private:
+  // PRIVATE TYPES
+  struct Counter {
+    int                                   d_fd;   // event file descriptor
+    const volatile perf_event_mmap_page  *d_page; // event's mapped control page
+  };
+
+  // DATA
+  int       d_leader;                   // dummy software event leading the group or -1 if not open
+  u_int16_t d_count;                    // events in 'd_counter'
+  Counter   d_counter[k_MAX_EVENTS];    // events in the order added
+
+  // PRIVATE ACCESSORS
+  u_int64_t readSlow(u_int16_t index) const;
+    // Return the value of event specified 'index' read by system call
+
+public:
+  // CREATORS
+  PerfEvents();
+    // Create an empty group. Nothing is opened until 'add'.
+
+  PerfEvents(const PerfEvents& other) = delete;
+    // Copy constructor not supported
+
+  ~PerfEvents();
+    // Close all events
+
+  // ACCESSORS
+  u_int16_t count() const;
+    // Return the number of events in the group
+
+  u_int64_t read(u_int16_t index) const;
+    // Return the current value of event specified 'index' in the order added. The behavior is defined if
+    // 'index<count()'.
+
+  bool userRdpmc(u_int16_t index) const;
+    // Return true if event specified 'index' is read with 'rdpmc' right now, and false if by system call e.g. a
+    // software event or an event the kernel hasn't scheduled on a counter. The behavior is defined if
+    // 'index<count()'.
+
+  // MANIPULATORS
+  int add(const PerfEvent& event);
+    // Return 0 if specified 'event' counting the calling thread was added to the group and its control page mapped,
+    // and errno otherwise with a diagnostic on stderr e.g. ENOENT if the host has no such event, EACCES if
+    // '/proc/sys/kernel/perf_event_paranoid' forbids it, or E2BIG if the group is full. The event counts whenever
+    // the group is enabled.
+
+  void truncate(u_int16_t count);
+    // Close events at index specified 'count' and after. The behavior is defined if 'count<=count()'.
+
+  int enable();
+    // Return 0 if all events started counting and errno otherwise
+
+  int disable();
+    // Return 0 if all events stopped counting, keeping their values, and errno otherwise
+
+  int reset();
+    // Return 0 if all events stopped counting and were zeroed, and errno otherwise
+
+  void close();
+    // Close all events including the leader
+
+  PerfEvents& operator=(const PerfEvents& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// INLINE DEFINITIONS
+// CREATORS
+inline
+PerfEvents::PerfEvents()
+: d_leader(-1)
+, d_count(0)
+{
+}
+
+inline
+PerfEvents::~PerfEvents() {
+  close();
+}
+
+// ACCESSORS
+inline
+u_int16_t PerfEvents::count() const {
+  return d_count;
+}
+
+inline
+u_int64_t PerfEvents::read(u_int16_t index) const {
+  assert(index<d_count);
+  const volatile perf_event_mmap_page *page = d_counter[index].d_page;
+
+  // Seqlock per 'include/uapi/linux/perf_event.h': the kernel bumps 'lock' around updates of 'index' and 'offset'
+  // e.g. when the thread is scheduled out or migrates; retry if it changed while reading
+  u_int32_t seq;
+  u_int64_t count;
+  do {
+    seq = page->lock;
+    __asm__ __volatile__("" : : : "memory");
+
+    const u_int32_t pmc = page->index;
+    if (__builtin_expect(!page->cap_user_rdpmc || pmc==0, 0)) {
+      return readSlow(index);
+    }
+
+    u_int64_t a, d;
+    __asm__ __volatile__("rdpmc" : "=a" (a), "=d" (d) : "c" (pmc-1));
+
+    // 'rdpmc' returns 'pmc_width' bits; sign extend them since 'offset' is relative to a negative start value
+    const u_int16_t shift = 64 - page->pmc_width;
+    count = page->offset + (u_int64_t)((int64_t)(((d<<32)|a) << shift) >> shift);
+
+    __asm__ __volatile__("" : : : "memory");
+  } while (page->lock!=seq);
+
+  return count;
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -1,39 +1,36 @@
 #include <intel_xeon_pmu.h>
+#include <intel_tsc_clock.h>
 
 std::ostream& Intel::XEON::PMU::print(std::ostream& stream) const {
-  u_int64_t ts = timeStampCounter();
+  Snapshot snap;
+  snapshot(&snap);
 
-  u_int64_t fixed[k_FIXED_COUNTERS];
-  for (u_int16_t i=0; i<fixedCountersDefined(); ++i) {
-    fixed[i] = fixedCounterValue(i);
-  }
-
-  u_int64_t prog[k_MAX_PROG_COUNTERS_HT_OFF];
-  for (u_int16_t i=0; i<programmableCountersDefined(); ++i) {
-    prog[i] = programmableCounterValue(i);
-  }
+  // One MSR read for every counter's overflow bit
+  u_int64_t status;
+  overflowStatus(&status);
 
   bool fixedOverflow[k_FIXED_COUNTERS];
   for (u_int16_t i=0; i<fixedCountersDefined(); ++i) {
-    fixedOverflow[i] = fixedCounterOverflowed(i);
+    fixedOverflow[i] = fixedCounterOverflowed(i, status);
   }
   
   bool progOverflow[k_MAX_PROG_COUNTERS_HT_OFF];
   for (u_int16_t i=0; i<d_cnt; ++i) {
-    progOverflow[i] = programmableCounterOverflowed(i);
+    progOverflow[i] = programmableCounterOverflowed(i, status);
   }
 
   stream << "Intel XEON CPU HW Core " << coreId() << " PMU Snapshot:" << std::endl;
 
   char buf[256];
-  snprintf(buf, sizeof(buf), "%-3s [%-48s]: value: %012lu\n", "R0", "rdtsc cycles", ts);
+  snprintf(buf, sizeof(buf), "%-3s [%-48s]: value: %012lu, ns: %lu\n", "R0", "rdtsc cycles", snap.d_tsc,
+    TscClock::instance().toNanoseconds(snap.d_tsc));
   stream << buf;
 
   for (u_int16_t i = 0; i<fixedCountersDefined(); ++i) {
     snprintf(buf, sizeof(buf), "%-3s [%-48s]: value: %012lu, overflowed: %s\n",
       d_fixedMnemonic[i].c_str(),
       d_fixedDescription[i].c_str(),
-      fixed[i],
+      snap.d_fixed[i],
       fixedOverflow[i] ? "true" : "false");
     stream << buf;
   }
@@ -42,7 +39,7 @@ std::ostream& Intel::XEON::PMU::print(std::ostream& stream) const {
     snprintf(buf, sizeof(buf), "%-3s [%-48s]: value: %012lu, overflowed: %s\n",
       d_progMnemonic[i].c_str(),
       d_progDescription[i].c_str(),
-      prog[i],
+      snap.d_prog[i],
       progOverflow[i] ? "true" : "false");
     stream << buf;
   }
@@ -51,7 +48,7 @@ std::ostream& Intel::XEON::PMU::print(std::ostream& stream) const {
 }
 
 int Intel::XEON::PMU::pinToHWCore(int core) {
-  assert(coreId>=0);
+  assert(core>=0);
 
   cpu_set_t mask;
   CPU_ZERO(&mask);
@@ -2,7 +2,9 @@
 
 // Classes:
 //    Intel::XEON::PMU: Manages 3 fixed counters and up to 8 programmable counters.
-//                      See 'doc/pmu.doc' for details including refs for constants.
+//                      See 'doc/pmu.doc' for details including refs for constants. Counters are programmed by
+//                      writing '/dev/cpu/<n>/msr' (the default, needs 'setcap') or through 'perf_event_open' with
+//                      'k_BACKEND_PERF' (no privileges beyond 'perf_event_paranoid', see 'PerfEvents').
 
 #include <assert.h>
 
@@ -14,6 +16,17 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <cpuid.h>
+
+#include <intel_xeon_msr_plan.h>
+#include <intel_pmu_snapshot.h>
+#include <intel_xeon_events.h>
+#include <intel_xeon_event_catalog.h>
+#include <intel_xeon_capability.h>
+#include <intel_xeon_perf_events.h>
+#include <intel_xeon_rapl.h>
+#include <intel_xeon_frequency.h>
 
 #include <string>
 #include <vector>
@@ -51,7 +64,33 @@ struct PMU {
     // | Programmable Counter 3: https://perfmon-events.intel.com/ -> BR_INST_RETIRED.COND_NTAKEN	     |
     // +-----------------------------------------------------------------------------------------------+
     k_DEFAULT_XEON_CONFIG_0 = 0,
-    k_DEFAULT_CONFIG_UNDEFINED = 1,
+    // +-----------------------------------------------------------------------------------------------+
+    // | Config 0 plus four memory counters. Needs 8 programmable counters i.e. hyper threading OFF.   |
+    // +-----------------------------------------------------------------------------------------------+
+    // | Programmable Counter 0-3: as 'k_DEFAULT_XEON_CONFIG_0'                                        |
+    // | Programmable Counter 4: perfmon-events.intel.com -> DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK       |
+    // | Programmable Counter 5: perfmon-events.intel.com -> DTLB_STORE_MISSES.MISS_CAUSES_A_WALK      |
+    // | Programmable Counter 6: perfmon-events.intel.com -> MEM_INST_RETIRED.ALL_LOADS                |
+    // | Programmable Counter 7: perfmon-events.intel.com -> MEM_INST_RETIRED.ALL_STORES               |
+    // +-----------------------------------------------------------------------------------------------+
+    k_DEFAULT_XEON_CONFIG_1 = 1,
+    // +-----------------------------------------------------------------------------------------------+
+    // | The first 'Capability::programmableBudget()' counters of 'k_DEFAULT_XEON_CONFIG_1' i.e. all 8 |
+    // | with hyper threading OFF and config 0 with it ON.                                             |
+    // +-----------------------------------------------------------------------------------------------+
+    k_AUTO_XEON_CONFIG = 2,
+    // +-----------------------------------------------------------------------------------------------+
+    // | Top-down (TMA) level 1 events of Skylake class cores. See 'Intel::TopDown'. Where the PMU has |
+    // | fixed counter 3 and IA32_PERF_METRICS (Ice Lake and later) 'reset()' also enables them; see   |
+    // | 'perfMetrics()'.                                                                              |
+    // +-----------------------------------------------------------------------------------------------+
+    // | Programmable Counter 0: perfmon-events.intel.com -> IDQ_UOPS_NOT_DELIVERED.CORE               |
+    // | Programmable Counter 1: perfmon-events.intel.com -> UOPS_ISSUED.ANY                           |
+    // | Programmable Counter 2: perfmon-events.intel.com -> UOPS_RETIRED.RETIRE_SLOTS                 |
+    // | Programmable Counter 3: perfmon-events.intel.com -> INT_MISC.RECOVERY_CYCLES                  |
+    // +-----------------------------------------------------------------------------------------------+
+    k_TOPDOWN_XEON_CONFIG = 3,
+    k_DEFAULT_CONFIG_UNDEFINED = 4,
   };
 
   enum Support {
@@ -59,54 +98,105 @@ struct PMU {
     k_MAX_PROG_COUNTERS_HT_ON   = 4,    // When CPU hyper threading ON  prog counters 0,1,2,3 available
     k_MAX_PROG_COUNTERS_HT_OFF  = 8,    // When CPU hyper threading OFF prog counters mostly [0-7] available
                                         // See https://perfmon-events.intel.com by event for details
+    k_DEFAULT_COUNTER_WIDTH     = 48,   // Counter bit width assumed when CPUID leaf 0xA doesn't report one
   };
 
-private:
-  const u_int32_t IA32_PERF_GLOBAL_STATUS = 0x38e;
-  const u_int32_t IA32_PERF_GLOBAL_CTRL   = 0x38f;
+  enum Backend {
+    k_BACKEND_MSR  = 0,                 // MSR writes program counters of the pinned core; 'rdpmc' reads them
+    k_BACKEND_PERF = 1,                 // 'perf_event_open' programs counters of the calling thread; reads go
+                                        // through each event's mmap'd page and 'rdpmc'. See 'PerfEvents'
+  };
+
+  enum FencePolicy {
+    k_FENCE_NONE          = 0,          // No serialization: reads may pass or be passed by surrounding code
+    k_FENCE_LFENCE        = 1,          // 'lfence': earlier instructions complete locally before reads
+    k_FENCE_MFENCE_LFENCE = 2,          // 'mfence;lfence': also wait for earlier stores to be globally visible
+    k_FENCE_RDTSCP        = 3,          // rdtsc read by 'rdtscp' which waits for earlier instructions
+  };
+    // Only 'k_FENCE_RDTSCP' reads the TSC with 'rdtscp'; the others always use plain 'rdtsc'. The cpu a snapshot
+    // was read on comes from 'rdpid' next to 'rdtsc' on targets built with RDPID, otherwise from one 'rdtscp' after
+    // the counters are read so the selected fence is unchanged and only its TSC_AUX value is kept.
+
+  // CONSTANTS
+  // MSR addresses and values shared by every class programming the PMU through '/dev/cpu/<n>/msr'
+  static constexpr u_int32_t IA32_TIME_STAMP_COUNTER = 0x10;
+  static constexpr u_int32_t IA32_PERF_GLOBAL_STATUS = 0x38e;
+  static constexpr u_int32_t IA32_PERF_GLOBAL_CTRL   = 0x38f;
 
   // MSR to configure programmable counter
-  const u_int32_t IA32_PERFEVTSEL0      = 0x186;
-  const u_int32_t IA32_PERFEVTSEL1      = 0x187;
-  const u_int32_t IA32_PERFEVTSEL2      = 0x188;
-  const u_int32_t IA32_PERFEVTSEL3      = 0x189;
-  const u_int32_t IA32_PERFEVTSEL4      = 0x18a;
-  const u_int32_t IA32_PERFEVTSEL5      = 0x18b;
-  const u_int32_t IA32_PERFEVTSEL6      = 0x18c;
-  const u_int32_t IA32_PERFEVTSEL7      = 0x18d;
+  static constexpr u_int32_t IA32_PERFEVTSEL0      = 0x186;
+  static constexpr u_int32_t IA32_PERFEVTSEL1      = 0x187;
+  static constexpr u_int32_t IA32_PERFEVTSEL2      = 0x188;
+  static constexpr u_int32_t IA32_PERFEVTSEL3      = 0x189;
+  static constexpr u_int32_t IA32_PERFEVTSEL4      = 0x18a;
+  static constexpr u_int32_t IA32_PERFEVTSEL5      = 0x18b;
+  static constexpr u_int32_t IA32_PERFEVTSEL6      = 0x18c;
+  static constexpr u_int32_t IA32_PERFEVTSEL7      = 0x18d;
 
   // Initial programmable counter values written here
-  const u_int32_t IA32_PMC0             = 0xc1;
-  const u_int32_t IA32_PMC1             = 0xc2;
-  const u_int32_t IA32_PMC2             = 0xc3;
-  const u_int32_t IA32_PMC3             = 0xc4;
-  const u_int32_t IA32_PMC4             = 0xc5;
-  const u_int32_t IA32_PMC5             = 0xc6;
-  const u_int32_t IA32_PMC6             = 0xc7;
-  const u_int32_t IA32_PMC7             = 0xc8;
+  static constexpr u_int32_t IA32_PMC0             = 0xc1;
+  static constexpr u_int32_t IA32_PMC1             = 0xc2;
+  static constexpr u_int32_t IA32_PMC2             = 0xc3;
+  static constexpr u_int32_t IA32_PMC3             = 0xc4;
+  static constexpr u_int32_t IA32_PMC4             = 0xc5;
+  static constexpr u_int32_t IA32_PMC5             = 0xc6;
+  static constexpr u_int32_t IA32_PMC6             = 0xc7;
+  static constexpr u_int32_t IA32_PMC7             = 0xc8;
 
-  const u_int32_t IA32_PERF_GLOBAL_STATUS_RESET = 0x390;
+  static constexpr u_int32_t IA32_PERF_GLOBAL_STATUS_RESET = 0x390;
 
   // Initial fixed counter values written here
-  const u_int32_t IA32_FIXED_CTR0       = 0x309;
-  const u_int32_t IA32_FIXED_CTR1       = 0x30a;
-  const u_int32_t IA32_FIXED_CTR2       = 0x30b;
+  static constexpr u_int32_t IA32_FIXED_CTR0       = 0x309;
+  static constexpr u_int32_t IA32_FIXED_CTR1       = 0x30a;
+  static constexpr u_int32_t IA32_FIXED_CTR2       = 0x30b;
+  static constexpr u_int32_t IA32_FIXED_CTR3       = 0x30c;   // TOPDOWN.SLOTS; 'perfMetrics()' only
 
   // MSR to conifgure fixed counters
-  const u_int32_t IA32_FIXED_CTR_CTRL   = 0x38d;
-  const u_int64_t DEFAULT_FIXED_CONFIG  = 0x222;
+  static constexpr u_int32_t IA32_FIXED_CTR_CTRL   = 0x38d;
+  static constexpr u_int64_t DEFAULT_FIXED_CONFIG  = 0x222;
+  static constexpr u_int64_t FIXED_CTR3_CONFIG     = 0x2000;  // fixed counter 3 user mode bits 12-15
+
+  // Top-down level 1 fractions of fixed counter 3's slots: 'doc/intel_msr.pdf' IA32_PERF_METRICS
+  static constexpr u_int32_t IA32_PERF_CAPABILITIES = 0x345;
+  static constexpr u_int32_t IA32_PERF_METRICS      = 0x329;
+  static constexpr u_int64_t PERF_METRICS_AVAILABLE = (1ull<<15); // IA32_PERF_CAPABILITIES bit
+  static constexpr u_int64_t FIXEDCTR3_ENABLE       = (1ull<<35); // IA32_PERF_GLOBAL_CTRL bit
+  static constexpr u_int64_t PERF_METRICS_ENABLE    = (1ull<<48); // IA32_PERF_GLOBAL_CTRL bit
 
   // Overflow masks for programmable counter 0, fixed counter 0
   // The others are generated by left shifting 
-  const u_int64_t PMC0_OVERFLOW_MASK      = (1ull<<0);  // 'doc/intel_msr.pdf p287'                                      
-  const u_int64_t FIXEDCTR0_OVERFLOW_MASK = (1ull<<32); // 'doc/intel_msr.pdf p287'                                      
+  static constexpr u_int64_t PMC0_OVERFLOW_MASK      = (1ull<<0);  // 'doc/intel_msr.pdf p287'                                      
+  static constexpr u_int64_t FIXEDCTR0_OVERFLOW_MASK = (1ull<<32); // 'doc/intel_msr.pdf p287'                                      
 
+private:
   // DATA
   int       d_fid;                             // file handle for MSR read/write
+  int       d_batchFid;                        // file handle for msr-safe batch device or -1 if not available
+  int       d_status;                          // 0 if construction succeeded else errno-style reason
   u_int16_t d_cnt;                             // # programmable counters in use [0, k_MAX_PROG_COUNTERS_HT_OFF)
   u_int64_t d_fcfg;                            // configuration for all fixed counters
   u_int64_t d_pcfg[k_MAX_PROG_COUNTERS_HT_OFF];// configuration for each programmable counter in [0, d_cnt)
-  
+  std::string d_msrRoot;                       // directory holding '<cpu>/msr' and 'msr_batch' device files
+  MSRPlan   d_resetPlan;                       // MSR writes run by 'reset()' built once at construction
+  MSRPlan   d_startPlan;                       // MSR writes run by 'start()' built once at construction
+  MSRPlan   d_pausePlan;                       // MSR writes run by 'pause()' built once at construction
+  MSRPlan   d_programPlan;                     // MSR writes run by 'program()' to switch programmable events
+  bool      d_paused;                          // true if 'pause()' ran without a matching 'resume()'
+  u_int64_t d_pauseStart;                      // rdtsc value when the current pause began
+  u_int64_t d_pausedCycles;                    // rdtsc cycles spent in completed pauses since 'reset()'
+  u_int16_t d_fixedWidth;                      // bit width of fixed counters per CPUID leaf 0xA
+  u_int16_t d_progWidth;                       // bit width of programmable counters per CPUID leaf 0xA
+  u_int64_t d_fixedMask;                       // '(1<<d_fixedWidth)-1'
+  u_int64_t d_progMask;                        // '(1<<d_progWidth)-1'
+  Capability d_capability;                     // host PMU capabilities probed at construction
+  Backend   d_backend;                         // how counters are programmed and read
+  u_int16_t d_fixedCnt;                        // # fixed counters in use; 0 or k_FIXED_COUNTERS
+  PerfEvents *d_perf;                          // events of 'k_BACKEND_PERF' or 0 for 'k_BACKEND_MSR'
+  bool      d_topdown;                         // true if constructed with 'k_TOPDOWN_XEON_CONFIG'
+  bool      d_perfMetrics;                     // true if fixed counter 3 and IA32_PERF_METRICS are enabled
+  const Rapl *d_rapl;                          // energy counters 'snapshot' also reads or 0 if none
+  const Frequency *d_frequency;                // APERF/MPERF and throttle bits 'snapshot' also reads or 0 if none
+
   // Pretty-print helper data
   std::vector<std::string> d_fixedMnemonic;    // Nickname for fixed counters e.g. 'F3' for counter 3
   std::vector<std::string> d_fixedDescription; // Full description e.g. 'Reference no-halt cycles'
@@ -114,18 +204,94 @@ private:
   // Pretty-print helper data
   std::vector<std::string> d_progMnemonic;     // Nickname for programmable counters e.g. 'P3' for counter 3
   std::vector<std::string> d_progDescription;  // Full description e.g. 'LLC cache misses'
+  std::vector<PerfEvent>   d_progEvent;        // perf events given at construction; empty if IA32_PERFEVTSEL values
 
 public:
+  // CLASS METHODS
+  static int check(const Capability& capability, u_int16_t count, const u_int64_t *eventSelect);
+    // Return 0 if specified 'count' programmable counters configured per specified 'eventSelect' can run on a host
+    // with specified 'capability', and non-zero otherwise with a diagnostic on stderr: EINVAL if 'count' exceeds
+    // 'capability.programmableBudget()', ENOTSUP if an architectural event is marked unavailable. If
+    // '!capability.known()' only 'count<=k_MAX_PROG_COUNTERS_HT_OFF' is checked. Non-architectural events can't be
+    // checked from CPUID.
+
+  static void counterWidth(u_int16_t *fixed, u_int16_t *programmable);
+    // Write into specified 'fixed' and 'programmable' the bit widths of the fixed and programmable counters reported
+    // by CPUID leaf 0xA, or 'k_DEFAULT_COUNTER_WIDTH' for any width the host doesn't report e.g. in a VM. rdpmc and
+    // MSR reads return values in '[0, 2^width)' and counters wrap to 0 at '2^width'. CPUID runs once per process;
+    // see 'Capability::host'.
+
+  static void counterWidth(const Capability& capability, u_int16_t *fixed, u_int16_t *programmable);
+    // As per the above method for a host with specified 'capability'
+
+  static u_int16_t configCount(ProgCounterSetConfig config, const Capability& capability);
+    // Return the number of programmable counters specified 'config' defines on a host with specified 'capability',
+    // or 0 if 'config' is undefined. 'k_AUTO_XEON_CONFIG' takes 'capability.programmableBudget()' of config 1's
+    // events, all 8 if '!capability.known()'. The result may exceed what 'check' accepts e.g. config 1 with hyper
+    // threading ON.
+
+  static const u_int64_t *configEventSelect(ProgCounterSetConfig config);
+    // Return the IA32_PERFEVTSEL values of the programmable counters of specified 'config' in counter order, the
+    // first 'configCount' of which a PMU constructed with 'config' programs, or 0 if 'config' is undefined
+
+  static const char *const *configDescription(ProgCounterSetConfig config);
+    // Return the descriptions of the events of 'configEventSelect' for specified 'config', or 0 if undefined
+
+  static PerfEvent fixedEvent(u_int16_t counter);
+    // Return the generic hardware perf event specified fixed 'counter' counts: retired instructions, core cycles, or
+    // reference cycles. Both backends count these. The behavior is defined if 'counter<k_FIXED_COUNTERS'.
+
+  static void buildPlans(int cpu, u_int64_t fixedConfig, u_int16_t count, const u_int64_t *eventSelect,
+                         bool perfMetrics, bool paused, MSRPlan *reset, MSRPlan *start, MSRPlan *pause,
+                         MSRPlan *program);
+    // Build into specified 'reset', 'start', 'pause' and, unless 0, 'program' the MSR writes for specified 'cpu' to
+    // run all fixed counters configured per specified 'fixedConfig' and specified 'count' programmable counters
+    // configured per specified 'eventSelect', with fixed counter 3 and IA32_PERF_METRICS if specified 'perfMetrics'.
+    // Specified 'paused' leaves counters stopped after 'program' runs. Shared by every class programming counters
+    // through MSRs. The behavior is defined if 'count<=k_MAX_PROG_COUNTERS_HT_OFF'.
+
   // CREATORS
   PMU() = delete;
     // Default constructor not provided
 
-  explicit PMU(ProgCounterSetConfig config);
+  explicit PMU(ProgCounterSetConfig config, const std::string& msrRoot = "/dev/cpu");
     // Create a PMU object to run all fixed counters and programmable counters according to specified enumerated
-    // value 'config'. The behavior is defined `config` is compatible for the host PMU hardware and HT (hyper
-    // threading) configuration. See `doc/pmu.md` background. Upon return callers should run `reset`. Note this
+    // value 'config'. If 'config' doesn't fit the host PMU hardware and HT (hyper threading) configuration per
+    // 'check', a diagnostic is printed on stderr, no programmable counters are defined, and 'status()' is non-zero.
+    // See `doc/pmu.md` background. Upon return callers should run `reset`. Note this
     // method unconditionally pins the caller's thread to the current, running core. If the thread was already
-    // pinned before entry here, or the PID was run taskset, this behavior will have no effect.
+    // pinned before entry here, or the PID was run taskset, this behavior will have no effect. Optionally specify
+    // 'msrRoot' to read/write '<msrRoot>/<coreId>/msr' instead of the Linux MSR device e.g. a file-backed fake.
+
+  PMU(ProgCounterSetConfig config, Backend backend);
+    // Create a PMU object as per the above constructor programmed through specified 'backend'. With
+    // 'k_BACKEND_PERF' fixed counters are the generic instructions, cycles, and reference cycles events and each
+    // programmable counter is the raw event of its IA32_PERFEVTSEL value, all counting the calling thread on any
+    // cpu; the thread isn't pinned. If the kernel refuses an event, a diagnostic is printed on stderr and 'status()'
+    // is non-zero.
+
+  PMU(const std::vector<PerfEvent>& event, bool fixed = true);
+    // Create a PMU object with backend 'k_BACKEND_PERF' running one programmable counter per perf event in specified
+    // 'event' e.g. 'PerfEvent::software(PERF_COUNT_SW_PAGE_FAULTS, "page faults")', and the fixed counters unless
+    // optionally specified 'fixed' is false e.g. on hosts or VMs without a PMU where only software events exist.
+    // Otherwise as per the above constructor. The behavior is defined if 'event.size()<=k_MAX_PROG_COUNTERS_HT_OFF'.
+
+  PMU(u_int16_t count, const u_int64_t *eventSelect, const char *const *description,
+      const std::string& msrRoot = "/dev/cpu");
+    // Create a PMU object to run all fixed counters and specified 'count' programmable counters where counter 'i' is
+    // configured with IA32_PERFEVTSEL value 'eventSelect[i]' and described by 'description[i]'. See 'EventSelect' in
+    // 'intel_xeon_events.h' to make 'eventSelect' values. The behavior is defined if the events are compatible with
+    // the host PMU. Otherwise as per the above constructor.
+
+  PMU(const EventCatalog& catalog, const std::vector<std::string>& eventName,
+      const std::string& msrRoot = "/dev/cpu");
+    // Create a PMU object to run all fixed counters and one programmable counter per perfmon event name in specified
+    // 'eventName' e.g. "LONGEST_LAT_CACHE.MISS" looked up in specified 'catalog'. Counter descriptions are the
+    // perfmon brief descriptions. Events perfmon restricts to some counters are placed on one of those per
+    // 'EventCatalog::place', so counter 'i' counts 'eventName[i]' unless a restricted event needed its counter. If any
+    // name is unknown, is a fixed counter event, needs an extra MSR, can't be placed, or there are more than
+    // 'k_MAX_PROG_COUNTERS_HT_OFF' names, a diagnostic is printed on stderr, no programmable counters are defined,
+    // and 'status()' is non-zero. Otherwise as per the first constructor.
 
   ~PMU();
     // Destroy this object.
@@ -134,11 +300,25 @@ public:
     // Copy constructor is not supported.
 
   // ACCESSORS
+  int status() const;
+    // Return 0 if this object was constructed as requested and an errno value otherwise. 'reset()' fails with this
+    // value without touching any MSR if it is non-zero.
+
+  const Capability& capability() const;
+    // Return a non-modifiable reference to the host PMU capabilities probed at construction
+
+  Backend backend() const;
+    // Return how counters are programmed and read
+
+  const PerfEvents *perfEvents() const;
+    // Return the perf events read by 'k_BACKEND_PERF' or 0 for 'k_BACKEND_MSR'
+
   int coreId() const;
     // Return the pinned HW core number (zero-based) of the caller.
 
   u_int16_t fixedCountersDefined() const;
-    // Return the number of fixed, distinct counters the `config` set at construction time configured.
+    // Return the number of fixed, distinct counters the `config` set at construction time configured: 3, or 0 for a
+    // 'k_BACKEND_PERF' PMU constructed without them.
 
   u_int16_t programmableCountersDefined() const;
     // Return the number of fixed, distinct programmable counters the `config` at constrction time configured.
@@ -156,13 +336,65 @@ public:
     // is defined provided 'start()' or 'reset()' previously ran without error, and if 'counter' is in the range
     // '0<=counter<fixedCountersDefined()'.
 
+  void snapshot(Snapshot *snap, FencePolicy fence = k_FENCE_MFENCE_LFENCE) const;
+    // Write into specified 'snap' rdtsc and the current value of every defined fixed and programmable counter on the
+    // HW core given by 'coreId()'. Serialization per specified 'fence' runs once, then all values are read back-to-back
+    // in one unrolled sequence. 'snap->d_aux' gets the cpu read on: 'rdtscp' writes it with the TSC atomically, other
+    // fences read it with 'rdpid' right after 'rdtsc', or on targets built without RDPID with an 'rdtscp' after the
+    // last counter read whose TSC is discarded. The energy counters of 'setRapl' and the frequency MSRs of
+    // 'setFrequency' are read after the counters so their cost falls outside a region this snapshot ends. The
+    // behavior is defined provided 'start()' or 'reset()' previously ran without error.
+
+  void snapshotBegin(Snapshot *snap, FencePolicy fence = k_FENCE_MFENCE_LFENCE) const;
+    // Same as 'snapshot' except the energy counters and frequency MSRs are read before the counters so their cost
+    // falls outside a region this snapshot begins. Use it for the first snapshot of a begin/end pair.
+
+  template <FencePolicy FENCE, u_int16_t COUNT>
+  void snapshot(Snapshot *snap) const;
+    // Same as the above 'snapshot' except the fence policy and programmable counter count are compile time constants
+    // so there is no dispatch. The behavior is defined if 'COUNT==programmableCountersDefined()'.
+
+  template <FencePolicy FENCE, u_int16_t COUNT>
+  void snapshotBegin(Snapshot *snap) const;
+    // Same as the above 'snapshotBegin' with compile time constants as per the above 'snapshot'
+
+  u_int16_t fixedCounterWidth() const;
+    // Return the bit width of the fixed counters. See 'counterWidth'
+
+  u_int16_t programmableCounterWidth() const;
+    // Return the bit width of the programmable counters. See 'counterWidth'
+
+  u_int64_t fixedCounterMask() const;
+    // Return the mask of the valid bits of fixed counter values. '(now-before) & fixedCounterMask()' is the count
+    // between two reads even if the counter wrapped once in between. All ones for 'k_BACKEND_PERF' whose values are
+    // the kernel's 64-bit virtual counts.
+
+  u_int64_t programmableCounterMask() const;
+    // Return the mask of the valid bits of programmable counter values. See 'fixedCounterMask'
+
+  int overflowStatus(u_int64_t *value) const;
+    // Return 0 and write into specified 'value' the contents of the SkyLake IA32_PERF_GLOBAL_STATUS MSR on success and
+    // non-zero otherwise. See IR p708 figure 19-10 for interpretation of value. This is one MSR read for all counters;
+    // decode it with the two argument '*Overflowed' methods. 'k_BACKEND_PERF' counts don't overflow so 'value' is 0.
+
   bool fixedCounterOverflowed(u_int16_t counter) const;
     // Return true if specified fixed 'counter' overflowed and false otherwise. The behavior is defined provided
-    // 'start()' or 'reset()' previously ran without error, and if 'counter' is in `[0, fixedCountersDefined()]`.
+    // 'start()' or 'reset()' previously ran without error, and if 'counter' is in `[0, fixedCountersDefined())`.
+    // Each call is one MSR read; to test several counters read 'overflowStatus' once instead.
+
+  bool fixedCounterOverflowed(u_int16_t counter, u_int64_t status) const;
+    // Return true if specified fixed 'counter' is marked overflowed in specified 'status' read by 'overflowStatus'
+    // and false otherwise. The behavior is defined if 'counter' is in `[0, fixedCountersDefined())`.
 
   bool programmableCounterOverflowed(u_int16_t counter) const;
     // Return true if specified programmable 'counter' overflowed and false otherwise. The behavior is defined provided
-    // 'start()' or 'reset()' previously ran without error, and if 'counter' is in `[0, programmableCountersDefined()]`
+    // 'start()' or 'reset()' previously ran without error, and if 'counter' is in `[0, programmableCountersDefined())`
+    // Each call is one MSR read; to test several counters read 'overflowStatus' once instead.
+
+  bool programmableCounterOverflowed(u_int16_t counter, u_int64_t status) const;
+    // Return true if specified programmable 'counter' is marked overflowed in specified 'status' read by
+    // 'overflowStatus' and false otherwise. The behavior is defined if 'counter' is in
+    // `[0, programmableCountersDefined())`.
 
   const std::vector<std::string>& fixedMnemonic() const;
     // Return a non-modifiable reference to an array of mnemonic names assigned by this class at construction time for
@@ -180,6 +412,45 @@ public:
     // Return a non-modifiable reference to an array of human readable descritions assigned by this class at
     // construction time for the programmable counters. 
 
+  PerfEvent programmableEvent(u_int16_t counter) const;
+    // Return the event specified programmable 'counter' counts as a perf event: the perf event given at construction,
+    // or 'PerfEvent::raw' of its IA32_PERFEVTSEL value. Identifies what was counted e.g. in a trace. The behavior is
+    // defined if 'counter<programmableCountersDefined()'.
+
+  bool batched() const;
+    // Return true if 'reset' and 'start' apply their MSR writes in one kernel crossing through the msr-safe batch
+    // device, and false if they fall back to one 'pwrite' per MSR. The result is meaningful after 'reset()'.
+
+  const MSRPlan& resetPlan() const;
+    // Return a non-modifiable reference to the MSR writes 'reset()' applies
+
+  const MSRPlan& startPlan() const;
+    // Return a non-modifiable reference to the MSR writes 'start()' applies
+
+  bool paused() const;
+    // Return true if counting is paused by 'pause()' and false otherwise
+
+  u_int64_t pausedCycles() const;
+    // Return the total rdtsc cycles counters were paused since the last 'reset()' including the current pause if any.
+    // Subtract from elapsed rdtsc cycles to get the rdtsc cycles counters were active.
+
+  bool perfMetrics() const;
+    // Return true if fixed counter 3 (TOPDOWN.SLOTS) and IA32_PERF_METRICS count along with the other counters, and
+    // false otherwise. Only 'k_TOPDOWN_XEON_CONFIG' MSR PMUs enable them, on hosts whose CPUID reports PMU version 5
+    // or later with 4 fixed counters and the slots event, and whose IA32_PERF_CAPABILITIES reports PERF_METRICS. The
+    // result is meaningful after 'reset()'.
+
+  void topDownMetrics(u_int64_t *slots, u_int64_t *metrics) const;
+    // Write into specified 'slots' fixed counter 3 and into specified 'metrics' IA32_PERF_METRICS, both read with
+    // 'rdpmc'. Byte 0 of 'metrics' is the retiring, 1 the bad speculation, 2 the front end bound, and 3 the back end
+    // bound share of 'slots' since 'reset()' in 255ths. The behavior is defined if 'perfMetrics()'.
+
+  const Rapl *rapl() const;
+    // Return the energy counters 'snapshot' reads per 'setRapl', or 0 if none
+
+  const Frequency *frequency() const;
+    // Return the frequency and throttle MSRs 'snapshot' reads per 'setFrequency', or 0 if none
+
   // MANIPULATORS
   int reset();
     // Return zero if all counters requested at construction time are stopped, configured, and reset to 0. The counters
@@ -188,30 +459,102 @@ public:
   int start();
     // Return 0 if all fixed Skylake counters, and all defined programmable counters defined at construction time 
     // are running and non-zero otherwise. The behavior is defined provided 'reset()' previously ran without error.
-    // Counters run until 'reset' is called.
+    // Counters run until 'reset' is called. Since 'reset' already configured the counters, this is one MSR write
+    // enabling every counter at the same instant.
+
+  int pause();
+    // Return 0 if all counters stopped counting and non-zero otherwise. Counter values are kept. This is one write
+    // to IA32_PERF_GLOBAL_CTRL; there is no user-space path to write MSRs. The behavior is defined provided
+    // 'start()' previously ran without error and counting is not paused.
+
+  int resume();
+    // Return 0 if all counters stopped by 'pause()' resumed counting from their paused values and non-zero otherwise.
+    // This is one write to IA32_PERF_GLOBAL_CTRL. The behavior is defined provided counting is paused.
+
+  int program(u_int16_t count, const u_int64_t *eventSelect, const char *const *description);
+    // Return 0 if the programmable counters were reconfigured to specified 'count' counters where counter 'i' counts
+    // IA32_PERFEVTSEL value 'eventSelect[i]' described by 'description[i]', and non-zero otherwise. If 'reset()' ran,
+    // programmable counters are stopped, reconfigured, zeroed, and restarted unless paused. With 'k_BACKEND_MSR'
+    // fixed counters keep counting throughout; with 'k_BACKEND_PERF' the whole event group, fixed events included,
+    // is disabled while the events are swapped, so counts of the swap itself are missed. If 'reset()' didn't run
+    // the new configuration takes effect at the next 'reset()'. The events are validated by 'check' against
+    // 'capability()' first, and on 'k_BACKEND_PERF' all opened before anything is committed; if either fails the
+    // configuration is unchanged and the previous events, reopened and zeroed, count again.
 
   bool overflow();
     // Return true if any fixed or programmable counter overflowed, and false otherwise.
 
+  void setRapl(const Rapl *rapl);
+    // Make 'snapshot' also read the energy counters of specified 'rapl' into 'Snapshot::d_energy', or stop reading
+    // them if 'rapl' is 0. That adds one MSR read per available domain, microseconds, after the counters in
+    // 'snapshot' and before them in 'snapshotBegin', so a begin/end pair keeps those reads out of the region and the
+    // counters' skew is unchanged. A snapshot that both ends one region and begins the next e.g. 'Stats::record()'
+    // still puts them in the next region. 'rapl' must outlive its use here. The behavior is defined if 'rapl' is 0 or
+    // its 'status()' is 0.
+
+  void setFrequency(const Frequency *frequency);
+    // Make 'snapshot' also read IA32_APERF, IA32_MPERF, and the throttle bits of specified 'frequency' into
+    // 'Snapshot::d_aperf', 'd_mperf', and 'd_throttle', or stop reading them if 'frequency' is 0. That adds three or
+    // four MSR reads next to the energy counters: after the counters in 'snapshot' and before them in
+    // 'snapshotBegin', as per 'setRapl'. 'frequency' must read the cpu the caller is pinned
+    // to and outlive its use here. The behavior is defined if 'frequency' is 0 or its 'status()' is 0.
+
   PMU& operator=(const PMU& rhs) = delete;
     // Assignment operator not supported
 
   // ASPECTS
   std::ostream& print(std::ostream& stream) const;
     // Pretty print to stdout a human readable snapshot of counters defined at construction time and their current
-    // values with overflow status to specified 'stream'.
+    // values with overflow status to specified 'stream'. rdtsc is also shown in nanoseconds per 'TscClock::instance()'.
 
 private:
+  // PRIVATE ACCESSORS
+  template <FencePolicy FENCE, bool BEGIN>
+  void snapshotByCount(Snapshot *snap) const;
+    // Call 'snapshotBegin<FENCE, COUNT>' if 'BEGIN' else 'snapshot<FENCE, COUNT>' for specified 'snap' with 'COUNT'
+    // equal to 'programmableCountersDefined()'
+
+  template <FencePolicy FENCE, u_int16_t COUNT>
+  void readCounters(Snapshot *snap) const;
+    // Write rdtsc, the cpu, every defined counter, and the paused cycles into specified 'snap' per 'snapshot'
+
+  void readEnergy(Snapshot *snap) const;
+    // Write the energy counters of 'd_rapl' into specified 'snap', or zeros if 'd_rapl' is 0
+
+  void readFrequency(Snapshot *snap) const;
+    // Write APERF, MPERF, and the throttle bits of 'd_frequency' into specified 'snap', or zeros if 'd_frequency' is 0
+
+  template <FencePolicy FENCE>
+  void snapshotPerf(Snapshot *snap) const;
+    // 'readCounters' for 'k_BACKEND_PERF': rdtsc after 'FENCE', then every event through 'PerfEvents::read'
+
   // PRIVATE MANIPULATORS
+  void initialize(ProgCounterSetConfig config);
+    // Call 'initialize' below with the events of specified 'config'. Shared by the constructors taking a config.
+
+  void initialize(u_int16_t count, const u_int64_t *eventSelect, const char *const *description,
+                  const std::vector<PerfEvent> *perfEvent = 0);
+    // Pin the caller, name all counters, and configure specified 'count' programmable counters per specified
+    // 'eventSelect' and 'description' arrays of 'count' entries. Shared by the constructors. With 'k_BACKEND_PERF'
+    // the caller isn't pinned and 'openPerf' runs instead of 'makePlans' with optionally specified 'perfEvent' if not
+    // 0, in which case 'eventSelect' is ignored, and raw events of 'eventSelect' otherwise.
+
+  void openPerf(const std::vector<PerfEvent>& event);
+    // Open the fixed counter events if 'd_fixedCnt' is non-zero then specified programmable 'event's into a new
+    // 'd_perf' unless 'status()' is already non-zero. On failure set 'd_status' and leave no counters defined.
+
+  int reprogramPerf(u_int16_t count, const u_int64_t *eventSelect, const char *const *description);
+    // Return 0 if the programmable events of 'd_perf' were replaced by specified 'count' raw events of specified
+    // 'eventSelect' values described by specified 'description' and the group restarted unless paused, and errno
+    // otherwise. On failure the events of 'programmableEvent' are reopened, zeroed, and the group restarted unless
+    // paused, so 'd_perf' still holds an event per counter defined. Changes no counter state unless an old event
+    // can't be reopened, in which case the counters defined shrink to those that were.
+
   int pinToHWCore(int coreId);                                                                                   
     // Return 0 if the the current/caller thread was pinned to 'coreId' and non-zero errno otherwise. Behavior is
     // defined provided 'coreId>=0' and 'coreId' is less than the total number of cores available in the underlying
     // HW as reported by 'cat /proc/cpuinfo'. Note this routine only enforces the minimum bound.
 
-  int overflowStatus(u_int64_t *value) const;
-    // Return 0 and write into specified 'value' the contents of the SkyLake IA32_PERF_GLOBAL_STATUS MSR on success and
-    // non-zero otherwise. See IR p708 figure 19-10 for interpretation of value.
-
   int rdmsr(u_int32_t reg, u_int64_t *value);
     // Return 0 if read into specified 'value' the contents of specified MSR 'reg' on the HW-core previously chosen
     // by 'open' and non-zero otherwise.
@@ -220,26 +563,411 @@ private:
     // Return 0 if wrote specified 'data' into specified MSR 'reg' on the HW-core previously chosen by 'open' and
     // non-zero otherwise.
 
+  int apply(MSRPlan *plan);
+    // Return 0 if all writes in specified 'plan' were applied on the HW-core previously chosen by 'open' and non-zero
+    // otherwise. The batch device is used if open; if the host rejects batching it's closed and 'pwrite' is used.
+
+  void makePlans(int cpu);
+    // Build 'd_resetPlan', 'd_startPlan', 'd_pausePlan' and 'd_programPlan' for specified 'cpu' from the counter
+    // configuration
+
   int open(int cpu);
     // Return 0 if the MSR system file for specified 'cpu' was successfully opened. Class member 'd_fid' will hold
-    // the file handle to it.
+    // the file handle to it. The msr-safe batch device is opened into 'd_batchFid' if present; its absence is not
+    // an error.
+
+  void probePerfMetrics();
+    // Set 'd_perfMetrics' and rebuild the plans with fixed counter 3 and IA32_PERF_METRICS if 'd_topdown' and the
+    // host has them. The behavior is defined if 'open' ran without error.
 };
 
+static_assert((int)Snapshot::k_FIXED_COUNTERS==(int)PMU::k_FIXED_COUNTERS, "Snapshot and PMU disagree");
+static_assert((int)Snapshot::k_MAX_PROG_COUNTERS==(int)PMU::k_MAX_PROG_COUNTERS_HT_OFF, "Snapshot and PMU disagree");
+
 // FREE OPERATORS
 std::ostream& operator<<(std::ostream& stream, const PMU& object);
   // Print into specified 'stream' human readable dump of 'object' returning 'stream'
 
 // INLINE DEFINITIONS
+// CLASS METHODS
+inline
+void PMU::counterWidth(u_int16_t *fixed, u_int16_t *programmable) {
+  assert(fixed);
+  assert(programmable);
+
+  counterWidth(Capability::host(), fixed, programmable);
+}
+
+inline
+void PMU::counterWidth(const Capability& capability, u_int16_t *fixed, u_int16_t *programmable) {
+  assert(fixed);
+  assert(programmable);
+
+  *programmable = capability.programmableWidth()>0 ? capability.programmableWidth() :
+    (u_int16_t)k_DEFAULT_COUNTER_WIDTH;
+  *fixed = capability.fixedWidth()>0 ? capability.fixedWidth() : (u_int16_t)k_DEFAULT_COUNTER_WIDTH;
+}
+
+inline
+u_int16_t PMU::configCount(ProgCounterSetConfig config, const Capability& capability) {
+  switch (config) {
+    case k_DEFAULT_XEON_CONFIG_0:
+    case k_TOPDOWN_XEON_CONFIG:
+      return 4;
+    case k_DEFAULT_XEON_CONFIG_1:
+      return 8;
+    case k_AUTO_XEON_CONFIG: {
+      // As many as the host allows; all 8 if the PMU isn't reported e.g. under a fake MSR device
+      const u_int16_t budget = capability.known() ? capability.programmableBudget() : 8;
+      return budget<8 ? budget : 8;
+    }
+    default:
+      return 0;
+  }
+}
+
+inline
+const u_int64_t *PMU::configEventSelect(ProgCounterSetConfig config) {
+  // Config 0 is the first four counters of config 1
+  static const u_int64_t k_DEFAULT[] = {
+    Events::LLC_REFERENCE::k_VALUE,
+    Events::LLC_MISS::k_VALUE,
+    Events::BRANCHES::k_VALUE,
+    Events::BRANCHES_NOT_TAKEN::k_VALUE,
+    Events::DTLB_LOAD_WALK::k_VALUE,
+    Events::DTLB_STORE_WALK::k_VALUE,
+    Events::LOADS::k_VALUE,
+    Events::STORES::k_VALUE,
+  };
+  static const u_int64_t k_TOPDOWN[] = {
+    Events::IDQ_UOPS_NOT_DELIVERED::k_VALUE,
+    Events::UOPS_ISSUED::k_VALUE,
+    Events::RETIRE_SLOTS::k_VALUE,
+    Events::RECOVERY_CYCLES::k_VALUE,
+  };
+
+  switch (config) {
+    case k_DEFAULT_XEON_CONFIG_0:
+    case k_DEFAULT_XEON_CONFIG_1:
+    case k_AUTO_XEON_CONFIG:
+      return k_DEFAULT;
+    case k_TOPDOWN_XEON_CONFIG:
+      return k_TOPDOWN;
+    default:
+      return 0;
+  }
+}
+
+inline
+const char *const *PMU::configDescription(ProgCounterSetConfig config) {
+  static const char *const k_DEFAULT[] = {
+    Events::LLC_REFERENCE::k_DESCRIPTION,
+    Events::LLC_MISS::k_DESCRIPTION,
+    Events::BRANCHES::k_DESCRIPTION,
+    Events::BRANCHES_NOT_TAKEN::k_DESCRIPTION,
+    Events::DTLB_LOAD_WALK::k_DESCRIPTION,
+    Events::DTLB_STORE_WALK::k_DESCRIPTION,
+    Events::LOADS::k_DESCRIPTION,
+    Events::STORES::k_DESCRIPTION,
+  };
+  static const char *const k_TOPDOWN[] = {
+    Events::IDQ_UOPS_NOT_DELIVERED::k_DESCRIPTION,
+    Events::UOPS_ISSUED::k_DESCRIPTION,
+    Events::RETIRE_SLOTS::k_DESCRIPTION,
+    Events::RECOVERY_CYCLES::k_DESCRIPTION,
+  };
+
+  switch (config) {
+    case k_DEFAULT_XEON_CONFIG_0:
+    case k_DEFAULT_XEON_CONFIG_1:
+    case k_AUTO_XEON_CONFIG:
+      return k_DEFAULT;
+    case k_TOPDOWN_XEON_CONFIG:
+      return k_TOPDOWN;
+    default:
+      return 0;
+  }
+}
+
+inline
+PerfEvent PMU::fixedEvent(u_int16_t counter) {
+  assert(counter<k_FIXED_COUNTERS);
+  static const u_int64_t k_ID[k_FIXED_COUNTERS] = {
+    PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_REF_CPU_CYCLES,
+  };
+  static const char *const k_DESCRIPTION[k_FIXED_COUNTERS] = {
+    "retired instructions", "no-halt cpu cycles", "reference no-halt cpu cycles",
+  };
+  return PerfEvent::hardware(k_ID[counter], k_DESCRIPTION[counter]);
+}
+
+inline
+int PMU::check(const Capability& capability, u_int16_t count, const u_int64_t *eventSelect) {
+  if (count>k_MAX_PROG_COUNTERS_HT_OFF) {
+    fprintf(stderr, "Error: %u programmable counters requested; at most %d supported\n", count,
+      (int)k_MAX_PROG_COUNTERS_HT_OFF);
+    return EINVAL;
+  }
+
+  if (!capability.known()) {
+    return 0;
+  }
+
+  if (count>capability.programmableBudget()) {
+    fprintf(stderr, "Error: %u programmable counters requested; host allows %u (PMU v%u, %u counters, "
+      "hyper threading %s)\n", count, capability.programmableBudget(), capability.version(),
+      capability.programmableCounters(), capability.hyperThreading() ? "ON" : "OFF");
+    return EINVAL;
+  }
+
+  for (u_int16_t i=0; i<count; ++i) {
+    for (u_int16_t e=0; e<Capability::k_ARCH_EVENTS; ++e) {
+      const Capability::ArchEvent event = static_cast<Capability::ArchEvent>(e);
+      if ((eventSelect[i] & 0xffff)==Capability::archEventSelect(event) && !capability.supports(event)) {
+        fprintf(stderr, "Error: programmable counter %u event select 0x%lx: architectural event %u unavailable\n",
+          i, eventSelect[i], e);
+        return ENOTSUP;
+      }
+    }
+  }
+
+  return 0;
+}
+
+inline
+void PMU::buildPlans(int cpu, u_int64_t fixedConfig, u_int16_t count, const u_int64_t *eventSelect, bool perfMetrics,
+                     bool paused, MSRPlan *reset, MSRPlan *start, MSRPlan *pause, MSRPlan *program) {
+  assert(count<=k_MAX_PROG_COUNTERS_HT_OFF);
+  assert(reset);
+  assert(start);
+  assert(pause);
+
+  // Stop everything first. Then configure, zero values, and clear overflow bits while stopped. IA32_PERF_GLOBAL_CTRL
+  // is the single point where all counters start so no counter sees another counter's setup.
+  u_int64_t enable = 0x700000000; // 'doc/pmd.md' discusses this number in detail
+  for(u_int16_t i = 0; i < count; ++i) {
+    enable |= (1<<i);
+  }
+  if (perfMetrics) {
+    enable |= FIXEDCTR3_ENABLE | PERF_METRICS_ENABLE;
+  }
+
+  reset->clear(cpu);
+  reset->append(IA32_PERF_GLOBAL_CTRL, 0);
+  reset->append(IA32_FIXED_CTR_CTRL, fixedConfig);
+  for(u_int16_t i = 0; i < count; ++i) {
+    reset->append(IA32_PERFEVTSEL0+i, eventSelect[i]);
+  }
+  for(u_int16_t i = 0; i < count; ++i) {
+    reset->append(IA32_PMC0+i, 0);
+  }
+  for(u_int16_t i = 0; i < k_FIXED_COUNTERS; ++i) {
+    reset->append(IA32_FIXED_CTR0+i, 0);
+  }
+  if (perfMetrics) {
+    // Metrics are shares of the slots counted since both were last zeroed
+    reset->append(IA32_FIXED_CTR3, 0);
+    reset->append(IA32_PERF_METRICS, 0);
+  }
+  // Set bits clear corresponding overflow bits in IA32_PERF_GLOBAL_STATUS
+  reset->append(IA32_PERF_GLOBAL_STATUS_RESET, enable);
+
+  start->clear(cpu);
+  start->append(IA32_PERF_GLOBAL_CTRL, enable);
+
+  pause->clear(cpu);
+  pause->append(IA32_PERF_GLOBAL_CTRL, 0);
+
+  if (program==0) {
+    return;
+  }
+
+  // Fixed counters keep running while programmable counters switch events
+  const u_int64_t fixedOnly = enable & ~0xffull;
+  program->clear(cpu);
+  program->append(IA32_PERF_GLOBAL_CTRL, paused ? 0 : fixedOnly);
+  for(u_int16_t i = 0; i < count; ++i) {
+    program->append(IA32_PERFEVTSEL0+i, eventSelect[i]);
+  }
+  for(u_int16_t i = 0; i < count; ++i) {
+    program->append(IA32_PMC0+i, 0);
+  }
+  program->append(IA32_PERF_GLOBAL_STATUS_RESET, enable & 0xffull);
+  program->append(IA32_PERF_GLOBAL_CTRL, paused ? 0 : enable);
+}
+
 // CREATORS
 inline
-PMU::PMU(ProgCounterSetConfig config)
+PMU::PMU(ProgCounterSetConfig config, const std::string& msrRoot)
+: d_fid(-1)
+, d_batchFid(-1)
+, d_status(0)
+, d_cnt(0)
+, d_fcfg(DEFAULT_FIXED_CONFIG)
+, d_msrRoot(msrRoot)
+, d_capability(Capability::host())
+, d_backend(k_BACKEND_MSR)
+, d_fixedCnt(k_FIXED_COUNTERS)
+, d_perf(0)
+, d_topdown(false)
+, d_perfMetrics(false)
+, d_rapl(0)
+, d_frequency(0)
+{
+  initialize(config);
+}
+
+inline
+PMU::PMU(ProgCounterSetConfig config, Backend backend)
+: d_fid(-1)
+, d_batchFid(-1)
+, d_status(0)
+, d_cnt(0)
+, d_fcfg(DEFAULT_FIXED_CONFIG)
+, d_msrRoot("/dev/cpu")
+, d_capability(Capability::host())
+, d_backend(backend)
+, d_fixedCnt(k_FIXED_COUNTERS)
+, d_perf(0)
+, d_topdown(false)
+, d_perfMetrics(false)
+, d_rapl(0)
+, d_frequency(0)
+{
+  initialize(config);
+}
+
+inline
+PMU::PMU(const std::vector<PerfEvent>& event, bool fixed)
 : d_fid(-1)
+, d_batchFid(-1)
+, d_status(0)
 , d_cnt(0)
 , d_fcfg(DEFAULT_FIXED_CONFIG)
+, d_msrRoot("/dev/cpu")
+, d_capability(Capability::host())
+, d_backend(k_BACKEND_PERF)
+, d_fixedCnt(fixed ? k_FIXED_COUNTERS : 0)
+, d_perf(0)
+, d_topdown(false)
+, d_perfMetrics(false)
+, d_rapl(0)
+, d_frequency(0)
 {
+  assert(event.size()<=k_MAX_PROG_COUNTERS_HT_OFF);
+
+  std::vector<const char*> description;
+  for (const PerfEvent& e: event) {
+    description.push_back(e.d_description.c_str());
+  }
+  initialize((u_int16_t)event.size(), 0, description.data(), &event);
+}
+
+inline
+void PMU::initialize(ProgCounterSetConfig config) {
   assert(config>=0 && config<k_DEFAULT_CONFIG_UNDEFINED);
 
-  pinToHWCore(sched_getcpu());
+  d_topdown = config==k_TOPDOWN_XEON_CONFIG;
+  // Config 0 is four counters, config 1 eight, auto as many as the host allows
+  initialize(configCount(config, d_capability), configEventSelect(config), configDescription(config));
+}
+
+inline
+PMU::PMU(u_int16_t count, const u_int64_t *eventSelect, const char *const *description, const std::string& msrRoot)
+: d_fid(-1)
+, d_batchFid(-1)
+, d_status(0)
+, d_cnt(0)
+, d_fcfg(DEFAULT_FIXED_CONFIG)
+, d_msrRoot(msrRoot)
+, d_capability(Capability::host())
+, d_backend(k_BACKEND_MSR)
+, d_fixedCnt(k_FIXED_COUNTERS)
+, d_perf(0)
+, d_topdown(false)
+, d_perfMetrics(false)
+, d_rapl(0)
+, d_frequency(0)
+{
+  initialize(count, eventSelect, description);
+}
+
+inline
+PMU::PMU(const EventCatalog& catalog, const std::vector<std::string>& eventName, const std::string& msrRoot)
+: d_fid(-1)
+, d_batchFid(-1)
+, d_status(0)
+, d_cnt(0)
+, d_fcfg(DEFAULT_FIXED_CONFIG)
+, d_msrRoot(msrRoot)
+, d_capability(Capability::host())
+, d_backend(k_BACKEND_MSR)
+, d_fixedCnt(k_FIXED_COUNTERS)
+, d_perf(0)
+, d_topdown(false)
+, d_perfMetrics(false)
+, d_rapl(0)
+, d_frequency(0)
+{
+  u_int64_t eventSelect[k_MAX_PROG_COUNTERS_HT_OFF];
+  const char *description[k_MAX_PROG_COUNTERS_HT_OFF];
+  u_int32_t counters[k_MAX_PROG_COUNTERS_HT_OFF];
+  u_int16_t counter[k_MAX_PROG_COUNTERS_HT_OFF];
+
+  if (eventName.size()>k_MAX_PROG_COUNTERS_HT_OFF) {
+    fprintf(stderr, "Error: %lu events requested; at most %d programmable counters\n", eventName.size(),
+      (int)k_MAX_PROG_COUNTERS_HT_OFF);
+    d_status = EINVAL;
+  }
+
+  for (u_int16_t i=0; d_status==0 && i<eventName.size(); ++i) {
+    const EventCatalog::Entry *entry = catalog.find(eventName[i].c_str());
+    if (entry==0) {
+      fprintf(stderr, "Error: event '%s' not in catalog\n", eventName[i].c_str());
+      d_status = ENOENT;
+    } else if (entry->d_flags & (EventCatalog::k_FIXED|EventCatalog::k_NEEDS_MSR)) {
+      fprintf(stderr, "Error: event '%s' is not a plain programmable counter event\n", eventName[i].c_str());
+      d_status = EINVAL;
+    } else {
+      counters[i] = entry->d_counters;
+    }
+  }
+
+  // Events perfmon restricts to some counters e.g. "Counter": "2" go on one of those
+  if (d_status==0 && EventCatalog::place((u_int16_t)eventName.size(), counters, counter)!=0) {
+    fprintf(stderr, "Error: events can't be placed on programmable counters 0-%lu their perfmon masks allow:",
+      eventName.size()-1);
+    for (u_int16_t i=0; i<eventName.size(); ++i) {
+      fprintf(stderr, " %s (0x%x)", eventName[i].c_str(), counters[i]);
+    }
+    fprintf(stderr, "\n");
+    d_status = EINVAL;
+  }
+
+  for (u_int16_t i=0; d_status==0 && i<eventName.size(); ++i) {
+    const EventCatalog::Entry *entry = catalog.find(eventName[i].c_str());
+    eventSelect[counter[i]] = entry->d_eventSelect;
+    description[counter[i]] = catalog.description(*entry);
+  }
+
+  initialize(d_status==0 ? (u_int16_t)eventName.size() : 0, eventSelect, description);
+}
+
+inline
+void PMU::initialize(u_int16_t count, const u_int64_t *eventSelect, const char *const *description,
+                     const std::vector<PerfEvent> *perfEvent) {
+  // Perf events other than raw ones have no IA32_PERFEVTSEL value to check against CPUID; the kernel checks them
+  int rc;
+  if (d_status==0 && perfEvent==0 && (rc = check(d_capability, count, eventSelect))!=0) {
+    d_status = rc;
+  }
+  if (d_status!=0) {
+    count = 0;
+  }
+
+  if (d_backend==k_BACKEND_MSR) {
+    pinToHWCore(sched_getcpu());
+  }
 
   d_fixedMnemonic.push_back("F0");
   d_fixedMnemonic.push_back("F1");
@@ -249,36 +977,105 @@ PMU::PMU(ProgCounterSetConfig config)
   d_fixedDescription.push_back("no-halt cpu cycles");
   d_fixedDescription.push_back("reference no-halt cpu cycles");
 
-  if (config==k_DEFAULT_XEON_CONFIG_0) {
-    d_progMnemonic.push_back("P0");
-    d_progMnemonic.push_back("P1");
-    d_progMnemonic.push_back("P2");
-    d_progMnemonic.push_back("P3");
+  for (u_int16_t i=0; i<count; ++i) {
+    d_progMnemonic.push_back("P" + std::to_string(i));
+    d_progDescription.push_back(description[i]);
+    d_pcfg[i] = perfEvent ? 0 : eventSelect[i];
+  }
+  if (perfEvent) {
+    d_progEvent.assign(perfEvent->begin(), perfEvent->begin()+count);
+  }
+  d_cnt = count;
+
+  d_paused = false;
+  d_pauseStart = 0;
+  d_pausedCycles = 0;
+
+  d_fixedMnemonic.resize(d_fixedCnt);
+  d_fixedDescription.resize(d_fixedCnt);
+
+  if (d_backend==k_BACKEND_PERF) {
+    // The kernel accumulates each event into a 64-bit virtual count
+    d_fixedWidth = d_progWidth = 64;
+    d_fixedMask = d_progMask = ~0ull;
+    std::vector<PerfEvent> event;
+    for (u_int16_t i=0; perfEvent==0 && i<count; ++i) {
+      event.push_back(PerfEvent::raw(eventSelect[i], description[i]));
+    }
+    openPerf(perfEvent ? *perfEvent : event);
+    return;
+  }
+
+  counterWidth(d_capability, &d_fixedWidth, &d_progWidth);
+  d_fixedMask = d_fixedWidth>=64 ? ~0ull : (1ull<<d_fixedWidth)-1;
+  d_progMask = d_progWidth>=64 ? ~0ull : (1ull<<d_progWidth)-1;
 
-    d_progDescription.push_back("LLC references");
-    d_progDescription.push_back("LLC misses");
-    d_progDescription.push_back("retired branch instructions");
-    d_progDescription.push_back("retired branch instructions not taken");
-  
-    d_pcfg[0] = 0x414f2e;
-    d_pcfg[1] = 0x41412e;
-    d_pcfg[2] = 0x4104c4;
-    d_pcfg[3] = 0x4110c4;
+  makePlans(coreId());
+}
+
+inline
+void PMU::openPerf(const std::vector<PerfEvent>& event) {
+  delete d_perf;
+  d_perf = new PerfEvents;
 
-    // Four counters defined
-    d_cnt = 4;
+  int rc = d_status;
+  for (u_int16_t i=0; rc==0 && i<d_fixedCnt; ++i) {
+    rc = d_perf->add(fixedEvent(i));
+  }
+  for (u_int16_t i=0; rc==0 && i<event.size(); ++i) {
+    rc = d_perf->add(event[i]);
+  }
+
+  if (rc!=0 && d_status==0) {
+    // Like a failed MSR configuration: no counters, and 'reset()' returns 'status()'
+    d_perf->close();
+    d_status = rc;
+  }
+  if (d_status!=0) {
+    d_fixedCnt = d_cnt = 0;
+    d_fixedMnemonic.clear();
+    d_fixedDescription.clear();
+    d_progMnemonic.clear();
+    d_progDescription.clear();
+    d_progEvent.clear();
   }
 }
 
 inline
 PMU::~PMU() {
+  delete d_perf;
+  d_perf = 0;
   if (d_fid!=-1) {
     close(d_fid);
     d_fid = -1;
   }
+  if (d_batchFid!=-1) {
+    close(d_batchFid);
+    d_batchFid = -1;
+  }
 }
 
 // ACCESSORS
+inline
+int PMU::status() const {
+  return d_status;
+}
+
+inline
+const Capability& PMU::capability() const {
+  return d_capability;
+}
+
+inline
+PMU::Backend PMU::backend() const {
+  return d_backend;
+}
+
+inline
+const PerfEvents *PMU::perfEvents() const {
+  return d_perf;
+}
+
 inline
 int PMU::coreId() const {
   return sched_getcpu();
@@ -286,7 +1083,7 @@ int PMU::coreId() const {
 
 inline
 u_int16_t PMU::fixedCountersDefined() const {
-  return (u_int16_t)k_FIXED_COUNTERS;
+  return d_fixedCnt;
 }
 
 inline
@@ -304,7 +1101,10 @@ u_int64_t PMU::timeStampCounter() const {
 
 inline
 u_int64_t PMU::programmableCounterValue(u_int16_t c) const {
-  assert(c<programmableCounterDefined());
+  assert(c<programmableCountersDefined());
+  if (d_perf) {
+    return d_perf->read(d_fixedCnt+c);
+  }
   u_int64_t a,d;                                                                                                        
   // Finish pending instructions                                                                                        
   __asm __volatile("mfence;lfence");                                                                                           
@@ -319,6 +1119,9 @@ u_int64_t PMU::programmableCounterValue(u_int16_t c) const {
 inline
 u_int64_t PMU::fixedCounterValue(u_int16_t c) const {
   assert(c<fixedCountersDefined());
+  if (d_perf) {
+    return d_perf->read(c);
+  }
   u_int64_t a,d;                                                                                                        
   // Finish pending instructions                                                                                        
   __asm __volatile("mfence;lfence");                                                                                           
@@ -330,26 +1133,287 @@ u_int64_t PMU::fixedCounterValue(u_int16_t c) const {
   return ((d<<32)|a);
 }
 
+// Read one counter with 'rdpmc' selecting it by 'ECX' writing it at byte offset 'OFF' of 'Snapshot' in '%[out]'.
+// 'rdpmc' returns the low 32-bits in EAX, the remaining bits up to counter-width in EDX.
+#define INTEL_XEON_PMU_RDPMC(ECX, OFF)                                                                                \
+  "movl $" #ECX ", %%ecx\n\t"                                                                                         \
+  "rdpmc\n\t"                                                                                                         \
+  "movl %%eax, " #OFF "(%[out])\n\t"                                                                                  \
+  "movl %%edx, " #OFF "+4(%[out])\n\t"
+
+// ECX register: bit 30 <- 1 (fixed counter) w/ low order bits counter# zero based
+#define INTEL_XEON_PMU_READ_FIXED                                                                                     \
+  INTEL_XEON_PMU_RDPMC(0x40000000, 8)                                                                                 \
+  INTEL_XEON_PMU_RDPMC(0x40000001, 16)                                                                                \
+  INTEL_XEON_PMU_RDPMC(0x40000002, 24)
+
+// ECX register: bit 30 <- 0 (programmable cntr) w/ low order bits counter# zero based
+#define INTEL_XEON_PMU_READ_PROG_0 ""
+#define INTEL_XEON_PMU_READ_PROG_1 INTEL_XEON_PMU_READ_PROG_0 INTEL_XEON_PMU_RDPMC(0, 32)
+#define INTEL_XEON_PMU_READ_PROG_2 INTEL_XEON_PMU_READ_PROG_1 INTEL_XEON_PMU_RDPMC(1, 40)
+#define INTEL_XEON_PMU_READ_PROG_3 INTEL_XEON_PMU_READ_PROG_2 INTEL_XEON_PMU_RDPMC(2, 48)
+#define INTEL_XEON_PMU_READ_PROG_4 INTEL_XEON_PMU_READ_PROG_3 INTEL_XEON_PMU_RDPMC(3, 56)
+#define INTEL_XEON_PMU_READ_PROG_5 INTEL_XEON_PMU_READ_PROG_4 INTEL_XEON_PMU_RDPMC(4, 64)
+#define INTEL_XEON_PMU_READ_PROG_6 INTEL_XEON_PMU_READ_PROG_5 INTEL_XEON_PMU_RDPMC(5, 72)
+#define INTEL_XEON_PMU_READ_PROG_7 INTEL_XEON_PMU_READ_PROG_6 INTEL_XEON_PMU_RDPMC(6, 80)
+#define INTEL_XEON_PMU_READ_PROG_8 INTEL_XEON_PMU_READ_PROG_7 INTEL_XEON_PMU_RDPMC(7, 88)
+
+#define INTEL_XEON_PMU_READ_TSCP                                                                                      \
+  "rdtscp\n\t"                                                                                                        \
+  "movl %%eax, 0(%[out])\n\t"                                                                                         \
+  "movl %%edx, 4(%[out])\n\t"                                                                                         \
+  "movl %%ecx, 104(%[out])\n\t"
+
+// IA32_TSC_AUX i.e. the cpu comes from 'rdpid' next to 'rdtsc' when the target has it. Otherwise an 'rdtscp' after
+// the counter reads loads it so fences other than 'k_FENCE_RDTSCP' keep plain 'rdtsc'; its TSC value is discarded
+#ifdef __RDPID__
+#define INTEL_XEON_PMU_READ_TSC                                                                                       \
+  "rdtsc\n\t"                                                                                                         \
+  "movl %%eax, 0(%[out])\n\t"                                                                                         \
+  "movl %%edx, 4(%[out])\n\t"                                                                                         \
+  "rdpid %%rax\n\t"                                                                                                   \
+  "movl %%eax, 104(%[out])\n\t"
+#define INTEL_XEON_PMU_READ_AUX ""
+#else
+#define INTEL_XEON_PMU_READ_TSC                                                                                       \
+  "rdtsc\n\t"                                                                                                         \
+  "movl %%eax, 0(%[out])\n\t"                                                                                         \
+  "movl %%edx, 4(%[out])\n\t"
+#define INTEL_XEON_PMU_READ_AUX                                                                                       \
+  "rdtscp\n\t"                                                                                                        \
+  "movl %%ecx, 104(%[out])\n\t"
+#endif
+
+#define INTEL_XEON_PMU_SNAPSHOT_ASM(PROLOGUE, PROG, EPILOGUE)                                                         \
+  __asm__ __volatile__(PROLOGUE INTEL_XEON_PMU_READ_FIXED PROG EPILOGUE : : [out] "r" (snap) : "rax", "rcx", "rdx",     \
+    "memory")
+
+#define INTEL_XEON_PMU_SNAPSHOT(PROG)                                                                                 \
+  if constexpr (FENCE==k_FENCE_NONE) {                                                                                \
+    INTEL_XEON_PMU_SNAPSHOT_ASM(INTEL_XEON_PMU_READ_TSC, PROG, INTEL_XEON_PMU_READ_AUX);                               \
+  } else if constexpr (FENCE==k_FENCE_LFENCE) {                                                                       \
+    INTEL_XEON_PMU_SNAPSHOT_ASM("lfence\n\t" INTEL_XEON_PMU_READ_TSC, PROG, INTEL_XEON_PMU_READ_AUX);                 \
+  } else if constexpr (FENCE==k_FENCE_MFENCE_LFENCE) {                                                                \
+    INTEL_XEON_PMU_SNAPSHOT_ASM("mfence\n\tlfence\n\t" INTEL_XEON_PMU_READ_TSC, PROG, INTEL_XEON_PMU_READ_AUX);        \
+  } else {                                                                                                            \
+    INTEL_XEON_PMU_SNAPSHOT_ASM(INTEL_XEON_PMU_READ_TSCP, PROG, "");                                                   \
+  }
+
+template <PMU::FencePolicy FENCE, u_int16_t COUNT>
+inline
+void PMU::readCounters(Snapshot *snap) const {
+  static_assert(COUNT<=k_MAX_PROG_COUNTERS_HT_OFF, "at most 8 programmable counters");
+  assert(snap);
+  assert(COUNT==d_cnt);
+
+  // Always predicted: the backend is fixed at construction
+  if (__builtin_expect(d_perf!=0, 0)) {
+    snapshotPerf<FENCE>(snap);
+    return;
+  }
+
+  if constexpr (COUNT==0) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_0);
+  } else if constexpr (COUNT==1) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_1);
+  } else if constexpr (COUNT==2) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_2);
+  } else if constexpr (COUNT==3) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_3);
+  } else if constexpr (COUNT==4) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_4);
+  } else if constexpr (COUNT==5) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_5);
+  } else if constexpr (COUNT==6) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_6);
+  } else if constexpr (COUNT==7) {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_7);
+  } else {
+    INTEL_XEON_PMU_SNAPSHOT(INTEL_XEON_PMU_READ_PROG_8);
+  }
+
+  snap->d_paused = pausedCycles();
+}
+
+#undef INTEL_XEON_PMU_SNAPSHOT
+#undef INTEL_XEON_PMU_SNAPSHOT_ASM
+#undef INTEL_XEON_PMU_READ_TSCP
+#undef INTEL_XEON_PMU_READ_TSC
+#undef INTEL_XEON_PMU_READ_AUX
+#undef INTEL_XEON_PMU_READ_PROG_8
+#undef INTEL_XEON_PMU_READ_PROG_7
+#undef INTEL_XEON_PMU_READ_PROG_6
+#undef INTEL_XEON_PMU_READ_PROG_5
+#undef INTEL_XEON_PMU_READ_PROG_4
+#undef INTEL_XEON_PMU_READ_PROG_3
+#undef INTEL_XEON_PMU_READ_PROG_2
+#undef INTEL_XEON_PMU_READ_PROG_1
+#undef INTEL_XEON_PMU_READ_PROG_0
+#undef INTEL_XEON_PMU_READ_FIXED
+#undef INTEL_XEON_PMU_RDPMC
+
+template <PMU::FencePolicy FENCE, u_int16_t COUNT>
+inline
+void PMU::snapshot(Snapshot *snap) const {
+  readCounters<FENCE, COUNT>(snap);
+  readEnergy(snap);
+  readFrequency(snap);
+}
+
+template <PMU::FencePolicy FENCE, u_int16_t COUNT>
+inline
+void PMU::snapshotBegin(Snapshot *snap) const {
+  readEnergy(snap);
+  readFrequency(snap);
+  readCounters<FENCE, COUNT>(snap);
+}
+
+inline
+void PMU::readEnergy(Snapshot *snap) const {
+  static_assert((int)Snapshot::k_ENERGY_DOMAINS==(int)Rapl::k_DOMAINS, "one energy counter per RAPL domain");
+
+  // Always predicted: attached once before measuring
+  if (__builtin_expect(d_rapl!=0, 0)) {
+    d_rapl->read(snap->d_energy);
+  } else {
+    snap->d_energy[Rapl::k_PACKAGE] = snap->d_energy[Rapl::k_PP0] = snap->d_energy[Rapl::k_DRAM] = 0;
+  }
+}
+
+inline
+void PMU::readFrequency(Snapshot *snap) const {
+  // Always predicted: attached once before measuring
+  if (__builtin_expect(d_frequency!=0, 0)) {
+    d_frequency->read(&snap->d_aperf, &snap->d_mperf, &snap->d_throttle);
+  } else {
+    snap->d_aperf = snap->d_mperf = 0;
+    snap->d_throttle = 0;
+  }
+}
+
+template <PMU::FencePolicy FENCE>
+inline
+void PMU::snapshotPerf(Snapshot *snap) const {
+  if constexpr (FENCE==k_FENCE_LFENCE) {
+    __asm__ __volatile__("lfence" : : : "memory");
+  } else if constexpr (FENCE==k_FENCE_MFENCE_LFENCE) {
+    __asm__ __volatile__("mfence\n\tlfence" : : : "memory");
+  }
+
+  u_int32_t lo, hi;
+  if constexpr (FENCE==k_FENCE_RDTSCP) {
+    __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(snap->d_aux));
+  } else {
+#ifdef __RDPID__
+    u_int64_t aux;
+    __asm__ __volatile__("rdtsc\n\trdpid %2" : "=a"(lo), "=d"(hi), "=r"(aux));
+    snap->d_aux = (u_int32_t)aux;
+#else
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+#endif
+  }
+  snap->d_tsc = ((u_int64_t)lo) | (((u_int64_t)hi)<<32);
+
+  for (u_int16_t i=0; i<k_FIXED_COUNTERS; ++i) {
+    snap->d_fixed[i] = i<d_fixedCnt ? d_perf->read(i) : 0;
+  }
+  for (u_int16_t i=0; i<d_cnt; ++i) {
+    snap->d_prog[i] = d_perf->read(d_fixedCnt+i);
+  }
+
+#ifndef __RDPID__
+  if constexpr (FENCE!=k_FENCE_RDTSCP) {
+    // As per the rdpmc path: cpu from an 'rdtscp' after the reads, its TSC discarded
+    u_int32_t discard;
+    __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(discard), "=c"(snap->d_aux));
+  }
+#endif
+
+  snap->d_paused = pausedCycles();
+}
+
+template <PMU::FencePolicy FENCE, bool BEGIN>
+inline
+void PMU::snapshotByCount(Snapshot *snap) const {
+  switch (d_cnt) {
+    case 0: BEGIN ? snapshotBegin<FENCE, 0>(snap) : snapshot<FENCE, 0>(snap); break;
+    case 1: BEGIN ? snapshotBegin<FENCE, 1>(snap) : snapshot<FENCE, 1>(snap); break;
+    case 2: BEGIN ? snapshotBegin<FENCE, 2>(snap) : snapshot<FENCE, 2>(snap); break;
+    case 3: BEGIN ? snapshotBegin<FENCE, 3>(snap) : snapshot<FENCE, 3>(snap); break;
+    case 4: BEGIN ? snapshotBegin<FENCE, 4>(snap) : snapshot<FENCE, 4>(snap); break;
+    case 5: BEGIN ? snapshotBegin<FENCE, 5>(snap) : snapshot<FENCE, 5>(snap); break;
+    case 6: BEGIN ? snapshotBegin<FENCE, 6>(snap) : snapshot<FENCE, 6>(snap); break;
+    case 7: BEGIN ? snapshotBegin<FENCE, 7>(snap) : snapshot<FENCE, 7>(snap); break;
+    default: BEGIN ? snapshotBegin<FENCE, 8>(snap) : snapshot<FENCE, 8>(snap); break;
+  }
+}
+
+inline
+void PMU::snapshot(Snapshot *snap, FencePolicy fence) const {
+  switch (fence) {
+    case k_FENCE_NONE:          snapshotByCount<k_FENCE_NONE, false>(snap); break;
+    case k_FENCE_LFENCE:        snapshotByCount<k_FENCE_LFENCE, false>(snap); break;
+    case k_FENCE_MFENCE_LFENCE: snapshotByCount<k_FENCE_MFENCE_LFENCE, false>(snap); break;
+    default:                    snapshotByCount<k_FENCE_RDTSCP, false>(snap); break;
+  }
+}
+
+inline
+void PMU::snapshotBegin(Snapshot *snap, FencePolicy fence) const {
+  switch (fence) {
+    case k_FENCE_NONE:          snapshotByCount<k_FENCE_NONE, true>(snap); break;
+    case k_FENCE_LFENCE:        snapshotByCount<k_FENCE_LFENCE, true>(snap); break;
+    case k_FENCE_MFENCE_LFENCE: snapshotByCount<k_FENCE_MFENCE_LFENCE, true>(snap); break;
+    default:                    snapshotByCount<k_FENCE_RDTSCP, true>(snap); break;
+  }
+}
+
+inline
+u_int16_t PMU::fixedCounterWidth() const {
+  return d_fixedWidth;
+}
+
+inline
+u_int16_t PMU::programmableCounterWidth() const {
+  return d_progWidth;
+}
+
+inline
+u_int64_t PMU::fixedCounterMask() const {
+  return d_fixedMask;
+}
+
+inline
+u_int64_t PMU::programmableCounterMask() const {
+  return d_progMask;
+}
+
 inline
 bool PMU::fixedCounterOverflowed(u_int16_t counter) const {
   assert(counter<fixedCountersDefined());
   u_int64_t overFlowStatus;                                                                                             
-  auto object = const_cast<PMU*>(this);
-  object->overflowStatus(&overFlowStatus);
-  u_int64_t mask(FIXEDCTR0_OVERFLOW_MASK);
-  for (u_int16_t i=0; i<=counter; ++i, mask<<=1);
-  return (overFlowStatus & mask);
+  overflowStatus(&overFlowStatus);
+  return fixedCounterOverflowed(counter, overFlowStatus);
+}
+
+inline
+bool PMU::fixedCounterOverflowed(u_int16_t counter, u_int64_t status) const {
+  assert(counter<fixedCountersDefined());
+  return (status & (FIXEDCTR0_OVERFLOW_MASK<<counter));
 }
 
 inline
 bool PMU::programmableCounterOverflowed(u_int16_t counter) const {
-  assert(counter<programmableCounterDefined());
+  assert(counter<programmableCountersDefined());
   u_int64_t overFlowStatus;                                                                                             
-  auto object = const_cast<PMU*>(this);
-  object->overflowStatus(&overFlowStatus);
-  u_int64_t mask(PMC0_OVERFLOW_MASK);
-  for (u_int16_t i=0; i<=counter; ++i, mask<<=1);
-  return (overFlowStatus & mask);
+  overflowStatus(&overFlowStatus);
+  return programmableCounterOverflowed(counter, overFlowStatus);
+}
+
+inline
+bool PMU::programmableCounterOverflowed(u_int16_t counter, u_int64_t status) const {
+  assert(counter<programmableCountersDefined());
+  return (status & (PMC0_OVERFLOW_MASK<<counter));
 }
 
 inline
@@ -372,90 +1436,211 @@ const std::vector<std::string>& PMU::programmableDescription() const {
   return d_progDescription;
 }
 
-// MANIPULATORS
 inline
-int PMU::start() {
-  assert(d_fid>0);
+PerfEvent PMU::programmableEvent(u_int16_t counter) const {
+  assert(counter<d_cnt);
+  if (counter<d_progEvent.size()) {
+    return d_progEvent[counter];
+  }
+  return PerfEvent::raw(d_pcfg[counter], d_progDescription[counter].c_str());
+}
 
-  int rc;
+inline
+bool PMU::batched() const {
+  return d_batchFid!=-1;
+}
 
-  // Enable all fixed counters (2nd enablement)
-  if ((rc = wrmsr(IA32_FIXED_CTR_CTRL, d_fcfg))!=0) {
-    return rc;
-  }
+inline
+const MSRPlan& PMU::resetPlan() const {
+  return d_resetPlan;
+}
 
-  // Enable defined programmable counters (2nd enablement)
-  int msr = IA32_PERFEVTSEL0;
-  for(u_int16_t i = 0; i < d_cnt; ++i, ++msr) {
-    if ((rc = wrmsr(msr, d_pcfg[i]))!=0) {
-      return rc;
-    }
+inline
+const MSRPlan& PMU::startPlan() const {
+  return d_startPlan;
+}
+
+inline
+bool PMU::paused() const {
+  return d_paused;
+}
+
+inline
+u_int64_t PMU::pausedCycles() const {
+  if (d_paused) {
+    return d_pausedCycles + (timeStampCounter()-d_pauseStart);
   }
+  return d_pausedCycles;
+}
 
-  return 0;
+inline
+bool PMU::perfMetrics() const {
+  return d_perfMetrics;
+}
+
+inline
+void PMU::topDownMetrics(u_int64_t *slots, u_int64_t *metrics) const {
+  assert(slots);
+  assert(metrics);
+  assert(d_perfMetrics);
+
+  u_int64_t a,d;
+  // ECX register: bit 30 <- 1 (fixed counter) w/ counter 3
+  __asm __volatile("rdpmc" : "=a" (a), "=d" (d) : "c" ((1<<30)+3));
+  *slots = (d<<32)|a;
+  // ECX register: bit 29 <- 1 selects IA32_PERF_METRICS
+  __asm __volatile("rdpmc" : "=a" (a), "=d" (d) : "c" (1<<29));
+  *metrics = (d<<32)|a;
+}
+
+inline
+const Rapl *PMU::rapl() const {
+  return d_rapl;
+}
+
+inline
+const Frequency *PMU::frequency() const {
+  return d_frequency;
+}
+
+// MANIPULATORS
+inline
+int PMU::start() {
+  if (d_perf) {
+    return d_perf->enable();
+  }
+  assert(d_fid>0);
+  return apply(&d_startPlan);
 }
 
 inline
 int PMU::reset() {
   int rc;
 
+  if (d_status!=0) {
+    return d_status;
+  }
+
+  if (d_backend==k_BACKEND_PERF) {
+    d_paused = false;
+    d_pausedCycles = 0;
+    return d_perf ? d_perf->reset() : 0;
+  }
+
   if (d_fid<0) {
     if ((rc = open(coreId()))!=0) {
       return rc;
     }
+    probePerfMetrics();
   }
 
   assert(d_fid>0);
 
-  // Turn off all counters global level (1st disablement)
-  if ((rc = wrmsr(IA32_PERF_GLOBAL_CTRL, 0))!=0) {
+  d_paused = false;
+  d_pausedCycles = 0;
+
+  return apply(&d_resetPlan);
+}
+
+inline
+int PMU::pause() {
+  assert(d_perf || d_fid>0);
+  assert(!d_paused);
+
+  int rc;
+  if ((rc = d_perf ? d_perf->disable() : apply(&d_pausePlan))!=0) {
     return rc;
   }
 
-  // Turn off all defined programmable counters (1st disablement)
-  int msr = IA32_PERFEVTSEL0;
-  for(u_int16_t i = 0; i < d_cnt; ++i, ++msr) {
-    if ((rc = wrmsr(msr, 0))!=0) {
-      return rc;
-    }
+  d_pauseStart = timeStampCounter();
+  d_paused = true;
+
+  return 0;
+}
+
+inline
+int PMU::resume() {
+  assert(d_perf || d_fid>0);
+  assert(d_paused);
+
+  d_pausedCycles += timeStampCounter()-d_pauseStart;
+  d_paused = false;
+
+  return d_perf ? d_perf->enable() : apply(&d_startPlan);
+}
+
+inline
+int PMU::program(u_int16_t count, const u_int64_t *eventSelect, const char *const *description) {
+  int rc;
+  if ((rc = check(d_capability, count, eventSelect))!=0) {
+    return rc;
   }
 
-  // Turn off all fixed counters (1st disablement)
-  if ((rc = wrmsr(IA32_FIXED_CTR_CTRL, 0))!=0) {
+  // Perf events open only now; commit nothing until all of them did
+  if (d_backend==k_BACKEND_PERF && (rc = reprogramPerf(count, eventSelect, description))!=0) {
     return rc;
   }
 
-  // Reset to 0 programmable counter values
-  msr = IA32_PMC0;
-  for(u_int16_t i = 0; i < d_cnt; ++i, ++msr) {
-    if ((rc = wrmsr(msr, 0))!=0) {
-      return rc;
-    }
+  d_progMnemonic.resize(count);
+  d_progDescription.resize(count);
+  for (u_int16_t i=0; i<count; ++i) {
+    d_progMnemonic[i] = "P" + std::to_string(i);
+    d_progDescription[i] = description[i];
+    d_pcfg[i] = eventSelect[i];
   }
+  d_progEvent.clear();
+  d_cnt = count;
 
-  // Reset to 0 fixed counter values
-  msr = IA32_FIXED_CTR0;
-  for(u_int16_t i = 0; i < k_FIXED_COUNTERS; ++i, ++msr) {
-    if ((rc = wrmsr(msr, 0))!=0) {
-      return rc;
-    }
+  if (d_backend==k_BACKEND_PERF) {
+    return 0;
   }
 
-  // Clear overflow bits
-  if ((rc = wrmsr(IA32_PERF_GLOBAL_STATUS_RESET, 0))!=0) {
-    return rc;
+  makePlans(coreId());
+
+  if (d_fid<0) {
+    return 0;
+  }
+
+  return apply(&d_programPlan);
+}
+
+inline
+int PMU::reprogramPerf(u_int16_t count, const u_int64_t *eventSelect, const char *const *description) {
+  if (d_perf==0) {
+    return d_status;
   }
 
-  // Re-enable all fixed and defined programmable counters (first enablement)
-  u_int64_t value = 0x700000000; // 'doc/pmd.md' discusses this number in detail
-  for(u_int16_t i = 0; i < d_cnt; ++i) {
-    value |= (1<<i);
+  // Swap the programmable events under a stopped group; fixed events keep their counts
+  int rc;
+  if (!d_paused && (rc = d_perf->disable())!=0) {
+    return rc;
+  }
+  d_perf->truncate(d_fixedCnt);
+  for (u_int16_t i=0; i<count && rc==0; ++i) {
+    rc = d_perf->add(PerfEvent::raw(eventSelect[i], description[i]));
   }
-  if ((rc = wrmsr(IA32_PERF_GLOBAL_CTRL, value))!=0) {
+
+  if (rc!=0) {
+    // Put back the events 'programmableEvent' still describes, zeroed
+    d_perf->truncate(d_fixedCnt);
+    for (u_int16_t i=0; i<d_cnt; ++i) {
+      if (d_perf->add(programmableEvent(i))!=0) {
+        // Keep the counters defined to those the group still reads
+        fprintf(stderr, "Error: cannot restore programmable counter %u; %u remain defined\n", i, i);
+        d_cnt = i;
+        d_progMnemonic.resize(i);
+        d_progDescription.resize(i);
+        d_progEvent.clear();
+        break;
+      }
+    }
+    if (!d_paused) {
+      d_perf->enable();
+    }
     return rc;
   }
 
-  return 0;
+  return d_paused ? 0 : d_perf->enable();
 }
 
 inline
@@ -463,22 +1648,36 @@ bool PMU::overflow() {
   bool flag(false);
   u_int64_t overFlowStatus;                                                                                             
   overflowStatus(&overFlowStatus);
-  u_int64_t mask(FIXEDCTR0_OVERFLOW_MASK);
-  for (u_int16_t i=0; i<fixedCountersDefined(); ++i, mask<<=1) {
-    flag |= (overFlowStatus & mask);
+  for (u_int16_t i=0; i<fixedCountersDefined(); ++i) {
+    flag |= fixedCounterOverflowed(i, overFlowStatus);
   }
-  mask = PMC0_OVERFLOW_MASK;
-  for (u_int16_t i=0; i<programmableCountersDefined(); ++i, mask<<=1) {
-    flag |= (overFlowStatus & mask);
+  for (u_int16_t i=0; i<programmableCountersDefined(); ++i) {
+    flag |= programmableCounterOverflowed(i, overFlowStatus);
   }
   return flag;
 }
 
+inline
+void PMU::setRapl(const Rapl *rapl) {
+  assert(rapl==0 || rapl->status()==0);
+  d_rapl = rapl;
+}
+
+inline
+void PMU::setFrequency(const Frequency *frequency) {
+  assert(frequency==0 || frequency->status()==0);
+  d_frequency = frequency;
+}
 
 inline
 int PMU::overflowStatus(u_int64_t *value) const {
   assert(value);
 
+  *value = 0;
+  if (d_backend==k_BACKEND_PERF) {
+    return 0;
+  }
+
   int rc;
   auto object = const_cast<PMU*>(this);
   if ((rc = object->rdmsr(IA32_PERF_GLOBAL_STATUS, value))!=0) {
@@ -516,13 +1715,36 @@ int PMU::wrmsr(u_int32_t reg, u_int64_t data) {
   return 0;
 }
 
+inline
+int PMU::apply(MSRPlan *plan) {
+  assert(plan);
+
+  if (d_batchFid!=-1) {
+    int rc = plan->applyBatch(d_batchFid);
+    if (rc!=ENOTTY && rc!=EINVAL) {
+      return rc;
+    }
+    // Not a batch device (e.g. a file-backed fake) or the ABI differs: don't try again
+    close(d_batchFid);
+    d_batchFid = -1;
+  }
+
+  return plan->apply(d_fid);
+}
+
+inline
+void PMU::makePlans(int cpu) {
+  buildPlans(cpu, d_fcfg, d_cnt, d_pcfg, d_perfMetrics, d_paused, &d_resetPlan, &d_startPlan, &d_pausePlan,
+    &d_programPlan);
+}
+
 inline
 int PMU::open(int cpu) {
   assert(cpu>=0);
   assert(d_fid==-1);
 
-  char msr_file_name[64];
-  sprintf(msr_file_name, "/dev/cpu/%d/msr", cpu);
+  char msr_file_name[PATH_MAX];
+  snprintf(msr_file_name, sizeof(msr_file_name), "%s/%d/msr", d_msrRoot.c_str(), cpu);
 
   d_fid = ::open(msr_file_name, O_RDWR);
   if (d_fid < 0) {
@@ -530,9 +1752,33 @@ int PMU::open(int cpu) {
     return errno;
   }
 
+  // Optional: msr-safe batch device
+  snprintf(msr_file_name, sizeof(msr_file_name), "%s/msr_batch", d_msrRoot.c_str());
+  d_batchFid = ::open(msr_file_name, O_RDWR);
+
   return 0;
 }
 
+inline
+void PMU::probePerfMetrics() {
+  assert(d_fid>0);
+
+  if (!d_topdown || d_perfMetrics || d_capability.version()<5 || d_capability.fixedCounters()<4 ||
+      !d_capability.supports(Capability::k_TOPDOWN_SLOTS)) {
+    return;
+  }
+
+  // Hybrid parts report version 5 on cores without PERF_METRICS; only IA32_PERF_CAPABILITIES is definitive
+  u_int64_t perfCapabilities;
+  if (rdmsr(IA32_PERF_CAPABILITIES, &perfCapabilities)!=0 || (perfCapabilities & PERF_METRICS_AVAILABLE)==0) {
+    return;
+  }
+
+  d_perfMetrics = true;
+  d_fcfg |= FIXED_CTR3_CONFIG;
+  makePlans(coreId());
+}
+
 // FREE OPERATOR
 // INLINE DEFINITIONS
 inline
@@ -0,0 +1,385 @@
+#include <intel_xeon_pmu_group.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct Intel::XEON::PMUGroup::Workers {
+  // Worker 'w' runs cores 'w, w+d_workers, ...' of each call. The calling thread is worker 0
+  std::mutex                               d_callMutex;   // serializes 'forEach' callers
+  std::mutex                               d_mutex;       // guards the fields below
+  std::condition_variable                  d_wake;        // signalled when 'd_generation' changes or 'd_stop'
+  std::condition_variable                  d_done;        // signalled when 'd_pending' drops to 0
+  const std::function<int(u_int32_t)>     *d_function;    // function of the current call or 0
+  u_int64_t                                d_generation;  // calls published so far
+  u_int32_t                                d_pending;     // workers yet to finish the current call
+  u_int32_t                                d_cores;       // cores in the group
+  u_int32_t                                d_workers;     // workers including the caller
+  bool                                     d_stop;        // true when the threads must exit
+  std::vector<int>                         d_status;      // first non-zero result by worker of the current call
+  std::vector<std::thread>                 d_thread;      // workers 1 and up
+
+  void part(u_int32_t w) {
+    for (u_int32_t core = w; core<d_cores; core += d_workers) {
+      int rc = (*d_function)(core);
+      if (rc!=0 && d_status[w]==0) {
+        d_status[w] = rc;
+      }
+    }
+  }
+
+  void run(u_int32_t w, int cpu, bool pin) {
+    if (pin) {
+      // Best effort: near the MSRs it writes most. A worker left unpinned is only slower
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      CPU_SET(cpu, &cpuSet);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    }
+
+    u_int64_t seen = 0;
+    std::unique_lock<std::mutex> lock(d_mutex);
+    for (;;) {
+      d_wake.wait(lock, [&] { return d_stop || d_generation!=seen; });
+      if (d_stop) {
+        return;
+      }
+      seen = d_generation;
+      lock.unlock();
+      part(w);
+      lock.lock();
+      if (--d_pending==0) {
+        d_done.notify_one();
+      }
+    }
+  }
+};
+
+Intel::XEON::PMUGroup::PMUGroup(const std::vector<int>& cpu, u_int16_t count, const u_int64_t *eventSelect,
+                                const char *const *description, u_int16_t threads, const std::string& msrRoot)
+: d_batchFid(-1)
+, d_status(0)
+, d_threads(0)
+, d_cnt(0)
+, d_fcfg(PMU::DEFAULT_FIXED_CONFIG)
+, d_msrRoot(msrRoot)
+, d_workers(0)
+{
+  initialize(cpu, count, eventSelect, description, threads);
+}
+
+Intel::XEON::PMUGroup::PMUGroup(const cpu_set_t& cpuSet, u_int16_t count, const u_int64_t *eventSelect,
+                                const char *const *description, u_int16_t threads, const std::string& msrRoot)
+: d_batchFid(-1)
+, d_status(0)
+, d_threads(0)
+, d_cnt(0)
+, d_fcfg(PMU::DEFAULT_FIXED_CONFIG)
+, d_msrRoot(msrRoot)
+, d_workers(0)
+{
+  std::vector<int> cpu;
+  for (int i=0; i<CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &cpuSet)) {
+      cpu.push_back(i);
+    }
+  }
+  initialize(cpu, count, eventSelect, description, threads);
+}
+
+Intel::XEON::PMUGroup::~PMUGroup() {
+  if (d_workers) {
+    {
+      std::lock_guard<std::mutex> lock(d_workers->d_mutex);
+      d_workers->d_stop = true;
+    }
+    d_workers->d_wake.notify_all();
+    for (auto& t: d_workers->d_thread) {
+      t.join();
+    }
+    delete d_workers;
+    d_workers = 0;
+  }
+
+  for (auto& core: d_core) {
+    if (core.d_fid!=-1) {
+      ::close(core.d_fid);
+      core.d_fid = -1;
+    }
+  }
+  if (d_batchFid!=-1) {
+    ::close(d_batchFid);
+    d_batchFid = -1;
+  }
+}
+
+int Intel::XEON::PMUGroup::snapshot(u_int32_t core, Snapshot *snap) const {
+  assert(core<d_core.size());
+  assert(snap);
+
+  const int fid = d_core[core].d_fid;
+  assert(fid>0);
+
+  memset(snap, 0, sizeof(Snapshot));
+
+  if (pread(fid, &snap->d_tsc, sizeof(u_int64_t), PMU::IA32_TIME_STAMP_COUNTER) != sizeof(u_int64_t)) {
+    fprintf(stderr, "Error: MSR read error on cpu %d register 0x%x: %s\n", d_core[core].d_cpu,
+      PMU::IA32_TIME_STAMP_COUNTER, strerror(errno));
+    return errno;
+  }
+
+  for (u_int16_t i=0; i<PMU::k_FIXED_COUNTERS; ++i) {
+    if (pread(fid, snap->d_fixed+i, sizeof(u_int64_t), PMU::IA32_FIXED_CTR0+i) != sizeof(u_int64_t)) {
+      fprintf(stderr, "Error: MSR read error on cpu %d register 0x%x: %s\n", d_core[core].d_cpu,
+        PMU::IA32_FIXED_CTR0+i, strerror(errno));
+      return errno;
+    }
+  }
+
+  for (u_int16_t i=0; i<d_cnt; ++i) {
+    if (pread(fid, snap->d_prog+i, sizeof(u_int64_t), PMU::IA32_PMC0+i) != sizeof(u_int64_t)) {
+      fprintf(stderr, "Error: MSR read error on cpu %d register 0x%x: %s\n", d_core[core].d_cpu,
+        PMU::IA32_PMC0+i, strerror(errno));
+      return errno;
+    }
+  }
+
+  return 0;
+}
+
+int Intel::XEON::PMUGroup::snapshot(std::vector<Snapshot> *snap) const {
+  assert(snap);
+  snap->resize(d_core.size());
+  return forEach([this, snap](u_int32_t core) { return snapshot(core, snap->data()+core); });
+}
+
+void Intel::XEON::PMUGroup::aggregate(const std::vector<Snapshot>& snap, Snapshot *total) {
+  assert(total);
+
+  memset(total, 0, sizeof(Snapshot));
+  for (const auto& core: snap) {
+    total->d_tsc = std::max(total->d_tsc, core.d_tsc);
+    for (u_int16_t i=0; i<Snapshot::k_FIXED_COUNTERS; ++i) {
+      total->d_fixed[i] += core.d_fixed[i];
+    }
+    for (u_int16_t i=0; i<Snapshot::k_MAX_PROG_COUNTERS; ++i) {
+      total->d_prog[i] += core.d_prog[i];
+    }
+  }
+}
+
+int Intel::XEON::PMUGroup::reset() {
+  int rc;
+
+  if (d_status!=0) {
+    return d_status;
+  }
+
+  // Open the batch device and the first core serially so a host rejecting batching is found once before the
+  // workers start. Then every other core is opened and reset concurrently.
+  if (d_batchFid==-1) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/msr_batch", d_msrRoot.c_str());
+    d_batchFid = ::open(path, O_RDWR);
+  }
+
+  if ((rc = open(&d_core[0]))!=0) {
+    return rc;
+  }
+
+  if (d_batchFid!=-1) {
+    rc = d_core[0].d_resetPlan.applyBatch(d_batchFid);
+    if (rc==ENOTTY || rc==EINVAL) {
+      // Not a batch device (e.g. a file-backed fake) or the ABI differs: don't try again
+      ::close(d_batchFid);
+      d_batchFid = -1;
+      rc = d_core[0].d_resetPlan.apply(d_core[0].d_fid);
+    }
+  } else {
+    rc = d_core[0].d_resetPlan.apply(d_core[0].d_fid);
+  }
+  if (rc!=0) {
+    return rc;
+  }
+
+  return forEach([this](u_int32_t core) {
+    if (core==0) {
+      return 0;
+    }
+    Core *state = &d_core[core];
+    int rc;
+    if ((rc = open(state))!=0) {
+      return rc;
+    }
+    return apply(state, &state->d_resetPlan);
+  });
+}
+
+int Intel::XEON::PMUGroup::start() {
+  return forEach([this](u_int32_t core) {
+    return apply(&d_core[core], &d_core[core].d_startPlan);
+  });
+}
+
+int Intel::XEON::PMUGroup::pause() {
+  return forEach([this](u_int32_t core) {
+    return apply(&d_core[core], &d_core[core].d_pausePlan);
+  });
+}
+
+std::ostream& Intel::XEON::PMUGroup::print(std::ostream& stream) const {
+  std::vector<Snapshot> snap;
+  if (snapshot(&snap)!=0) {
+    stream << "Intel XEON PMU group: cannot read counters" << std::endl;
+    return stream;
+  }
+
+  Snapshot total;
+  aggregate(snap, &total);
+
+  stream << "Intel XEON PMU group of "
+         << d_core.size()
+         << " cores with "
+         << d_cnt
+         << " programmable counters:"
+         << std::endl;
+
+  char buf[512];
+  for (u_int16_t i = 0; i<d_cnt; ++i) {
+    snprintf(buf, sizeof(buf), "P%-3u [%-48s]\n", i, d_progDescription[i].c_str());
+    stream << buf;
+  }
+
+  for (u_int32_t core = 0; core<=d_core.size(); ++core) {
+    const Snapshot& value = core<d_core.size() ? snap[core] : total;
+    if (core<d_core.size()) {
+      snprintf(buf, sizeof(buf), "cpu %-4d:", d_core[core].d_cpu);
+    } else {
+      snprintf(buf, sizeof(buf), "total   :");
+    }
+    stream << buf;
+    for (u_int16_t i = 0; i<PMU::k_FIXED_COUNTERS; ++i) {
+      snprintf(buf, sizeof(buf), " F%u %015lu", i, value.d_fixed[i]);
+      stream << buf;
+    }
+    for (u_int16_t i = 0; i<d_cnt; ++i) {
+      snprintf(buf, sizeof(buf), " P%u %015lu", i, value.d_prog[i]);
+      stream << buf;
+    }
+    stream << std::endl;
+  }
+
+  return stream;
+}
+
+int Intel::XEON::PMUGroup::forEach(const std::function<int(u_int32_t)>& function) const {
+  assert(d_workers);
+
+  Workers& workers = *d_workers;
+  std::lock_guard<std::mutex> call(workers.d_callMutex);
+
+  {
+    std::lock_guard<std::mutex> lock(workers.d_mutex);
+    workers.d_function = &function;
+    std::fill(workers.d_status.begin(), workers.d_status.end(), 0);
+    workers.d_pending = workers.d_workers-1;
+    ++workers.d_generation;
+  }
+  workers.d_wake.notify_all();
+
+  workers.part(0);
+
+  {
+    std::unique_lock<std::mutex> lock(workers.d_mutex);
+    workers.d_done.wait(lock, [&] { return workers.d_pending==0; });
+    workers.d_function = 0;
+  }
+
+  for (int status: workers.d_status) {
+    if (status!=0) {
+      return status;
+    }
+  }
+  return 0;
+}
+
+void Intel::XEON::PMUGroup::initialize(const std::vector<int>& cpu, u_int16_t count, const u_int64_t *eventSelect,
+                                       const char *const *description, u_int16_t threads) {
+  assert(!cpu.empty());
+
+  if (threads==0) {
+    threads = (u_int16_t)std::max(1u, std::thread::hardware_concurrency());
+  }
+  d_threads = threads;
+
+  // Same validation as 'PMU'. On failure only the fixed counters are defined
+  if ((d_status = PMU::check(Capability::host(), count, eventSelect))!=0) {
+    count = 0;
+  }
+
+  for (u_int16_t i=0; i<count; ++i) {
+    d_progDescription.push_back(description[i]);
+    d_pcfg[i] = eventSelect[i];
+  }
+  d_cnt = count;
+
+  // Same plans as 'PMU' built once per cpu: the batch device carries the target cpu in every op
+  d_core.resize(cpu.size());
+  for (u_int32_t c=0; c<cpu.size(); ++c) {
+    Core& core = d_core[c];
+    core.d_cpu = cpu[c];
+    core.d_fid = -1;
+    PMU::buildPlans(core.d_cpu, d_fcfg, d_cnt, d_pcfg, false, false, &core.d_resetPlan, &core.d_startPlan,
+      &core.d_pausePlan, 0);
+  }
+
+  // Workers pin to cpus this process may run on; others e.g. of a fake MSR tree run anywhere
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  d_workers = new Workers();
+  d_workers->d_function = 0;
+  d_workers->d_generation = 0;
+  d_workers->d_pending = 0;
+  d_workers->d_cores = (u_int32_t)d_core.size();
+  d_workers->d_workers = std::min<u_int32_t>(d_threads, d_workers->d_cores);
+  d_workers->d_stop = false;
+  d_workers->d_status.resize(d_workers->d_workers, 0);
+  d_workers->d_thread.reserve(d_workers->d_workers);
+  for (u_int32_t w = 1; w<d_workers->d_workers; ++w) {
+    const int target = d_core[w].d_cpu;
+    const bool pin = target>=0 && target<CPU_SETSIZE && CPU_ISSET(target, &allowed);
+    d_workers->d_thread.emplace_back(&Workers::run, d_workers, w, target, pin);
+  }
+}
+
+int Intel::XEON::PMUGroup::apply(Core *core, MSRPlan *plan) {
+  assert(core);
+  assert(plan);
+  assert(core->d_fid>0);
+
+  if (d_batchFid!=-1) {
+    return plan->applyBatch(d_batchFid);
+  }
+  return plan->apply(core->d_fid);
+}
+
+int Intel::XEON::PMUGroup::open(Core *core) {
+  assert(core);
+
+  if (core->d_fid!=-1) {
+    return 0;
+  }
+
+  char msr_file_name[PATH_MAX];
+  snprintf(msr_file_name, sizeof(msr_file_name), "%s/%d/msr", d_msrRoot.c_str(), core->d_cpu);
+  core->d_fid = ::open(msr_file_name, O_RDWR);
+  if (core->d_fid < 0) {
+    fprintf(stderr, "Error: cannot open '%s': %s\n", msr_file_name, strerror(errno));
+    return errno;
+  }
+
+  return 0;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+// PURPOSE: Program and read the PMU counters of many HW cores from one thread
+//
+// CLASSES:
+//  Intel::XEON::PMUGroup: Runs the same fixed and programmable counter configuration on every cpu in a set e.g. all
+//                         cores of a thread-per-core server. Cores are opened and programmed concurrently by a
+//                         bounded number of worker threads so setup time grows with 'cores/threads' not 'cores'.
+//                         'rdpmc' only reads the counters of the core it runs on, so values are read with MSR reads
+//                         of IA32_TIME_STAMP_COUNTER, IA32_FIXED_CTR* and IA32_PMC* through '<msrRoot>/<cpu>/msr'.
+//                         Events are validated and MSR writes planned exactly as 'PMU' does. The worker threads are
+//                         created once at construction, each pinned to the cpu of the first core it serves, and
+//                         reused by every operation. Unlike 'PMU' the caller is not pinned and may run anywhere.
+
+#include <intel_xeon_pmu.h>
+
+#include <sched.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Intel {
+namespace XEON {
+
+class PMUGroup {
+  // PRIVATE TYPES
+  struct Core {
+    int     d_cpu;                      // HW cpu number
+    int     d_fid;                      // file handle for '<msrRoot>/<cpu>/msr' or -1 if not open
+    MSRPlan d_resetPlan;                // MSR writes run by 'reset()' on this cpu
+    MSRPlan d_startPlan;                // MSR writes run by 'start()' on this cpu
+    MSRPlan d_pausePlan;                // MSR writes run by 'pause()' on this cpu
+  };
+
+  struct Workers;
+    // Persistent worker threads run by 'forEach'. Defined in the implementation file.
+
+  // DATA
+  std::vector<Core>        d_core;                          // state by core in construction order
+  int                      d_batchFid;                      // msr-safe batch device or -1 if not available
+  int                      d_status;                        // 0 if construction succeeded else errno-style reason
+  u_int16_t                d_threads;                       // upper bound on worker threads per operation
+  u_int16_t                d_cnt;                           // # programmable counters in use on every core
+  u_int64_t                d_fcfg;                          // configuration for all fixed counters
+  u_int64_t                d_pcfg[PMU::k_MAX_PROG_COUNTERS_HT_OFF]; // configuration by programmable counter
+  std::string              d_msrRoot;                       // directory holding '<cpu>/msr' and 'msr_batch'
+  std::vector<std::string> d_progDescription;               // description by programmable counter
+  Workers                 *d_workers;                       // worker threads other than the caller's
+
+public:
+  // CREATORS
+  PMUGroup(const std::vector<int>& cpu, u_int16_t count, const u_int64_t *eventSelect,
+           const char *const *description, u_int16_t threads = 0, const std::string& msrRoot = "/dev/cpu");
+    // Create a group running all fixed counters and specified 'count' programmable counters on each HW cpu in
+    // specified 'cpu' where counter 'i' is configured with IA32_PERFEVTSEL value 'eventSelect[i]' and described by
+    // 'description[i]'. At most specified 'threads' worker threads open, program, start, stop, and read cores
+    // concurrently; 0 means one per online cpu. Optionally specify 'msrRoot' to use '<msrRoot>/<cpu>/msr' instead of
+    // the Linux MSR devices e.g. a tree of file-backed fakes. The events are validated by 'PMU::check' against the
+    // host's CPUID; if that fails a diagnostic is printed on stderr, no programmable counters are defined, and
+    // 'status()' is non-zero. Upon return callers should run 'reset'. The behavior is defined if 'cpu' is non-empty
+    // without duplicates.
+
+  PMUGroup(const cpu_set_t& cpuSet, u_int16_t count, const u_int64_t *eventSelect,
+           const char *const *description, u_int16_t threads = 0, const std::string& msrRoot = "/dev/cpu");
+    // Create a group on every cpu in specified 'cpuSet' e.g. as returned by 'sched_getaffinity'. Otherwise as per
+    // the above constructor.
+
+  PMUGroup(const PMUGroup& other) = delete;
+    // Copy constructor is not supported.
+
+  ~PMUGroup();
+    // Destroy this object stopping the worker threads and closing all MSR devices
+
+  // ACCESSORS
+  int status() const;
+    // Return 0 if construction succeeded and an errno value otherwise
+
+  u_int32_t cores() const;
+    // Return the number of cores in this group
+
+  int cpu(u_int32_t core) const;
+    // Return the HW cpu number of specified 'core'. The behavior is defined if 'core<cores()'
+
+  u_int16_t fixedCountersDefined() const;
+    // Return the number of fixed counters running on each core
+
+  u_int16_t programmableCountersDefined() const;
+    // Return the number of programmable counters running on each core
+
+  const std::vector<std::string>& programmableDescription() const;
+    // Return a non-modifiable reference to the description by programmable counter
+
+  bool batched() const;
+    // Return true if MSR writes go through the msr-safe batch device. The result is meaningful after 'reset()'
+
+  int snapshot(u_int32_t core, Snapshot *snap) const;
+    // Return 0 if the IA32_TIME_STAMP_COUNTER value and every fixed and defined programmable counter value of
+    // specified 'core' were read into specified 'snap', and an errno value otherwise. 'd_paused' and 'd_aux' are
+    // zeroed. Each value is one MSR read. The behavior is defined provided 'reset()' previously ran without error and
+    // 'core<cores()'.
+
+  int snapshot(std::vector<Snapshot> *snap) const;
+    // Return 0 if a snapshot of every core was read into specified 'snap' indexed by core, and an errno value
+    // otherwise. Cores are read concurrently. Otherwise as per the above method.
+
+  static void aggregate(const std::vector<Snapshot>& snap, Snapshot *total);
+    // Write into specified 'total' the sum over specified 'snap' of each fixed and programmable counter and the
+    // largest time stamp counter value.
+
+  // MANIPULATORS
+  int reset();
+    // Return 0 if every core's MSR device was opened, and its counters stopped, configured, and zeroed, and an errno
+    // value of the first failure otherwise, or 'status()' if non-zero. Cores are processed concurrently.
+
+  int start();
+    // Return 0 if all counters on every core are running and an errno value otherwise. This is one
+    // IA32_PERF_GLOBAL_CTRL write per core issued concurrently. Also resumes counting after 'pause()'. The behavior
+    // is defined provided 'reset()' previously ran without error.
+
+  int pause();
+    // Return 0 if all counters on every core stopped counting keeping their values, and an errno value otherwise.
+    // The behavior is defined provided 'reset()' previously ran without error.
+
+  PMUGroup& operator=(const PMUGroup& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the current counter values of every core and their sum
+
+private:
+  // PRIVATE ACCESSORS
+  int forEach(const std::function<int(u_int32_t)>& function) const;
+    // Return 0 if specified 'function' returned 0 for every core index, and one of its non-zero values
+    // otherwise. Calls are spread over the caller's thread and the persistent workers; concurrent callers are
+    // serialized.
+
+  // PRIVATE MANIPULATORS
+  void initialize(const std::vector<int>& cpu, u_int16_t count, const u_int64_t *eventSelect,
+                  const char *const *description, u_int16_t threads);
+    // Validate the events, build per core state and MSR plans, and start the worker threads. Shared by the
+    // constructors.
+
+  int apply(Core *core, MSRPlan *plan);
+    // Return 0 if all writes in specified 'plan' were applied on specified 'core' and an errno value otherwise
+
+  int open(Core *core);
+    // Return 0 if the MSR device for specified 'core' is open and an errno value otherwise
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const PMUGroup& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+int PMUGroup::status() const {
+  return d_status;
+}
+
+inline
+u_int32_t PMUGroup::cores() const {
+  return (u_int32_t)d_core.size();
+}
+
+inline
+int PMUGroup::cpu(u_int32_t core) const {
+  assert(core<d_core.size());
+  return d_core[core].d_cpu;
+}
+
+inline
+u_int16_t PMUGroup::fixedCountersDefined() const {
+  return (u_int16_t)PMU::k_FIXED_COUNTERS;
+}
+
+inline
+u_int16_t PMUGroup::programmableCountersDefined() const {
+  return d_cnt;
+}
+
+inline
+const std::vector<std::string>& PMUGroup::programmableDescription() const {
+  return d_progDescription;
+}
+
+inline
+bool PMUGroup::batched() const {
+  return d_batchFid!=-1;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const PMUGroup& object) {
+  return object.print(stream);
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -0,0 +1,138 @@
+#include <intel_xeon_rapl.h>
+#include <intel_xeon_capability.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+
+namespace {
+
+const u_int32_t k_STATUS_MSR[Intel::XEON::Rapl::k_DOMAINS] = {
+  Intel::XEON::Rapl::MSR_PKG_ENERGY_STATUS,
+  Intel::XEON::Rapl::MSR_PP0_ENERGY_STATUS,
+  Intel::XEON::Rapl::MSR_DRAM_ENERGY_STATUS,
+};
+
+bool serverDram() {
+  // Xeon server parts count DRAM energy in 2^-16 J whatever MSR_RAPL_POWER_UNIT says: Haswell-EP, Broadwell-EP/DE,
+  // Skylake-SP/Cascade Lake, Ice Lake-SP/D, Sapphire and Emerald Rapids
+  u_int32_t eax, ebx, ecx, edx;
+  Intel::XEON::Capability::hostCpuid(1, 0, &eax, &ebx, &ecx, &edx);
+  const u_int32_t family = (eax>>8) & 0xf;
+  const u_int32_t model = ((eax>>4) & 0xf) | (((eax>>16) & 0xf)<<4);
+  if (family!=6) {
+    return false;
+  }
+  switch (model) {
+    case 0x3f: case 0x4f: case 0x56: case 0x55: case 0x6a: case 0x6c: case 0x8f: case 0xcf:
+      return true;
+    default:
+      return false;
+  }
+}
+
+} // namespace
+
+const char *Intel::XEON::Rapl::name(Domain domain) {
+  switch (domain) {
+    case k_PACKAGE: return "package";
+    case k_PP0:     return "cores (PP0)";
+    case k_DRAM:    return "DRAM";
+    default:        return "unknown";
+  }
+}
+
+Intel::XEON::Rapl::Rapl(const Options& options)
+: d_fid(-1)
+, d_cpu(options.d_cpu<0 ? sched_getcpu() : options.d_cpu)
+, d_status(0)
+, d_available(0)
+{
+  char msr_file_name[PATH_MAX];
+  snprintf(msr_file_name, sizeof(msr_file_name), "%s/%d/msr", options.d_msrRoot.c_str(), d_cpu);
+  d_fid = ::open(msr_file_name, O_RDONLY);
+  if (d_fid<0) {
+    d_status = errno;
+    fprintf(stderr, "Error: cannot open '%s': %s\n", msr_file_name, strerror(d_status));
+    return;
+  }
+
+  u_int64_t unit;
+  if (pread(d_fid, &unit, sizeof(unit), MSR_RAPL_POWER_UNIT)!=sizeof(unit)) {
+    d_status = errno ? errno : EIO;
+    fprintf(stderr, "Error: MSR read error on cpu %d register 0x%x: %s\n", d_cpu, MSR_RAPL_POWER_UNIT,
+      strerror(d_status));
+    return;
+  }
+
+  const double joules = 1.0/(double)(1ull<<((unit>>ENERGY_UNIT_SHIFT) & ENERGY_UNIT_MASK));
+  d_joules[k_PACKAGE] = joules;
+  d_joules[k_PP0] = joules;
+  d_joules[k_DRAM] = options.d_dramJoules>0 ? options.d_dramJoules : serverDram() ? SERVER_DRAM_JOULES : joules;
+
+  for (u_int16_t d=0; d<k_DOMAINS; ++d) {
+    u_int64_t value;
+    if (pread(d_fid, &value, sizeof(value), k_STATUS_MSR[d])==sizeof(value)) {
+      d_available |= 1u<<d;
+    }
+  }
+
+  if (!available(k_PACKAGE)) {
+    d_status = EIO;
+    fprintf(stderr, "Error: cannot read MSR_PKG_ENERGY_STATUS on cpu %d\n", d_cpu);
+  }
+}
+
+Intel::XEON::Rapl::~Rapl() {
+  if (d_fid!=-1) {
+    close(d_fid);
+  }
+}
+
+int Intel::XEON::Rapl::read(u_int32_t *energy) const {
+  assert(energy);
+
+  u_int64_t value;
+  for (u_int16_t d=0; d<k_DOMAINS; ++d) {
+    energy[d] = 0;
+    if ((d_available & (1u<<d))==0) {
+      continue;
+    }
+    if (pread(d_fid, &value, sizeof(value), k_STATUS_MSR[d])!=sizeof(value)) {
+      const int rc = errno ? errno : EIO;
+      fprintf(stderr, "Error: MSR read error on cpu %d register 0x%x: %s\n", d_cpu, k_STATUS_MSR[d], strerror(rc));
+      return rc;
+    }
+    energy[d] = (u_int32_t)(value & ENERGY_STATUS_MASK);
+  }
+
+  return 0;
+}
+
+std::ostream& Intel::XEON::Rapl::print(std::ostream& stream) const {
+  stream << "Intel XEON RAPL energy counters of cpu " << d_cpu << "'s package:" << std::endl;
+
+  u_int32_t energy[k_DOMAINS] = {0};
+  const bool valid = d_status==0 && read(energy)==0;
+
+  char buf[128];
+  for (u_int16_t d=0; d<k_DOMAINS; ++d) {
+    const Domain domain = static_cast<Domain>(d);
+    if (!available(domain)) {
+      snprintf(buf, sizeof(buf), "E%u  [%-12s]: not available\n", d, name(domain));
+    } else {
+      snprintf(buf, sizeof(buf), "E%u  [%-12s]: %010u counts of %.3lf uJ = %.6lf J%s\n", d, name(domain),
+        energy[d], d_joules[d]*1e6, joules(domain, energy[d]), valid ? "" : " (read failed)");
+    }
+    stream << buf;
+  }
+
+  return stream;
+}
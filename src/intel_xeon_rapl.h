@@ -0,0 +1,171 @@
+#pragma once
+
+// PURPOSE: Read the RAPL energy counters of the package a thread runs on
+//
+// CLASSES:
+//  Intel::XEON::Rapl: Reads MSR_PKG_ENERGY_STATUS (package), MSR_PP0_ENERGY_STATUS (cores), and
+//                     MSR_DRAM_ENERGY_STATUS (memory) through '<msrRoot>/<cpu>/msr' and converts their counts to
+//                     joules per MSR_RAPL_POWER_UNIT. Each counter is 32 bits wide and wraps: the package counter
+//                     roughly every minute at full power on large parts, so deltas are taken modulo 2^32 and must span
+//                     less than one wrap. Domains whose MSR can't be read e.g. DRAM on client parts are reported
+//                     unavailable and read as 0. The hardware updates the counters about once a millisecond, so
+//                     energy of one short region is noise; sum many. Attach to a 'PMU' with 'PMU::setRapl' to have
+//                     every 'Snapshot' carry the counters and 'Stats' report joules and watts.
+//
+// Usage:
+//   Intel::XEON::Rapl rapl;
+//   u_int32_t begin[Intel::XEON::Rapl::k_DOMAINS], end[Intel::XEON::Rapl::k_DOMAINS];
+//   rapl.read(begin);
+//   ...
+//   rapl.read(end);
+//   double joules = rapl.joules(Intel::XEON::Rapl::k_PACKAGE, Intel::XEON::Rapl::delta(begin[0], end[0]));
+
+#include <sys/types.h>
+
+#include <iosfwd>
+#include <string>
+
+namespace Intel {
+namespace XEON {
+
+class Rapl {
+public:
+  // ENUM
+  enum Domain {
+    k_PACKAGE = 0,                      // whole package: cores, LLC, uncore
+    k_PP0     = 1,                      // all cores of the package
+    k_DRAM    = 2,                      // memory attached to the package
+    k_DOMAINS = 3,                      // number of domains; equals 'Snapshot::k_ENERGY_DOMAINS'
+  };
+
+  struct Options {
+    std::string d_msrRoot = "/dev/cpu"; // directory holding '<cpu>/msr'
+    int         d_cpu = -1;             // cpu whose package is read; -1 is the calling thread's cpu
+    double      d_dramJoules = 0;       // joules per DRAM count; 0 is 2^-16 on Xeon servers else the package unit
+  };
+
+  // CONSTANTS
+  // 'doc/intel_msr.pdf' RAPL interfaces
+  static constexpr u_int32_t MSR_RAPL_POWER_UNIT    = 0x606;
+  static constexpr u_int32_t MSR_PKG_ENERGY_STATUS  = 0x611;
+  static constexpr u_int32_t MSR_PP0_ENERGY_STATUS  = 0x639;
+  static constexpr u_int32_t MSR_DRAM_ENERGY_STATUS = 0x619;
+  static constexpr u_int64_t ENERGY_STATUS_MASK     = 0xffffffffull; // valid bits of *_ENERGY_STATUS
+  static constexpr u_int32_t ENERGY_UNIT_SHIFT      = 8;             // MSR_RAPL_POWER_UNIT bits 8-12: 1/2^ESU J
+  static constexpr u_int64_t ENERGY_UNIT_MASK       = 0x1f;
+  static constexpr double    SERVER_DRAM_JOULES     = 1.0/65536;     // fixed DRAM unit of Haswell-EP and later Xeons
+
+private:
+  // DATA
+  int       d_fid;                      // file handle for '<msrRoot>/<d_cpu>/msr' or -1 if not open
+  int       d_cpu;                      // cpu read
+  int       d_status;                   // 0 if construction succeeded else errno-style reason
+  u_int32_t d_available;                // bit 'd' set if domain 'd' can be read
+  double    d_joules[k_DOMAINS];        // joules per count by domain
+
+public:
+  // CLASS METHODS
+  static u_int32_t delta(u_int32_t begin, u_int32_t end);
+    // Return the counts from specified 'begin' to specified 'end' reads of one domain even if the counter wrapped once
+
+  static const char *name(Domain domain);
+    // Return the name of specified 'domain' e.g. "package"
+
+  // CREATORS
+  Rapl();
+    // Create an object reading the package of the calling thread's cpu with default 'Options'. Otherwise as per the
+    // constructor below.
+
+  explicit Rapl(const Options& options);
+    // Create an object reading the energy counters of the package of specified 'options.d_cpu'. If the MSR device
+    // can't be opened, or MSR_RAPL_POWER_UNIT or MSR_PKG_ENERGY_STATUS can't be read, a diagnostic is printed on
+    // stderr and 'status()' is non-zero.
+
+  Rapl(const Rapl& other) = delete;
+    // Copy constructor is not supported.
+
+  ~Rapl();
+    // Destroy this object closing the MSR device
+
+  // ACCESSORS
+  int status() const;
+    // Return 0 if this object was constructed as requested and an errno value otherwise
+
+  int cpu() const;
+    // Return the cpu whose MSR device is read
+
+  bool available(Domain domain) const;
+    // Return true if specified 'domain' is counted and false otherwise
+
+  double joulesPerCount(Domain domain) const;
+    // Return the joules of one count of specified 'domain'
+
+  double joules(Domain domain, u_int64_t count) const;
+    // Return the joules of specified 'count' counts of specified 'domain'
+
+  int read(u_int32_t *energy) const;
+    // Return 0 if the counter of every available domain was read into specified 'energy' array of 'k_DOMAINS'
+    // entries by domain, unavailable domains reading 0, and an errno value otherwise. Each domain is one MSR read
+    // i.e. a system call, so this costs microseconds. The behavior is defined if 'status()==0'.
+
+  Rapl& operator=(const Rapl& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the domains, their units, and current counter values in joules
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Rapl& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CLASS METHODS
+inline
+u_int32_t Rapl::delta(u_int32_t begin, u_int32_t end) {
+  // Unsigned 32-bit subtraction is modulo 2^32
+  return end - begin;
+}
+
+// CREATORS
+inline
+Rapl::Rapl()
+: Rapl(Options())
+{
+}
+
+// ACCESSORS
+inline
+int Rapl::status() const {
+  return d_status;
+}
+
+inline
+int Rapl::cpu() const {
+  return d_cpu;
+}
+
+inline
+bool Rapl::available(Domain domain) const {
+  return (d_available & (1u<<domain))!=0;
+}
+
+inline
+double Rapl::joulesPerCount(Domain domain) const {
+  return d_joules[domain];
+}
+
+inline
+double Rapl::joules(Domain domain, u_int64_t count) const {
+  return (double)count*d_joules[domain];
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Rapl& object) {
+  return object.print(stream);
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -0,0 +1,177 @@
+#pragma once
+
+// PURPOSE: Choose programmable counter events at compile time
+//
+// CLASSES:
+//  Intel::XEON::StaticPMU: PMU whose programmable counters are the template argument list of 'Events' types e.g.
+//                          'StaticPMU<Events::LLC_REFERENCE, Events::LLC_MISS>'. IA32_PERFEVTSEL values are encoded
+//                          at compile time, the counter count limit is a 'static_assert', and snapshots and 'Stats'
+//                          records run fully unrolled with no branching on counter count.
+
+#include <intel_xeon_pmu.h>
+#include <intel_pmu_stats.h>
+
+#include <array>
+
+namespace Intel {
+namespace XEON {
+
+template <class... EVENTS>
+class StaticPMU {
+public:
+  // CONSTANTS
+  static constexpr u_int16_t k_COUNT = sizeof...(EVENTS);
+    // Number of programmable counters
+
+  static_assert(k_COUNT<=PMU::k_MAX_PROG_COUNTERS_HT_OFF, "at most 8 programmable counters with HT off");
+
+  static constexpr bool k_FITS_HT_ON = k_COUNT<=PMU::k_MAX_PROG_COUNTERS_HT_ON;
+    // True if the event set can run with CPU hyper threading ON
+
+  static constexpr std::array<u_int64_t, k_COUNT> k_EVENT_SELECT = { EVENTS::k_VALUE... };
+    // IA32_PERFEVTSEL value by programmable counter
+
+  static constexpr std::array<const char *, k_COUNT> k_DESCRIPTION = { EVENTS::k_DESCRIPTION... };
+    // Description by programmable counter
+
+  static constexpr std::array<const char *, k_COUNT> k_NAME = { EVENTS::k_NAME... };
+    // perfmon event name by programmable counter
+
+private:
+  // DATA
+  PMU d_pmu;                            // runtime PMU configured with 'k_EVENT_SELECT'
+
+public:
+  // CREATORS
+  explicit StaticPMU(const std::string& msrRoot = "/dev/cpu");
+    // Create a PMU running all fixed counters and one programmable counter per 'EVENTS' type. See
+    // 'PMU::PMU(ProgCounterSetConfig, const std::string&)' for pinning and specified 'msrRoot'.
+
+  StaticPMU(const StaticPMU& other) = delete;
+    // Copy constructor is not supported.
+
+  ~StaticPMU() = default;
+    // Destroy this object.
+
+  // ACCESSORS
+  const PMU& pmu() const;
+    // Return a non-modifiable reference to the underlying runtime PMU e.g. to construct 'Stats'
+
+  template <PMU::FencePolicy FENCE = PMU::k_FENCE_MFENCE_LFENCE>
+  void snapshot(Snapshot *snap) const;
+    // Write rdtsc and all counter values into specified 'snap' per 'PMU::snapshot' with no runtime dispatch
+
+  template <PMU::FencePolicy FENCE = PMU::k_FENCE_MFENCE_LFENCE>
+  void snapshotBegin(Snapshot *snap) const;
+    // Write rdtsc and all counter values into specified 'snap' per 'PMU::snapshotBegin' with no runtime dispatch
+
+  template <PMU::FencePolicy FENCE = PMU::k_FENCE_MFENCE_LFENCE>
+  void record(Stats *stats) const;
+    // Take a snapshot and record it into specified 'stats' with fully unrolled loops. The behavior is defined if
+    // 'stats' was constructed with 'pmu()'.
+
+  // MANIPULATORS
+  PMU& pmu();
+    // Return a modifiable reference to the underlying runtime PMU
+
+  int reset();
+    // See 'PMU::reset'
+
+  int start();
+    // See 'PMU::start'
+
+  int pause();
+    // See 'PMU::pause'
+
+  int resume();
+    // See 'PMU::resume'
+
+  StaticPMU& operator=(const StaticPMU& rhs) = delete;
+    // Assignment operator not supported
+};
+
+// FREE OPERATORS
+template <class... EVENTS>
+std::ostream& operator<<(std::ostream& stream, const StaticPMU<EVENTS...>& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// CREATORS
+template <class... EVENTS>
+inline
+StaticPMU<EVENTS...>::StaticPMU(const std::string& msrRoot)
+: d_pmu(k_COUNT, k_EVENT_SELECT.data(), k_DESCRIPTION.data(), msrRoot)
+{
+}
+
+// ACCESSORS
+template <class... EVENTS>
+inline
+const PMU& StaticPMU<EVENTS...>::pmu() const {
+  return d_pmu;
+}
+
+template <class... EVENTS>
+template <PMU::FencePolicy FENCE>
+inline
+void StaticPMU<EVENTS...>::snapshot(Snapshot *snap) const {
+  d_pmu.snapshot<FENCE, k_COUNT>(snap);
+}
+
+template <class... EVENTS>
+template <PMU::FencePolicy FENCE>
+inline
+void StaticPMU<EVENTS...>::snapshotBegin(Snapshot *snap) const {
+  d_pmu.snapshotBegin<FENCE, k_COUNT>(snap);
+}
+
+template <class... EVENTS>
+template <PMU::FencePolicy FENCE>
+inline
+void StaticPMU<EVENTS...>::record(Stats *stats) const {
+  assert(stats);
+  Snapshot snap;
+  d_pmu.snapshot<FENCE, k_COUNT>(&snap);
+  stats->record<k_COUNT>(snap);
+}
+
+// MANIPULATORS
+template <class... EVENTS>
+inline
+PMU& StaticPMU<EVENTS...>::pmu() {
+  return d_pmu;
+}
+
+template <class... EVENTS>
+inline
+int StaticPMU<EVENTS...>::reset() {
+  return d_pmu.reset();
+}
+
+template <class... EVENTS>
+inline
+int StaticPMU<EVENTS...>::start() {
+  return d_pmu.start();
+}
+
+template <class... EVENTS>
+inline
+int StaticPMU<EVENTS...>::pause() {
+  return d_pmu.pause();
+}
+
+template <class... EVENTS>
+inline
+int StaticPMU<EVENTS...>::resume() {
+  return d_pmu.resume();
+}
+
+// FREE OPERATORS
+template <class... EVENTS>
+inline
+std::ostream& operator<<(std::ostream& stream, const StaticPMU<EVENTS...>& object) {
+  return object.pmu().print(stream);
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -0,0 +1,414 @@
+#include <intel_xeon_uncore.h>
+#include <intel_xeon_capability.h>
+#include <intel_tsc_clock.h>
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+
+namespace {
+
+int readInteger(const std::string& path, int *value) {
+  // Return 0 if the first integer of the text file at 'path' was read into 'value' e.g. a sysfs attribute
+  FILE *file = fopen(path.c_str(), "r");
+  if (file==0) {
+    return errno;
+  }
+  const int rc = fscanf(file, "%d", value)==1 ? 0 : EINVAL;
+  fclose(file);
+  return rc;
+}
+
+int readAt(int fid, u_int32_t offset, void *value, size_t size) {
+  if (pread(fid, value, size, offset)!=(ssize_t)size) {
+    return errno ? errno : EIO;
+  }
+  return 0;
+}
+
+int writeAt(int fid, u_int32_t offset, const void *value, size_t size) {
+  if (pwrite(fid, value, size, offset)!=(ssize_t)size) {
+    return errno ? errno : EIO;
+  }
+  return 0;
+}
+
+int wrmsr(int fid, u_int32_t reg, u_int64_t value) {
+  const int rc = writeAt(fid, reg, &value, sizeof(value));
+  if (rc!=0) {
+    fprintf(stderr, "Error: MSR write error on register 0x%x value 0x%lx: %s\n", reg, value, strerror(rc));
+  }
+  return rc;
+}
+
+int wrpci(int fid, u_int32_t offset, u_int32_t value) {
+  // IMC control registers are 32 bits wide
+  const int rc = writeAt(fid, offset, &value, sizeof(value));
+  if (rc!=0) {
+    fprintf(stderr, "Error: PCI config write error at offset 0x%x value 0x%x: %s\n", offset, value, strerror(rc));
+  }
+  return rc;
+}
+
+} // namespace
+
+constexpr u_int16_t Intel::XEON::Uncore::IMC_DEVICE_ID[3];
+
+double Intel::XEON::Uncore::gigabytesPerSecond(u_int64_t cas, u_int64_t cycles) {
+  const double ns = TscClock::instance().nanoseconds((double)cycles);
+  return ns>0 ? (double)cas*k_CAS_BYTES/ns : 0;
+}
+
+Intel::XEON::Uncore::Uncore()
+: Uncore(Options())
+{
+}
+
+Intel::XEON::Uncore::Uncore(const Options& options)
+: d_options(options)
+, d_occupancyScale(options.d_occupancyScale)
+, d_mask((1ull<<k_COUNTER_WIDTH)-1)
+, d_status(0)
+{
+  d_status = discover();
+
+  if (d_occupancyScale==0) {
+    // CPUID leaf 0xF: subleaf 0 EDX bit 1 is L3 monitoring, subleaf 1 EDX bit 0 is L3 occupancy and EBX its scale
+    u_int32_t eax, ebx, ecx, edx;
+    Capability::hostCpuid(0xf, 0, &eax, &ebx, &ecx, &edx);
+    if (edx & 0x2) {
+      Capability::hostCpuid(0xf, 1, &eax, &ebx, &ecx, &edx);
+      d_occupancyScale = (edx & 0x1) ? ebx : 0;
+    }
+  }
+}
+
+Intel::XEON::Uncore::~Uncore() {
+  for (Socket& socket: d_socket) {
+    if (socket.d_fid!=-1) {
+      close(socket.d_fid);
+    }
+    for (Channel& channel: socket.d_channel) {
+      if (channel.d_fid!=-1) {
+        close(channel.d_fid);
+      }
+    }
+  }
+}
+
+int Intel::XEON::Uncore::discover() {
+  // Cpus by package, and the distinct cores of each package
+  std::map<int, std::pair<int, std::set<int>>> package;
+  DIR *dir = opendir(d_options.d_cpuRoot.c_str());
+  if (dir==0) {
+    int rc = errno;
+    fprintf(stderr, "Error: cannot open '%s': %s\n", d_options.d_cpuRoot.c_str(), strerror(rc));
+    return rc;
+  }
+  for (dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+    int cpu, id, core;
+    char tail;
+    if (sscanf(entry->d_name, "cpu%d%c", &cpu, &tail)!=1) {
+      continue;
+    }
+    const std::string topology = d_options.d_cpuRoot + "/" + entry->d_name + "/topology/";
+    if (readInteger(topology + "physical_package_id", &id)!=0 || readInteger(topology + "core_id", &core)!=0) {
+      // Offline cpus have no topology
+      continue;
+    }
+    auto found = package.find(id);
+    if (found==package.end()) {
+      package[id] = std::make_pair(cpu, std::set<int>{core});
+    } else {
+      found->second.first = std::min(found->second.first, cpu);
+      found->second.second.insert(core);
+    }
+  }
+  closedir(dir);
+
+  if (package.empty()) {
+    fprintf(stderr, "Error: no cpu topology under '%s'\n", d_options.d_cpuRoot.c_str());
+    return ENOENT;
+  }
+
+  for (const auto& p: package) {
+    Socket socket;
+    socket.d_package = p.first;
+    socket.d_cpu = p.second.first;
+    socket.d_fid = -1;
+    socket.d_chas = d_options.d_chas;
+    d_socket.push_back(socket);
+  }
+
+  // IMC channels and CHAs present per PCU by PCI bus. Each socket's IMCs sit on one bus, its PCU on one bus, and
+  // buses ascend with package ID.
+  std::map<u_int32_t, std::vector<std::string>> bus;
+  std::map<u_int32_t, u_int16_t> pcu;
+  dir = opendir(d_options.d_pciRoot.c_str());
+  for (dirent *entry = dir ? readdir(dir) : 0; entry; entry = readdir(dir)) {
+    unsigned domain, number, device, function;
+    if (sscanf(entry->d_name, "%x:%x:%x.%x", &domain, &number, &device, &function)!=4) {
+      continue;
+    }
+    const std::string path = d_options.d_pciRoot + "/" + entry->d_name + "/config";
+    const int fid = ::open(path.c_str(), O_RDONLY);
+    u_int16_t id[2] = {0, 0};
+    if (fid<0) {
+      continue;
+    }
+    u_int32_t capid6 = 0;
+    int rc = readAt(fid, 0, id, sizeof(id));
+    if (rc==0 && id[0]==PCI_VENDOR_INTEL && id[1]==PCU_CR3_DEVICE_ID) {
+      rc = readAt(fid, PCU_CAPID6, &capid6, sizeof(capid6));
+    }
+    close(fid);
+    if (rc!=0 || id[0]!=PCI_VENDOR_INTEL) {
+      continue;
+    }
+    if (id[1]==PCU_CR3_DEVICE_ID) {
+      const u_int16_t chas = (u_int16_t)__builtin_popcount(capid6&CAPID6_CHA_MASK);
+      if (chas) {
+        pcu[(domain<<8)|number] = chas;
+      }
+    } else if (std::find(IMC_DEVICE_ID, IMC_DEVICE_ID+3, id[1])!=IMC_DEVICE_ID+3) {
+      bus[(domain<<8)|number].push_back(path);
+    }
+  }
+  if (dir) {
+    closedir(dir);
+  }
+
+  if (d_options.d_chas==0) {
+    auto found = pcu.begin();
+    auto p = package.begin();
+    for (Socket& socket: d_socket) {
+      if (found!=pcu.end()) {
+        socket.d_chas = (found++)->second;
+      } else {
+        socket.d_chas = (u_int16_t)p->second.second.size();
+        fprintf(stderr, "Warning: no PCU CAPID6 for package %d; assuming %u CHAs, one per physical core\n",
+          socket.d_package, socket.d_chas);
+      }
+      ++p;
+    }
+  }
+
+  u_int16_t s = 0;
+  for (auto& b: bus) {
+    if (s>=d_socket.size()) {
+      fprintf(stderr, "Warning: IMC bus 0x%x has no socket; ignored\n", b.first);
+      continue;
+    }
+    std::sort(b.second.begin(), b.second.end());
+    for (const std::string& path: b.second) {
+      d_socket[s].d_channel.push_back(Channel{path, -1});
+    }
+    ++s;
+  }
+
+  return 0;
+}
+
+int Intel::XEON::Uncore::open(Socket *socket) {
+  assert(socket);
+
+  if (socket->d_fid==-1) {
+    char msr_file_name[PATH_MAX];
+    snprintf(msr_file_name, sizeof(msr_file_name), "%s/%d/msr", d_options.d_msrRoot.c_str(), socket->d_cpu);
+    socket->d_fid = ::open(msr_file_name, O_RDWR);
+    if (socket->d_fid<0) {
+      int rc = errno;
+      fprintf(stderr, "Error: cannot open '%s': %s\n", msr_file_name, strerror(rc));
+      return rc;
+    }
+  }
+
+  for (Channel& channel: socket->d_channel) {
+    if (channel.d_fid!=-1) {
+      continue;
+    }
+    channel.d_fid = ::open(channel.d_path.c_str(), O_RDWR);
+    if (channel.d_fid<0) {
+      int rc = errno;
+      fprintf(stderr, "Error: cannot open '%s': %s\n", channel.d_path.c_str(), strerror(rc));
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+int Intel::XEON::Uncore::boxes(u_int64_t control) {
+  int rc;
+  for (Socket& socket: d_socket) {
+    for (u_int16_t c=0; c<socket.d_chas; ++c) {
+      if ((rc = wrmsr(socket.d_fid, CHA_MSR_PMON_BOX_CTL+c*CHA_MSR_OFFSET, control))!=0) {
+        return rc;
+      }
+    }
+    for (Channel& channel: socket.d_channel) {
+      if ((rc = wrpci(channel.d_fid, IMC_PMON_BOX_CTL, (u_int32_t)control))!=0) {
+        return rc;
+      }
+    }
+  }
+  return 0;
+}
+
+int Intel::XEON::Uncore::reset() {
+  if (d_status!=0) {
+    return d_status;
+  }
+
+  // Freeze and zero every box, then program it while frozen so 'start' is the single point counting begins
+  int rc;
+  for (Socket& socket: d_socket) {
+    if ((rc = open(&socket))!=0) {
+      return rc;
+    }
+    for (u_int16_t c=0; c<socket.d_chas; ++c) {
+      const u_int32_t box = CHA_MSR_PMON_BOX_CTL+c*CHA_MSR_OFFSET;
+      if ((rc = wrmsr(socket.d_fid, box, BOX_CTL_FREEZE_ENABLE|BOX_CTL_FREEZE|BOX_CTL_RESET))!=0 ||
+          (rc = wrmsr(socket.d_fid, box+CHA_PMON_FILTER0, LLC_LOOKUP_FILTER))!=0 ||
+          (rc = wrmsr(socket.d_fid, box+CHA_PMON_CTL0, LLC_LOOKUP_ANY))!=0) {
+        return rc;
+      }
+    }
+    for (Channel& channel: socket.d_channel) {
+      if ((rc = wrpci(channel.d_fid, IMC_PMON_BOX_CTL,
+                      (u_int32_t)(BOX_CTL_FREEZE_ENABLE|BOX_CTL_FREEZE|BOX_CTL_RESET)))!=0 ||
+          (rc = wrpci(channel.d_fid, IMC_PMON_CTL0, (u_int32_t)CAS_COUNT_RD))!=0 ||
+          (rc = wrpci(channel.d_fid, IMC_PMON_CTL0+4, (u_int32_t)CAS_COUNT_WR))!=0) {
+        return rc;
+      }
+    }
+    if (d_occupancyScale && (rc = wrmsr(socket.d_fid, IA32_QM_EVTSEL, QM_L3_OCCUPANCY))!=0) {
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+int Intel::XEON::Uncore::start() {
+  return boxes(BOX_CTL_FREEZE_ENABLE);
+}
+
+int Intel::XEON::Uncore::pause() {
+  return boxes(BOX_CTL_FREEZE_ENABLE|BOX_CTL_FREEZE);
+}
+
+int Intel::XEON::Uncore::snapshot(u_int16_t index, UncoreSnapshot *snap) const {
+  assert(index<sockets());
+  assert(snap);
+
+  const Socket& socket = d_socket[index];
+  memset(snap, 0, sizeof(*snap));
+  snap->d_tsc = __rdtsc();
+
+  int rc;
+  u_int64_t value;
+  for (const Channel& channel: socket.d_channel) {
+    if ((rc = readAt(channel.d_fid, IMC_PMON_CTR0, &value, sizeof(value)))!=0) {
+      return rc;
+    }
+    snap->d_casRead += value & d_mask;
+    if ((rc = readAt(channel.d_fid, IMC_PMON_CTR0+8, &value, sizeof(value)))!=0) {
+      return rc;
+    }
+    snap->d_casWrite += value & d_mask;
+  }
+  for (u_int16_t c=0; c<socket.d_chas; ++c) {
+    if ((rc = readAt(socket.d_fid, CHA_MSR_PMON_BOX_CTL+c*CHA_MSR_OFFSET+CHA_PMON_CTR0, &value, sizeof(value)))!=0) {
+      return rc;
+    }
+    snap->d_llcLookup += value & d_mask;
+  }
+  if (d_occupancyScale) {
+    if ((rc = readAt(socket.d_fid, IA32_QM_CTR, &value, sizeof(value)))!=0) {
+      return rc;
+    }
+    snap->d_occupancy = (value & QM_CTR_ERROR) ? 0 : (value & QM_CTR_DATA)*d_occupancyScale;
+  }
+
+  // Sums of counters wrap like one counter: '(end-begin) & mask' is the total change
+  snap->d_casRead &= d_mask;
+  snap->d_casWrite &= d_mask;
+  snap->d_llcLookup &= d_mask;
+
+  return 0;
+}
+
+int Intel::XEON::Uncore::snapshot(std::vector<UncoreSnapshot> *snap) const {
+  assert(snap);
+
+  snap->resize(d_socket.size());
+  int rc;
+  for (u_int16_t s=0; s<sockets(); ++s) {
+    if ((rc = snapshot(s, &(*snap)[s]))!=0) {
+      return rc;
+    }
+  }
+  return 0;
+}
+
+std::ostream& Intel::XEON::Uncore::print(std::ostream& stream) const {
+  stream << "Intel XEON uncore PMU " << sockets() << " sockets, LLC occupancy "
+         << (occupancy() ? "monitored" : "not monitored") << ":" << std::endl;
+
+  char buf[256];
+  for (u_int16_t s=0; s<sockets(); ++s) {
+    UncoreSnapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    const bool valid = d_socket[s].d_fid!=-1 && snapshot(s, &snap)==0;
+    snprintf(buf, sizeof(buf), "socket %u package %d cpu %d: %u IMC channels, %u CHAs, CAS rd: %015lu, CAS wr: "
+      "%015lu, LLC lookups: %015lu%s\n", s, d_socket[s].d_package, d_socket[s].d_cpu, channels(s), chas(s),
+      snap.d_casRead, snap.d_casWrite, snap.d_llcLookup, valid ? "" : " (not reset)");
+    stream << buf;
+  }
+
+  return stream;
+}
+
+std::ostream& Intel::XEON::Uncore::print(std::ostream& stream, const std::vector<UncoreSnapshot>& begin,
+                                         const std::vector<UncoreSnapshot>& end) const {
+  assert(begin.size()==d_socket.size());
+  assert(end.size()==d_socket.size());
+
+  stream << "Intel XEON uncore PMU " << sockets() << " sockets:" << std::endl;
+
+  char buf[256];
+  double reads = 0, written = 0, lookups = 0, occupied = 0;
+  for (u_int16_t s=0; s<sockets(); ++s) {
+    const u_int64_t cycles = end[s].d_tsc - begin[s].d_tsc;
+    const double ns = TscClock::instance().nanoseconds((double)cycles);
+    const double r = gigabytesPerSecond((end[s].d_casRead - begin[s].d_casRead) & d_mask, cycles);
+    const double w = gigabytesPerSecond((end[s].d_casWrite - begin[s].d_casWrite) & d_mask, cycles);
+    const double l = ns>0 ? (double)((end[s].d_llcLookup - begin[s].d_llcLookup) & d_mask)/ns*1e3 : 0;
+    const double o = (double)end[s].d_occupancy/(1024*1024);
+    snprintf(buf, sizeof(buf), "socket %u: DRAM read %8.3lf GB/s, write %8.3lf GB/s, LLC lookups %10.3lf M/s, "
+      "LLC occupancy %8.2lf MiB%s\n", s, r, w, l, o, channels(s) ? "" : " (no IMC channels)");
+    stream << buf;
+    reads += r;
+    written += w;
+    lookups += l;
+    occupied += o;
+  }
+
+  snprintf(buf, sizeof(buf), "total   : DRAM read %8.3lf GB/s, write %8.3lf GB/s, LLC lookups %10.3lf M/s, "
+    "LLC occupancy %8.2lf MiB\n", reads, written, lookups, occupied);
+  stream << buf;
+
+  return stream;
+}
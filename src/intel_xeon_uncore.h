@@ -0,0 +1,269 @@
+#pragma once
+
+// PURPOSE: Count socket wide memory controller and LLC events which per core counters can't see
+//
+// CLASSES:
+//  Intel::XEON::UncoreSnapshot: One socket's uncore counter values and rdtsc at the time they were read
+//  Intel::XEON::Uncore:         Programs the uncore PMUs of every socket of a Skylake-SP class Xeon: CAS_COUNT.RD and
+//                               CAS_COUNT.WR in each integrated memory controller (IMC) channel through PCI config
+//                               space, LLC_LOOKUP.ANY in each caching/home agent (CHA) through MSRs, and reads LLC
+//                               occupancy of the default RDT monitoring ID (RMID 0, every thread unless resctrl
+//                               assigns another) through IA32_QM_EVTSEL/IA32_QM_CTR. Same 'reset'/'start'/'pause'/
+//                               'snapshot' life cycle as 'PMU'; 'print' turns two snapshots per socket into read and
+//                               write DRAM GB/s, LLC lookups per second, and LLC occupancy. Sockets, their cpus and
+//                               cores come from '<cpuRoot>/cpu<n>/topology', IMC channels from the PCI device IDs in
+//                               '<pciRoot>/<device>/config', CHAs from the PCU's CAPID6 register, and MSRs are
+//                               '<msrRoot>/<cpu>/msr', so the whole component runs against a tree of file-backed
+//                               fakes too. Writing PCI config space needs root.
+//
+// Usage:
+//   Intel::XEON::Uncore uncore;
+//   std::vector<Intel::XEON::UncoreSnapshot> begin, end;
+//   uncore.reset(); uncore.start();
+//   uncore.snapshot(&begin);
+//   ...
+//   uncore.snapshot(&end);
+//   uncore.print(std::cout, begin, end);
+
+#include <assert.h>
+
+#include <sys/types.h>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Intel {
+namespace XEON {
+
+struct UncoreSnapshot {
+  // DATA
+  u_int64_t d_tsc;                      // rdtsc before the socket's counters were read
+  u_int64_t d_casRead;                  // CAS_COUNT.RD summed over IMC channels modulo 2^48
+  u_int64_t d_casWrite;                 // CAS_COUNT.WR summed over IMC channels modulo 2^48
+  u_int64_t d_llcLookup;                // LLC_LOOKUP.ANY summed over CHAs modulo 2^48
+  u_int64_t d_occupancy;                // LLC bytes held by RMID 0 now, or 0 if not monitored
+};
+
+class Uncore {
+public:
+  // ENUM
+  enum Support {
+    k_COUNTER_WIDTH = 48,               // bit width of IMC and CHA counters
+    k_CAS_BYTES     = 64,               // bytes moved per CAS command i.e. one cache line
+  };
+
+  struct Options {
+    std::string d_msrRoot = "/dev/cpu";                 // directory holding '<cpu>/msr'
+    std::string d_pciRoot = "/sys/bus/pci/devices";     // directory holding '<device>/config'
+    std::string d_cpuRoot = "/sys/devices/system/cpu";  // directory holding 'cpu<n>/topology'
+    u_int16_t   d_chas = 0;                             // CHAs per socket; 0 reads the PCU's CAPID6 falling
+                                                        // back to one per physical core
+    u_int64_t   d_occupancyScale = 0;                   // bytes per IA32_QM_CTR unit; 0 reads CPUID leaf 0xF
+  };
+
+  // CONSTANTS
+  // IMC channel PCI config space offsets and device IDs: Skylake-SP uncore performance monitoring guide
+  static constexpr u_int32_t IMC_PMON_BOX_CTL  = 0xf4;    // 32-bit
+  static constexpr u_int32_t IMC_PMON_CTL0     = 0xd8;    // 32-bit, counter 'i' at +4*i
+  static constexpr u_int32_t IMC_PMON_CTR0     = 0xa0;    // 64-bit, counter 'i' at +8*i
+  static constexpr u_int16_t IMC_DEVICE_ID[3]  = {0x2042, 0x2046, 0x204a};
+  static constexpr u_int16_t PCI_VENDOR_INTEL  = 0x8086;
+
+  // PCU function 3 holds CAPID6 whose low bits flag each CHA present, including those of cores fused off
+  static constexpr u_int16_t PCU_CR3_DEVICE_ID = 0x2083;
+  static constexpr u_int32_t PCU_CAPID6        = 0x9c;    // 32-bit
+  static constexpr u_int32_t CAPID6_CHA_MASK   = 0xfffffff;
+
+  // CHA 'n' MSRs are at 'CHA_MSR_PMON_BOX_CTL+n*CHA_MSR_OFFSET' plus the offsets below
+  static constexpr u_int32_t CHA_MSR_PMON_BOX_CTL  = 0xe00;
+  static constexpr u_int32_t CHA_MSR_OFFSET        = 0x10;
+  static constexpr u_int32_t CHA_PMON_CTL0         = 0x1;
+  static constexpr u_int32_t CHA_PMON_FILTER0      = 0x5;
+  static constexpr u_int32_t CHA_PMON_CTR0         = 0x8;
+
+  // Box control bits shared by IMC and CHA boxes
+  static constexpr u_int64_t BOX_CTL_RESET         = 0x3;      // reset control and counter registers
+  static constexpr u_int64_t BOX_CTL_FREEZE        = 0x100;    // stop every counter of the box
+  static constexpr u_int64_t BOX_CTL_FREEZE_ENABLE = 0x10000;  // let 'BOX_CTL_FREEZE' act
+
+  // Event selects; bit 22 enables the counter
+  static constexpr u_int64_t CAS_COUNT_RD          = 0x400304;
+  static constexpr u_int64_t CAS_COUNT_WR          = 0x400c04;
+  static constexpr u_int64_t LLC_LOOKUP_ANY        = 0x401134;
+  static constexpr u_int64_t LLC_LOOKUP_FILTER     = 0x01e20000; // CHA filter 0 LLC states F, M, E, S, I
+
+  // Cache monitoring technology
+  static constexpr u_int32_t IA32_QM_EVTSEL        = 0xc8d;
+  static constexpr u_int32_t IA32_QM_CTR           = 0xc8e;
+  static constexpr u_int64_t QM_L3_OCCUPANCY       = 1;          // IA32_QM_EVTSEL event ID, RMID 0 in bits 32-41
+  static constexpr u_int64_t QM_CTR_ERROR          = (3ull<<62); // error or unavailable data
+  static constexpr u_int64_t QM_CTR_DATA           = (1ull<<62)-1;
+
+private:
+  // PRIVATE TYPES
+  struct Channel {
+    std::string d_path;                 // '<pciRoot>/<device>/config'
+    int         d_fid;                  // file handle for 'd_path' or -1 if not open
+  };
+
+  struct Socket {
+    int                  d_package;     // physical package ID
+    int                  d_cpu;         // first cpu of the package; its MSR device reaches the socket's CHAs
+    int                  d_fid;         // file handle for '<msrRoot>/<d_cpu>/msr' or -1 if not open
+    u_int16_t            d_chas;        // CHAs programmed
+    std::vector<Channel> d_channel;     // IMC channels of the socket
+  };
+
+  // DATA
+  Options             d_options;        // configuration
+  std::vector<Socket> d_socket;         // state by socket in package ID order
+  u_int64_t           d_occupancyScale; // bytes per IA32_QM_CTR unit or 0 if occupancy isn't monitored
+  u_int64_t           d_mask;           // '(1<<k_COUNTER_WIDTH)-1'
+  int                 d_status;         // 0 if construction succeeded else errno-style reason
+
+public:
+  // CLASS METHODS
+  static double gigabytesPerSecond(u_int64_t cas, u_int64_t cycles);
+    // Return the GB/s (10^9 bytes) moved by specified 'cas' commands in specified 'cycles' rdtsc cycles per
+    // 'TscClock::instance()'
+
+  // CREATORS
+  Uncore();
+    // Create an uncore PMU of every socket with default 'Options'. Otherwise as per the constructor below.
+
+  explicit Uncore(const Options& options);
+    // Create an uncore PMU of every socket found per specified 'options'. If no socket is found a diagnostic is
+    // printed on stderr and 'status()' is non-zero. Sockets without IMC channels e.g. non Skylake-SP parts still count
+    // LLC lookups. Upon return callers should run 'reset'.
+
+  Uncore(const Uncore& other) = delete;
+    // Copy constructor is not supported.
+
+  ~Uncore();
+    // Destroy this object closing all devices
+
+  // ACCESSORS
+  int status() const;
+    // Return 0 if this object was constructed as requested and an errno value otherwise
+
+  u_int16_t sockets() const;
+    // Return the number of sockets
+
+  int package(u_int16_t socket) const;
+    // Return the physical package ID of specified 'socket'. The behavior is defined if 'socket<sockets()'.
+
+  int cpu(u_int16_t socket) const;
+    // Return the cpu whose MSR device programs specified 'socket'. The behavior is defined if 'socket<sockets()'.
+
+  u_int16_t channels(u_int16_t socket) const;
+    // Return the number of IMC channels of specified 'socket'. The behavior is defined if 'socket<sockets()'.
+
+  u_int16_t chas(u_int16_t socket) const;
+    // Return the number of CHAs of specified 'socket'. The behavior is defined if 'socket<sockets()'.
+
+  bool occupancy() const;
+    // Return true if LLC occupancy is monitored
+
+  int snapshot(u_int16_t socket, UncoreSnapshot *snap) const;
+    // Return 0 if rdtsc and the counters of specified 'socket' were read into specified 'snap', and an errno value
+    // otherwise. Each IMC channel counter is one PCI config read and each CHA counter one MSR read. The behavior is
+    // defined provided 'reset()' previously ran without error and 'socket<sockets()'.
+
+  int snapshot(std::vector<UncoreSnapshot> *snap) const;
+    // Return 0 if a snapshot of every socket was read into specified 'snap' indexed by socket, and an errno value
+    // otherwise. Otherwise as per the above method.
+
+  // MANIPULATORS
+  int reset();
+    // Return 0 if every socket's devices were opened and their counters frozen, configured, and zeroed, and an errno
+    // value of the first failure otherwise. Counters don't count until 'start()'.
+
+  int start();
+    // Return 0 if every counter of every socket is counting and an errno value otherwise. Also resumes counting after
+    // 'pause()'. The behavior is defined provided 'reset()' previously ran without error.
+
+  int pause();
+    // Return 0 if every counter of every socket stopped counting keeping its value, and an errno value otherwise.
+    // The behavior is defined provided 'reset()' previously ran without error.
+
+  Uncore& operator=(const Uncore& rhs) = delete;
+    // Assignment operator not supported
+
+  // ASPECTS
+  std::ostream& print(std::ostream& stream) const;
+    // Pretty print to specified 'stream' the sockets found and their current counter values
+
+  std::ostream& print(std::ostream& stream, const std::vector<UncoreSnapshot>& begin,
+                      const std::vector<UncoreSnapshot>& end) const;
+    // Pretty print to specified 'stream' per socket DRAM read and write GB/s, LLC lookups per second, and LLC
+    // occupancy at specified 'end' between specified 'begin' and 'end' snapshots, and their totals over sockets
+
+private:
+  // PRIVATE MANIPULATORS
+  int discover();
+    // Return 0 if at least one socket was found filling 'd_socket', and an errno value otherwise. Each socket has
+    // 'd_options.d_chas' CHAs if set, else as many as its PCU's CAPID6 flags, else one per physical core with a
+    // warning on stderr.
+
+  int boxes(u_int64_t control);
+    // Return 0 if specified 'control' was written into the box control register of every IMC channel and CHA, and
+    // an errno value of the first failure otherwise
+
+  int open(Socket *socket);
+    // Return 0 if the MSR and PCI config devices of specified 'socket' are open and an errno value otherwise
+};
+
+// FREE OPERATORS
+std::ostream& operator<<(std::ostream& stream, const Uncore& object);
+  // Print into specified 'stream' human readable dump of 'object' returning 'stream'
+
+// INLINE DEFINITIONS
+// ACCESSORS
+inline
+int Uncore::status() const {
+  return d_status;
+}
+
+inline
+u_int16_t Uncore::sockets() const {
+  return (u_int16_t)d_socket.size();
+}
+
+inline
+int Uncore::package(u_int16_t socket) const {
+  assert(socket<sockets());
+  return d_socket[socket].d_package;
+}
+
+inline
+int Uncore::cpu(u_int16_t socket) const {
+  assert(socket<sockets());
+  return d_socket[socket].d_cpu;
+}
+
+inline
+u_int16_t Uncore::channels(u_int16_t socket) const {
+  assert(socket<sockets());
+  return (u_int16_t)d_socket[socket].d_channel.size();
+}
+
+inline
+u_int16_t Uncore::chas(u_int16_t socket) const {
+  assert(socket<sockets());
+  return d_socket[socket].d_chas;
+}
+
+inline
+bool Uncore::occupancy() const {
+  return d_occupancyScale!=0;
+}
+
+// FREE OPERATORS
+inline
+std::ostream& operator<<(std::ostream& stream, const Uncore& object) {
+  return object.print(stream);
+}
+
+} // namespace XEON
+} // namespace Intel
@@ -0,0 +1,165 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_tsc_clock.h>
+#include <intel_xeon_capability.h>
+#include <intel_xeon_pmu.h>
+
+#include <stdio.h>
+
+// Purpose: verify 'Intel::XEON::Capability' decodes injected CPUID leaves 0xA, 0xB and 0x80000007, and that
+// 'PMU::check', 'PMU::counterWidth' and 'PMU::configCount' size event sets from it. No PMU or MSR access is needed.
+//
+// Usage: capability_test.tsk (exits 0 on success, aborts on the first failed check)
+
+using namespace Intel;
+using namespace Intel::XEON;
+
+// Registers returned by 'fakeCpuid'
+u_int32_t fakeEax0A;
+u_int32_t fakeEbx0A;
+u_int32_t fakeEdx0A;
+u_int32_t fakeThreads;
+u_int32_t fakeEdx80000007;
+
+void fakeCpuid(u_int32_t leaf, u_int32_t, u_int32_t *eax, u_int32_t *ebx, u_int32_t *ecx, u_int32_t *edx) {
+  *eax = *ebx = *ecx = *edx = 0;
+  if (leaf==0xa) {
+    *eax = fakeEax0A;
+    *ebx = fakeEbx0A;
+    *edx = fakeEdx0A;
+  } else if (leaf==0xb && fakeThreads>0) {
+    *ebx = fakeThreads;
+    *ecx = 1u<<8;                       // SMT level
+  } else if (leaf==0x80000007) {
+    *edx = fakeEdx80000007;
+  }
+}
+
+Capability inject(u_int32_t eax, u_int32_t ebx, u_int32_t edx, u_int32_t threads) {
+  fakeEax0A = eax;
+  fakeEbx0A = ebx;
+  fakeEdx0A = edx;
+  fakeThreads = threads;
+  return Capability(&fakeCpuid);
+}
+
+const u_int64_t k_EVENT_SELECT[] = {
+  Events::LLC_REFERENCE::k_VALUE, Events::LLC_MISS::k_VALUE, Events::BRANCHES::k_VALUE,
+  Events::BRANCHES_NOT_TAKEN::k_VALUE, Events::DTLB_LOAD_WALK::k_VALUE, Events::DTLB_STORE_WALK::k_VALUE,
+  Events::LOADS::k_VALUE, Events::STORES::k_VALUE, Events::LOADS::k_VALUE,
+};
+
+void testSkylake() {
+  // Version 4, 8 x 48-bit programmable counters, 7 architectural events, 3 x 48-bit fixed counters
+  for (u_int32_t threads=1; threads<=2; ++threads) {
+    const Capability capability = inject(0x07300804, 0, 0x0603, threads);
+    assert(capability.known());
+    assert(capability.version()==4);
+    assert(capability.programmableCounters()==8);
+    assert(capability.programmableWidth()==48);
+    assert(capability.fixedCounters()==3);
+    assert(capability.fixedWidth()==48);
+    assert(capability.threadsPerCore()==threads);
+    assert(capability.hyperThreading()==(threads>1));
+    assert(capability.supports(Capability::k_LLC_MISS));
+    assert(capability.supports(Capability::k_BRANCH_MISSES));
+
+    const u_int16_t budget = threads>1 ? 4 : 8;
+    assert(capability.programmableBudget()==budget);
+    assert(PMU::configCount(PMU::k_DEFAULT_XEON_CONFIG_0, capability)==4);
+    assert(PMU::configCount(PMU::k_DEFAULT_XEON_CONFIG_1, capability)==8);
+    assert(PMU::configCount(PMU::k_AUTO_XEON_CONFIG, capability)==budget);
+    assert(PMU::configCount(PMU::k_TOPDOWN_XEON_CONFIG, capability)==4);
+    assert(PMU::configCount(PMU::k_DEFAULT_CONFIG_UNDEFINED, capability)==0);
+
+    assert(PMU::check(capability, 4, k_EVENT_SELECT)==0);
+    assert(PMU::check(capability, budget, k_EVENT_SELECT)==0);
+    assert((PMU::check(capability, 8, k_EVENT_SELECT)==0)==(threads==1));
+    assert(PMU::check(capability, 9, k_EVENT_SELECT)==EINVAL);
+
+    u_int16_t fixed = 0, programmable = 0;
+    PMU::counterWidth(capability, &fixed, &programmable);
+    assert(fixed==48);
+    assert(programmable==48);
+  }
+}
+
+void testWidths() {
+  // Version 5 Ice Lake server: 4 fixed counters, 40-bit fixed and 46-bit programmable widths differ
+  Capability capability = inject(0x082e0805, 0, 0x0504, 1);
+  assert(capability.version()==5);
+  assert(capability.fixedCounters()==4);
+  u_int16_t fixed = 0, programmable = 0;
+  PMU::counterWidth(capability, &fixed, &programmable);
+  assert(fixed==40);
+  assert(programmable==46);
+
+  // Version 1 reports no fixed counters; their width falls back to the default
+  capability = inject(0x07280201, 0, 0x0603, 1);
+  assert(capability.version()==1);
+  assert(capability.programmableCounters()==2);
+  assert(capability.fixedCounters()==0);
+  assert(capability.fixedWidth()==0);
+  PMU::counterWidth(capability, &fixed, &programmable);
+  assert(fixed==PMU::k_DEFAULT_COUNTER_WIDTH);
+  assert(programmable==40);
+  assert(capability.programmableBudget()==2);
+  assert(PMU::configCount(PMU::k_AUTO_XEON_CONFIG, capability)==2);
+  assert(PMU::check(capability, 2, k_EVENT_SELECT)==0);
+  assert(PMU::check(capability, 3, k_EVENT_SELECT)==EINVAL);
+}
+
+void testUnreported() {
+  // A VM hiding the PMU: nothing known, defaults everywhere, only the hard limit checked
+  const Capability capability = inject(0, 0, 0, 0);
+  assert(!capability.known());
+  assert(capability.programmableCounters()==0);
+  assert(capability.threadsPerCore()==1);
+  u_int16_t fixed = 0, programmable = 0;
+  PMU::counterWidth(capability, &fixed, &programmable);
+  assert(fixed==PMU::k_DEFAULT_COUNTER_WIDTH);
+  assert(programmable==PMU::k_DEFAULT_COUNTER_WIDTH);
+  assert(PMU::configCount(PMU::k_AUTO_XEON_CONFIG, capability)==8);
+  assert(PMU::check(capability, 8, k_EVENT_SELECT)==0);
+  assert(PMU::check(capability, 9, k_EVENT_SELECT)==EINVAL);
+}
+
+void testUnavailableEvent() {
+  // EBX bit 4 set: LLC misses unavailable. Config 0 counts them in programmable counter 1
+  const Capability capability = inject(0x07300804, 1u<<4, 0x0603, 1);
+  assert(!capability.supports(Capability::k_LLC_MISS));
+  assert(capability.supports(Capability::k_LLC_REFERENCE));
+  assert(PMU::check(capability, 1, k_EVENT_SELECT)==0);
+  assert(PMU::check(capability, 4, k_EVENT_SELECT)==ENOTSUP);
+
+  // Events past the EBX vector length are unavailable
+  const Capability shortVector = inject(0x04300804, 0, 0x0603, 1);
+  assert(shortVector.supports(Capability::k_LLC_REFERENCE));
+  assert(!shortVector.supports(Capability::k_LLC_MISS));
+}
+
+void testInvariantTsc() {
+  fakeEdx80000007 = 1u<<8;
+  assert(TscClock::invariant(&fakeCpuid));
+  fakeEdx80000007 = ~(1u<<8);
+  assert(!TscClock::invariant(&fakeCpuid));
+}
+
+void testHostCached() {
+  // Probed once: every call returns the same object
+  assert(&Capability::host()==&Capability::host());
+}
+
+int main() {
+  testSkylake();
+  testWidths();
+  testUnreported();
+  testUnavailableEvent();
+  testInvariantTsc();
+  testHostCached();
+
+  printf("capability_test: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_pmu_comparison.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+// Purpose: verify 'Intel::Comparison' statistics and verdicts on fixed-seed inputs: 'median' of odd, even and empty
+// inputs, 'mannWhitney' U and tie corrected p-value against a hand computed case, and 'compare' calling a clear
+// regression, a clear improvement, and same-distribution noise as such. A significant change within 'd_threshold' is
+// noise, the bootstrap interval brackets the median change and narrows as 1/sqrt(n), and the same seed gives the same
+// interval. Diagnostics of the rejected inputs are expected on stderr.
+//
+// Usage: comparison_test.tsk
+
+using namespace Intel;
+
+namespace {
+
+std::vector<u_int64_t> sample(u_int64_t seed, u_int32_t count, double mean, double deviation) {
+  // 'count' normal values of specified 'mean' and 'deviation' rounded to integers
+  std::mt19937_64 random(seed);
+  std::normal_distribution<double> normal(mean, deviation);
+  std::vector<u_int64_t> result(count);
+  for (u_int64_t& x: result) {
+    x = (u_int64_t)llround(normal(random));
+  }
+  return result;
+}
+
+void testMedian() {
+  assert(Comparison::median(std::vector<double>())==0.0);
+  assert(Comparison::median(std::vector<double>{7.0})==7.0);
+  assert(Comparison::median(std::vector<double>{1.0, 2.0, 10.0})==2.0);
+  assert(Comparison::median(std::vector<double>{1.0, 2.0, 4.0, 10.0})==3.0);
+}
+
+void testMannWhitney() {
+  // Pooled ranks 1, 3, 3, 3, 5.5, 5.5, 7, 8: the candidate's sum 23.5 less 4*5/2 gives U 13.5. Tie groups of 3 and 2
+  // make the variance 16/12*(9-30/56), and |13.5-8|-0.5 over its root is z 1.48834.
+  const std::vector<double> baseline = {1, 2, 2, 3};
+  const std::vector<double> candidate = {2, 3, 4, 5};
+  double u;
+  const double p = Comparison::mannWhitney(baseline, candidate, &u);
+  assert(u==13.5);
+  assert(fabs(p-0.13665824773814753)<1e-12);
+
+  // Swapping sides mirrors U and keeps p
+  assert(fabs(Comparison::mannWhitney(candidate, baseline, &u)-p)<1e-15);
+  assert(u==16-13.5);
+
+  // No information: p is 1
+  assert(Comparison::mannWhitney(std::vector<double>{5, 5, 5}, std::vector<double>{5, 5}, &u)==1.0 && u==3.0);
+  assert(Comparison::mannWhitney(std::vector<double>(), candidate, &u)==1.0 && u==0.0);
+}
+
+void testVerdict() {
+  const std::vector<u_int64_t> baseline = sample(1, 500, 1000, 10);
+  Comparison comparison;
+
+  assert(comparison.compare("R", "regressed", baseline, sample(2, 500, 1100, 10))==0);
+  assert(comparison.compare("I", "improved", baseline, sample(3, 500, 900, 10))==0);
+  assert(comparison.compare("N", "noise", baseline, sample(4, 500, 1000, 10))==0);
+  assert(comparison.compare("S", "small", baseline, sample(5, 500, 1010, 10))==0);
+
+  const std::vector<Comparison::Result>& result = comparison.results();
+  assert(result.size()==4);
+  assert(comparison.regressions()==1 && comparison.improvements()==1);
+
+  assert(result[0].d_verdict==Comparison::k_REGRESSED);
+  assert(result[0].d_p<1e-12 && result[0].d_low>0 && result[0].d_probability>0.99);
+  assert(fabs(result[0].d_delta-0.1)<0.005);
+
+  assert(result[1].d_verdict==Comparison::k_IMPROVED);
+  assert(result[1].d_p<1e-12 && result[1].d_high<0 && result[1].d_probability<0.01);
+
+  assert(result[2].d_verdict==Comparison::k_NOISE);
+  assert(result[2].d_p>0.05 && result[2].d_low<=0 && result[2].d_high>=0);
+
+  // A 1% shift is significant and outside the interval yet within the 2% threshold
+  assert(result[3].d_verdict==Comparison::k_NOISE);
+  assert(result[3].d_p<1e-6 && result[3].d_low>0);
+  Comparison::Options options;
+  options.d_threshold = 0.005;
+  Comparison strict(options);
+  assert(strict.compare("S", "small", baseline, sample(5, 500, 1010, 10))==0);
+  assert(strict.results()[0].d_verdict==Comparison::k_REGRESSED);
+
+  comparison.reset();
+  assert(comparison.results().empty() && comparison.regressions()==0 && comparison.improvements()==0);
+
+  // Too few values or invalid options
+  assert(comparison.compare("X", "short", baseline, std::vector<u_int64_t>{1000})==EINVAL);
+  options.d_alpha = 1.0;
+  Comparison invalid(options);
+  assert(invalid.compare("X", "alpha", baseline, baseline)==EINVAL);
+  assert(comparison.results().empty() && invalid.results().empty());
+}
+
+void testBootstrap() {
+  // The interval brackets the median change and narrows about 10x for 100x the values
+  Comparison small, large, again;
+  assert(small.compare("F1", "cycles", sample(6, 100, 1000, 50), sample(7, 100, 1050, 50))==0);
+  assert(large.compare("F1", "cycles", sample(6, 10000, 1000, 50), sample(7, 10000, 1050, 50))==0);
+  assert(again.compare("F1", "cycles", sample(6, 100, 1000, 50), sample(7, 100, 1050, 50))==0);
+
+  const Comparison::Result& s = small.results()[0];
+  const Comparison::Result& l = large.results()[0];
+  assert(s.d_low<=s.d_delta && s.d_delta<=s.d_high);
+  assert(l.d_low<=l.d_delta && l.d_delta<=l.d_high);
+  assert(l.d_low<0.05 && l.d_high>0.05);
+  const double ratio = (s.d_high-s.d_low)/(l.d_high-l.d_low);
+  assert(ratio>5 && ratio<20);
+
+  // Seeded: the same inputs give the same interval
+  assert(again.results()[0].d_low==s.d_low && again.results()[0].d_high==s.d_high);
+}
+
+} // namespace
+
+int main() {
+  testMedian();
+  testMannWhitney();
+  testVerdict();
+  testBootstrap();
+
+  printf("comparison_test: all checks passed\n");
+  return 0;
+}
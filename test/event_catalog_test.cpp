@@ -0,0 +1,85 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_xeon_event_catalog.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Purpose: verify 'Intel::XEON::EventCatalog' keeps perfmon's "Counter" restrictions and 'place' puts every event on
+// a counter its mask allows: unrestricted events stay in order, restricted ones move others out of the way, and
+// impossible sets are rejected. A two event perfmon JSON file is compiled into a catalog under /tmp.
+//
+// Usage: event_catalog_test.tsk
+
+using namespace Intel::XEON;
+
+namespace {
+
+void testPlace() {
+  u_int16_t counter[8];
+
+  // Unrestricted events keep their order
+  const u_int32_t any[4] = {0, 0, 0, 0};
+  assert(EventCatalog::place(4, any, counter)==0);
+  for (u_int16_t i=0; i<4; ++i) {
+    assert(counter[i]==i);
+  }
+
+  // The first event only counts on counter 2, so the third moves
+  const u_int32_t two[4] = {0x4, 0, 0, 0};
+  assert(EventCatalog::place(4, two, counter)==0);
+  assert(counter[0]==2 && counter[1]==1 && counter[3]==3);
+  assert(counter[2]==0);
+
+  // A chain: event 0 on 0-1, event 1 only on 0, event 2 on 1-2
+  const u_int32_t chain[3] = {0x3, 0x1, 0x6};
+  assert(EventCatalog::place(3, chain, counter)==0);
+  assert(counter[1]==0 && counter[0]==1 && counter[2]==2);
+
+  // Five events restricted to counters 0-3, or one restricted beyond the counters in use
+  const u_int32_t low[5] = {0xf, 0xf, 0xf, 0xf, 0xf};
+  assert(EventCatalog::place(5, low, counter)==EINVAL);
+  const u_int32_t high[2] = {0, 0x4};
+  assert(EventCatalog::place(2, high, counter)==EINVAL);
+}
+
+void testCompile() {
+  char dir[] = "/tmp/pmc-catalog-test.XXXXXX";
+  assert(mkdtemp(dir));
+  const std::string json = std::string(dir) + "/events.json";
+  const std::string catalog = std::string(dir) + "/events.cat";
+
+  FILE *file = fopen(json.c_str(), "w");
+  assert(file);
+  fprintf(file, "{\"Header\": {}, \"Events\": ["
+    "{\"EventName\": \"ONLY.TWO\", \"EventCode\": \"0x48\", \"UMask\": \"0x01\", \"Counter\": \"2\", "
+    "\"BriefDescription\": \"restricted\"},"
+    "{\"EventName\": \"LOW.FOUR\", \"EventCode\": \"0xA3\", \"UMask\": \"0x14\", \"Counter\": \"0,1,2,3\", "
+    "\"BriefDescription\": \"low counters\"}]}\n");
+  fclose(file);
+
+  assert(EventCatalog::compile(std::vector<std::string>{json}, catalog)==0);
+  EventCatalog events;
+  assert(events.open(catalog)==0);
+  assert(events.find("ONLY.TWO")->d_counters==0x4);
+  assert(events.find("LOW.FOUR")->d_counters==0xf);
+
+  events.close();
+  unlink(json.c_str());
+  unlink(catalog.c_str());
+  rmdir(dir);
+}
+
+} // namespace
+
+int main() {
+  testPlace();
+  testCompile();
+
+  printf("event_catalog_test: all checks passed\n");
+  return 0;
+}
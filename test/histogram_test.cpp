@@ -0,0 +1,104 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_pmu_histogram.h>
+
+#include <stdio.h>
+
+// Purpose: verify 'Intel::Histogram' buckets: values below 2*k_SUB_BUCKETS get their own bucket, every power of 2
+// above starts a new bucket adjacent to the last one of the power below, and the buckets cover [0, 2^64). Percentiles
+// stay within a bucket of the truth and are clamped to the recorded minimum and maximum, and merging two histograms
+// gives the histogram of all their values.
+//
+// Usage: histogram_test.tsk
+
+using namespace Intel;
+
+namespace {
+
+void testBuckets() {
+  for (u_int64_t value=0; value<2*Histogram::k_SUB_BUCKETS; ++value) {
+    assert(Histogram::bucket(value)==value);
+    assert(Histogram::lowerBound((u_int32_t)value)==value && Histogram::upperBound((u_int32_t)value)==value);
+  }
+
+  for (u_int32_t power=1; power<64; ++power) {
+    const u_int64_t value = 1ull<<power;
+    const u_int32_t index = Histogram::bucket(value);
+    assert(Histogram::bucket(value-1)+1==index);
+    assert(Histogram::upperBound(index-1)==value-1);
+    if (value>=2*Histogram::k_SUB_BUCKETS) {
+      // A power of 2 starts its first sub-bucket, which is 'value/k_SUB_BUCKETS' wide
+      assert(Histogram::lowerBound(index)==value);
+      assert(Histogram::upperBound(index)==value+value/Histogram::k_SUB_BUCKETS-1);
+      assert(Histogram::bucket(value+value/Histogram::k_SUB_BUCKETS)==index+1);
+    }
+  }
+
+  assert(Histogram::bucket(~0ull)==Histogram::k_BUCKETS-1);
+  assert(Histogram::upperBound(Histogram::k_BUCKETS-1)==~0ull);
+}
+
+void testPercentile() {
+  Histogram histogram;
+  assert(histogram.percentile(50)==0 && histogram.min()==0 && histogram.max()==0);
+
+  // Bucket [992, 1007] has midpoint 999: below the minimum here, above the maximum below
+  histogram.record(1000);
+  histogram.record(1005);
+  assert(histogram.percentile(0)==1000 && histogram.percentile(100)==1000);
+  histogram.reset();
+  histogram.record(992);
+  histogram.record(995);
+  assert(histogram.percentile(0)==995 && histogram.percentile(100)==995);
+
+  // Within a bucket, about 3%, of the exact percentile
+  histogram.reset();
+  for (u_int64_t value=1; value<=10000; ++value) {
+    histogram.record(value);
+  }
+  assert(histogram.count()==10000 && histogram.min()==1 && histogram.max()==10000);
+  assert(histogram.percentile(0)==1 && histogram.percentile(100)==10000);
+  const double percents[] = {50.0, 90.0, 99.0, 99.9};
+  for (double percent: percents) {
+    const double exact = percent*100.0;
+    const double value = (double)histogram.percentile(percent);
+    assert(value>=exact*(1-1.0/Histogram::k_SUB_BUCKETS) && value<=exact*(1+1.0/Histogram::k_SUB_BUCKETS));
+  }
+}
+
+void testMerge() {
+  Histogram whole, low, high, empty;
+  for (u_int64_t value=3; value<5000; value+=7) {
+    whole.record(value);
+    (value<1000 ? low : high).record(value);
+  }
+  high.merge(empty);
+  low.merge(high);
+
+  assert(low.count()==whole.count() && low.total()==whole.total());
+  assert(low.min()==3 && low.max()==whole.max());
+  for (u_int32_t i=0; i<Histogram::k_BUCKETS; ++i) {
+    assert(low.bucketCount(i)==whole.bucketCount(i));
+  }
+  const double percents[] = {0.0, 25.0, 50.0, 99.0, 100.0};
+  for (double percent: percents) {
+    assert(low.percentile(percent)==whole.percentile(percent));
+  }
+
+  // Merging into an empty histogram copies the other
+  empty.merge(whole);
+  assert(empty.min()==whole.min() && empty.max()==whole.max() && empty.percentile(50)==whole.percentile(50));
+}
+
+} // namespace
+
+int main() {
+  testBuckets();
+  testPercentile();
+  testMerge();
+
+  printf("histogram_test: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,140 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_pmu_metric.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// Purpose: verify 'Intel::Metric' compiles expressions with the usual precedence, parentheses and unary minus,
+// follows IEEE division by zero, rejects unknown mnemonics, syntax errors and programs deeper than 'k_MAX_STACK', and
+// that the batch evaluator gives bit for bit the scalar result across several 'k_BATCH' blocks. Diagnostics of the
+// rejected expressions are expected on stderr.
+//
+// Usage: metric_test.tsk
+
+using namespace Intel;
+
+namespace {
+
+double evaluate(const char *expression, const u_int64_t *value) {
+  Metric metric;
+  assert(metric.compile("test", expression)==0);
+  assert(metric.compiled());
+  return metric.evaluate(value);
+}
+
+void testPrecedence() {
+  // R0=1, A0=2, F0=3, F1=4, F2=5, P0=6, ..., P7=13
+  u_int64_t value[Metric::k_VARIABLES];
+  for (u_int32_t i=0; i<Metric::k_VARIABLES; ++i) {
+    value[i] = i+1;
+  }
+
+  assert(evaluate("F0+F1*F2", value)==23.0);
+  assert(evaluate("(F0+F1)*F2", value)==35.0);
+  assert(evaluate("P7-P0-F0", value)==4.0);
+  assert(evaluate("P7-(P0-F0)", value)==10.0);
+  assert(evaluate("P7/F0/A0", value)==13.0/3.0/2.0);
+  assert(evaluate("-F0*-F1", value)==12.0);
+  assert(evaluate("1-(P0+P1)/(4*F1)", value)==1.0-13.0/16.0);
+  assert(evaluate(" 1000 * P1 / F0 ", value)==1000.0*7.0/3.0);
+  assert(evaluate("2.5e1+.5", value)==25.5);
+
+  Metric metric;
+  assert(metric.compile("taken", "(P2-P3)/P2")==0);
+  assert(metric.uses(Metric::variable("P2")) && metric.uses(Metric::variable("P3")));
+  assert(!metric.uses(Metric::variable("F0")));
+  assert(metric.defined(0, 4) && !metric.defined(3, 3));
+  assert(metric.size()==5);
+}
+
+void testDivision() {
+  u_int64_t value[Metric::k_VARIABLES];
+  memset(value, 0, sizeof(value));
+  value[Metric::variable("F0")] = 7;
+
+  assert(isinf(evaluate("F0/F1", value)) && evaluate("F0/F1", value)>0);
+  assert(isinf(evaluate("-F0/F1", value)) && evaluate("-F0/F1", value)<0);
+  assert(isnan(evaluate("F1/F2", value)));
+  assert(evaluate("F0/(F1+1)", value)==7.0);
+}
+
+void testRejected() {
+  Metric metric;
+  assert(metric.compile("ok", "F0/F1")==0);
+
+  // Every failure leaves the metric uncompiled
+  const char *const invalid[] = {"X0/F1", "P8", "F0+", "(F0", "F0)", "F0 F1", "", "F0#F1"};
+  for (const char *expression: invalid) {
+    assert(metric.compile("bad", expression)==EINVAL);
+    assert(!metric.compiled());
+  }
+
+  // Right nesting keeps every operand on the stack: 8 fit, 9 don't
+  std::string deep = "F0";
+  for (u_int32_t i=1; i<Metric::k_MAX_STACK; ++i) {
+    deep = "F0+(" + deep + ")";
+  }
+  assert(metric.compile("deep", deep)==0);
+  deep = "F0+(" + deep + ")";
+  assert(metric.compile("deeper", deep)==E2BIG);
+  assert(!metric.compiled());
+
+  // Left nesting of as many operands needs two slots
+  std::string flat = "F0";
+  for (u_int32_t i=0; i<Metric::k_MAX_STACK; ++i) {
+    flat += "+F0";
+  }
+  assert(metric.compile("flat", flat)==0);
+}
+
+void testBatch() {
+  // Not a multiple of the block size so the last block is partial
+  const u_int32_t count = 3*Metric::k_BATCH + 17;
+  std::vector<u_int64_t> column[Metric::k_VARIABLES];
+  const u_int64_t *pointer[Metric::k_VARIABLES];
+  u_int32_t seed = 7;
+  for (u_int32_t v=0; v<Metric::k_VARIABLES; ++v) {
+    column[v].resize(count);
+    for (u_int32_t i=0; i<count; ++i) {
+      seed = seed*1103515245u + 12345u;
+      column[v][i] = i%97==0 ? 0 : (seed>>8);
+    }
+    pointer[v] = column[v].data();
+  }
+
+  const char *const expressions[] = {"F0/F1", "1000*P1/F0", "1-(P0+P1+4*P3)/(4*F1)", "-(R0-A0)*(F2/P7)", "42"};
+  std::vector<double> batch(count);
+  for (const char *expression: expressions) {
+    Metric metric;
+    assert(metric.compile("batch", expression)==0);
+    metric.evaluate(pointer, count, batch.data());
+    for (u_int32_t i=0; i<count; ++i) {
+      u_int64_t value[Metric::k_VARIABLES];
+      for (u_int32_t v=0; v<Metric::k_VARIABLES; ++v) {
+        value[v] = column[v][i];
+      }
+      const double scalar = metric.evaluate(value);
+      assert((isnan(scalar) && isnan(batch[i])) || memcmp(&scalar, &batch[i], sizeof(scalar))==0);
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  testPrecedence();
+  testDivision();
+  testRejected();
+  testBatch();
+
+  printf("metric_test: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_pmu_runner.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/perf_event.h>
+
+// Purpose: verify 'Intel::Runner' warmup and outlier rules: 'changepoint' splits a step series at the step and finds
+// none in flat noise, 'medianMad' gives the median and MAD of odd and even counts, and a run fed through 'add' drops
+// the warmup before a step and rejects a planted outlier by its modified z-score. The run needs a software perf event
+// for the PMU whose programmable counter it judges; that part is skipped if the kernel refuses one.
+//
+// Usage: runner_test.tsk
+
+using namespace Intel;
+
+namespace {
+
+u_int64_t noise(u_int32_t *seed, u_int64_t spread) {
+  // Deterministic LCG in [0, spread)
+  *seed = *seed*1103515245u + 12345u;
+  return (*seed>>16) % spread;
+}
+
+void testChangepoint() {
+  u_int64_t value[64];
+  u_int32_t seed = 1;
+
+  // 20 warmup iterations 50% slower than the rest
+  for (u_int32_t i=0; i<64; ++i) {
+    value[i] = (i<20 ? 1500 : 1000) + noise(&seed, 50);
+  }
+  assert(Runner::changepoint(value, 64, 5.0)==20);
+
+  // The same noise without the step
+  for (u_int32_t i=0; i<64; ++i) {
+    value[i] = 1000 + noise(&seed, 50);
+  }
+  assert(Runner::changepoint(value, 64, 5.0)==0);
+
+  // Constant and too short series
+  for (u_int32_t i=0; i<64; ++i) {
+    value[i] = 1000;
+  }
+  assert(Runner::changepoint(value, 64, 5.0)==0);
+  value[0] = value[1] = 2000;
+  assert(Runner::changepoint(value, 3, 5.0)==0);
+  assert(Runner::changepoint(value, 64, 5.0)==2);
+}
+
+void testMedianMad() {
+  double median, mad;
+
+  // Deviations 2, 1, 0, 1, 97: the outlier moves neither
+  const u_int64_t odd[5] = {4, 100, 1, 3, 2};
+  Runner::medianMad(odd, 5, &median, &mad);
+  assert(median==3.0 && mad==1.0);
+  assert(0.6745*(100.0-median)/mad>Runner::Options().d_outlierZ);
+  assert(0.6745*(median-1.0)/mad<=Runner::Options().d_outlierZ);
+
+  // Even counts average the middle two: deviations 1.5, 0.5, 0.5, 1.5
+  const u_int64_t even[4] = {4, 1, 3, 2};
+  Runner::medianMad(even, 4, &median, &mad);
+  assert(median==2.5 && mad==1.0);
+}
+
+void testRun(const XEON::PMU& pmu) {
+  Runner::Options options;
+  options.d_counter = Runner::k_P0;
+  options.d_warmupWindow = 16;
+  options.d_minIterations = 30;
+  options.d_maxIterations = 1000;
+  Runner runner(pmu, options);
+  assert(runner.start()==0);
+
+  // 10 slow warmup iterations, then steady ones with one planted 5x outlier
+  XEON::Snapshot begin, end;
+  memset(&begin, 0, sizeof(begin));
+  u_int32_t seed = 1;
+  u_int32_t iterations = 0;
+  bool more = true;
+  while (more) {
+    const u_int64_t value = iterations<10 ? 3000 : (iterations==20 ? 5000 : 1000 + noise(&seed, 3));
+    end = begin;
+    end.d_tsc += value;
+    end.d_prog[0] += value;
+    more = runner.add(begin, end);
+    begin = end;
+    ++iterations;
+  }
+
+  const Runner::Result& result = runner.result();
+  assert(result.d_converged);
+  assert(result.d_iterations==iterations);
+  assert(result.d_warmup==10);
+  assert(result.d_outliers==1);
+  assert(result.d_counter[Runner::k_P0].count()==iterations-11);
+  assert(result.d_counter[Runner::k_P0].mean()>=1000.0 && result.d_counter[Runner::k_P0].mean()<1003.0);
+  assert(runner.stats().iterations()==iterations-11);
+}
+
+} // namespace
+
+int main() {
+  testChangepoint();
+  testMedianMad();
+
+  XEON::PMU pmu(std::vector<XEON::PerfEvent>{
+    XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock")}, false);
+  if (pmu.status()!=0 || pmu.reset()!=0 || pmu.start()!=0) {
+    printf("runner_test: skipped, no software perf event\n");
+    return 77;
+  }
+  testRun(pmu);
+
+  printf("runner_test: all checks passed\n");
+  return 0;
+}
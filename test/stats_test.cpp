@@ -0,0 +1,146 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_pmu_stats.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include <linux/perf_event.h>
+
+// Purpose: verify 'Intel::Stats' judges frequency stability on windows of at least 'k_FREQUENCY_WINDOW_US' of MPERF
+// rather than single deltas: per delta jitter around a steady clock is stable, a clock step is not, and merging two
+// halves gives the windows of the whole. APERF/MPERF are written into hand made snapshots. Stats of a PMU with a
+// 'Frequency' attached don't merge with those of one without; the 'Frequency' reads a file-backed fake MSR device.
+// Needs a software perf event for the PMU 'Stats' is built on; exits 77 (skipped) if the kernel refuses one.
+//
+// Usage: stats_test.tsk
+
+using namespace Intel;
+
+namespace {
+
+void run(Stats *stats, XEON::Snapshot *snap, u_int32_t deltas, u_int64_t mperf, double ratio, double jitter) {
+  // Record 'deltas' deltas of 'mperf' MPERF each at APERF/MPERF 'ratio', alternately 'jitter' above and below it
+  for (u_int32_t i=0; i<deltas; ++i) {
+    XEON::Snapshot next = *snap;
+    next.d_tsc += mperf;
+    next.d_mperf += mperf;
+    next.d_aperf += (u_int64_t)((double)mperf*ratio*(i%2 ? 1-jitter : 1+jitter));
+    stats->record(*snap, next);
+    *snap = next;
+  }
+}
+
+void testJitter(const XEON::PMU& pmu, u_int64_t window) {
+  // Per delta GHz spread is 40% yet every window averages to the same clock
+  Stats stats(pmu);
+  XEON::Snapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  run(&stats, &snap, 20000, window/1000, 1.5, 0.2);
+  assert(stats.frequencyWindows()==20);
+  assert(stats.deviationGhz()<=0.001*stats.effectiveGhz());
+  assert(stats.frequencyStable());
+}
+
+void testStep(const XEON::PMU& pmu, u_int64_t window) {
+  // Half the run at 1.5 then half at 1.2 times the TSC frequency
+  Stats stats(pmu);
+  XEON::Snapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  run(&stats, &snap, 10000, window/1000, 1.5, 0.0);
+  run(&stats, &snap, 10000, window/1000, 1.2, 0.0);
+  assert(stats.frequencyWindows()==20);
+  assert(stats.maxGhz()>stats.minGhz()*1.2);
+  assert(!stats.frequencyStable());
+
+  // A short run closing no window is judged on throttling only
+  Stats brief(pmu);
+  memset(&snap, 0, sizeof(snap));
+  run(&brief, &snap, 10, window/1000, 1.5, 0.0);
+  run(&brief, &snap, 10, window/1000, 1.2, 0.0);
+  assert(brief.frequencyWindows()==0);
+  assert(brief.deviationGhz()==0 && brief.minGhz()==brief.effectiveGhz());
+  assert(brief.frequencyStable());
+}
+
+void testMerge(const XEON::PMU& pmu, u_int64_t window) {
+  Stats whole(pmu), first(pmu), second(pmu);
+  XEON::Snapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  run(&whole, &snap, 6000, window/1000, 1.5, 0.0);
+  run(&whole, &snap, 10000, window/1000, 1.2, 0.0);
+  memset(&snap, 0, sizeof(snap));
+  run(&first, &snap, 6000, window/1000, 1.5, 0.0);
+  run(&second, &snap, 10000, window/1000, 1.2, 0.0);
+
+  assert(first.merge(second)==0);
+  assert(first.frequencyWindows()==whole.frequencyWindows());
+  assert(fabs(first.deviationGhz()-whole.deviationGhz())<1e-9);
+  assert(first.minGhz()==whole.minGhz() && first.maxGhz()==whole.maxGhz());
+  assert(!first.frequencyStable());
+}
+
+void testMergeMismatch(const XEON::PMU& pmu) {
+  // A zeroed fake '<root>/0/msr' reads fine
+  char root[] = "/tmp/pmc-stats-test.XXXXXX";
+  assert(mkdtemp(root));
+  const std::string cpu = std::string(root) + "/0";
+  const std::string msr = cpu + "/msr";
+  assert(mkdir(cpu.c_str(), 0755)==0);
+  const int fid = open(msr.c_str(), O_CREAT|O_RDWR, 0644);
+  assert(fid>=0 && ftruncate(fid, 4096)==0);
+  close(fid);
+
+  XEON::Frequency::Options options;
+  options.d_msrRoot = root;
+  options.d_cpu = 0;
+  XEON::Frequency frequency(options);
+  assert(frequency.status()==0);
+
+  XEON::PMU other(std::vector<XEON::PerfEvent>{
+    XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock")}, false);
+  assert(other.status()==0);
+  other.setFrequency(&frequency);
+
+  Stats plain(pmu), measured(other);
+  assert(plain.merge(measured)==EINVAL);
+  assert(measured.merge(plain)==EINVAL);
+  other.setFrequency(0);
+  assert(plain.merge(measured)==0);
+
+  unlink(msr.c_str());
+  rmdir(cpu.c_str());
+  rmdir(root);
+}
+
+} // namespace
+
+int main() {
+  XEON::PMU pmu(std::vector<XEON::PerfEvent>{
+    XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock")}, false);
+  if (pmu.status()!=0 || pmu.reset()!=0 || pmu.start()!=0) {
+    printf("stats_test: skipped, no software perf event\n");
+    return 77;
+  }
+
+  // MPERF of one window; the runs above take a thousandth of it per delta
+  const u_int64_t window = TscClock::instance().hz()/1000000*Stats::k_FREQUENCY_WINDOW_US;
+
+  testJitter(pmu, window);
+  testStep(pmu, window);
+  testMerge(pmu, window);
+  testMergeMismatch(pmu);
+
+  printf("stats_test: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Checks must run in the project's NDEBUG build
+#undef NDEBUG
+#include <assert.h>
+
+#include <intel_pmu_trace.h>
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <linux/perf_event.h>
+
+// Purpose: verify 'Intel::TraceWriter' fails stickily without writing past its block once the file can't grow, that
+// the blocks written before stay readable, that the header records each counter's event, and that 'TraceReader' and
+// 'TraceWriter' reject out of range block sizes.
+// File growth is made to fail with RLIMIT_FSIZE. Needs a software perf event for the writer's PMU; exits 77 (skipped)
+// if the kernel refuses one.
+//
+// Usage: trace_test.tsk
+
+using namespace Intel;
+
+void testBlockSamples(const XEON::PMU& pmu, const char *path) {
+  TraceWriter writer;
+  assert(writer.open(path, pmu, 0)==EINVAL);
+  assert(writer.open(path, pmu, TraceHeader::k_MAX_BLOCK_SAMPLES+1)==EINVAL);
+  assert(!writer.isOpen());
+
+  XEON::Snapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  assert(writer.open(path, pmu, 4)==0);
+  for (u_int32_t i=0; i<10; ++i) {
+    snap.d_tsc = i;
+    assert(writer.append(snap)==0);
+  }
+  assert(writer.close()==0);
+
+  TraceReader reader;
+  assert(reader.open(path)==0);
+  assert(memcmp(reader.header().d_magic, TraceHeader::k_MAGIC, sizeof(TraceHeader::k_MAGIC))==0);
+  assert(reader.header().d_version==TraceHeader::k_VERSION);
+  assert(reader.header().counts(0, XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "")));
+  assert(!reader.header().counts(0, XEON::PerfEvent::software(PERF_COUNT_SW_PAGE_FAULTS, "")));
+  assert(!reader.header().counts(0, XEON::PerfEvent::raw(XEON::Events::LLC_MISS::k_VALUE, "")));
+  assert(!reader.header().counts(1, XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "")));
+  u_int32_t count = 0;
+  while (reader.next(&snap)) {
+    assert(snap.d_tsc==count);
+    ++count;
+  }
+  assert(count==10);
+  reader.close();
+
+  // Only the one format version is read
+  const u_int32_t version[2] = {TraceHeader::k_VERSION+1, TraceHeader::k_VERSION};
+  FILE *file = fopen(path, "r+");
+  assert(file);
+  assert(fseek(file, offsetof(TraceHeader, d_version), SEEK_SET)==0);
+  assert(fwrite(version, sizeof(version[0]), 1, file)==1);
+  fclose(file);
+  assert(reader.open(path)==EINVAL);
+
+  // A header claiming huge blocks must be rejected before the reader sizes its block buffer
+  const u_int32_t huge = 0xffffffff;
+  file = fopen(path, "r+");
+  assert(file);
+  assert(fseek(file, offsetof(TraceHeader, d_version), SEEK_SET)==0);
+  assert(fwrite(version+1, sizeof(version[1]), 1, file)==1);
+  assert(fseek(file, offsetof(TraceHeader, d_blockSamples), SEEK_SET)==0);
+  assert(fwrite(&huge, sizeof(huge), 1, file)==1);
+  fclose(file);
+  assert(reader.open(path)==EINVAL);
+}
+
+void testStickyError(const XEON::PMU& pmu, const char *path) {
+  TraceWriter writer;
+  assert(writer.open(path, pmu, 1024)==0);
+
+  // The first window is allocated: forbid growing past it
+  struct rlimit saved, limit;
+  assert(getrlimit(RLIMIT_FSIZE, &saved)==0);
+  limit = saved;
+  limit.rlim_cur = TraceWriter::k_WINDOW_SIZE;
+  assert(setrlimit(RLIMIT_FSIZE, &limit)==0);
+
+  // Random values take the longest varints so the window fills quickly
+  XEON::Snapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  srandom(1);
+  int rc = 0;
+  u_int64_t appended = 0;
+  while (rc==0 && appended<(1u<<24)) {
+    snap.d_tsc = ((u_int64_t)random()<<33) ^ (u_int64_t)random();
+    snap.d_paused = ((u_int64_t)random()<<33) ^ (u_int64_t)random();
+    snap.d_prog[0] = ((u_int64_t)random()<<33) ^ (u_int64_t)random();
+    if ((rc = writer.append(snap))==0) {
+      ++appended;
+    }
+  }
+  assert(rc!=0);
+  assert(writer.status()==rc);
+
+  // Full block never flushed: later appends return the same error without writing past the columns
+  const u_int64_t samples = writer.samples();
+  const u_int64_t bytes = writer.bytes();
+  assert(samples%1024==0);
+  for (u_int32_t i=0; i<100000; ++i) {
+    assert(writer.append(snap)==rc);
+  }
+  assert(writer.samples()==samples);
+  assert(writer.flush()==rc);
+  assert(writer.close()==rc);
+  assert(setrlimit(RLIMIT_FSIZE, &saved)==0);
+
+  // Blocks written before the failure read back as a trace whose writer didn't close
+  TraceReader reader;
+  assert(reader.open(path)==0);
+  assert(!reader.complete());
+  u_int64_t count = 0;
+  while (reader.next(&snap)) {
+    ++count;
+  }
+  assert(reader.status()==0);
+  assert(count==samples-1024);
+  assert(bytes>TraceHeader::k_HEADER_SIZE);
+}
+
+int main() {
+  // Growing past RLIMIT_FSIZE raises SIGXFSZ; ignored the write fails with EFBIG instead
+  signal(SIGXFSZ, SIG_IGN);
+
+  XEON::PMU pmu(std::vector<XEON::PerfEvent>{
+    XEON::PerfEvent::software(PERF_COUNT_SW_TASK_CLOCK, "task clock")}, false);
+  if (pmu.status()!=0) {
+    printf("trace_test: skipped, no software perf event\n");
+    return 77;
+  }
+
+  char path[] = "/tmp/pmc-trace-test.XXXXXX";
+  const int fid = mkstemp(path);
+  assert(fid>=0);
+  close(fid);
+
+  testBlockSamples(pmu, path);
+  testStickyError(pmu, path);
+
+  unlink(path);
+  printf("trace_test: all checks passed\n");
+  return 0;
+}